@@ -0,0 +1,30 @@
+#------------------------------------------------------------------------------
+# Finds EGL, which the programs use to render without a window. EGL is
+# optional; OS X does not have it.
+#
+# Variables set:
+#
+# EGL_FOUND             True if EGL has been found
+# EGL_LIBRARIES         Libraries that need to be linked into the executable
+# EGL_INCLUDE_DIR       Path to the EGL include files
+#------------------------------------------------------------------------------
+cmake_minimum_required(VERSION 2.8)
+
+# Find EGL header
+find_path(EGL_INCLUDE_DIR EGL/egl.h
+  /usr/local/include
+  /usr/include
+)
+
+# Find EGL library
+find_library(EGL_LIBRARIES EGL
+  /usr/local/lib
+  /usr/lib
+)
+
+if(EGL_INCLUDE_DIR AND EGL_LIBRARIES)
+  set(EGL_FOUND 1)
+else()
+  set(EGL_FOUND 0)
+  set(EGL_LIBRARIES "")
+endif()
@@ -0,0 +1,105 @@
+//--------------------------------------------------------------------------------
+// aligned_array.h
+//
+// Fixed size array of plain values aligned to a cache line, so that SIMD loads
+// never straddle two lines and every plane of a structure-of-arrays starts on
+// a fresh one.
+//--------------------------------------------------------------------------------
+#ifndef _aligned_array_h
+#define _aligned_array_h
+
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+namespace Compute
+{
+   /**
+    * Heap array of T aligned to 64 bytes. T must be a plain value type: the
+    * contents are not constructed or destroyed, and resize() zero fills.
+    *
+    * How to use this class:
+    * \code
+    * Compute::AlignedArray<float> x(n);
+    * for(size_t i = 0; i < n; i += Compute::floatv::width)
+    * {
+    *    ...
+    * }
+    * \endcode
+    */
+   template<typename T>
+   class AlignedArray
+   {
+   public:
+      static const size_t alignment = 64;
+
+      /**
+       * Constructor
+       *
+       * @param size
+       *    Number of elements
+       */
+      explicit AlignedArray(size_t size = 0)
+      :  _data  (NULL)
+      ,  _size  (0)
+      {
+         resize(size);
+      }
+
+      /**
+       * Destructor
+       */
+      ~AlignedArray()
+      {
+         free(_data);
+      }
+
+      /**
+       * Reallocate the array. The previous contents are discarded and the
+       * new elements are zero
+       *
+       * @param size
+       *    Number of elements
+       */
+      void resize(size_t size)
+      {
+         free(_data);
+         _data = NULL;
+         _size = 0;
+
+         if(size == 0)
+         {
+            return;
+         }
+
+         // posix_memalign is available on every platform this code builds
+         // for, including iOS, unlike C++17 aligned new
+         void* ptr = NULL;
+         if(posix_memalign(&ptr, alignment, sizeof(T) * size) != 0)
+         {
+            throw std::bad_alloc();
+         }
+         memset(ptr, 0, sizeof(T) * size);
+
+         _data = static_cast<T*>(ptr);
+         _size = size;
+      }
+
+      size_t   size() const                   { return _size; }
+      T*       data()                         { return _data; }
+      const T* data() const                   { return _data; }
+      T&       operator[](size_t i)           { return _data[i]; }
+      const T& operator[](size_t i) const     { return _data[i]; }
+
+   private:
+      // Not copyable
+      AlignedArray(const AlignedArray&);
+      AlignedArray& operator=(const AlignedArray&);
+
+      T*                      _data;         //< 64 byte aligned storage
+      size_t                  _size;         //< Number of elements
+   };
+}
+
+#endif
@@ -0,0 +1,193 @@
+//--------------------------------------------------------------------------------
+// counter_rng.h
+//
+// Counter-based random number generation (Philox4x32-10). Every random value
+// is a pure function of (seed, index, stream), so initialization loops can be
+// split across any number of threads and still produce identical results.
+//
+// See "Parallel Random Numbers: As Easy as 1, 2, 3" by Salmon, Moraes,
+// Dror and Shaw (SC '11) for details on Philox.
+//--------------------------------------------------------------------------------
+#ifndef _counter_rng_h
+#define _counter_rng_h
+
+#include <cmath>
+#include <cstddef>
+#include <stdint.h>
+
+#include "simd_math.h"
+
+namespace Compute
+{
+   /**
+    * Philox4x32-10 counter-based generator. There is no internal state
+    * besides the key: the same (index, stream) pair always maps to the same
+    * four 32-bit words.
+    *
+    * How to use this class:
+    * \code
+    * Compute::Philox rng(seed);
+    *
+    * // Four uniform floats in (0,1] for particle i
+    * float u[4];
+    * rng.uniform4(i, 0, u);
+    *
+    * // Four normally distributed floats for lattice cell i
+    * float g[4];
+    * rng.gaussian4(i, 0, g);
+    * \endcode
+    */
+   class Philox
+   {
+   public:
+      /**
+       * Constructor
+       *
+       * @param seed
+       *    The 64-bit seed. Becomes the Philox key
+       */
+      explicit Philox(uint64_t seed)
+      :  _key0  (uint32_t(seed))
+      ,  _key1  (uint32_t(seed >> 32))
+      {
+      }
+
+      /**
+       * Generate four random 32-bit words
+       *
+       * @param index
+       *    Index of the item being initialized (particle, lattice cell, ...)
+       * @param stream
+       *    Selects an independent sequence for the same index
+       * @param out
+       *    Four random words
+       */
+      void random4(uint64_t index, uint32_t stream, uint32_t out[4]) const
+      {
+         out[0] = uint32_t(index);
+         out[1] = uint32_t(index >> 32);
+         out[2] = stream;
+         out[3] = 0;
+
+         uint32_t k0 = _key0;
+         uint32_t k1 = _key1;
+         for(int round = 0; round < 10; ++round)
+         {
+            philoxRound(out, k0, k1);
+            k0 += 0x9E3779B9;
+            k1 += 0xBB67AE85;
+         }
+      }
+
+      /**
+       * Generate four uniformly distributed floats in the range (0,1]
+       */
+      void uniform4(uint64_t index, uint32_t stream, float out[4]) const
+      {
+         uint32_t bits[4];
+         random4(index, stream, bits);
+         for(int i = 0; i < 4; ++i)
+         {
+            out[i] = toUniform(bits[i]);
+         }
+      }
+
+      /**
+       * Generate four normally distributed floats (mean 0, variance 1).
+       * Uses two Box-Muller transforms on the four uniform values
+       */
+      void gaussian4(uint64_t index, uint32_t stream, float out[4]) const
+      {
+         float u[4];
+         uniform4(index, stream, u);
+         boxMuller(u[0], u[1], out[0], out[1]);
+         boxMuller(u[2], u[3], out[2], out[3]);
+      }
+
+      /**
+       * Map a 32-bit word to a float in the range (0,1]. The top 24 bits are
+       * used so that every result is exactly representable, and zero is
+       * excluded so that log() is always defined
+       */
+      static float toUniform(uint32_t bits)
+      {
+         return ((bits >> 8) + 1) * (1.0f / 16777216.0f);
+      }
+
+      /**
+       * Box-Muller transform of one pair of uniform values in (0,1]
+       */
+      static void boxMuller(float u1, float u2, float& z0, float& z1)
+      {
+         float r     = sqrtf(-2.0f * logf(u1));
+         float theta = 2.0f * float(M_PI) * u2;
+         z0 = r * cosf(theta);
+         z1 = r * sinf(theta);
+      }
+
+   private:
+      /**
+       * One Philox round: two 32x32->64 multiplies and a permutation
+       */
+      static void philoxRound(uint32_t ctr[4], uint32_t k0, uint32_t k1)
+      {
+         uint64_t p0 = uint64_t(0xD2511F53) * ctr[0];
+         uint64_t p1 = uint64_t(0xCD9E8D57) * ctr[2];
+
+         uint32_t hi0 = uint32_t(p0 >> 32);
+         uint32_t lo0 = uint32_t(p0);
+         uint32_t hi1 = uint32_t(p1 >> 32);
+         uint32_t lo1 = uint32_t(p1);
+
+         ctr[0] = hi1 ^ ctr[1] ^ k0;
+         ctr[1] = lo1;
+         ctr[2] = hi0 ^ ctr[3] ^ k1;
+         ctr[3] = lo0;
+      }
+
+      uint32_t _key0;      //< Low 32 bits of the seed
+      uint32_t _key1;      //< High 32 bits of the seed
+   };
+
+   // boxMuller() is compiled for the floatv of the including translation
+   // unit, see simd.h
+   namespace COMPUTE_SIMD_NAMESPACE
+   {
+   /**
+    * Box-Muller transform over arrays of uniform values. There are no
+    * branches or rejection step (unlike the polar method), so whole floatv
+    * registers are transformed at once with logApprox() and sincosApprox().
+    * The pairs after the last full register use libm
+    *
+    * @param n
+    *    Number of pairs
+    * @param u1, u2
+    *    Uniform values in (0,1]
+    * @param z0, z1
+    *    Normally distributed output values
+    */
+   inline void boxMuller(size_t n, const float* u1, const float* u2, float* z0, float* z1)
+   {
+      size_t i = 0;
+      for(; i + floatv::width <= n; i += floatv::width)
+      {
+         floatv r     = sqrt(-2.0f * logApprox(floatv::load(&u1[i])));
+         floatv theta = 2.0f * float(M_PI) * floatv::load(&u2[i]);
+         floatv s, c;
+         sincosApprox(theta, s, c);
+         (r * c).store(&z0[i]);
+         (r * s).store(&z1[i]);
+      }
+
+      for(; i < n; ++i)
+      {
+         float r     = sqrtf(-2.0f * logf(u1[i]));
+         float theta = 2.0f * float(M_PI) * u2[i];
+         z0[i] = r * cosf(theta);
+         z1[i] = r * sinf(theta);
+      }
+   }
+   }
+}
+
+#endif
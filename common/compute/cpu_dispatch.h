@@ -0,0 +1,250 @@
+//--------------------------------------------------------------------------------
+// cpu_dispatch.h
+//
+// Run time choice of the instruction set for the hot SIMD kernels, so that one
+// binary runs at full speed on every x86 machine of a mixed fleet.
+//
+// With the CMake option CPU_DISPATCH (which defines COMPUTE_DISPATCH) the
+// program is compiled for the x86-64 baseline, SSE2, and each hot kernel is
+// compiled once more with AVX2 and FMA and once more with AVX-512F, in
+// translation units of their own. simd.h puts floatv and everything built on
+// it in a namespace per instruction set, so the copies do not clash.
+// CpuDispatch asks the CPU (cpuid, through __builtin_cpu_supports) which of
+// them it can run and picks the widest; the programs' --isa option forces a
+// narrower one for testing.
+//
+// Without COMPUTE_DISPATCH the kernels exist once, for the compiler flags of
+// the program (e.g. -march=native), and that is the only level.
+//
+// A kernel that is dispatched provides a table of function pointers per
+// level (see particle_dispatch.h), and picks one with getIsa():
+// \code
+// switch(Compute::CpuDispatch::instance().getIsa())
+// {
+//    case Compute::ISA_AVX512: return avx512::kernels();
+//    ...
+// }
+// \endcode
+//--------------------------------------------------------------------------------
+#ifndef _cpu_dispatch_h
+#define _cpu_dispatch_h
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "simd.h"
+
+namespace Compute
+{
+   /**
+    * @return the name of an instruction set level: scalar, sse2, avx2 or
+    *    avx512
+    */
+   inline const char* isaName(Isa isa)
+   {
+      const char* names[NUM_ISAS] = { "scalar", "sse2", "avx2", "avx512" };
+      return isa >= 0 && isa < NUM_ISAS ? names[isa] : "unknown";
+   }
+
+   /**
+    * @return the floats per register at an instruction set level
+    */
+   inline int isaWidth(Isa isa)
+   {
+      const int widths[NUM_ISAS] = { 1, 4, 8, 16 };
+      return isa >= 0 && isa < NUM_ISAS ? widths[isa] : 1;
+   }
+
+   /**
+    * Parse the name of an instruction set level
+    *
+    * @param name
+    *    One of the names isaName() returns
+    * @param isa
+    *    Gets the level
+    * @return false if name is not a level
+    */
+   inline bool parseIsa(const std::string& name, Isa& isa)
+   {
+      for(int i = 0; i < NUM_ISAS; ++i)
+      {
+         if(name == isaName(Isa(i)))
+         {
+            isa = Isa(i);
+            return true;
+         }
+      }
+      return false;
+   }
+
+   /**
+    * @return true if the CPU and the operating system support the
+    *    instructions of a level
+    */
+   inline bool cpuSupports(Isa isa)
+   {
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+      __builtin_cpu_init();
+      switch(isa)
+      {
+         case ISA_SCALAR: return true;
+         case ISA_SSE2:   return __builtin_cpu_supports("sse2");
+         case ISA_AVX2:   return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+         case ISA_AVX512: return __builtin_cpu_supports("avx512f");
+         default:         return false;
+      }
+#else
+      return isa == ISA_SCALAR;
+#endif
+   }
+
+   /**
+    * The instruction set level of the dispatched kernels. Starts at the
+    * widest level that was built and that the CPU supports.
+    *
+    * How to use this class:
+    * \code
+    * Compute::Isa isa;
+    * if(Compute::parseIsa(argv[i], isa))
+    * {
+    *    Compute::CpuDispatch::instance().setIsa(isa);
+    * }
+    * std::cout << Compute::CpuDispatch::instance().describe() << std::endl;
+    * \endcode
+    */
+   class CpuDispatch
+   {
+   public:
+      /**
+       * @return the dispatch state shared by the whole program
+       */
+      static CpuDispatch& instance()
+      {
+         static CpuDispatch dispatch;
+         return dispatch;
+      }
+
+      /**
+       * @return the levels the kernels were built for, narrowest first
+       */
+      static std::vector<Isa> builtLevels()
+      {
+         std::vector<Isa> levels;
+#ifdef COMPUTE_DISPATCH
+         levels.push_back(ISA_SSE2);
+         levels.push_back(ISA_AVX2);
+         levels.push_back(ISA_AVX512);
+#else
+         levels.push_back(Isa(floatv::isa));
+#endif
+         return levels;
+      }
+
+      /**
+       * @return true if the kernels were built for isa and the CPU runs it
+       */
+      static bool available(Isa isa)
+      {
+         std::vector<Isa> levels = builtLevels();
+         for(size_t i = 0; i < levels.size(); ++i)
+         {
+            if(levels[i] == isa)
+            {
+               return cpuSupports(isa);
+            }
+         }
+         return false;
+      }
+
+      /**
+       * @return the names of the available levels, narrowest first and
+       *    separated by commas, for usage and error messages
+       */
+      static std::string availableNames()
+      {
+         std::string names;
+         std::vector<Isa> levels = builtLevels();
+         for(size_t i = 0; i < levels.size(); ++i)
+         {
+            if(cpuSupports(levels[i]))
+            {
+               names += std::string(names.empty() ? "" : ", ") + isaName(levels[i]);
+            }
+         }
+         return names;
+      }
+
+      /**
+       * @return the widest level that is available
+       */
+      static Isa best()
+      {
+         std::vector<Isa> levels = builtLevels();
+         Isa isa = levels.front();
+         for(size_t i = 0; i < levels.size(); ++i)
+         {
+            if(cpuSupports(levels[i]))
+            {
+               isa = levels[i];
+            }
+         }
+         return isa;
+      }
+
+      /**
+       * @return the level the dispatched kernels run at
+       */
+      Isa getIsa() const
+      {
+         return _isa;
+      }
+
+      /**
+       * Force a level. Throws std::runtime_error if it was not built or the
+       * CPU does not support it
+       */
+      void setIsa(Isa isa)
+      {
+         if(!available(isa))
+         {
+            throw std::runtime_error(std::string("Instruction set ") + isaName(isa) +
+                                     " is not available. This binary on this CPU supports: " + availableNames());
+         }
+         _isa = isa;
+      }
+
+      /**
+       * @return the selected level and how it was chosen, for reports
+       */
+      std::string describe() const
+      {
+         std::string text = isaName(_isa);
+         if(_isa != best())
+         {
+            text += std::string(", forced; best is ") + isaName(best());
+         }
+#ifndef COMPUTE_DISPATCH
+         text += ", fixed at compile time";
+#endif
+         return text;
+      }
+
+   private:
+      /**
+       * Constructor. Picks the best level
+       */
+      CpuDispatch()
+      :  _isa (best())
+      {
+      }
+
+      // Not copyable
+      CpuDispatch(const CpuDispatch&);
+      CpuDispatch& operator=(const CpuDispatch&);
+
+      Isa _isa;   //< Level of the dispatched kernels
+   };
+}
+
+#endif
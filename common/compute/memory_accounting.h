@@ -0,0 +1,294 @@
+//--------------------------------------------------------------------------------
+// memory_accounting.h
+//
+// Registry of the memory held by each subsystem: host bytes in arrays and
+// vectors, and device bytes in GL textures and buffers. Every subsystem owns
+// a MemoryAccount and keeps it up to date when it allocates, and the registry
+// sums the accounts by name, so the memory a lattice or particle count needs
+// can be read off a run instead of estimated.
+//--------------------------------------------------------------------------------
+#ifndef _memory_accounting_h
+#define _memory_accounting_h
+
+#include <algorithm>
+#include <cstddef>
+#include <iomanip>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace Compute
+{
+   class MemoryAccount;
+
+   /**
+    * @return the bytes a vector has allocated, which is its capacity and not
+    *    its size
+    */
+   template<typename T, typename Allocator>
+   size_t vectorBytes(const std::vector<T, Allocator>& v)
+   {
+      return v.capacity() * sizeof(T);
+   }
+
+   /**
+    * Usage of one kind of object, summed over all objects of that kind
+    */
+   struct MemoryUsage
+   {
+      std::string name;          //< Name of the accounts
+      size_t      objects;       //< Number of accounts with that name
+      size_t      hostBytes;     //< Host memory
+      size_t      deviceBytes;   //< GPU memory
+   };
+
+   /**
+    * All memory accounts of the program. Accounts register themselves, so
+    * the registry only has to be asked.
+    *
+    * How to use this class:
+    * \code
+    * std::vector<Compute::MemoryUsage> usage = Compute::MemoryRegistry::instance().usage();
+    * Compute::MemoryRegistry::instance().report(std::cout);
+    * \endcode
+    */
+   class MemoryRegistry
+   {
+   public:
+      /**
+       * @return the registry shared by the whole program
+       */
+      static MemoryRegistry& instance()
+      {
+         static MemoryRegistry registry;
+         return registry;
+      }
+
+      /**
+       * @return the usage of every kind of object, in the order the first
+       *    account of each kind was created
+       */
+      std::vector<MemoryUsage> usage() const;
+
+      /**
+       * @return the usage of all accounts together, named "total"
+       */
+      MemoryUsage total() const
+      {
+         std::vector<MemoryUsage> kinds = usage();
+         MemoryUsage sum = { "total", 0, 0, 0 };
+         for(size_t k = 0; k < kinds.size(); ++k)
+         {
+            sum.objects     += kinds[k].objects;
+            sum.hostBytes   += kinds[k].hostBytes;
+            sum.deviceBytes += kinds[k].deviceBytes;
+         }
+         return sum;
+      }
+
+      /**
+       * Write a table with the host and device memory of every kind of
+       * object and the total, in MB
+       */
+      void report(std::ostream& out) const
+      {
+         std::vector<MemoryUsage> kinds = usage();
+         kinds.push_back(total());
+
+         out << "Memory in MB" << std::endl;
+         out << std::left << std::setw(26) << "object" << std::right << std::setw(8) << "count"
+             << std::setw(12) << "host" << std::setw(12) << "device" << std::endl;
+         out << std::fixed << std::setprecision(3);
+         for(size_t k = 0; k < kinds.size(); ++k)
+         {
+            out << std::left << std::setw(26) << kinds[k].name << std::right << std::setw(8) << kinds[k].objects
+                << std::setw(12) << kinds[k].hostBytes * 1e-6 << std::setw(12) << kinds[k].deviceBytes * 1e-6 << std::endl;
+         }
+         out.unsetf(std::ios::floatfield);
+      }
+
+   private:
+      friend class MemoryAccount;
+
+      /**
+       * Constructor
+       */
+      MemoryRegistry()
+      {
+      }
+
+      // Not copyable
+      MemoryRegistry(const MemoryRegistry&);
+      MemoryRegistry& operator=(const MemoryRegistry&);
+
+      mutable std::mutex                  _mutex;      //< Protects _accounts and the bytes of every account
+      std::vector<const MemoryAccount*>   _accounts;   //< Every live account, oldest first
+   };
+
+   /**
+    * The memory of one object. Owners hold an account as a member and set
+    * its bytes whenever they allocate or free; the account leaves the
+    * registry when the owner is destroyed. A copy of the owner holds a copy
+    * of its memory, so copying an account registers a second account with
+    * the same bytes.
+    *
+    * How to use this class:
+    * \code
+    * class Lattice
+    * {
+    * public:
+    *    Lattice(size_t n)
+    *    :  _cells  (n)
+    *    ,  _memory ("Lattice")
+    *    {
+    *       _memory.setHost(Compute::vectorBytes(_cells));
+    *    }
+    * private:
+    *    std::vector<float>      _cells;
+    *    Compute::MemoryAccount  _memory;
+    * };
+    * \endcode
+    */
+   class MemoryAccount
+   {
+   public:
+      /**
+       * Constructor. Registers the account with no bytes
+       *
+       * @param name
+       *    Kind of object, usually the class name. Accounts with the same
+       *    name are summed
+       */
+      explicit MemoryAccount(const std::string& name)
+      :  _name        (name)
+      ,  _hostBytes   (0)
+      ,  _deviceBytes (0)
+      {
+         add();
+      }
+
+      /**
+       * Copy constructor. Registers a new account with the same bytes
+       */
+      MemoryAccount(const MemoryAccount& other)
+      :  _name        (other._name)
+      ,  _hostBytes   (other.getHost())
+      ,  _deviceBytes (other.getDevice())
+      {
+         add();
+      }
+
+      /**
+       * Assignment. Takes the bytes of other; the name stays
+       */
+      MemoryAccount& operator=(const MemoryAccount& other)
+      {
+         size_t host   = other.getHost();
+         size_t device = other.getDevice();
+         set(host, device);
+         return *this;
+      }
+
+      /**
+       * Destructor. Removes the account from the registry
+       */
+      ~MemoryAccount()
+      {
+         MemoryRegistry& registry = MemoryRegistry::instance();
+         std::lock_guard<std::mutex> lock(registry._mutex);
+         registry._accounts.erase(std::find(registry._accounts.begin(), registry._accounts.end(), this));
+      }
+
+      /**
+       * @param hostBytes
+       *    Host memory the object holds now
+       */
+      void setHost(size_t hostBytes)
+      {
+         std::lock_guard<std::mutex> lock(MemoryRegistry::instance()._mutex);
+         _hostBytes = hostBytes;
+      }
+
+      /**
+       * @param deviceBytes
+       *    GPU memory the object holds now
+       */
+      void setDevice(size_t deviceBytes)
+      {
+         std::lock_guard<std::mutex> lock(MemoryRegistry::instance()._mutex);
+         _deviceBytes = deviceBytes;
+      }
+
+      /**
+       * Set the host and GPU memory the object holds now
+       */
+      void set(size_t hostBytes, size_t deviceBytes)
+      {
+         std::lock_guard<std::mutex> lock(MemoryRegistry::instance()._mutex);
+         _hostBytes   = hostBytes;
+         _deviceBytes = deviceBytes;
+      }
+
+      /**
+       * @return the host memory of the object in bytes
+       */
+      size_t getHost() const
+      {
+         std::lock_guard<std::mutex> lock(MemoryRegistry::instance()._mutex);
+         return _hostBytes;
+      }
+
+      /**
+       * @return the GPU memory of the object in bytes
+       */
+      size_t getDevice() const
+      {
+         std::lock_guard<std::mutex> lock(MemoryRegistry::instance()._mutex);
+         return _deviceBytes;
+      }
+
+   private:
+      friend class MemoryRegistry;
+
+      /**
+       * Register the account
+       */
+      void add()
+      {
+         MemoryRegistry& registry = MemoryRegistry::instance();
+         std::lock_guard<std::mutex> lock(registry._mutex);
+         registry._accounts.push_back(this);
+      }
+
+      std::string _name;          //< Kind of object
+      size_t      _hostBytes;     //< Host memory, guarded by the registry's mutex
+      size_t      _deviceBytes;   //< GPU memory, guarded by the registry's mutex
+   };
+
+   inline std::vector<MemoryUsage> MemoryRegistry::usage() const
+   {
+      std::lock_guard<std::mutex> lock(_mutex);
+      std::vector<MemoryUsage> kinds;
+      for(size_t a = 0; a < _accounts.size(); ++a)
+      {
+         const MemoryAccount& account = *_accounts[a];
+         size_t k = 0;
+         while(k < kinds.size() && kinds[k].name != account._name)
+         {
+            ++k;
+         }
+         if(k == kinds.size())
+         {
+            MemoryUsage kind = { account._name, 0, 0, 0 };
+            kinds.push_back(kind);
+         }
+         kinds[k].objects     += 1;
+         kinds[k].hostBytes   += account._hostBytes;
+         kinds[k].deviceBytes += account._deviceBytes;
+      }
+      return kinds;
+   }
+}
+
+#endif
@@ -0,0 +1,78 @@
+//--------------------------------------------------------------------------------
+// parallel_for.h
+//
+// Split a loop over [begin, end) into contiguous chunks and process the chunks
+// on the shared thread pool.
+//--------------------------------------------------------------------------------
+#ifndef _parallel_for_h
+#define _parallel_for_h
+
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstddef>
+
+namespace Compute
+{
+   /**
+    * Run body(first, last) over chunks of exactly chunkSize indices (the last
+    * chunk may be shorter). Use this when the chunk size matters, for
+    * example to keep each chunk's working set inside the cache or chunk
+    * boundaries on SIMD multiples. Returns when every chunk has been
+    * processed.
+    *
+    * @param begin, end
+    *    The range of indices to process
+    * @param chunkSize
+    *    Number of indices per chunk
+    * @param body
+    *    Callable with signature void(size_t first, size_t last)
+    */
+   template<typename Function>
+   void parallelForChunks(size_t begin, size_t end, size_t chunkSize, Function body)
+   {
+      if(end <= begin)
+      {
+         return;
+      }
+
+      chunkSize = std::max<size_t>(chunkSize, 1);
+      size_t numChunks = (end - begin + chunkSize - 1) / chunkSize;
+
+      ThreadPool::instance().run(numChunks, [&](size_t chunk)
+      {
+         size_t first = begin + chunk * chunkSize;
+         body(first, std::min(first + chunkSize, end));
+      });
+   }
+
+   /**
+    * Run body(first, last) over contiguous sub-ranges of [begin, end) in
+    * parallel. The range is split into a few chunks per thread so that
+    * uneven work balances out. Returns when every range has been processed.
+    *
+    * @param begin, end
+    *    The range of indices to process
+    * @param body
+    *    Callable with signature void(size_t first, size_t last)
+    * @param minRange
+    *    Smallest range worth handing to a thread
+    */
+   template<typename Function>
+   void parallelFor(size_t begin, size_t end, Function body, size_t minRange = 4096)
+   {
+      if(end <= begin)
+      {
+         return;
+      }
+
+      const size_t chunksPerThread = 4;
+      size_t count     = end - begin;
+      size_t numChunks = size_t(ThreadPool::instance().getNumThreads()) * chunksPerThread;
+      size_t chunkSize = std::max<size_t>(minRange, (count + numChunks - 1) / numChunks);
+
+      parallelForChunks(begin, end, chunkSize, body);
+   }
+}
+
+#endif
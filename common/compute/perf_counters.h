@@ -0,0 +1,511 @@
+//--------------------------------------------------------------------------------
+// perf_counters.h
+//
+// Hardware performance counters around a kernel, through Linux's
+// perf_event_open: cycles, instructions, last level cache misses and branch
+// misses of every thread of the process, and where the memory controllers
+// expose them, the bytes read from and written to DRAM. Instructions per
+// cycle and misses per item next to the throughput tell a kernel that waits
+// on memory from one that is short of threads or of arithmetic.
+//
+// Counters that the machine or the permissions do not provide are left out,
+// and without any the kernels still run and report their times. Virtual
+// machines usually have no counters at all.
+//--------------------------------------------------------------------------------
+#ifndef _perf_counters_h
+#define _perf_counters_h
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#ifdef __linux__
+#  include <dirent.h>
+#  include <linux/perf_event.h>
+#  include <sys/syscall.h>
+#  include <unistd.h>
+#endif
+
+namespace Compute
+{
+   /**
+    * Counter values, either totals since the counters were opened or, as
+    * the difference of two totals, the counts of one region
+    */
+   struct PerfCounts
+   {
+      enum Event
+      {
+         CYCLES,          //< Core cycles, user space
+         INSTRUCTIONS,    //< Instructions retired, user space
+         LLC_MISSES,      //< Last level cache misses, user space
+         BRANCH_MISSES,   //< Mispredicted branches, user space
+         DRAM_BYTES,      //< Bytes read from and written to DRAM by the whole machine
+         NUM_EVENTS
+      };
+
+      double value[NUM_EVENTS];   //< Count of each event
+      bool   valid[NUM_EVENTS];   //< true if the event was counted
+
+      /**
+       * Constructor. No event counted
+       */
+      PerfCounts()
+      {
+         std::fill(value, value + NUM_EVENTS, 0.0);
+         std::fill(valid, valid + NUM_EVENTS, false);
+      }
+
+      /**
+       * @return true if any event was counted
+       */
+      bool any() const
+      {
+         return std::find(valid, valid + NUM_EVENTS, true) != valid + NUM_EVENTS;
+      }
+
+      /**
+       * @return instructions per cycle, 0 if either was not counted
+       */
+      double ipc() const
+      {
+         return valid[CYCLES] && valid[INSTRUCTIONS] && value[CYCLES] > 0 ? value[INSTRUCTIONS] / value[CYCLES] : 0;
+      }
+
+      /**
+       * @return the counts between an earlier total and this one
+       */
+      PerfCounts operator-(const PerfCounts& earlier) const
+      {
+         PerfCounts diff;
+         for(int e = 0; e < NUM_EVENTS; ++e)
+         {
+            diff.valid[e] = valid[e] && earlier.valid[e];
+            diff.value[e] = diff.valid[e] ? value[e] - earlier.value[e] : 0;
+         }
+         return diff;
+      }
+
+      /**
+       * Add the counts of another region
+       */
+      PerfCounts& operator+=(const PerfCounts& other)
+      {
+         for(int e = 0; e < NUM_EVENTS; ++e)
+         {
+            if(other.valid[e])
+            {
+               value[e] += other.value[e];
+               valid[e]  = true;
+            }
+         }
+         return *this;
+      }
+
+      /**
+       * @return the name of an event as used in reports, e.g. "llc_misses"
+       */
+      static const char* name(int e)
+      {
+         static const char* names[NUM_EVENTS] = { "cycles", "instructions", "llc_misses", "branch_misses", "dram_bytes" };
+         return names[e];
+      }
+   };
+
+   /**
+    * Counters of the whole process. On construction every thread that
+    * exists gets a counter group, and threads they start later are counted
+    * with them, so worker threads and a driver's threads are included
+    * whenever they were created. Counting only covers user space, which
+    * the default perf_event_paranoid setting of 2 allows for one's own
+    * process.
+    *
+    * The counters run from construction on; read() returns the totals, and
+    * the difference of two reads is the count of the region between them.
+    * When the machine has more events than counters the kernel multiplexes
+    * them, and the totals are scaled up by the share of time each was
+    * counted.
+    *
+    * DRAM traffic comes from the uncore memory controller counters of Intel
+    * processors (uncore_imc), which count for the whole machine and need
+    * perf_event_paranoid 0 or CAP_PERFMON.
+    *
+    * How to use this class:
+    * \code
+    * Compute::PerfCounters counters;
+    * Compute::PerfCounts before = counters.read();
+    * kernel();
+    * Compute::PerfCounts counts = counters.read() - before;
+    * if(counts.valid[Compute::PerfCounts::LLC_MISSES])
+    * {
+    *    std::cout << counts.value[Compute::PerfCounts::LLC_MISSES] / numItems << " misses per item" << std::endl;
+    * }
+    * \endcode
+    */
+   class PerfCounters
+   {
+   public:
+      /**
+       * Constructor. Opens the counters. Never throws: counters that cannot
+       * be opened are left out, see status()
+       */
+      PerfCounters()
+      :  _numThreads (0)
+      {
+#ifdef __linux__
+         openCoreGroups();
+         openDramCounters();
+#else
+         _status = "performance counters need Linux";
+#endif
+      }
+
+      /**
+       * Destructor. Closes the counters
+       */
+      ~PerfCounters()
+      {
+#ifdef __linux__
+         for(size_t g = 0; g < _groups.size(); ++g)
+         {
+            for(size_t f = 0; f < _groups[g].fds.size(); ++f)
+            {
+               close(_groups[g].fds[f]);
+            }
+         }
+         for(size_t d = 0; d < _dram.size(); ++d)
+         {
+            close(_dram[d]);
+         }
+#endif
+      }
+
+      /**
+       * @return true if any event is counted
+       */
+      bool available() const
+      {
+         return !_groups.empty() || !_dram.empty();
+      }
+
+      /**
+       * @return the events counted and on how many threads, or why there
+       *    are none, e.g. "cycles instructions llc_misses branch_misses on
+       *    5 threads; no DRAM counters"
+       */
+      std::string status() const
+      {
+         return _status;
+      }
+
+      /**
+       * @return the totals since construction
+       */
+      PerfCounts read() const
+      {
+         PerfCounts counts;
+#ifdef __linux__
+         for(size_t g = 0; g < _groups.size(); ++g)
+         {
+            const Group& group = _groups[g];
+
+            // PERF_FORMAT_GROUP with the times: nr, time enabled, time
+            // running, then one value per event in the order they were opened
+            std::vector<uint64_t> data(3 + group.events.size());
+            ssize_t bytes = ::read(group.fds[0], &data[0], data.size() * sizeof(uint64_t));
+            if(bytes < ssize_t(3 * sizeof(uint64_t)) || data[0] != group.events.size())
+            {
+               continue;
+            }
+            double scale = data[2] > 0 && data[2] < data[1] ? double(data[1]) / data[2] : 1.0;
+            for(size_t e = 0; e < group.events.size(); ++e)
+            {
+               counts.value[group.events[e]] += data[3 + e] * scale;
+               counts.valid[group.events[e]]  = true;
+            }
+         }
+
+         for(size_t d = 0; d < _dram.size(); ++d)
+         {
+            uint64_t value = 0;
+            if(::read(_dram[d], &value, sizeof(value)) == ssize_t(sizeof(value)))
+            {
+               counts.value[PerfCounts::DRAM_BYTES] += double(value) * CACHE_LINE_BYTES;
+               counts.valid[PerfCounts::DRAM_BYTES]  = true;
+            }
+         }
+#endif
+         return counts;
+      }
+
+   private:
+      // Each memory controller CAS command moves one cache line
+      static const int CACHE_LINE_BYTES = 64;
+
+      /**
+       * The counters of one thread: a group led by the cycle counter, so
+       * that all its events are counted over the same intervals
+       */
+      struct Group
+      {
+         std::vector<int>                fds;      //< Leader first
+         std::vector<PerfCounts::Event>  events;   //< Event of each fd
+      };
+
+      // Not copyable
+      PerfCounters(const PerfCounters&);
+      PerfCounters& operator=(const PerfCounters&);
+
+#ifdef __linux__
+      /**
+       * @return a file descriptor for one event, or -1 with errno set
+       */
+      static int openEvent(uint32_t type, uint64_t config, pid_t pid, int cpu, int groupFd, bool user)
+      {
+         perf_event_attr attr;
+         memset(&attr, 0, sizeof(attr));
+         attr.size   = sizeof(attr);
+         attr.type   = type;
+         attr.config = config;
+         if(user)
+         {
+            attr.read_format    = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+            attr.inherit        = 1;
+            attr.exclude_kernel = 1;
+            attr.exclude_hv     = 1;
+         }
+         int fd = int(syscall(__NR_perf_event_open, &attr, pid, cpu, groupFd, PERF_FLAG_FD_CLOEXEC));
+
+         // Some kernels refuse inherited counters that are read as a group.
+         // Then only the threads that exist now are counted
+         if(fd < 0 && errno == EINVAL && user)
+         {
+            attr.inherit = 0;
+            fd = int(syscall(__NR_perf_event_open, &attr, pid, cpu, groupFd, PERF_FLAG_FD_CLOEXEC));
+         }
+         return fd;
+      }
+
+      /**
+       * Open a counter group on every thread of the process
+       */
+      void openCoreGroups()
+      {
+         struct Event
+         {
+            PerfCounts::Event event;
+            uint32_t          type;
+            uint64_t          config;
+         };
+         const Event events[] =
+         {
+            { PerfCounts::CYCLES,        PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES       },
+            { PerfCounts::INSTRUCTIONS,  PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS     },
+            { PerfCounts::LLC_MISSES,    PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES     },
+            { PerfCounts::BRANCH_MISSES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES    }
+         };
+         const size_t numEvents = sizeof(events) / sizeof(events[0]);
+
+         std::vector<pid_t> threads = processThreads();
+         int                error   = 0;
+         for(size_t t = 0; t < threads.size(); ++t)
+         {
+            Group group;
+            for(size_t e = 0; e < numEvents; ++e)
+            {
+               int fd = openEvent(events[e].type, events[e].config, threads[t], -1, group.fds.empty() ? -1 : group.fds[0], true);
+               if(fd >= 0)
+               {
+                  group.fds.push_back(fd);
+                  group.events.push_back(events[e].event);
+               }
+               else if(group.fds.empty())
+               {
+                  // Without the cycle counter there is no group
+                  error = errno;
+                  break;
+               }
+            }
+            if(!group.fds.empty())
+            {
+               _groups.push_back(group);
+               ++_numThreads;
+            }
+         }
+
+         std::ostringstream status;
+         if(_groups.empty())
+         {
+            status << "no core counters: " << describeError(error);
+         }
+         else
+         {
+            for(size_t e = 0; e < _groups[0].events.size(); ++e)
+            {
+               status << PerfCounts::name(_groups[0].events[e]) << " ";
+            }
+            status << "on " << _numThreads << " thread" << (_numThreads == 1 ? "" : "s");
+         }
+         _status = status.str();
+      }
+
+      /**
+       * Open the CAS counters of every Intel memory controller, if the
+       * kernel exposes them
+       */
+      void openDramCounters()
+      {
+         const std::string devices = "/sys/bus/event_source/devices/";
+         const char*       names[] = { "cas_count_read", "cas_count_write", "data_reads", "data_writes" };
+
+         int error = ENOENT;
+         DIR* dir = opendir(devices.c_str());
+         struct dirent* entry;
+         while(dir != NULL && (entry = readdir(dir)) != NULL)
+         {
+            std::string pmu = entry->d_name;
+            if(pmu.compare(0, 10, "uncore_imc") != 0 || pmu.find("free_running") != std::string::npos)
+            {
+               continue;
+            }
+
+            std::string path = devices + pmu + "/";
+            uint32_t    type = uint32_t(atoi(readLine(path + "type").c_str()));
+            int         cpu  = atoi(readLine(path + "cpumask").c_str());
+            for(size_t n = 0; n < sizeof(names) / sizeof(names[0]); ++n)
+            {
+               std::string event = readLine(path + "events/" + names[n]);
+               uint64_t    config = 0;
+               if(event.empty() || !parseEvent(path, event, config))
+               {
+                  continue;
+               }
+               int fd = openEvent(type, config, -1, cpu, -1, false);
+               if(fd >= 0)
+               {
+                  _dram.push_back(fd);
+               }
+               else
+               {
+                  error = errno;
+               }
+            }
+         }
+         if(dir != NULL)
+         {
+            closedir(dir);
+         }
+
+         if(_dram.empty())
+         {
+            _status += "; no DRAM counters: " + describeError(error);
+         }
+         else
+         {
+            _status += "; dram_bytes from the memory controllers";
+         }
+      }
+
+      /**
+       * Turn an event description from sysfs, e.g. "event=0x04,umask=0x03",
+       * into a config value, using the PMU's format files to place each
+       * term. Only terms in config are supported
+       *
+       * @return true if every term could be placed
+       */
+      static bool parseEvent(const std::string& pmuPath, const std::string& event, uint64_t& config)
+      {
+         std::stringstream terms(event);
+         std::string       term;
+         config = 0;
+         while(std::getline(terms, term, ','))
+         {
+            size_t   equals = term.find('=');
+            std::string key = term.substr(0, equals);
+            uint64_t value  = equals == std::string::npos ? 1 : strtoull(term.substr(equals + 1).c_str(), NULL, 0);
+
+            // The format is e.g. "config:8-15" or "config:21"
+            std::string format = readLine(pmuPath + "format/" + key);
+            if(format.compare(0, 7, "config:") != 0)
+            {
+               return false;
+            }
+            int low = atoi(format.c_str() + 7);
+            config |= value << low;
+         }
+         return true;
+      }
+
+      /**
+       * @return the ids of every thread of the process
+       */
+      static std::vector<pid_t> processThreads()
+      {
+         std::vector<pid_t> threads;
+         DIR* dir = opendir("/proc/self/task");
+         struct dirent* entry;
+         while(dir != NULL && (entry = readdir(dir)) != NULL)
+         {
+            pid_t tid = pid_t(atoi(entry->d_name));
+            if(tid > 0)
+            {
+               threads.push_back(tid);
+            }
+         }
+         if(dir != NULL)
+         {
+            closedir(dir);
+         }
+         if(threads.empty())
+         {
+            threads.push_back(0);
+         }
+         return threads;
+      }
+
+      /**
+       * @return the first line of a file, empty if it cannot be read
+       */
+      static std::string readLine(const std::string& filename)
+      {
+         std::ifstream in(filename.c_str());
+         std::string   line;
+         std::getline(in, line);
+         return line;
+      }
+
+      /**
+       * @return why perf_event_open failed, in terms of what to change
+       */
+      static std::string describeError(int error)
+      {
+         switch(error)
+         {
+         case EACCES:
+         case EPERM:
+            return "not permitted, see /proc/sys/kernel/perf_event_paranoid";
+         case ENOENT:
+         case ENODEV:
+         case EOPNOTSUPP:
+            return "not supported by this CPU or virtual machine";
+         default:
+            return strerror(error);
+         }
+      }
+#endif
+
+      std::vector<Group>   _groups;       //< Counter group of every thread
+      std::vector<int>     _dram;         //< Memory controller CAS counters
+      size_t               _numThreads;   //< Threads with a counter group
+      std::string          _status;       //< What is counted, or why not
+   };
+}
+
+#endif
@@ -0,0 +1,104 @@
+//--------------------------------------------------------------------------------
+// radix_sort.h
+//
+// Parallel least-significant-digit radix sort of 64 bit keys with a payload,
+// 8 bits per pass. Each pass counts digits per block on the thread pool, turns
+// the counts into per block output offsets, and scatters the blocks in
+// parallel. The sort is stable.
+//--------------------------------------------------------------------------------
+#ifndef _radix_sort_h
+#define _radix_sort_h
+
+#include "thread_pool.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include <stdint.h>
+
+namespace Compute
+{
+   /**
+    * Sort key / value pairs by key
+    *
+    * @param keys, values
+    *    The pairs to sort, n of each. Sorted in place
+    * @param keysTmp, valuesTmp
+    *    Scratch space for n pairs
+    * @param n
+    *    Number of pairs
+    * @param keyBits
+    *    Only the low keyBits bits of the keys may be set. Fewer bits means
+    *    fewer passes
+    */
+   template<typename Value>
+   void radixSort(uint64_t* keys, Value* values, uint64_t* keysTmp, Value* valuesTmp, size_t n, int keyBits)
+   {
+      const int    digitBits    = 8;
+      const size_t radix        = size_t(1) << digitBits;
+      const size_t minBlockSize = 16384;
+
+      ThreadPool& pool = ThreadPool::instance();
+      size_t numBlocks = std::max<size_t>(1, std::min<size_t>(pool.getNumThreads() * 4, n / minBlockSize));
+      size_t blockSize = (n + numBlocks - 1) / numBlocks;
+      std::vector<size_t> offsets(numBlocks * radix);
+
+      uint64_t* srcKeys   = keys;
+      Value*    srcValues = values;
+      uint64_t* dstKeys   = keysTmp;
+      Value*    dstValues = valuesTmp;
+
+      for(int shift = 0; shift < keyBits; shift += digitBits)
+      {
+         std::fill(offsets.begin(), offsets.end(), 0);
+         pool.run(numBlocks, [&](size_t block)
+         {
+            size_t* count = &offsets[block * radix];
+            size_t  last  = std::min(n, (block + 1) * blockSize);
+            for(size_t i = block * blockSize; i < last; ++i)
+            {
+               ++count[(srcKeys[i] >> shift) & (radix - 1)];
+            }
+         });
+
+         // Digit-major exclusive prefix sum: all of block 0's zeros come
+         // first, then block 1's, and so on, which keeps the sort stable
+         size_t sum = 0;
+         for(size_t digit = 0; digit < radix; ++digit)
+         {
+            for(size_t block = 0; block < numBlocks; ++block)
+            {
+               size_t count = offsets[block * radix + digit];
+               offsets[block * radix + digit] = sum;
+               sum += count;
+            }
+         }
+
+         pool.run(numBlocks, [&](size_t block)
+         {
+            size_t* offset = &offsets[block * radix];
+            size_t  last   = std::min(n, (block + 1) * blockSize);
+            for(size_t i = block * blockSize; i < last; ++i)
+            {
+               size_t dst = offset[(srcKeys[i] >> shift) & (radix - 1)]++;
+               dstKeys[dst]   = srcKeys[i];
+               dstValues[dst] = srcValues[i];
+            }
+         });
+
+         std::swap(srcKeys, dstKeys);
+         std::swap(srcValues, dstValues);
+      }
+
+      // After an odd number of passes the result is in the scratch arrays
+      if(srcKeys != keys)
+      {
+         memcpy(keys, srcKeys, n * sizeof(uint64_t));
+         memcpy(values, srcValues, n * sizeof(Value));
+      }
+   }
+}
+
+#endif
@@ -0,0 +1,196 @@
+//--------------------------------------------------------------------------------
+// roofline.h
+//
+// Measure the two roofs of the roofline model on the host: the memory bandwidth
+// and the floating point rate of independent multiply-add chains on floatv.
+// All run on the shared thread pool, so they measure what the pool's current
+// number of threads can reach.
+//
+// The bandwidth is measured two ways. The STREAM triad, a[i] = b[i] + s c[i],
+// is the usual figure, but the write to a separate array costs a read for
+// ownership that STREAM does not count. Kernels that update their arrays in
+// place, like the particle update, can reach noticeably more, so the in-place
+// update a[i] = s a[i] is measured too, and the higher of the two is the roof.
+//
+// A kernel with arithmetic intensity I flops per byte of memory traffic can run
+// at most min(peak flops, I x bandwidth). Kernels below the ridge point,
+// peak / bandwidth, are limited by memory; kernels above it by arithmetic.
+//--------------------------------------------------------------------------------
+#ifndef _roofline_h
+#define _roofline_h
+
+#include "aligned_array.h"
+#include "parallel_for.h"
+#include "simd.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <vector>
+
+namespace Compute
+{
+   /**
+    * Run body(a, b, c, i) for every floatv::width-th i over three arrays of
+    * n floats, repeats times, and return the fastest bandwidth
+    *
+    * @param bytesPerElement
+    *    Memory traffic counted for each i
+    */
+   template<typename Body>
+   double measureBandwidth(size_t n, int repeats, int bytesPerElement, Body body)
+   {
+      typedef std::chrono::steady_clock Clock;
+
+      n = (n + floatv::width - 1) / floatv::width * floatv::width;
+      AlignedArray<float> a(n), b(n), c(n);
+      float* pa = a.data();
+      float* pb = b.data();
+      float* pc = c.data();
+
+      // Touch the arrays from the threads that use them, so that the pages
+      // are spread over the memory controllers the same way as in the timed
+      // passes
+      parallelFor(0, n, [&](size_t first, size_t last)
+      {
+         for(size_t i = first; i < last; ++i)
+         {
+            pa[i] = 0.0f;
+            pb[i] = 1.0f;
+            pc[i] = 2.0f;
+         }
+      }, 1 << 16);
+
+      double best = 0;
+      for(int r = 0; r < repeats; ++r)
+      {
+         Clock::time_point start = Clock::now();
+         parallelFor(0, n / floatv::width, [&](size_t first, size_t last)
+         {
+            for(size_t i = first * floatv::width; i < last * floatv::width; i += floatv::width)
+            {
+               body(pa, pb, pc, i);
+            }
+         }, 1 << 12);
+         double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+         best = std::max(best, double(bytesPerElement) * n / seconds);
+      }
+      return best;
+   }
+
+   /**
+    * Bandwidth of the STREAM triad over three arrays of n floats. Counts
+    * 12 bytes per element, as STREAM does: the write allocate of a is not
+    * counted
+    *
+    * @param n
+    *    Elements per array. Pick the arrays several times larger than the
+    *    last level cache, or the result is the cache bandwidth
+    * @param repeats
+    *    Timed passes. The fastest is reported
+    * @return bytes per second
+    */
+   inline double measureTriadBandwidth(size_t n = size_t(1) << 24, int repeats = 10)
+   {
+      return measureBandwidth(n, repeats, 12, [](float* a, float* b, float* c, size_t i)
+      {
+         (floatv::load(b + i) + floatv(3.0f) * floatv::load(c + i)).store(a + i);
+      });
+   }
+
+   /**
+    * Bandwidth of an in-place update of three arrays of n floats,
+    * a[i] = s a[i] and the same for b and c. Counts 24 bytes per element,
+    * which is all the traffic there is
+    *
+    * @param n
+    *    Elements per array
+    * @param repeats
+    *    Timed passes. The fastest is reported
+    * @return bytes per second
+    */
+   inline double measureUpdateBandwidth(size_t n = size_t(1) << 24, int repeats = 10)
+   {
+      // s = -1 keeps the values bounded over the passes, and unlike 1 the
+      // compiler cannot drop the multiply and then the store
+      return measureBandwidth(n, repeats, 24, [](float* a, float* b, float* c, size_t i)
+      {
+         const floatv s(-1.0f);
+         (s * floatv::load(a + i)).store(a + i);
+         (s * floatv::load(b + i)).store(b + i);
+         (s * floatv::load(c + i)).store(c + i);
+      });
+   }
+
+   /**
+    * Floating point rate of multiply-adds on floatv. Each chunk runs 12
+    * independent chains, enough to keep two multiply-add units busy through
+    * a latency of up to 6 cycles; the compiler fuses the pairs where the
+    * target has FMA. The chains are separate variables rather than an
+    * array so that they stay in registers. A multiply-add counts as two
+    * operations
+    *
+    * @param iterations
+    *    Multiply-adds per chain and chunk
+    * @param repeats
+    *    Timed passes. The fastest is reported
+    * @return floating point operations per second
+    */
+   inline double measurePeakFlops(size_t iterations = 1 << 20, int repeats = 5)
+   {
+      typedef std::chrono::steady_clock Clock;
+
+      const int chains    = 12;
+      size_t    numChunks = 4 * ThreadPool::instance().getNumThreads();
+
+      // The chains converge to a / (1 - m), so the values never overflow or
+      // turn denormal
+      const floatv m(0.999f);
+      const floatv a(0.001f);
+      std::vector<float> sink(numChunks);
+
+      double best = 0;
+      for(int r = 0; r < repeats; ++r)
+      {
+         Clock::time_point start = Clock::now();
+         ThreadPool::instance().run(numChunks, [&](size_t chunk)
+         {
+            floatv c0 = floatv::ramp(0),  c1 = floatv::ramp(1),  c2  = floatv::ramp(2),  c3  = floatv::ramp(3);
+            floatv c4 = floatv::ramp(4),  c5 = floatv::ramp(5),  c6  = floatv::ramp(6),  c7  = floatv::ramp(7);
+            floatv c8 = floatv::ramp(8),  c9 = floatv::ramp(9),  c10 = floatv::ramp(10), c11 = floatv::ramp(11);
+            for(size_t i = 0; i < iterations; ++i)
+            {
+               c0 = c0 * m + a;  c1 = c1 * m + a;  c2  = c2  * m + a;  c3  = c3  * m + a;
+               c4 = c4 * m + a;  c5 = c5 * m + a;  c6  = c6  * m + a;  c7  = c7  * m + a;
+               c8 = c8 * m + a;  c9 = c9 * m + a;  c10 = c10 * m + a;  c11 = c11 * m + a;
+            }
+
+            // Keep the result live so the loop is not optimized away
+            floatv sum = ((c0 + c1) + (c2 + c3)) + ((c4 + c5) + (c6 + c7)) + ((c8 + c9) + (c10 + c11));
+            float lanes[floatv::width];
+            sum.store(lanes);
+            sink[chunk] = lanes[0];
+         });
+         double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+         best = std::max(best, 2.0 * chains * floatv::width * iterations * numChunks / seconds);
+      }
+      return best;
+   }
+
+   /**
+    * @param intensity
+    *    Floating point operations per byte of memory traffic
+    * @param peakFlops
+    *    Floating point operations per second
+    * @param bandwidth
+    *    Bytes per second
+    * @return the highest rate, in operations per second, that a kernel with
+    *    this intensity can reach
+    */
+   inline double attainableFlops(double intensity, double peakFlops, double bandwidth)
+   {
+      return std::min(peakFlops, intensity * bandwidth);
+   }
+}
+
+#endif
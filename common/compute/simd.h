@@ -0,0 +1,401 @@
+//--------------------------------------------------------------------------------
+// simd.h
+//
+// Thin wrapper around the SIMD float registers of the target: 16 lanes with
+// AVX-512, 8 lanes with AVX2, 4 lanes with SSE2 and a single lane otherwise.
+// Code written against floatv compiles to the widest instruction set enabled by
+// the compiler flags.
+//
+// The definitions are in an inline namespace named after that instruction set
+// (Compute::avx2::floatv and so on). A program can then compile the same
+// kernel in several translation units with different flags, and link them
+// together without two different floatv or functions of floatv sharing one
+// name; cpu_dispatch.h picks the one to run.
+//--------------------------------------------------------------------------------
+#ifndef _simd_h
+#define _simd_h
+
+#include <cmath>
+#include <stdint.h>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#if defined(__AVX512F__)
+#define COMPUTE_SIMD_NAMESPACE avx512
+#elif defined(__AVX2__)
+#define COMPUTE_SIMD_NAMESPACE avx2
+#elif defined(__SSE2__)
+#define COMPUTE_SIMD_NAMESPACE sse2
+#else
+#define COMPUTE_SIMD_NAMESPACE scalar
+#endif
+
+namespace Compute
+{
+   /**
+    * Instruction set levels of floatv, from narrowest to widest
+    */
+   enum Isa
+   {
+      ISA_SCALAR,   //< One lane
+      ISA_SSE2,     //< 4 lanes
+      ISA_AVX2,     //< 8 lanes, with FMA
+      ISA_AVX512,   //< 16 lanes, AVX-512F
+      NUM_ISAS
+   };
+
+   // Everything below depends on the instruction set; see the file comment
+   inline namespace COMPUTE_SIMD_NAMESPACE
+   {
+   /**
+    * floatv is a vector of floats and maskv is a vector of booleans, one per
+    * lane. Comparisons of floatv return a maskv, which is used with select().
+    * bits() packs a maskv into an integer with bit i set for lane i, for
+    * loops over the set lanes.
+    *
+    * How to use these classes:
+    * \code
+    * for(size_t i = 0; i < n; i += Compute::floatv::width)
+    * {
+    *    Compute::floatv x = Compute::floatv::load(&in[i]);
+    *    Compute::select(x < 0, -x, x).store(&out[i]);
+    * }
+    * \endcode
+    */
+#if defined(__AVX512F__)
+   struct floatv
+   {
+      static const int width = 16;
+      static const Isa isa   = ISA_AVX512;
+      __m512 v;
+
+      floatv() {}
+      floatv(__m512 x) : v(x) {}
+      floatv(float x)  : v(_mm512_set1_ps(x)) {}
+
+      static floatv load(const float* p)        { return _mm512_loadu_ps(p); }
+      void          store(float* p) const       { _mm512_storeu_ps(p, v); }
+
+      /**
+       * @return (start, start + 1, ..., start + width - 1)
+       */
+      static floatv ramp(float start)
+      {
+         return _mm512_add_ps(_mm512_set1_ps(start),
+                              _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+      }
+   };
+
+   struct maskv
+   {
+      __mmask16 v;
+
+      maskv(__mmask16 x) : v(x) {}
+   };
+
+   inline floatv operator+(floatv a, floatv b)  { return _mm512_add_ps(a.v, b.v); }
+   inline floatv operator-(floatv a, floatv b)  { return _mm512_sub_ps(a.v, b.v); }
+   inline floatv operator*(floatv a, floatv b)  { return _mm512_mul_ps(a.v, b.v); }
+   inline floatv operator/(floatv a, floatv b)  { return _mm512_div_ps(a.v, b.v); }
+   inline floatv operator-(floatv a)            { return _mm512_sub_ps(_mm512_setzero_ps(), a.v); }
+   inline maskv  operator<(floatv a, floatv b)  { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_LT_OQ); }
+   inline maskv  operator>(floatv a, floatv b)  { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_GT_OQ); }
+   inline maskv  operator>=(floatv a, floatv b) { return _mm512_cmp_ps_mask(a.v, b.v, _CMP_GE_OQ); }
+   inline maskv  operator&(maskv a, maskv b)    { return __mmask16(a.v & b.v); }
+   inline maskv  operator|(maskv a, maskv b)    { return __mmask16(a.v | b.v); }
+   inline bool   any(maskv a)                   { return a.v != 0; }
+   inline unsigned bits(maskv a)                { return a.v; }
+   inline floatv min(floatv a, floatv b)        { return _mm512_min_ps(a.v, b.v); }
+   inline floatv max(floatv a, floatv b)        { return _mm512_max_ps(a.v, b.v); }
+   inline floatv floor(floatv a)                { return _mm512_roundscale_ps(a.v, _MM_FROUND_TO_NEG_INF); }
+   inline floatv sqrt(floatv a)                 { return _mm512_sqrt_ps(a.v); }
+
+   /**
+    * Hardware reciprocal square root estimate, about 14 bits
+    */
+   inline floatv rsqrtEstimate(floatv a)        { return _mm512_maskz_rsqrt14_ps(0xFFFF, a.v); }
+
+   /**
+    * @return a where mask is set, b elsewhere
+    */
+   inline floatv select(maskv mask, floatv a, floatv b)
+   {
+      return _mm512_mask_blend_ps(mask.v, b.v, a.v);
+   }
+
+   /**
+    * @return 2^n for integral n in [-126, 127]
+    */
+   inline floatv pow2n(floatv n)
+   {
+      __m512i e = _mm512_add_epi32(_mm512_cvtps_epi32(n.v), _mm512_set1_epi32(127));
+      return _mm512_castsi512_ps(_mm512_slli_epi32(e, 23));
+   }
+
+   /**
+    * Split a positive normal float into m 2^e with m in [1, 2)
+    *
+    * @return m. e gets the exponent as a float
+    */
+   inline floatv splitExponent(floatv a, floatv& e)
+   {
+      e = _mm512_getexp_ps(a.v);
+      return _mm512_getmant_ps(a.v, _MM_MANT_NORM_1_2, _MM_MANT_SIGN_src);
+   }
+
+#elif defined(__AVX2__)
+   struct floatv
+   {
+      static const int width = 8;
+      static const Isa isa   = ISA_AVX2;
+      __m256 v;
+
+      floatv() {}
+      floatv(__m256 x) : v(x) {}
+      floatv(float x)  : v(_mm256_set1_ps(x)) {}
+
+      static floatv load(const float* p)        { return _mm256_loadu_ps(p); }
+      void          store(float* p) const       { _mm256_storeu_ps(p, v); }
+
+      /**
+       * @return (start, start + 1, ..., start + width - 1)
+       */
+      static floatv ramp(float start)
+      {
+         return _mm256_add_ps(_mm256_set1_ps(start), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7));
+      }
+   };
+
+   struct maskv
+   {
+      __m256 v;
+
+      maskv(__m256 x) : v(x) {}
+   };
+
+   inline floatv operator+(floatv a, floatv b)  { return _mm256_add_ps(a.v, b.v); }
+   inline floatv operator-(floatv a, floatv b)  { return _mm256_sub_ps(a.v, b.v); }
+   inline floatv operator*(floatv a, floatv b)  { return _mm256_mul_ps(a.v, b.v); }
+   inline floatv operator/(floatv a, floatv b)  { return _mm256_div_ps(a.v, b.v); }
+   inline floatv operator-(floatv a)            { return _mm256_xor_ps(a.v, _mm256_set1_ps(-0.0f)); }
+   inline maskv  operator<(floatv a, floatv b)  { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+   inline maskv  operator>(floatv a, floatv b)  { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+   inline maskv  operator>=(floatv a, floatv b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+   inline maskv  operator&(maskv a, maskv b)    { return _mm256_and_ps(a.v, b.v); }
+   inline maskv  operator|(maskv a, maskv b)    { return _mm256_or_ps(a.v, b.v); }
+   inline bool   any(maskv a)                   { return _mm256_movemask_ps(a.v) != 0; }
+   inline unsigned bits(maskv a)                { return _mm256_movemask_ps(a.v); }
+   inline floatv min(floatv a, floatv b)        { return _mm256_min_ps(a.v, b.v); }
+   inline floatv max(floatv a, floatv b)        { return _mm256_max_ps(a.v, b.v); }
+   inline floatv floor(floatv a)                { return _mm256_floor_ps(a.v); }
+   inline floatv sqrt(floatv a)                 { return _mm256_sqrt_ps(a.v); }
+
+   /**
+    * Hardware reciprocal square root estimate, about 12 bits
+    */
+   inline floatv rsqrtEstimate(floatv a)        { return _mm256_rsqrt_ps(a.v); }
+
+   /**
+    * @return a where mask is set, b elsewhere
+    */
+   inline floatv select(maskv mask, floatv a, floatv b)
+   {
+      return _mm256_blendv_ps(b.v, a.v, mask.v);
+   }
+
+   /**
+    * @return 2^n for integral n in [-126, 127]
+    */
+   inline floatv pow2n(floatv n)
+   {
+      __m256i e = _mm256_add_epi32(_mm256_cvtps_epi32(n.v), _mm256_set1_epi32(127));
+      return _mm256_castsi256_ps(_mm256_slli_epi32(e, 23));
+   }
+
+   /**
+    * Split a positive normal float into m 2^e with m in [1, 2)
+    *
+    * @return m. e gets the exponent as a float
+    */
+   inline floatv splitExponent(floatv a, floatv& e)
+   {
+      __m256i bits = _mm256_castps_si256(a.v);
+      e = _mm256_cvtepi32_ps(_mm256_sub_epi32(_mm256_srli_epi32(bits, 23), _mm256_set1_epi32(127)));
+      bits = _mm256_or_si256(_mm256_and_si256(bits, _mm256_set1_epi32(0x007FFFFF)), _mm256_set1_epi32(0x3F800000));
+      return _mm256_castsi256_ps(bits);
+   }
+
+#elif defined(__SSE2__)
+   struct floatv
+   {
+      static const int width = 4;
+      static const Isa isa   = ISA_SSE2;
+      __m128 v;
+
+      floatv() {}
+      floatv(__m128 x) : v(x) {}
+      floatv(float x)  : v(_mm_set1_ps(x)) {}
+
+      static floatv load(const float* p)        { return _mm_loadu_ps(p); }
+      void          store(float* p) const       { _mm_storeu_ps(p, v); }
+
+      /**
+       * @return (start, start + 1, ..., start + width - 1)
+       */
+      static floatv ramp(float start)
+      {
+         return _mm_add_ps(_mm_set1_ps(start), _mm_setr_ps(0, 1, 2, 3));
+      }
+   };
+
+   struct maskv
+   {
+      __m128 v;
+
+      maskv(__m128 x) : v(x) {}
+   };
+
+   inline floatv operator+(floatv a, floatv b)  { return _mm_add_ps(a.v, b.v); }
+   inline floatv operator-(floatv a, floatv b)  { return _mm_sub_ps(a.v, b.v); }
+   inline floatv operator*(floatv a, floatv b)  { return _mm_mul_ps(a.v, b.v); }
+   inline floatv operator/(floatv a, floatv b)  { return _mm_div_ps(a.v, b.v); }
+   inline floatv operator-(floatv a)            { return _mm_xor_ps(a.v, _mm_set1_ps(-0.0f)); }
+   inline maskv  operator<(floatv a, floatv b)  { return _mm_cmplt_ps(a.v, b.v); }
+   inline maskv  operator>(floatv a, floatv b)  { return _mm_cmpgt_ps(a.v, b.v); }
+   inline maskv  operator>=(floatv a, floatv b) { return _mm_cmpge_ps(a.v, b.v); }
+   inline maskv  operator&(maskv a, maskv b)    { return _mm_and_ps(a.v, b.v); }
+   inline maskv  operator|(maskv a, maskv b)    { return _mm_or_ps(a.v, b.v); }
+   inline bool   any(maskv a)                   { return _mm_movemask_ps(a.v) != 0; }
+   inline unsigned bits(maskv a)                { return _mm_movemask_ps(a.v); }
+   inline floatv min(floatv a, floatv b)        { return _mm_min_ps(a.v, b.v); }
+   inline floatv max(floatv a, floatv b)        { return _mm_max_ps(a.v, b.v); }
+   inline floatv sqrt(floatv a)                 { return _mm_sqrt_ps(a.v); }
+
+   /**
+    * Hardware reciprocal square root estimate, about 12 bits
+    */
+   inline floatv rsqrtEstimate(floatv a)        { return _mm_rsqrt_ps(a.v); }
+
+   /**
+    * @return a where mask is set, b elsewhere
+    */
+   inline floatv select(maskv mask, floatv a, floatv b)
+   {
+      return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v));
+   }
+
+   /**
+    * SSE2 has no floor instruction. Truncate and correct the negative values
+    */
+   inline floatv floor(floatv a)
+   {
+      floatv t = _mm_cvtepi32_ps(_mm_cvttps_epi32(a.v));
+      return t - select(a < t, floatv(1.0f), floatv(0.0f));
+   }
+
+   /**
+    * @return 2^n for integral n in [-126, 127]
+    */
+   inline floatv pow2n(floatv n)
+   {
+      __m128i e = _mm_add_epi32(_mm_cvtps_epi32(n.v), _mm_set1_epi32(127));
+      return _mm_castsi128_ps(_mm_slli_epi32(e, 23));
+   }
+
+   /**
+    * Split a positive normal float into m 2^e with m in [1, 2)
+    *
+    * @return m. e gets the exponent as a float
+    */
+   inline floatv splitExponent(floatv a, floatv& e)
+   {
+      __m128i bits = _mm_castps_si128(a.v);
+      e = _mm_cvtepi32_ps(_mm_sub_epi32(_mm_srli_epi32(bits, 23), _mm_set1_epi32(127)));
+      bits = _mm_or_si128(_mm_and_si128(bits, _mm_set1_epi32(0x007FFFFF)), _mm_set1_epi32(0x3F800000));
+      return _mm_castsi128_ps(bits);
+   }
+
+#else
+   struct floatv
+   {
+      static const int width = 1;
+      static const Isa isa   = ISA_SCALAR;
+      float v;
+
+      floatv() {}
+      floatv(float x) : v(x) {}
+
+      static floatv load(const float* p)        { return *p; }
+      void          store(float* p) const       { *p = v; }
+
+      /**
+       * @return start
+       */
+      static floatv ramp(float start)
+      {
+         return start;
+      }
+   };
+
+   struct maskv
+   {
+      bool v;
+
+      explicit maskv(bool x) : v(x) {}
+   };
+
+   inline floatv operator+(floatv a, floatv b)  { return a.v + b.v; }
+   inline floatv operator-(floatv a, floatv b)  { return a.v - b.v; }
+   inline floatv operator*(floatv a, floatv b)  { return a.v * b.v; }
+   inline floatv operator/(floatv a, floatv b)  { return a.v / b.v; }
+   inline floatv operator-(floatv a)            { return -a.v; }
+   inline maskv  operator<(floatv a, floatv b)  { return maskv(a.v < b.v); }
+   inline maskv  operator>(floatv a, floatv b)  { return maskv(a.v > b.v); }
+   inline maskv  operator>=(floatv a, floatv b) { return maskv(a.v >= b.v); }
+   inline maskv  operator&(maskv a, maskv b)    { return maskv(a.v && b.v); }
+   inline maskv  operator|(maskv a, maskv b)    { return maskv(a.v || b.v); }
+   inline bool   any(maskv a)                   { return a.v; }
+   inline unsigned bits(maskv a)                { return a.v ? 1 : 0; }
+   inline floatv min(floatv a, floatv b)        { return a.v < b.v ? a.v : b.v; }
+   inline floatv max(floatv a, floatv b)        { return a.v > b.v ? a.v : b.v; }
+   inline floatv floor(floatv a)                { return floorf(a.v); }
+   inline floatv sqrt(floatv a)                 { return sqrtf(a.v); }
+   inline floatv rsqrtEstimate(floatv a)        { return 1.0f / sqrtf(a.v); }
+
+   /**
+    * @return a where mask is set, b elsewhere
+    */
+   inline floatv select(maskv mask, floatv a, floatv b)
+   {
+      return mask.v ? a : b;
+   }
+
+   /**
+    * @return 2^n for integral n in [-126, 127]
+    */
+   inline floatv pow2n(floatv n)
+   {
+      return ldexpf(1.0f, int(n.v));
+   }
+
+   /**
+    * Split a positive normal float into m 2^e with m in [1, 2)
+    *
+    * @return m. e gets the exponent as a float
+    */
+   inline floatv splitExponent(floatv a, floatv& e)
+   {
+      int exponent;
+      float m = frexpf(a.v, &exponent);
+      e = float(exponent - 1);
+      return 2.0f * m;
+   }
+#endif
+   }
+}
+
+#endif
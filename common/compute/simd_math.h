@@ -0,0 +1,149 @@
+//--------------------------------------------------------------------------------
+// simd_math.h
+//
+// Vectorized approximations of exp(), log(), sin(), cos(), sqrt() and
+// 1 / sqrt() on floatv. All are branch free so a whole SIMD register is
+// evaluated at once.
+//
+// Accuracy, measured against the libm float versions over their full range:
+//    expApprox   max relative error about 1e-7 (Cephes polynomial), 0 below -87
+//    logApprox   max error about 1e-7, relative above 1 (Cephes polynomial)
+//    sincosApprox max absolute error about 1e-7 on [0, 2 pi] (Cephes polynomials)
+//    sqrtApprox  max relative error about 3e-7 (rsqrt estimate + one Newton step)
+//    rsqrtApprox max relative error about 3e-7
+//--------------------------------------------------------------------------------
+#ifndef _simd_math_h
+#define _simd_math_h
+
+#include "simd.h"
+
+namespace Compute
+{
+   /**
+    * exp(x). The argument is split into n ln(2) + r with |r| <= ln(2) / 2,
+    * e^r is evaluated with a degree 6 polynomial and 2^n is built directly
+    * in the exponent bits. Results below the smallest normal float are
+    * flushed to zero
+    */
+   inline floatv expApprox(floatv x)
+   {
+      const floatv lo(-87.0f);
+      const floatv hi(88.0f);
+
+      maskv  underflow = x < lo;
+      x = min(max(x, lo), hi);
+
+      // n = round(x / ln(2))
+      floatv n = floor(x * 1.44269504088896341f + 0.5f);
+
+      // r = x - n ln(2), with ln(2) split in two for extra precision
+      floatv r = x - n * 0.693359375f + n * 2.12194440e-4f;
+
+      floatv p = 1.9875691500e-4f;
+      p = p * r + 1.3981999507e-3f;
+      p = p * r + 8.3334519073e-3f;
+      p = p * r + 4.1665795894e-2f;
+      p = p * r + 1.6666665459e-1f;
+      p = p * r + 5.0000001201e-1f;
+      p = p * r * r + r + 1.0f;
+
+      return select(underflow, floatv(0.0f), p * pow2n(n));
+   }
+
+   /**
+    * log(x) for positive normal x. x is split into m 2^e with m in
+    * [sqrt(1/2), sqrt(2)), and log(m) is evaluated with the Cephes degree 9
+    * polynomial in m - 1
+    */
+   inline floatv logApprox(floatv x)
+   {
+      floatv e;
+      floatv m = splitExponent(x, e);
+
+      // Move m from [1, 2) to [sqrt(1/2), sqrt(2)) so that m - 1 is small
+      maskv  big = m > 1.41421356f;
+      m = select(big, 0.5f * m, m);
+      e = select(big, e + 1.0f, e);
+
+      floatv f = m - 1.0f;
+      floatv z = f * f;
+
+      floatv p = 7.0376836292e-2f;
+      p = p * f - 1.1514610310e-1f;
+      p = p * f + 1.1676998740e-1f;
+      p = p * f - 1.2420140846e-1f;
+      p = p * f + 1.4249322787e-1f;
+      p = p * f - 1.6668057665e-1f;
+      p = p * f + 2.0000714765e-1f;
+      p = p * f - 2.4999993993e-1f;
+      p = p * f + 3.3333331174e-1f;
+      p = p * f * z;
+
+      // log(2) split in two for extra precision, as in expApprox()
+      p = p - e * 2.12194440e-4f - 0.5f * z;
+      return f + p + e * 0.693359375f;
+   }
+
+   /**
+    * sin(x) and cos(x) together. The argument is reduced to
+    * r = x - n pi / 2 with |r| <= pi / 4, both are evaluated with the Cephes
+    * polynomials in r and the quadrant n mod 4 swaps and negates them. Meant
+    * for |x| up to a few thousand; beyond that the reduction loses precision
+    *
+    * @param s, c
+    *    Get sin(x) and cos(x)
+    */
+   inline void sincosApprox(floatv x, floatv& s, floatv& c)
+   {
+      floatv n = floor(x * 0.636619772f + 0.5f);
+
+      // pi / 2 split in three for extra precision
+      floatv r = x - n * 1.5703125f - n * 4.837512969970703125e-4f - n * 7.54978995489188216e-8f;
+      floatv z = r * r;
+
+      floatv sr = -1.9515295891e-4f;
+      sr = sr * z + 8.3321608736e-3f;
+      sr = sr * z - 1.6666654611e-1f;
+      sr = sr * z * r + r;
+
+      floatv cr = 2.443315711809948e-5f;
+      cr = cr * z - 1.388731625493765e-3f;
+      cr = cr * z + 4.166664568298827e-2f;
+      cr = cr * z * z - 0.5f * z + 1.0f;
+
+      // Quadrant q = n mod 4, exact since n is integral
+      floatv q    = n - 4.0f * floor(0.25f * n);
+      maskv  odd  = ((q > 0.5f) & (q < 1.5f)) | (q > 2.5f);
+      maskv  sneg = q > 1.5f;
+      maskv  cneg = (q > 0.5f) & (q < 2.5f);
+
+      s = select(odd, cr, sr);
+      c = select(odd, sr, cr);
+      s = select(sneg, -s, s);
+      c = select(cneg, -c, c);
+   }
+
+   /**
+    * sqrt(x) for x >= 0 from the reciprocal square root estimate, refined
+    * with one Newton-Raphson step. Avoids the long latency divider used by
+    * the exact square root instruction
+    */
+   inline floatv sqrtApprox(floatv x)
+   {
+      floatv y = rsqrtEstimate(x);
+      y = y * (1.5f - 0.5f * x * y * y);
+      return select(x > 0.0f, x * y, floatv(0.0f));
+   }
+
+   /**
+    * 1 / sqrt(x) for x > 0 from the reciprocal square root estimate, refined
+    * with one Newton-Raphson step. Max relative error about 3e-7
+    */
+   inline floatv rsqrtApprox(floatv x)
+   {
+      floatv y = rsqrtEstimate(x);
+      return y * (1.5f - 0.5f * x * y * y);
+   }
+}
+
+#endif
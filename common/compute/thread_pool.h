@@ -0,0 +1,284 @@
+//--------------------------------------------------------------------------------
+// thread_pool.h
+//
+// Persistent worker threads for parallel loops. Starting a std::thread per
+// range costs tens of microseconds, which is more than a whole particle update
+// of a small system, so the workers are started once and woken for each job.
+//--------------------------------------------------------------------------------
+#ifndef _thread_pool_h
+#define _thread_pool_h
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+#include "trace.h"
+
+namespace Compute
+{
+   /**
+    * @return the number of hardware threads, at least 1
+    */
+   inline unsigned int defaultThreadCount()
+   {
+      unsigned int count = std::thread::hardware_concurrency();
+      return count > 0 ? count : 1;
+   }
+
+   /**
+    * A fixed set of worker threads that process numbered chunks of a job.
+    * Chunks are handed out dynamically through an atomic counter, so a thread
+    * that finishes early takes more chunks instead of idling. The calling
+    * thread works on the job too.
+    *
+    * A job submitted from inside a worker, or while another thread's job is
+    * running, is run serially on the calling thread rather than waiting.
+    *
+    * How to use this class:
+    * \code
+    * Compute::ThreadPool& pool = Compute::ThreadPool::instance();
+    * pool.run(numChunks, [&](size_t chunk)
+    * {
+    *    process(chunk * chunkSize, std::min(n, (chunk + 1) * chunkSize));
+    * });
+    * \endcode
+    */
+   class ThreadPool
+   {
+   public:
+      /**
+       * Constructor
+       *
+       * @param numThreads
+       *    Number of threads working on a job, including the caller
+       */
+      explicit ThreadPool(unsigned int numThreads = defaultThreadCount())
+      :  _job        (NULL)
+      ,  _numChunks  (0)
+      ,  _nextChunk  (0)
+      ,  _active     (0)
+      ,  _generation (0)
+      ,  _quit       (false)
+      {
+         start(numThreads);
+      }
+
+      /**
+       * Destructor. Stops the workers
+       */
+      ~ThreadPool()
+      {
+         stop();
+      }
+
+      /**
+       * @return the pool shared by the parallel loops
+       */
+      static ThreadPool& instance()
+      {
+         static ThreadPool pool;
+         return pool;
+      }
+
+      /**
+       * @return the number of threads working on a job, including the caller
+       */
+      unsigned int getNumThreads() const
+      {
+         return static_cast<unsigned int>(_workers.size()) + 1;
+      }
+
+      /**
+       * Restart the pool with a different number of threads. Must not be
+       * called while a job is running
+       *
+       * @param numThreads
+       *    Number of threads working on a job, including the caller
+       */
+      void setNumThreads(unsigned int numThreads)
+      {
+         stop();
+         start(numThreads);
+      }
+
+      /**
+       * Run body(chunk) for every chunk in [0, numChunks) and return when all
+       * chunks are done. body must not throw
+       *
+       * @param numChunks
+       *    Number of chunks in the job
+       * @param body
+       *    Callable with signature void(size_t chunk)
+       */
+      template<typename Function>
+      void run(size_t numChunks, Function body)
+      {
+         if(numChunks == 0)
+         {
+            return;
+         }
+
+         // A job that runs a nested job would otherwise try_lock() _submit on
+         // the thread that already holds it
+         if(_workers.empty() || numChunks == 1 || isWorker() || inJob() || !_submit.try_lock())
+         {
+            for(size_t chunk = 0; chunk < numChunks; ++chunk)
+            {
+               body(chunk);
+            }
+            return;
+         }
+
+         std::lock_guard<std::mutex> submit(_submit, std::adopt_lock);
+         std::function<void(size_t)> job(body);
+
+         {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _job       = &job;
+            _numChunks = numChunks;
+            _nextChunk = 0;
+            _active    = _workers.size();
+            ++_generation;
+         }
+         _wake.notify_all();
+
+         work(job, numChunks);
+
+         std::unique_lock<std::mutex> lock(_mutex);
+         while(_active > 0)
+         {
+            _done.wait(lock);
+         }
+         _job = NULL;
+      }
+
+   private:
+      // Not copyable
+      ThreadPool(const ThreadPool&);
+      ThreadPool& operator=(const ThreadPool&);
+
+      /**
+       * @return true on the pool's worker threads
+       */
+      static bool& isWorker()
+      {
+         static thread_local bool worker = false;
+         return worker;
+      }
+
+      /**
+       * @return true while this thread runs chunks of a job
+       */
+      static bool& inJob()
+      {
+         static thread_local bool running = false;
+         return running;
+      }
+
+      /**
+       * Start numThreads - 1 workers
+       */
+      void start(unsigned int numThreads)
+      {
+         _quit = false;
+         for(unsigned int i = 1; i < numThreads; ++i)
+         {
+            _workers.push_back(std::thread(&ThreadPool::workerLoop, this, _generation));
+         }
+      }
+
+      /**
+       * Stop and join the workers
+       */
+      void stop()
+      {
+         {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _quit = true;
+         }
+         _wake.notify_all();
+
+         for(size_t i = 0; i < _workers.size(); ++i)
+         {
+            _workers[i].join();
+         }
+         _workers.clear();
+      }
+
+      /**
+       * Claim chunks until none are left. Traced as one event per thread
+       * and job, which shows when each thread joined and left the job
+       */
+      void work(const std::function<void(size_t)>& job, size_t numChunks)
+      {
+         ScopedTrace trace("ThreadPool job");
+         inJob() = true;
+         size_t chunk;
+         while((chunk = _nextChunk.fetch_add(1)) < numChunks)
+         {
+            job(chunk);
+         }
+         inJob() = false;
+      }
+
+      /**
+       * Worker thread body. Sleeps until a new job is posted
+       *
+       * @param seen
+       *    The job generation when the worker was started. Passed in rather
+       *    than read here so that a job posted before the thread runs is not
+       *    missed
+       */
+      void workerLoop(uint64_t seen)
+      {
+         isWorker() = true;
+         Tracer::setThreadName("pool worker");
+
+         std::unique_lock<std::mutex> lock(_mutex);
+         for(;;)
+         {
+            while(!_quit && _generation == seen)
+            {
+               _wake.wait(lock);
+            }
+            if(_quit)
+            {
+               return;
+            }
+            seen = _generation;
+
+            const std::function<void(size_t)>* job = _job;
+            size_t numChunks = _numChunks;
+            lock.unlock();
+
+            work(*job, numChunks);
+
+            lock.lock();
+            if(--_active == 0)
+            {
+               _done.notify_one();
+            }
+         }
+      }
+
+      std::vector<std::thread> _workers;     //< Worker threads, one less than getNumThreads()
+      std::mutex              _submit;       //< Held by the thread whose job is running
+      std::mutex              _mutex;        //< Protects the job description below
+      std::condition_variable _wake;         //< Signals a new job or shutdown to the workers
+      std::condition_variable _done;         //< Signals the submitter that the workers finished
+      const std::function<void(size_t)>* _job; //< Current job
+      size_t                  _numChunks;    //< Number of chunks in the current job
+      std::atomic<size_t>     _nextChunk;    //< Next unclaimed chunk
+      size_t                  _active;       //< Workers still working on the current job
+      uint64_t                _generation;   //< Incremented for every job
+      bool                    _quit;         //< Set to stop the workers
+   };
+}
+
+#endif
@@ -0,0 +1,386 @@
+//--------------------------------------------------------------------------------
+// trace.h
+//
+// Timeline tracer. Scoped events record when each stage of a frame ran and on
+// which thread, and the timeline is written as Chrome trace_event JSON, which
+// chrome://tracing and https://ui.perfetto.dev open. Unlike the phase
+// histograms, a timeline shows what else was running when a frame took long.
+//
+// Each thread writes to its own ring of the most recent events, so recording
+// takes no locks and threads never contend. Tracing is off until enable() is
+// called; until then a scoped event costs one relaxed atomic load.
+//--------------------------------------------------------------------------------
+#ifndef _trace_h
+#define _trace_h
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <stdint.h>
+
+namespace Compute
+{
+   /**
+    * Records trace events from every thread and writes them as Chrome
+    * trace_event JSON. Event names must be string literals, or otherwise
+    * outlive the tracer: only the pointer is stored.
+    *
+    * Each thread has a ring of RING_SIZE events, which is registered the
+    * first time the thread records an event. The owning thread is the only
+    * writer; it fills a slot and then publishes it by advancing the ring's
+    * head. write() reads the heads and copies the slots, so it can run while
+    * other threads record. Rings that wrapped keep the most recent events.
+    * Events recorded while write() runs can be lost: the slots they overwrite
+    * are left out rather than written half updated.
+    *
+    * The file is written when the program exits, and whenever poll() finds
+    * that the trace signal arrived. Writing is not async-signal-safe, so the
+    * signal handler only sets a flag.
+    *
+    * How to use this class:
+    * \code
+    * Compute::Tracer::instance().enable("trace.json");
+    * Compute::Tracer::instance().installSignalHandler(SIGUSR1);
+    * while(running)
+    * {
+    *    {
+    *       Compute::ScopedTrace trace("update");
+    *       update();
+    *    }
+    *    Compute::Tracer::instance().poll();
+    * }
+    * \endcode
+    */
+   class Tracer
+   {
+   public:
+      static const size_t RING_SIZE = 1 << 16;
+
+      typedef std::chrono::steady_clock Clock;
+
+      /**
+       * @return the tracer shared by the whole program
+       */
+      static Tracer& instance()
+      {
+         static Tracer tracer;
+         return tracer;
+      }
+
+      /**
+       * Start recording. The trace is written to filename when the program
+       * exits through exit() or by returning from main(). The calling
+       * thread is named "main" in the trace
+       *
+       * @param filename
+       *    Output file
+       */
+      void enable(const std::string& filename)
+      {
+         _filename   = filename;
+         _mainThread = std::this_thread::get_id();
+         if(!_atExit)
+         {
+            std::atexit(writeAtExit);
+            _atExit = true;
+         }
+         _enabled.store(true, std::memory_order_release);
+      }
+
+      /**
+       * @return true if events are being recorded
+       */
+      bool enabled() const
+      {
+         return _enabled.load(std::memory_order_relaxed);
+      }
+
+      /**
+       * Write the trace whenever signum arrives, at the next poll(). For
+       * example kill -USR1 with SIGUSR1
+       */
+      void installSignalHandler(int signum)
+      {
+         std::signal(signum, requestWrite);
+      }
+
+      /**
+       * Write the trace if the signal arrived since the last call. Call
+       * this once per frame
+       */
+      void poll()
+      {
+         if(writeRequested())
+         {
+            writeRequested() = 0;
+            write();
+         }
+      }
+
+      /**
+       * @return microseconds since the tracer was created
+       */
+      double now() const
+      {
+         return std::chrono::duration<double, std::micro>(Clock::now() - _start).count();
+      }
+
+      /**
+       * Name the calling thread in the trace. Takes effect if the thread
+       * has not recorded an event yet; costs nothing otherwise, so threads
+       * can name themselves whether or not tracing is on
+       *
+       * @param name
+       *    Name of the thread. Must be a string literal
+       */
+      static void setThreadName(const char* name)
+      {
+         threadName() = name;
+      }
+
+      /**
+       * Record an event on the calling thread
+       *
+       * @param name
+       *    Name of the event, see the class comment
+       * @param begin, end
+       *    Start and end time from now()
+       */
+      void record(const char* name, double begin, double end)
+      {
+         Ring&    ring = threadRing();
+         uint64_t head = ring.head.load(std::memory_order_relaxed);
+         Event&   e    = ring.events[head % RING_SIZE];
+         e.name  = name;
+         e.begin = begin;
+         e.end   = end;
+         ring.head.store(head + 1, std::memory_order_release);
+      }
+
+      /**
+       * Write the events of every thread to the file given to enable().
+       * Events that a thread overwrote while they were being copied are
+       * left out
+       */
+      void write()
+      {
+         if(_filename.empty())
+         {
+            return;
+         }
+
+         std::ofstream out(_filename.c_str());
+         if(!out)
+         {
+            fprintf(stderr, "Unable to write trace to %s\n", _filename.c_str());
+            return;
+         }
+
+         std::lock_guard<std::mutex> lock(_mutex);
+         out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[" << std::endl;
+         out << std::fixed << std::setprecision(3);
+         bool first = true;
+         for(size_t t = 0; t < _rings.size(); ++t)
+         {
+            const Ring& ring = *_rings[t];
+            out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << t
+                << ",\"args\":{\"name\":\"" << ring.name << "\"}}";
+            first = false;
+
+            uint64_t head  = ring.head.load(std::memory_order_acquire);
+            uint64_t begin = head > RING_SIZE ? head - RING_SIZE : 0;
+            std::vector<Event> events;
+            events.reserve(size_t(head - begin));
+            for(uint64_t i = begin; i < head; ++i)
+            {
+               events.push_back(ring.events[i % RING_SIZE]);
+            }
+
+            // Slots below the new head minus the ring size may have been
+            // reused while they were copied. The owner may also be writing
+            // slot after % RING_SIZE right now, which is the slot of event
+            // after - RING_SIZE, so that one is dropped too
+            uint64_t after = ring.head.load(std::memory_order_acquire);
+            uint64_t valid = after + 1 > RING_SIZE ? after + 1 - RING_SIZE : 0;
+            for(uint64_t i = std::max(begin, valid); i < head; ++i)
+            {
+               const Event& e = events[size_t(i - begin)];
+               out << ",\n{\"name\":\"" << e.name << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << t
+                   << ",\"ts\":" << e.begin << ",\"dur\":" << e.end - e.begin << "}";
+            }
+         }
+         out << std::endl << "]}" << std::endl;
+         out.unsetf(std::ios::floatfield);
+      }
+
+   private:
+      /**
+       * One event
+       */
+      struct Event
+      {
+         const char* name;    //< Name, not owned
+         double      begin;   //< Start in microseconds since the tracer was created
+         double      end;     //< End in microseconds since the tracer was created
+      };
+
+      /**
+       * The events of one thread
+       */
+      struct Ring
+      {
+         std::vector<Event>    events;   //< RING_SIZE slots
+         std::atomic<uint64_t> head;     //< Number of events recorded; the next slot is head % RING_SIZE
+         std::string           name;     //< Thread name in the trace
+
+         Ring()
+         :  events (RING_SIZE)
+         ,  head   (0)
+         {
+         }
+      };
+
+      /**
+       * Constructor. Recording is off until enable() is called
+       */
+      Tracer()
+      :  _enabled (false)
+      ,  _atExit  (false)
+      ,  _start   (Clock::now())
+      {
+      }
+
+      /**
+       * Destructor. Frees the rings
+       */
+      ~Tracer()
+      {
+         for(size_t t = 0; t < _rings.size(); ++t)
+         {
+            delete _rings[t];
+         }
+      }
+
+      // Not copyable
+      Tracer(const Tracer&);
+      Tracer& operator=(const Tracer&);
+
+      /**
+       * @return the calling thread's ring, registering it on first use.
+       *    Rings of threads that have exited are kept, so that their
+       *    events are still written
+       */
+      Ring& threadRing()
+      {
+         static thread_local Ring* ring = NULL;
+         if(ring == NULL)
+         {
+            ring = new Ring;
+            std::lock_guard<std::mutex> lock(_mutex);
+            if(threadName() != NULL)
+            {
+               ring->name = threadName();
+            }
+            else
+            {
+               ring->name = std::this_thread::get_id() == _mainThread ? "main" : "thread " + std::to_string(_rings.size());
+            }
+            _rings.push_back(ring);
+         }
+         return *ring;
+      }
+
+      /**
+       * @return the name given to setThreadName() on the calling thread
+       */
+      static const char*& threadName()
+      {
+         static thread_local const char* name = NULL;
+         return name;
+      }
+
+      /**
+       * @return the flag set by the signal handler
+       */
+      static volatile sig_atomic_t& writeRequested()
+      {
+         static volatile sig_atomic_t requested = 0;
+         return requested;
+      }
+
+      /**
+       * Signal handler
+       */
+      static void requestWrite(int)
+      {
+         writeRequested() = 1;
+      }
+
+      /**
+       * atexit() handler
+       */
+      static void writeAtExit()
+      {
+         instance().write();
+      }
+
+      std::atomic<bool>    _enabled;    //< true if events are recorded
+      bool                 _atExit;     //< true once the exit handler is registered
+      std::string          _filename;   //< Output file
+      std::thread::id      _mainThread; //< Thread that called enable()
+      Clock::time_point    _start;      //< Time zero of the trace
+      std::mutex           _mutex;      //< Protects _rings and the thread names
+      std::vector<Ring*>   _rings;      //< Ring of every thread that recorded an event
+   };
+
+   /**
+    * Records the enclosing scope as one event on the calling thread. Does
+    * nothing unless the Tracer is enabled
+    */
+   class ScopedTrace
+   {
+   public:
+      /**
+       * Constructor. Notes the start time
+       *
+       * @param name
+       *    Name of the event. Must be a string literal
+       */
+      explicit ScopedTrace(const char* name)
+      :  _name  (Tracer::instance().enabled() ? name : NULL)
+      ,  _begin (_name != NULL ? Tracer::instance().now() : 0)
+      {
+      }
+
+      /**
+       * Destructor. Records the event
+       */
+      ~ScopedTrace()
+      {
+         if(_name != NULL)
+         {
+            Tracer& tracer = Tracer::instance();
+            tracer.record(_name, _begin, tracer.now());
+         }
+      }
+
+   private:
+      ScopedTrace(const ScopedTrace&);
+      ScopedTrace& operator=(const ScopedTrace&);
+
+      const char* _name;    //< Name of the event, NULL if tracing was off
+      double      _begin;   //< Start time from Tracer::now()
+   };
+}
+
+#endif
@@ -0,0 +1,58 @@
+//--------------------------------------------------------------------------------
+// glsl_cpp.h
+//
+// Prelude of the kernels that are compiled both as GLSL and as C++. The
+// shaders #include the kernels (GL::Shader expands the #include lines, GLSL
+// has none), and the CPU code includes them like any other header, so both
+// run the same source.
+//
+// A kernel sticks to the subset the two languages share, with the glm names
+// for the GLSL types and functions:
+//
+//    - vec2, vec3, vec4, float and int; structs without constructors
+//    - length, normalize, dot and clamp
+//    - no in/out/inout parameters and no C++ references; results are
+//      returned
+//    - no swizzles beyond .x, .y, .z and .w
+//    - float literals with an f suffix, so that C++ does not promote to
+//      double; GLSL 1.30 and later accept the suffix
+//
+// Functions are declared KERNEL_INLINE, so that C++ can include a kernel in
+// several translation units. In C++ the kernels are in namespace Kernels,
+// between KERNELS_BEGIN and KERNELS_END. A parameter that a kernel keeps for
+// the shaders' signature but does not read is marked KERNEL_UNUSED, which
+// keeps C++ from warning about it.
+//--------------------------------------------------------------------------------
+#ifndef _glsl_cpp_h
+#define _glsl_cpp_h
+
+#ifdef __cplusplus
+
+#include <glm/glm.hpp>
+
+#define KERNEL_INLINE inline
+#define KERNELS_BEGIN namespace Kernels {
+#define KERNELS_END }
+#define KERNEL_UNUSED(x) (void) (x)
+
+namespace Kernels
+{
+   using glm::vec2;
+   using glm::vec3;
+   using glm::vec4;
+   using glm::length;
+   using glm::normalize;
+   using glm::dot;
+   using glm::clamp;
+}
+
+#else
+
+#define KERNEL_INLINE
+#define KERNELS_BEGIN
+#define KERNELS_END
+#define KERNEL_UNUSED(x)
+
+#endif
+
+#endif
@@ -0,0 +1,60 @@
+//--------------------------------------------------------------------------------
+// lb_collision.h
+//
+// Collision step of the lattice Boltzmann shallow water model of lb_waves
+// (ca_update_frag.c). Written in the common subset of GLSL and C++ (see
+// glsl_cpp.h), so that a CPU lattice runs the same collision as the shader.
+//
+// A site has five mass flows: f_0 at rest and f_1 to f_4 to the right,
+// left, up and down. The shader keeps them in two RGBA texels,
+// mf0 = [f_0, f_1, f_2, f_3] and mf1 = [f_4, k, unused, unused].
+//--------------------------------------------------------------------------------
+#ifndef _lb_collision_h
+#define _lb_collision_h
+
+#include "glsl_cpp.h"
+
+KERNELS_BEGIN
+
+/**
+ * Collision constant K of a site
+ *
+ * @param lambda      Lattice site spacing in meters
+ * @param timeStep    Length of the time step in seconds
+ * @param waveNumber  Wave number k of the site
+ */
+KERNEL_INLINE float collisionK(float lambda, float timeStep, float waveNumber)
+{
+   // Gravitational acceleration
+   float g = 9.81f;
+
+   // Velocity is lattice site spacing (meters) divided by length of time step (seconds)
+   float v = lambda / timeStep;
+   return g / (v * v * waveNumber);
+}
+
+/**
+ * Dots row omega_i with the mass flow.
+ */
+KERNEL_INLINE float dotOmegaMass0(float k, const vec4 mf0, const vec4 mf1)
+{
+   float b = -4.0f * k;
+   float c =  2.0f - b;
+   return b * mf0.x + c * mf0.y + c * mf0.z + c * mf0.w + c * mf1.x;
+}
+
+KERNEL_INLINE float dotOmegaMass1(float k, const vec4 mf0, const vec4 mf1)
+{
+   float a = k - 1.0f;
+   return k * mf0.x + a * mf0.y + a * mf0.z + k * mf0.w + k * mf1.x;
+}
+
+KERNEL_INLINE float dotOmegaMass2(float k, const vec4 mf0, const vec4 mf1)
+{
+   float a = k - 1.0f;
+   return k * mf0.x + k * mf0.y + k * mf0.z + a * mf0.w + a * mf1.x;
+}
+
+KERNELS_END
+
+#endif
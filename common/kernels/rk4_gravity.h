@@ -0,0 +1,123 @@
+//--------------------------------------------------------------------------------
+// rk4_gravity.h
+//
+// RK4 step of a particle in the gravity well at the origin, as run by the
+// update shaders of copy_to_pbo, vertex_texture_fetch and transform_feedback.
+// Written in the common subset of GLSL and C++ (see glsl_cpp.h), so the CPU
+// can run the exact kernel of the GPU and check the GPU backends against it.
+//
+// The CPU engines in common/particles use their own SIMD form of the same
+// step (integrators.h), with GM folded into one constant; ps_bench --validate
+// compares them with this kernel as well.
+//--------------------------------------------------------------------------------
+#ifndef _rk4_gravity_h
+#define _rk4_gravity_h
+
+#include "glsl_cpp.h"
+
+KERNELS_BEGIN
+
+//----------------------------------------------------------------------
+// Structures for passing around position and velocity state
+// and derivatives for use with RK4
+//----------------------------------------------------------------------
+struct Derivative
+{
+   vec3 dx;
+   vec3 dv;
+};
+
+struct State
+{
+   vec3 x;
+   vec3 v;
+};
+
+//----------------------------------------------------------------------
+// Calculate the magnitude of the gravitational force between
+// two masses.
+//
+// Input:  m1 - mass in Kg
+//         m2 - mass in Kg
+//         r  - distance in meters
+//
+// Return: magnitude of attractive force in Newtons
+// floating point ops: 2
+//----------------------------------------------------------------------
+KERNEL_INLINE float gravity(float m1, float m2, float r)
+{
+   float G = 6.67e-11f; // Nm^2/kg^2
+   return G * m1 * m2 / (r * r);
+}
+
+//----------------------------------------------------------------------
+// Calculate the acceleration vector
+//
+// Input:  state - position (m) and velocity (m/s)
+//         t     - time (s)
+//
+// Output: acceleration vector (m/s^2)
+// floating point ops: 6
+//----------------------------------------------------------------------
+KERNEL_INLINE vec3 acceleration(State state, float t)
+{
+   // The well does not move, so the force does not depend on time
+   KERNEL_UNUSED(t);
+
+   float m1 = 9.5e9f;
+   float m2 = 1e5f;
+   float g = gravity(m1, m2, length(state.x));
+   vec3 force = normalize(state.x) * -g;
+
+   // Acceleration vector. F = ma => a = F/m
+   return force / m2;
+}
+
+//----------------------------------------------------------------------
+// RK4 functions
+// floating point ops: 6
+//----------------------------------------------------------------------
+KERNEL_INLINE Derivative evaluate(State initial, float t)
+{
+   Derivative OUT;
+   OUT.dx = initial.v;
+   OUT.dv = acceleration(initial, t);
+   return OUT;
+}
+
+// floating point ops: 11
+KERNEL_INLINE Derivative evaluate(State initial, float t, float dt, Derivative d)
+{
+   State state;
+   state.x = initial.x + d.dx * dt;
+   state.v = initial.v + d.dv * dt;
+
+   Derivative OUT;
+   OUT.dx = state.v;
+   OUT.dv = acceleration(state, t + dt);
+
+   return OUT;
+}
+
+// 6 + 11 + 11 + 11 + 10 + 4 = 53
+KERNEL_INLINE State integrate(State state, float t, float dt)
+{
+   State OUT = state;
+
+   Derivative a = evaluate(state, t);
+   Derivative b = evaluate(state, t, dt * 0.5f, a);
+   Derivative c = evaluate(state, t, dt * 0.5f, b);
+   Derivative d = evaluate(state, t, dt, c);
+
+   vec3 dxdt = 0.166666667f * (a.dx + 2.0f * (b.dx + c.dx) + d.dx);
+   vec3 dvdt = 0.166666667f * (a.dv + 2.0f * (b.dv + c.dv) + d.dv);
+
+   OUT.x = state.x + dxdt * dt;
+   OUT.v = state.v + dvdt * dt;
+
+   return OUT;
+}
+
+KERNELS_END
+
+#endif
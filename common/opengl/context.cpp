@@ -0,0 +1,416 @@
+//--------------------------------------------------------------------------------
+// context.cpp
+//
+// GLFW window and EGL pbuffer contexts.
+//--------------------------------------------------------------------------------
+#include "context.h"
+
+#include "opengl.h"
+#include <GL/glfw.h>
+
+#ifdef HAVE_EGL
+// Keep the X11 headers, and their macros, out of eglplatform.h
+#  define EGL_NO_X11
+#  define MESA_EGL_NO_X11_HEADERS
+#  include <EGL/egl.h>
+#  include <EGL/eglext.h>
+#endif
+
+#include <chrono>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+namespace GL
+{
+   namespace
+   {
+      /**
+       * Load the GL entry points on platforms that use GLEW. Must be called
+       * with the new context current
+       */
+      void loadEntryPoints()
+      {
+#ifndef __APPLE__
+         glewExperimental = GL_TRUE;
+         GLenum err = glewInit();
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+         // GLEW 2 initializes GLX after loading the GL entry points, which
+         // fails without an X display. The entry points are still usable
+         if(err == GLEW_ERROR_NO_GLX_DISPLAY)
+         {
+            err = GLEW_OK;
+         }
+#endif
+         if(err != GLEW_OK)
+         {
+            throw std::runtime_error(std::string("glewInit failed: ") + reinterpret_cast<const char*>(glewGetErrorString(err)));
+         }
+
+         // glewInit() asks for GL_EXTENSIONS, which is an invalid enum in a
+         // core profile. Clear the error so the first GL_ERR_CHECK() does
+         // not report it
+         while(glGetError() != GL_NO_ERROR)
+         {
+         }
+#endif
+      }
+
+      /**
+       * A GLFW window
+       */
+      class WindowContext : public Context
+      {
+      public:
+         /**
+          * Constructor. Opens the window
+          */
+         WindowContext(int width, int height, int samples)
+         {
+            if(!glfwInit())
+            {
+               throw std::runtime_error("Failed to initialize GLFW");
+            }
+
+            // Request an OpenGL core profile context, without backwards compatibility
+            glfwOpenWindowHint(GLFW_OPENGL_VERSION_MAJOR,  3);
+            glfwOpenWindowHint(GLFW_OPENGL_VERSION_MINOR,  2);
+            glfwOpenWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
+            glfwOpenWindowHint(GLFW_OPENGL_PROFILE,        GLFW_OPENGL_CORE_PROFILE);
+            if(samples > 0)
+            {
+               glfwOpenWindowHint(GLFW_FSAA_SAMPLES, samples);
+            }
+
+            // Open a window and create its OpenGL context
+            if(!glfwOpenWindow(width, height, 0, 0, 0, 8, 32, 0, GLFW_WINDOW))
+            {
+               glfwTerminate();
+               throw std::runtime_error("Failed to open GLFW window");
+            }
+            loadEntryPoints();
+         }
+
+         /**
+          * Destructor. Closes the window
+          */
+         virtual ~WindowContext()
+         {
+            glfwTerminate();
+         }
+
+         virtual bool isHeadless() const
+         {
+            return false;
+         }
+
+         virtual void swapBuffers()
+         {
+            glfwSwapBuffers();
+         }
+
+         virtual void setSwapInterval(int interval)
+         {
+            glfwSwapInterval(interval);
+         }
+
+         virtual void getSize(int& width, int& height) const
+         {
+            glfwGetWindowSize(&width, &height);
+         }
+
+         virtual double getTime() const
+         {
+            return glfwGetTime();
+         }
+
+         virtual void waitEvents()
+         {
+            glfwWaitEvents();
+         }
+
+         virtual std::string describe() const
+         {
+            return "GLFW window";
+         }
+      };
+
+#ifdef HAVE_EGL
+      /**
+       * An EGL pbuffer. Mesa's surfaceless platform is used where it exists,
+       * since it needs neither an X server nor a GPU; otherwise the default
+       * display, which on a GPU driver is usually the GPU itself
+       */
+      class HeadlessContext : public Context
+      {
+      public:
+         typedef std::chrono::steady_clock Clock;
+
+         /**
+          * Constructor. Creates the pbuffer and the context
+          */
+         HeadlessContext(int width, int height, int samples)
+         :  _display     (EGL_NO_DISPLAY)
+         ,  _surface     (EGL_NO_SURFACE)
+         ,  _context     (EGL_NO_CONTEXT)
+         ,  _width       (width)
+         ,  _height      (height)
+         ,  _surfaceless (false)
+         ,  _start       (Clock::now())
+         {
+            try
+            {
+               init(samples);
+            }
+            catch(...)
+            {
+               release();
+               throw;
+            }
+         }
+
+         /**
+          * Destructor. Destroys the context and the pbuffer
+          */
+         virtual ~HeadlessContext()
+         {
+            release();
+         }
+
+         virtual bool isHeadless() const
+         {
+            return true;
+         }
+
+         virtual void swapBuffers()
+         {
+            eglSwapBuffers(_display, _surface);
+         }
+
+         virtual void setSwapInterval(int interval)
+         {
+            eglSwapInterval(_display, interval);
+         }
+
+         virtual void getSize(int& width, int& height) const
+         {
+            width  = _width;
+            height = _height;
+         }
+
+         virtual double getTime() const
+         {
+            return std::chrono::duration<double>(Clock::now() - _start).count();
+         }
+
+         virtual void waitEvents()
+         {
+         }
+
+         virtual std::string describe() const
+         {
+            std::ostringstream out;
+            out << "EGL " << _version << " pbuffer" << (_surfaceless ? ", surfaceless platform" : "");
+            return out.str();
+         }
+
+      private:
+         /**
+          * Open the display, then create the pbuffer and the context and make
+          * them current
+          */
+         void init(int samples)
+         {
+            openDisplay();
+
+            EGLConfig config = chooseConfig(samples);
+            EGLint pbufferAttribs[] =
+            {
+               EGL_WIDTH,  _width,
+               EGL_HEIGHT, _height,
+               EGL_NONE
+            };
+            _surface = eglCreatePbufferSurface(_display, config, pbufferAttribs);
+            if(_surface == EGL_NO_SURFACE)
+            {
+               throw error("eglCreatePbufferSurface");
+            }
+
+            if(!eglBindAPI(EGL_OPENGL_API))
+            {
+               throw error("eglBindAPI(EGL_OPENGL_API)");
+            }
+
+            // The same core profile that the GLFW window asks for
+            EGLint contextAttribs[] =
+            {
+               EGL_CONTEXT_MAJOR_VERSION_KHR,       3,
+               EGL_CONTEXT_MINOR_VERSION_KHR,       2,
+               EGL_CONTEXT_OPENGL_PROFILE_MASK_KHR, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT_KHR,
+               EGL_CONTEXT_FLAGS_KHR,               EGL_CONTEXT_OPENGL_FORWARD_COMPATIBLE_BIT_KHR,
+               EGL_NONE
+            };
+            _context = eglCreateContext(_display, config, EGL_NO_CONTEXT, contextAttribs);
+            if(_context == EGL_NO_CONTEXT)
+            {
+               throw error("eglCreateContext");
+            }
+
+            if(!eglMakeCurrent(_display, _surface, _surface, _context))
+            {
+               throw error("eglMakeCurrent");
+            }
+            loadEntryPoints();
+         }
+
+         /**
+          * Get and initialize the surfaceless display if there is one, the
+          * default display otherwise
+          */
+         void openDisplay()
+         {
+            EGLint major = 0;
+            EGLint minor = 0;
+
+#ifdef EGL_PLATFORM_SURFACELESS_MESA
+            const char* extensions = eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS);
+            PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+               reinterpret_cast<PFNEGLGETPLATFORMDISPLAYEXTPROC>(eglGetProcAddress("eglGetPlatformDisplayEXT"));
+            if(extensions != NULL && strstr(extensions, "EGL_MESA_platform_surfaceless") != NULL && getPlatformDisplay != NULL)
+            {
+               _display = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+               if(_display != EGL_NO_DISPLAY && eglInitialize(_display, &major, &minor))
+               {
+                  _surfaceless = true;
+                  setVersion(major, minor);
+                  return;
+               }
+            }
+#endif
+
+            _display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+            if(_display == EGL_NO_DISPLAY)
+            {
+               throw error("eglGetDisplay");
+            }
+            if(!eglInitialize(_display, &major, &minor))
+            {
+               _display = EGL_NO_DISPLAY;
+               throw error("eglInitialize");
+            }
+            setVersion(major, minor);
+         }
+
+         /**
+          * @return an RGBA8 config with a depth buffer that supports pbuffers
+          *    and desktop OpenGL, with the requested multisampling if there
+          *    is such a config
+          */
+         EGLConfig chooseConfig(int samples)
+         {
+            for(;;)
+            {
+               EGLint attribs[] =
+               {
+                  EGL_SURFACE_TYPE,    EGL_PBUFFER_BIT,
+                  EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+                  EGL_RED_SIZE,        8,
+                  EGL_GREEN_SIZE,      8,
+                  EGL_BLUE_SIZE,       8,
+                  EGL_ALPHA_SIZE,      8,
+                  EGL_DEPTH_SIZE,      24,
+                  EGL_SAMPLE_BUFFERS,  samples > 0 ? 1 : 0,
+                  EGL_SAMPLES,         samples,
+                  EGL_NONE
+               };
+
+               EGLConfig config;
+               EGLint    numConfigs = 0;
+               if(eglChooseConfig(_display, attribs, &config, 1, &numConfigs) && numConfigs > 0)
+               {
+                  return config;
+               }
+               if(samples == 0)
+               {
+                  throw error("eglChooseConfig");
+               }
+               samples = 0;
+            }
+         }
+
+         /**
+          * Release whatever has been created so far
+          */
+         void release()
+         {
+            if(_display == EGL_NO_DISPLAY)
+            {
+               return;
+            }
+            eglMakeCurrent(_display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+            if(_context != EGL_NO_CONTEXT)
+            {
+               eglDestroyContext(_display, _context);
+            }
+            if(_surface != EGL_NO_SURFACE)
+            {
+               eglDestroySurface(_display, _surface);
+            }
+            eglTerminate(_display);
+            _display = EGL_NO_DISPLAY;
+         }
+
+         /**
+          * Remember the EGL version for describe()
+          */
+         void setVersion(EGLint major, EGLint minor)
+         {
+            std::ostringstream out;
+            out << major << "." << minor;
+            _version = out.str();
+         }
+
+         /**
+          * @return an exception for a failed EGL call, with the EGL error code
+          */
+         static std::runtime_error error(const std::string& call)
+         {
+            std::ostringstream out;
+            out << call << " failed, EGL error 0x" << std::hex << eglGetError();
+            return std::runtime_error(out.str());
+         }
+
+         EGLDisplay         _display;       //< EGL display connection
+         EGLSurface         _surface;       //< Pbuffer that stands in for the window
+         EGLContext         _context;       //< OpenGL context
+         int                _width;         //< Width of the pbuffer
+         int                _height;        //< Height of the pbuffer
+         bool               _surfaceless;   //< true if the display is Mesa's surfaceless platform
+         std::string        _version;       //< EGL version of the display
+         Clock::time_point  _start;         //< Time the context was created
+      };
+#endif
+   }
+
+   Context* Context::create(Backend backend, int width, int height, int samples)
+   {
+      if(backend == WINDOW)
+      {
+         return new WindowContext(width, height, samples);
+      }
+#ifdef HAVE_EGL
+      return new HeadlessContext(width, height, samples);
+#else
+      throw std::runtime_error("Headless rendering needs EGL, which this build does not have");
+#endif
+   }
+
+   bool Context::headlessSupported()
+   {
+#ifdef HAVE_EGL
+      return true;
+#else
+      return false;
+#endif
+   }
+}
@@ -0,0 +1,110 @@
+//--------------------------------------------------------------------------------
+// context.h
+//
+// Creation of the OpenGL context the programs render with: a GLFW window, or
+// with EGL an offscreen pbuffer that needs no display, so that the GL paths
+// can run on headless machines and under Mesa's llvmpipe software driver.
+//
+// This header does not include the OpenGL headers, so that programs with
+// their own opengl.h can use it.
+//--------------------------------------------------------------------------------
+#ifndef _context_h
+#define _context_h
+
+#include <string>
+
+namespace GL
+{
+   /**
+    * An OpenGL 3.2 core profile context and the surface it draws to. The
+    * context is current on the calling thread once create() returns.
+    *
+    * Programs call through this class instead of GLFW for everything the
+    * frame loop needs; the input callbacks are only installed when
+    * isHeadless() is false.
+    *
+    * How to use this class:
+    * \code
+    * std::unique_ptr<GL::Context> context(GL::Context::create(GL::Context::WINDOW, 1280, 720));
+    * while(running)
+    * {
+    *    draw();
+    *    context->swapBuffers();
+    * }
+    * \endcode
+    */
+   class Context
+   {
+   public:
+      enum Backend
+      {
+         WINDOW,     //< GLFW window
+         HEADLESS    //< EGL pbuffer, on the surfaceless platform where available
+      };
+
+      /**
+       * Create a context and make it current
+       *
+       * @param backend
+       *    Window or headless
+       * @param width, height
+       *    Size of the window or pbuffer
+       * @param samples
+       *    Multisample count. The headless backend falls back to no
+       *    multisampling if there is no config with that many samples
+       * @return the new context. Throws std::runtime_error if it could not
+       *    be created
+       */
+      static Context* create(Backend backend, int width, int height, int samples = 0);
+
+      /**
+       * @return true if the headless backend was built in
+       */
+      static bool headlessSupported();
+
+      /**
+       * Destructor. Destroys the context and its surface
+       */
+      virtual ~Context()
+      {
+      }
+
+      /**
+       * @return true if there is no window, and so no input
+       */
+      virtual bool isHeadless() const = 0;
+
+      /**
+       * Show the frame that was drawn. Headless, this only ends the frame
+       */
+      virtual void swapBuffers() = 0;
+
+      /**
+       * @param interval
+       *    Number of vertical retraces to wait for in swapBuffers()
+       */
+      virtual void setSwapInterval(int interval) = 0;
+
+      /**
+       * Get the size of the window or pbuffer
+       */
+      virtual void getSize(int& width, int& height) const = 0;
+
+      /**
+       * @return seconds since the context was created
+       */
+      virtual double getTime() const = 0;
+
+      /**
+       * Wait for input. Headless there is none, so this returns at once
+       */
+      virtual void waitEvents() = 0;
+
+      /**
+       * @return a description of the backend, e.g. "EGL 1.5 pbuffer"
+       */
+      virtual std::string describe() const = 0;
+   };
+}
+
+#endif
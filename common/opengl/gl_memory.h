@@ -0,0 +1,76 @@
+//--------------------------------------------------------------------------------
+// gl_memory.h
+//
+// GPU memory of textures and buffers, for the memory accounts (see
+// common/compute/memory_accounting.h). The sizes are asked from the driver
+// rather than worked out from the formats the programs request: an unsized
+// format such as GL_RGBA leaves the driver free to pick the component sizes.
+//
+// This header does not include the OpenGL headers, because the programs each
+// have their own opengl.h. Include it after that.
+//--------------------------------------------------------------------------------
+#ifndef _gl_memory_h
+#define _gl_memory_h
+
+#include <cstddef>
+
+namespace GL
+{
+   /**
+    * @param texture
+    *    A 2D texture. Only level 0 is counted; the programs use no mipmaps
+    * @return the bytes of the texture's storage, from its size and the bits
+    *    of each component that the driver allocated. 0 for texture 0
+    */
+   inline size_t textureBytes(GLuint texture)
+   {
+      if(texture == 0)
+      {
+         return 0;
+      }
+
+      GLint bound = 0;
+      glGetIntegerv(GL_TEXTURE_BINDING_2D, &bound);
+      glBindTexture(GL_TEXTURE_2D, texture);
+
+      const GLenum components[] = { GL_TEXTURE_RED_SIZE, GL_TEXTURE_GREEN_SIZE, GL_TEXTURE_BLUE_SIZE,
+                                    GL_TEXTURE_ALPHA_SIZE, GL_TEXTURE_DEPTH_SIZE, GL_TEXTURE_STENCIL_SIZE };
+      GLint width  = 0;
+      GLint height = 0;
+      GLint bits   = 0;
+      glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_WIDTH,  &width);
+      glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, GL_TEXTURE_HEIGHT, &height);
+      for(size_t c = 0; c < sizeof(components) / sizeof(components[0]); ++c)
+      {
+         GLint size = 0;
+         glGetTexLevelParameteriv(GL_TEXTURE_2D, 0, components[c], &size);
+         bits += size;
+      }
+
+      glBindTexture(GL_TEXTURE_2D, bound);
+      return size_t(width) * size_t(height) * size_t((bits + 7) / 8);
+   }
+
+   /**
+    * @param buffer
+    *    A buffer object
+    * @return the bytes of the buffer's data store. 0 for buffer 0
+    */
+   inline size_t bufferBytes(GLuint buffer)
+   {
+      if(buffer == 0)
+      {
+         return 0;
+      }
+
+      GLint bound = 0;
+      glGetIntegerv(GL_ARRAY_BUFFER_BINDING, &bound);
+      glBindBuffer(GL_ARRAY_BUFFER, buffer);
+      GLint size = 0;
+      glGetBufferParameteriv(GL_ARRAY_BUFFER, GL_BUFFER_SIZE, &size);
+      glBindBuffer(GL_ARRAY_BUFFER, bound);
+      return size_t(size);
+   }
+}
+
+#endif
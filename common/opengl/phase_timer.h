@@ -0,0 +1,653 @@
+//--------------------------------------------------------------------------------
+// phase_timer.h
+//
+// Per-phase timing of a frame loop. Scoped timers measure the CPU time of
+// each phase with a steady clock and, where timer queries are available, the
+// GPU time with GL_TIME_ELAPSED queries. The samples are kept in log-binned
+// histograms and reported when the program exits. Every phase is also a
+// trace event (common/compute/trace.h), so a trace shows the phases on the
+// timeline. With hardware performance counters enabled each CPU phase also
+// gets its cycles, instructions and cache and branch misses
+// (common/compute/perf_counters.h), per call and per item it processed.
+//
+// This header does not include the OpenGL headers, because the programs each
+// have their own opengl.h. Include it after that.
+//--------------------------------------------------------------------------------
+#ifndef _phase_timer_h
+#define _phase_timer_h
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <stdint.h>
+
+#include <perf_counters.h>
+#include <trace.h>
+
+namespace GL
+{
+   /**
+    * Histogram of durations with BINS_PER_OCTAVE bins per power of two,
+    * from 2^MIN_OCTAVE ns up to about 4 s. Quantiles are the geometric
+    * center of the bin they fall in, so they are accurate to about 10%.
+    */
+   class PhaseHistogram
+   {
+   public:
+      static const int BINS_PER_OCTAVE = 4;
+      static const int MIN_OCTAVE      = 8;
+      static const int NUM_BINS        = 24 * BINS_PER_OCTAVE;
+
+      /**
+       * Constructor
+       */
+      PhaseHistogram()
+      :  _bins  (NUM_BINS, 0)
+      ,  _count (0)
+      ,  _sum   (0)
+      ,  _max   (0)
+      {
+      }
+
+      /**
+       * Add a sample
+       *
+       * @param ns
+       *    Duration in nanoseconds
+       */
+      void add(double ns)
+      {
+         int bin = ns > 0 ? int(floor((log2(ns) - MIN_OCTAVE) * BINS_PER_OCTAVE)) : 0;
+         ++_bins[std::max(0, std::min(NUM_BINS - 1, bin))];
+         ++_count;
+         _sum += ns;
+         _max  = std::max(_max, ns);
+      }
+
+      /**
+       * @return the number of samples
+       */
+      size_t count() const
+      {
+         return _count;
+      }
+
+      /**
+       * @return the mean in nanoseconds, 0 if there are no samples
+       */
+      double mean() const
+      {
+         return _count > 0 ? _sum / _count : 0;
+      }
+
+      /**
+       * @return the largest sample in nanoseconds
+       */
+      double max() const
+      {
+         return _max;
+      }
+
+      /**
+       * @param q
+       *    Quantile in [0,1]
+       * @return the duration at quantile q in nanoseconds
+       */
+      double quantile(double q) const
+      {
+         size_t rank = size_t(ceil(q * _count));
+         size_t seen = 0;
+         for(int bin = 0; bin < NUM_BINS; ++bin)
+         {
+            seen += _bins[bin];
+            if(seen >= std::max(rank, size_t(1)))
+            {
+               return std::min(_max, sqrt(binLow(bin) * binLow(bin + 1)));
+            }
+         }
+         return _max;
+      }
+
+      /**
+       * @return the lower edge of a bin in nanoseconds
+       */
+      static double binLow(int bin)
+      {
+         return exp2(MIN_OCTAVE + double(bin) / BINS_PER_OCTAVE);
+      }
+
+      /**
+       * @return the number of samples in a bin
+       */
+      size_t binCount(int bin) const
+      {
+         return _bins[bin];
+      }
+
+   private:
+      std::vector<size_t> _bins;    //< Samples per bin
+      size_t              _count;   //< Number of samples
+      double              _sum;     //< Sum of the samples
+      double              _max;     //< Largest sample
+   };
+
+   /**
+    * Collects the phase timings of a program. Phases are registered by name
+    * the first time they are timed, and may nest. Only one GL_TIME_ELAPSED
+    * query can be active at a time, so a phase that starts inside another
+    * GPU timed phase only gets a CPU time.
+    *
+    * GPU results are read back QUERY_DELAY frames later, by which time the
+    * GPU has finished with them, so reading them does not stall the pipeline.
+    * The first CPU and GPU time of each phase is dropped: it includes driver
+    * warm-up, and some drivers return garbage for the first query.
+    *
+    * How to use this class:
+    * \code
+    * GL::PhaseTimer::instance().enable();   // With a current context
+    * ...
+    * {
+    *    GL::ScopedPhase timed("update");
+    *    update();
+    * }
+    * ...
+    * GL::PhaseTimer::instance().report(std::cout);
+    * \endcode
+    */
+   class PhaseTimer
+   {
+   public:
+      static const int QUERY_DELAY = 4;
+
+      typedef std::chrono::steady_clock Clock;
+
+      /**
+       * @return the timer shared by the whole program
+       */
+      static PhaseTimer& instance()
+      {
+         static PhaseTimer timer;
+         return timer;
+      }
+
+      /**
+       * Start collecting timings. A GL context must be current; GPU times
+       * are collected if it supports timer queries (OpenGL 3.3 or
+       * GL_ARB_timer_query)
+       */
+      void enable()
+      {
+         _enabled   = true;
+         _gpuTimers = timerQueriesSupported();
+      }
+
+      /**
+       * Count hardware events in every phase as well. Reading the counters
+       * takes a system call per thread at the start and end of each phase,
+       * so only enable them for phases of a millisecond or more
+       *
+       * @return what is counted, or why nothing is
+       */
+      std::string enableCounters()
+      {
+         _counters.reset(new Compute::PerfCounters);
+         return _counters->status();
+      }
+
+      /**
+       * @return the counters, or NULL if no event is counted
+       */
+      const Compute::PerfCounters* counters() const
+      {
+         return _counters && _counters->available() ? _counters.get() : NULL;
+      }
+
+      /**
+       * @return true if timings are being collected
+       */
+      bool enabled() const
+      {
+         return _enabled;
+      }
+
+      /**
+       * @return true if GPU times are being collected
+       */
+      bool gpuTimers() const
+      {
+         return _gpuTimers;
+      }
+
+      /**
+       * @param name
+       *    Name of the phase
+       * @param gpu
+       *    true to time the GL commands of the phase as well
+       * @return the index of the phase, registering it if needed
+       */
+      size_t phase(const char* name, bool gpu)
+      {
+         for(size_t p = 0; p < _phases.size(); ++p)
+         {
+            if(strcmp(_phases[p].name.c_str(), name) == 0)
+            {
+               return p;
+            }
+         }
+
+         Phase phase;
+         phase.name  = name;
+         phase.gpu   = gpu && _gpuTimers;
+         phase.next  = 0;
+         phase.calls = 0;
+         phase.seen  = 0;
+         phase.items = 0;
+         std::fill(phase.queries, phase.queries + QUERY_DELAY, 0);
+         std::fill(phase.pending, phase.pending + QUERY_DELAY, false);
+#ifdef GL_TIME_ELAPSED
+         if(phase.gpu)
+         {
+            glGenQueries(QUERY_DELAY, phase.queries);
+         }
+#endif
+         _phases.push_back(phase);
+         return _phases.size() - 1;
+      }
+
+      /**
+       * Start the GPU timer of a phase
+       *
+       * @return true if a query was started
+       */
+      bool beginGpu(size_t p)
+      {
+#ifdef GL_TIME_ELAPSED
+         Phase& phase = _phases[p];
+         if(!phase.gpu || _gpuActive)
+         {
+            return false;
+         }
+
+         // Collect the result of the query that is about to be reused
+         int slot = phase.next % QUERY_DELAY;
+         if(phase.pending[slot])
+         {
+            readQuery(phase, slot);
+         }
+         glBeginQuery(GL_TIME_ELAPSED, phase.queries[slot]);
+         _gpuActive = true;
+         return true;
+#else
+         return false;
+#endif
+      }
+
+      /**
+       * Stop the GPU timer of a phase started with beginGpu()
+       */
+      void endGpu(size_t p)
+      {
+#ifdef GL_TIME_ELAPSED
+         Phase& phase = _phases[p];
+         glEndQuery(GL_TIME_ELAPSED);
+         phase.pending[phase.next % QUERY_DELAY] = true;
+         ++phase.next;
+         _gpuActive = false;
+#endif
+      }
+
+      /**
+       * Add a CPU time to a phase
+       */
+      void addCpu(size_t p, Clock::duration elapsed)
+      {
+         if(_phases[p].calls++ == 0)
+         {
+            return;
+         }
+         _phases[p].cpu.add(double(std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count()));
+      }
+
+      /**
+       * Add the counts of one call to a phase. Call after addCpu(), whose
+       * first call is dropped; so is the first count
+       *
+       * @param items
+       *    Items the call processed, e.g. lattice cells or particle steps,
+       *    0 if the phase has no natural item
+       */
+      void addCounts(size_t p, const Compute::PerfCounts& counts, size_t items)
+      {
+         if(_phases[p].cpu.count() == 0)
+         {
+            return;
+         }
+         _phases[p].counts += counts;
+         _phases[p].items  += double(items);
+      }
+
+      /**
+       * Wait for the outstanding GPU queries and add their results
+       */
+      void collect()
+      {
+         for(size_t p = 0; p < _phases.size(); ++p)
+         {
+            for(int slot = 0; slot < QUERY_DELAY; ++slot)
+            {
+               if(_phases[p].pending[slot])
+               {
+                  readQuery(_phases[p], slot);
+               }
+            }
+         }
+      }
+
+      /**
+       * Write a table with the calls and the mean, median and 99th percentile
+       * CPU and GPU time of every phase, then the histogram of each
+       */
+      void report(std::ostream& out)
+      {
+         collect();
+
+         out << "Phase times in ms" << (_gpuTimers ? "" : " (no GPU timer queries)") << std::endl;
+         out << std::left << std::setw(26) << "phase" << std::right << std::setw(8) << "calls"
+             << std::setw(10) << "cpu mean" << std::setw(10) << "cpu p50" << std::setw(10) << "cpu p99"
+             << std::setw(10) << "gpu mean" << std::setw(10) << "gpu p50" << std::setw(10) << "gpu p99" << std::endl;
+         out << std::fixed << std::setprecision(3);
+         for(size_t p = 0; p < _phases.size(); ++p)
+         {
+            const Phase& phase = _phases[p];
+            out << std::left << std::setw(26) << phase.name << std::right << std::setw(8) << phase.cpu.count();
+            writeStats(out, phase.cpu);
+            writeStats(out, phase.gpuTime);
+            out << std::endl;
+         }
+
+         if(counters() != NULL)
+         {
+            writeCounters(out);
+         }
+
+         for(size_t p = 0; p < _phases.size(); ++p)
+         {
+            writeHistogram(out, _phases[p].name + " cpu", _phases[p].cpu);
+            writeHistogram(out, _phases[p].name + " gpu", _phases[p].gpuTime);
+         }
+         out.unsetf(std::ios::floatfield);
+      }
+
+   private:
+      /**
+       * Timings of one phase
+       */
+      struct Phase
+      {
+         std::string          name;                   //< Name of the phase
+         bool                 gpu;                    //< true if the phase has GPU queries
+         PhaseHistogram       cpu;                    //< CPU times
+         PhaseHistogram       gpuTime;                //< GPU times
+         Compute::PerfCounts  counts;                 //< Hardware events of the timed calls
+         double               items;                  //< Items processed by the timed calls
+         GLuint               queries[QUERY_DELAY];   //< Ring of timer queries
+         bool                 pending[QUERY_DELAY];   //< true if a query has a result to read
+         unsigned long        next;                   //< Number of queries started
+         unsigned long        calls;                  //< Number of CPU times measured
+         unsigned long        seen;                   //< Number of GPU results read
+      };
+
+      /**
+       * Constructor. Timing is off until enable() is called
+       */
+      PhaseTimer()
+      :  _enabled   (false)
+      ,  _gpuTimers (false)
+      ,  _gpuActive (false)
+      {
+      }
+
+      /**
+       * @return true if the current context supports GL_TIME_ELAPSED queries
+       */
+      static bool timerQueriesSupported()
+      {
+#ifdef GL_TIME_ELAPSED
+         GLint major = 0;
+         GLint minor = 0;
+         glGetIntegerv(GL_MAJOR_VERSION, &major);
+         glGetIntegerv(GL_MINOR_VERSION, &minor);
+         if(major > 3 || (major == 3 && minor >= 3))
+         {
+            return true;
+         }
+
+         GLint numExtensions = 0;
+         glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+         for(GLint i = 0; i < numExtensions; ++i)
+         {
+            const GLubyte* name = glGetStringi(GL_EXTENSIONS, i);
+            if(name != NULL && strcmp(reinterpret_cast<const char*>(name), "GL_ARB_timer_query") == 0)
+            {
+               return true;
+            }
+         }
+#endif
+         return false;
+      }
+
+      /**
+       * Add the result of a finished query to the phase's GPU times
+       */
+      static void readQuery(Phase& phase, int slot)
+      {
+#ifdef GL_TIME_ELAPSED
+         GLuint64 ns = 0;
+         glGetQueryObjectui64v(phase.queries[slot], GL_QUERY_RESULT, &ns);
+         if(phase.seen++ > 0)
+         {
+            phase.gpuTime.add(double(ns));
+         }
+#endif
+         phase.pending[slot] = false;
+      }
+
+      /**
+       * Write mean, median and 99th percentile in ms, or dashes if there are
+       * no samples
+       */
+      static void writeStats(std::ostream& out, const PhaseHistogram& histogram)
+      {
+         if(histogram.count() == 0)
+         {
+            out << std::setw(10) << "-" << std::setw(10) << "-" << std::setw(10) << "-";
+            return;
+         }
+         out << std::setw(10) << histogram.mean() * 1e-6
+             << std::setw(10) << histogram.quantile(0.5) * 1e-6
+             << std::setw(10) << histogram.quantile(0.99) * 1e-6;
+      }
+
+      /**
+       * Write a table of the hardware events of every phase per call and,
+       * for phases that gave an item count, per item
+       */
+      void writeCounters(std::ostream& out) const
+      {
+         out << std::endl << "Phase counters per call, user space of all threads (" << _counters->status() << ")" << std::endl;
+         out << std::left << std::setw(26) << "phase" << std::right
+             << std::setw(10) << "Mcycles" << std::setw(10) << "Minstr" << std::setw(8) << "IPC"
+             << std::setw(11) << "kLLC miss" << std::setw(11) << "kbr miss" << std::setw(10) << "DRAM MB"
+             << std::setw(11) << "LLC/item" << std::setw(11) << "br/item" << std::setw(12) << "DRAM B/item" << std::endl;
+         for(size_t p = 0; p < _phases.size(); ++p)
+         {
+            const Phase&               phase  = _phases[p];
+            const Compute::PerfCounts& counts = phase.counts;
+            double                     calls  = double(phase.cpu.count());
+            out << std::left << std::setw(26) << phase.name << std::right;
+            writeCount(out, 10, counts, Compute::PerfCounts::CYCLES,        calls * 1e6);
+            writeCount(out, 10, counts, Compute::PerfCounts::INSTRUCTIONS,  calls * 1e6);
+            if(counts.ipc() > 0)
+            {
+               out << std::setw(8) << counts.ipc();
+            }
+            else
+            {
+               out << std::setw(8) << "-";
+            }
+            writeCount(out, 11, counts, Compute::PerfCounts::LLC_MISSES,    calls * 1e3);
+            writeCount(out, 11, counts, Compute::PerfCounts::BRANCH_MISSES, calls * 1e3);
+            writeCount(out, 10, counts, Compute::PerfCounts::DRAM_BYTES,    calls * 1e6);
+            writeCount(out, 11, counts, Compute::PerfCounts::LLC_MISSES,    phase.items);
+            writeCount(out, 11, counts, Compute::PerfCounts::BRANCH_MISSES, phase.items);
+            writeCount(out, 12, counts, Compute::PerfCounts::DRAM_BYTES,    phase.items);
+            out << std::endl;
+         }
+      }
+
+      /**
+       * Write one event's count divided by divisor, or a dash if the event
+       * was not counted or there is nothing to divide by
+       */
+      static void writeCount(std::ostream& out, int width, const Compute::PerfCounts& counts, Compute::PerfCounts::Event event, double divisor)
+      {
+         if(!counts.valid[event] || divisor <= 0)
+         {
+            out << std::setw(width) << "-";
+            return;
+         }
+         out << std::setw(width) << counts.value[event] / divisor;
+      }
+
+      /**
+       * Write the non-empty bins of a histogram, one line per bin with its
+       * range in ms, its count and a bar scaled to the fullest bin
+       */
+      static void writeHistogram(std::ostream& out, const std::string& title, const PhaseHistogram& histogram)
+      {
+         if(histogram.count() == 0)
+         {
+            return;
+         }
+
+         size_t fullest = 0;
+         int    first   = PhaseHistogram::NUM_BINS;
+         int    last    = 0;
+         for(int bin = 0; bin < PhaseHistogram::NUM_BINS; ++bin)
+         {
+            if(histogram.binCount(bin) > 0)
+            {
+               fullest = std::max(fullest, histogram.binCount(bin));
+               first   = std::min(first, bin);
+               last    = bin;
+            }
+         }
+
+         out << std::endl << title << std::endl;
+         for(int bin = first; bin <= last; ++bin)
+         {
+            size_t count = histogram.binCount(bin);
+            out << std::setw(10) << (bin == 0 ? 0.0 : PhaseHistogram::binLow(bin) * 1e-6) << " - "
+                << std::setw(10) << PhaseHistogram::binLow(bin + 1) * 1e-6 << std::setw(8) << count << " "
+                << std::string((count * 40 + fullest - 1) / fullest, '#') << std::endl;
+         }
+      }
+
+      bool                                   _enabled;     //< true if timings are collected
+      bool                                   _gpuTimers;   //< true if GPU times are collected
+      bool                                   _gpuActive;   //< true while a GL_TIME_ELAPSED query is active
+      std::vector<Phase>                     _phases;      //< Timings of every phase
+      std::unique_ptr<Compute::PerfCounters> _counters;    //< Hardware counters, NULL unless enabled
+   };
+
+   /**
+    * Times the enclosing scope as one phase, and records it as a trace
+    * event. Each does nothing unless the PhaseTimer or the Tracer is
+    * enabled
+    */
+   class ScopedPhase
+   {
+   public:
+      /**
+       * Constructor. Starts the timers
+       *
+       * @param name
+       *    Name of the phase. The same name always adds to the same phase.
+       *    Must be a string literal, see Compute::Tracer
+       * @param gpu
+       *    true to time the GL commands in the scope, false for CPU work and
+       *    for calls such as buffer swaps that wait on the GPU
+       * @param items
+       *    Items the scope processes, for the hardware counts per item. 0
+       *    if there is no natural item
+       */
+      explicit ScopedPhase(const char* name, bool gpu = true, size_t items = 0)
+      :  _trace    (name)
+      ,  _timer    (PhaseTimer::instance())
+      ,  _active   (_timer.enabled())
+      ,  _phase    (0)
+      ,  _gpu      (false)
+      ,  _counters (_active ? _timer.counters() : NULL)
+      ,  _items    (items)
+      {
+         if(_active)
+         {
+            _phase = _timer.phase(name, gpu);
+            _gpu   = _timer.beginGpu(_phase);
+            if(_counters != NULL)
+            {
+               _counts = _counters->read();
+            }
+            _start = PhaseTimer::Clock::now();
+         }
+      }
+
+      /**
+       * Destructor. Stops the timers and adds the times to the phase
+       */
+      ~ScopedPhase()
+      {
+         if(_active)
+         {
+            PhaseTimer::Clock::time_point end = PhaseTimer::Clock::now();
+            Compute::PerfCounts           counts;
+            if(_counters != NULL)
+            {
+               counts = _counters->read() - _counts;
+            }
+            _timer.addCpu(_phase, end - _start);
+            if(_counters != NULL)
+            {
+               _timer.addCounts(_phase, counts, _items);
+            }
+            if(_gpu)
+            {
+               _timer.endGpu(_phase);
+            }
+         }
+      }
+
+   private:
+      ScopedPhase(const ScopedPhase&);
+      ScopedPhase& operator=(const ScopedPhase&);
+
+      Compute::ScopedTrace          _trace;    //< Trace event of the scope
+      PhaseTimer&                   _timer;    //< Timer the phase is added to
+      bool                          _active;   //< true if the timer was enabled when the scope started
+      size_t                        _phase;    //< Index of the phase
+      bool                          _gpu;      //< true if a GPU query was started
+      const Compute::PerfCounters*  _counters; //< Hardware counters, NULL if not counting
+      size_t                        _items;    //< Items the scope processes
+      Compute::PerfCounts           _counts;   //< Counter totals at the start of the scope
+      PhaseTimer::Clock::time_point _start;    //< CPU time at the start of the scope
+   };
+}
+
+#endif
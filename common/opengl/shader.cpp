@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <iostream>
 #include <fstream>
 #include "shader.h"
@@ -105,13 +106,119 @@ namespace GL
       return source;
    }
    
+   /**
+    * Find the file name of an #include "file" line
+    *
+    * @param line		A line of shader source
+    * @param name		Gets the file name
+    * @return			true if the line is an #include with a quoted name.
+    *					Other #include lines, e.g. of <glm/glm.hpp> in the
+    *					C++ part of a shared kernel, are left to the compiler
+    */
+   static bool includeName(const std::string& line, std::string& name)
+   {
+      std::istringstream in(line);
+      std::string hash;
+      std::string directive;
+      if(!(in >> hash))
+      {
+         return false;
+      }
+      if(hash == "#")
+      {
+         in >> directive;
+      }
+      else if(hash.compare(0, 1, "#") == 0)
+      {
+         directive = hash.substr(1);
+      }
+      if(directive != "include")
+      {
+         return false;
+      }
+
+      size_t open  = line.find('"');
+      size_t close = line.rfind('"');
+      if(open == std::string::npos || close == open)
+      {
+         return false;
+      }
+      name = line.substr(open + 1, close - open - 1);
+      return true;
+   }
+
+   /**
+    * Creates the source of a shader by reading a file and expanding its
+    * #include "file" lines, recursively. GLSL has no #include, so this is
+    * what lets shaders share code with each other and with the C++ code
+    * (see common/kernels). As in C, the name is relative to the directory
+    * of the file with the #include. A file is inserted only the first time
+    * it is included.
+    *
+    * #line directives keep the line numbers in compile errors right: lines
+    * of files[n] are reported as source string n.
+    *
+    * @param filename	The name of the file
+    * @param files		The files read so far. filename is added
+    * @param version	GLSL version from the #version line, 0 until it is read
+    * @return			The source with the includes expanded
+    */
+   static std::string readShaderSource(const std::string& filename, std::vector<std::string>& files, int& version)
+   {
+      size_t      index = files.size();
+      std::string dir   = filename.substr(0, filename.find_last_of('/') + 1);
+      files.push_back(filename);
+
+      std::istringstream in(readTextFile(filename));
+      std::ostringstream source;
+      std::string        line;
+      std::string        name;
+      int                lineNumber = 0;
+      while(std::getline(in, line))
+      {
+         ++lineNumber;
+         if(!includeName(line, name))
+         {
+            std::istringstream directive(line);
+            std::string        hash;
+            if(directive >> hash && hash == "#version")
+            {
+               directive >> version;
+            }
+            source << line << "\n";
+            continue;
+         }
+
+         std::string included = name.compare(0, 1, "/") == 0 ? name : dir + name;
+         if(std::find(files.begin(), files.end(), included) != files.end())
+         {
+            source << "\n";
+            continue;
+         }
+         if(!std::ifstream(included.c_str()).is_open())
+         {
+            std::stringstream err;
+            err << filename << ":" << lineNumber << ": could not open included file " << included;
+            throw std::runtime_error(err.str());
+         }
+         // Before GLSL 3.30, #line n numbers the next line n + 1
+         int next = version < 330 ? 0 : 1;
+         source << "#line " << next << " " << files.size() << "\n";
+         source << readShaderSource(included, files, version);
+         source << "#line " << lineNumber + next << " " << index << "\n";
+      }
+      return source.str();
+   }
+   
    /**
     * Constructor
     */
    Shader::Shader(const std::string& filename, GLenum shaderType)
    : _handle   (0)
    {
-      std::string source = readTextFile(filename);
+      std::vector<std::string> files;
+      int version = 0;
+      std::string source = readShaderSource(filename, files, version);
       const GLchar* sourcePtr0 = source.c_str();
       const GLchar** sourcePtr = &sourcePtr0;
       
@@ -129,6 +236,10 @@ namespace GL
       {
          std::stringstream err;
          err << "Failed to compile shader file: " << filename << std::endl;
+         for(size_t f = 1; f < files.size(); ++f)
+         {
+            err << "Source string " << f << " is the included file " << files[f] << std::endl;
+         }
          err << getLog() << std::endl;
          throw std::runtime_error(err.str());
       }
@@ -203,6 +314,46 @@ namespace GL
       mapAttributeNamesToIndices();
    }
 
+   Program::Program(const std::string& vShaderFile, const std::vector<std::string>& varyings, GLenum bufferMode)
+   :  _vertexShader   (NULL)
+   ,  _fragmentShader (NULL)
+   ,  _geometryShader (NULL)
+   {
+      _handle = glCreateProgram();
+      GL_ERR_CHECK();
+      
+      _vertexShader   = new Shader(vShaderFile, GL_VERTEX_SHADER);
+      
+      glAttachShader(_handle, _vertexShader->getHandle());
+      GL_ERR_CHECK();
+
+      // The varyings must be named before the program is linked
+      std::vector<const char*> names;
+      for(size_t i = 0; i < varyings.size(); ++i)
+      {
+         names.push_back(varyings[i].c_str());
+      }
+      glTransformFeedbackVaryings(_handle, GLsizei(names.size()), names.empty() ? NULL : &names[0], bufferMode);
+      GL_ERR_CHECK();
+      
+      // Link the program
+      glLinkProgram(_handle);
+      GL_ERR_CHECK();
+      
+      // Check for linker errors
+      if(!getLinkStatus())
+      {
+         std::stringstream err;
+         err << "GLSL program failed to link:" << std::endl;
+         err << getLog() << std::endl;
+         throw std::runtime_error(err.str());
+      }
+      bind();
+      mapUniformNamesToIndices();
+      mapAttributeNamesToIndices();
+      mapVaryingNamesToIndices();
+   }
+
    Program::Program(const std::string& vShaderFile, const std::string& fShaderFile)
    :  _vertexShader   (NULL)
    ,  _fragmentShader (NULL)
@@ -368,6 +519,28 @@ namespace GL
       {
          std::cout << "attrib: (name, index): (" << itr->first << "," << itr->second << ")" << std::endl;
       }
+#endif
+   }
+
+   void Program::mapVaryingNamesToIndices(void)
+   {
+      int total = -1;
+      glGetProgramiv(_handle, GL_TRANSFORM_FEEDBACK_VARYINGS, &total);
+      for(int i = 0; i < total; ++i)
+      {
+         int name_len=-1, num=-1;
+         GLenum type = GL_ZERO;
+         char name[100];
+         glGetTransformFeedbackVarying(_handle, GLuint(i), sizeof(name) - 1, &name_len, &num, &type, name);
+         name[name_len] = 0;
+         _varying[std::string(name)] = GLuint(i);
+      }
+#ifdef DEBUG_VARYINGS
+      std::map<std::string, GLuint>::const_iterator itr;
+      for(itr = _varying.begin(); itr != _varying.end(); ++itr)
+      {
+         std::cout << "varying: (name, index): (" << itr->first << "," << itr->second << ")" << std::endl;
+      }
 #endif
    }
 }
@@ -115,6 +115,19 @@ namespace GL
        */
       Program(const std::string& vertexFile);
 
+      /**
+       * Create a GLSL program that captures vertex shader outputs with
+       * transform feedback
+       *
+       * @param vertexFile
+       *    The name of the file that contains vertex shader source
+       * @param varyings
+       *    Names of the transform feedback varyings
+       * @param bufferMode
+       *    GL_INTERLEAVED_ATTRIBS or GL_SEPARATE_ATTRIBS
+       */
+      Program(const std::string& vertexFile, const std::vector<std::string>& varyings, GLenum bufferMode);
+
       /**
        * Create a GLSL program
        *
@@ -153,6 +166,11 @@ namespace GL
        */
       void mapAttributeNamesToIndices(void);
 
+      /**
+       * Map the names of transform feedback varyings to indices
+       */
+      void mapVaryingNamesToIndices(void);
+
       /**
        * Check the link status of the program
        *
@@ -181,6 +199,24 @@ namespace GL
          return glGetAttribLocation(_handle, name.c_str());
       }
 
+      /**
+       * Get the index of a transform feedback varying, the binding point
+       * of its buffer in GL_SEPARATE_ATTRIBS mode
+       *
+       * @param name
+       *    The name of the varying
+       * @return the index of the varying
+       */
+      GLuint getVaryingLocation(const std::string& name) const
+      {
+         std::map<std::string, GLuint>::const_iterator loc = _varying.find(name);
+         if(loc == _varying.end())
+         {
+            throw std::runtime_error("Varying does not exist: " + name);
+         }
+         return loc->second;
+      }
+
       /**
        * Define an array of generic vertex attribute data.
        *
@@ -625,6 +661,7 @@ namespace GL
       Shader*                       _geometryShader; //< Pointer to the geometry shader
       std::map<std::string, GLuint> _uniform;        //< Map of uniform names to GLuint indices
       std::map<std::string, GLuint> _attrib;         //< Map of attribute names to GLuint indices
+      std::map<std::string, GLuint> _varying;        //< Map of transform feedback varying names to indices
    };
    
    class VertexAttribute
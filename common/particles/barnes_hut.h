@@ -0,0 +1,99 @@
+//--------------------------------------------------------------------------------
+// barnes_hut.h
+//
+// Mutual gravity solver for NBodyEngine on a Barnes-Hut octree (octree.h).
+// Accurate at every scale, O(N log N) per step.
+//--------------------------------------------------------------------------------
+#ifndef _barnes_hut_h
+#define _barnes_hut_h
+
+#include "octree.h"
+#include "particle_store.h"
+
+#include <algorithm>
+#include <cstddef>
+
+namespace Particles
+{
+   /**
+    * How to use this class:
+    * \code
+    * Particles::NBodyEngine<Particles::BarnesHut> engine(numParticles);
+    * engine.getSolver().setOpeningAngle(0.7f);
+    * \endcode
+    */
+   class BarnesHut
+   {
+   public:
+      /**
+       * Constructor
+       */
+      BarnesHut()
+      :  _softening     (0.01f)
+      ,  _openingAngle  (0.5f)
+      ,  _leafSize      (16)
+      {
+      }
+
+      static const char* name() { return "barnes-hut"; }
+
+      /**
+       * Rebuild the tree and compute the acceleration of every particle due
+       * to all others
+       *
+       * @param store
+       *    Particles
+       * @param particleGM
+       *    Gravitational constant times the mass of one particle
+       * @param ax, ay, az
+       *    Output planes, indexed like the particle store
+       */
+      void accelerations(const ParticleStore& store, float particleGM, float* ax, float* ay, float* az)
+      {
+         _tree.build(store, particleGM, _openingAngle, _leafSize);
+         _tree.accelerations(std::max(_softening * _softening, 1e-12f), ax, ay, az);
+      }
+
+      float  getSoftening() const                     { return _softening; }
+      float  getOpeningAngle() const                  { return _openingAngle; }
+      size_t getLeafSize() const                      { return _leafSize; }
+      const Octree& getTree() const                   { return _tree; }
+
+      /**
+       * @param softening
+       *    Softening length of the particle-particle force. Keeps close
+       *    encounters from producing huge accelerations
+       */
+      void setSoftening(float softening)
+      {
+         _softening = softening;
+      }
+
+      /**
+       * @param theta
+       *    Barnes-Hut opening angle. 0.5 to 0.7 is usual; smaller is more
+       *    accurate and slower
+       */
+      void setOpeningAngle(float theta)
+      {
+         _openingAngle = theta;
+      }
+
+      /**
+       * @param leafSize
+       *    Tree nodes with at most this many particles are not subdivided
+       */
+      void setLeafSize(size_t leafSize)
+      {
+         _leafSize = std::max<size_t>(leafSize, 1);
+      }
+
+   private:
+      float                   _softening;    //< Softening length of the particle-particle force
+      float                   _openingAngle; //< Barnes-Hut opening angle theta
+      size_t                  _leafSize;     //< Largest tree node that is not subdivided
+      Octree                  _tree;         //< Rebuilt every step
+   };
+}
+
+#endif
@@ -0,0 +1,576 @@
+//--------------------------------------------------------------------------------
+// block_steps.h
+//
+// Hierarchical power-of-two time steps. Every particle sits on a level l and
+// takes 2^l sub-steps of dt / 2^l per engine step, so particles close to a
+// well take short steps and the rest keep the base step. The levels nest
+// inside one base step, so all particles are synchronized when update()
+// returns and the renderer always sees a consistent snapshot.
+//
+// A particle's level is chosen so that its velocity changes by at most a
+// fraction of its speed per sub-step:
+//
+//    |dv| / 2^l <= accuracy * |v|
+//
+// where dv is the velocity change over the last base step. dv comes out of
+// the step itself, so picking the next level costs no force evaluation. For a
+// circular orbit this is a step of accuracy / 2 pi of the period; at the
+// pericenter of an eccentric orbit the steps shrink.
+//
+// Level 0 particles are updated in store order by the usual contiguous SIMD
+// loop, masked by a plane of levels. The particles of each deeper level are
+// kept as a compacted list of indices, rebuilt after every step by a scan
+// that skips whole SIMD vectors of level 0 particles. The list kernels
+// gather a level's particles into SIMD registers, run all of their sub-steps
+// there, and scatter them back. The particles move independently in the
+// wells, so running a level's sub-steps back to back gives the same result
+// as interleaving them with the other levels.
+//--------------------------------------------------------------------------------
+#ifndef _block_steps_h
+#define _block_steps_h
+
+#include "particle_kernels.h"
+#include "particle_store.h"
+
+#include <aligned_array.h>
+#include <memory_accounting.h>
+#include <simd.h>
+#include <thread_pool.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+#include <stdint.h>
+
+namespace Particles
+{
+   /**
+    * Per particle levels and the index list of each level above 0.
+    *
+    * How to use this class:
+    * \code
+    * Particles::BlockSteps steps;
+    * steps.setMaxLevel(4);
+    * steps.resize(store.paddedSize());
+    * // ... write every particle's level into steps.levels() ...
+    * steps.rebin(store.size());
+    * for(int level = 1; level <= steps.getMaxLevel(); ++level)
+    * {
+    *    const uint32_t* indices = steps.bin(level);
+    *    size_t          count   = steps.binSize(level);
+    * }
+    * \endcode
+    */
+   class BlockSteps
+   {
+   public:
+      /**
+       * Deepest level that can be set, 2^8 sub-steps per step
+       */
+      static const int levelLimit = 8;
+
+      /**
+       * Constructor
+       */
+      BlockSteps()
+      :  _maxLevel  (0)
+      ,  _accuracy  (0.02f)
+      ,  _valid     (false)
+      ,  _memory    ("BlockSteps")
+      {
+         std::fill(_binStart, _binStart + levelLimit + 2, 0);
+      }
+
+      int   getMaxLevel() const                       { return _maxLevel; }
+      float getAccuracy() const                       { return _accuracy; }
+      bool  enabled() const                           { return _maxLevel > 0; }
+
+      /**
+       * @param maxLevel
+       *    Deepest level, clamped to [0, levelLimit]. 0 turns block steps
+       *    off
+       */
+      void setMaxLevel(int maxLevel)
+      {
+         _maxLevel = std::max(0, std::min(maxLevel, int(levelLimit)));
+         _valid    = false;
+      }
+
+      /**
+       * @param accuracy
+       *    Largest change of velocity per sub-step, as a fraction of the
+       *    speed. Smaller is more accurate and puts more particles on deep
+       *    levels
+       */
+      void setAccuracy(float accuracy)
+      {
+         _accuracy = accuracy;
+      }
+
+      /**
+       * @return true if the levels are set for a padded size of n and binned
+       */
+      bool valid(size_t n) const
+      {
+         return _valid && _levels.size() == n;
+      }
+
+      /**
+       * Mark the levels as stale, for example after the particles were
+       * reinitialized
+       */
+      void invalidate()
+      {
+         _valid = false;
+      }
+
+      /**
+       * Reallocate the levels. They must be written before the next rebin()
+       *
+       * @param paddedSize
+       *    ParticleStore::paddedSize()
+       */
+      void resize(size_t paddedSize)
+      {
+         if(_levels.size() != paddedSize)
+         {
+            _levels.resize(paddedSize);
+            _indices.resize(paddedSize);
+            _memory.setHost(paddedSize * (sizeof(float) + sizeof(uint32_t)));
+         }
+         _valid = false;
+      }
+
+      /**
+       * @return the level of each particle, as a float plane laid out like
+       *    the particle store so the kernels can load it with the positions
+       */
+      float* levels()
+      {
+         return _levels.data();
+      }
+
+      const float* levels() const
+      {
+         return _levels.data();
+      }
+
+      /**
+       * @return the first index of a level's list. Level 0 has no list
+       */
+      const uint32_t* bin(int level) const
+      {
+         return _indices.data() + _binStart[level];
+      }
+
+      /**
+       * @return the number of particles on a level above 0
+       */
+      size_t binSize(int level) const
+      {
+         return _binStart[level + 1] - _binStart[level];
+      }
+
+      /**
+       * Rebuild the index lists from the levels, with a parallel counting
+       * sort. Each list is in increasing index order, so the kernels gather
+       * from memory roughly in order
+       *
+       * @param size
+       *    Number of particles, ParticleStore::size()
+       */
+      void rebin(size_t size)
+      {
+         using Compute::floatv;
+
+         const size_t numLevels    = levelLimit + 1;
+         const size_t minBlockSize = 65536;
+
+         Compute::ThreadPool& pool = Compute::ThreadPool::instance();
+         size_t numBlocks = std::max<size_t>(1, std::min<size_t>(pool.getNumThreads() * 4, size / minBlockSize));
+         size_t blockSize = (size / numBlocks + floatv::width - 1) / floatv::width * floatv::width;
+         std::vector<size_t> offsets(numBlocks * numLevels);
+
+         const float* levels  = _levels.data();
+         uint32_t*    indices = _indices.data();
+
+         // Both passes skip whole vectors of level 0 particles, which are
+         // usually nearly all of them
+         pool.run(numBlocks, [&](size_t block)
+         {
+            size_t* count = &offsets[block * numLevels];
+            size_t  first = std::min(size, block * blockSize);
+            size_t  last  = block + 1 == numBlocks ? size : std::min(size, first + blockSize);
+            for(size_t i = first; i < last; i += floatv::width)
+            {
+               if(Compute::any(floatv::load(levels + i) > floatv(0.0f)))
+               {
+                  for(size_t j = i; j < std::min(i + floatv::width, last); ++j)
+                  {
+                     ++count[size_t(levels[j])];
+                  }
+               }
+            }
+         });
+
+         // Level-major exclusive prefix sum, so that each level's list is
+         // contiguous and in block order
+         size_t sum = 0;
+         for(size_t level = 1; level < numLevels; ++level)
+         {
+            _binStart[level] = sum;
+            for(size_t block = 0; block < numBlocks; ++block)
+            {
+               size_t count = offsets[block * numLevels + level];
+               offsets[block * numLevels + level] = sum;
+               sum += count;
+            }
+         }
+         _binStart[0]         = 0;
+         _binStart[numLevels] = sum;
+
+         pool.run(numBlocks, [&](size_t block)
+         {
+            size_t* offset = &offsets[block * numLevels];
+            size_t  first  = std::min(size, block * blockSize);
+            size_t  last   = block + 1 == numBlocks ? size : std::min(size, first + blockSize);
+            for(size_t i = first; i < last; i += floatv::width)
+            {
+               if(Compute::any(floatv::load(levels + i) > floatv(0.0f)))
+               {
+                  for(size_t j = i; j < std::min(i + floatv::width, last); ++j)
+                  {
+                     if(levels[j] > 0)
+                     {
+                        indices[offset[size_t(levels[j])]++] = uint32_t(j);
+                     }
+                  }
+               }
+            }
+         });
+
+         _valid = true;
+      }
+
+   private:
+      int                           _maxLevel;   //< Deepest level, 0 when block steps are off
+      float                         _accuracy;   //< Largest velocity change per sub-step, over the speed
+      bool                          _valid;      //< The levels and lists are up to date
+      Compute::AlignedArray<float>  _levels;     //< Level of each particle, padded like the store
+      Compute::AlignedArray<uint32_t> _indices;  //< Index lists of levels 1 and up, back to back
+      size_t                        _binStart[levelLimit + 2]; //< Start of each level's list in _indices
+      Compute::MemoryAccount        _memory;     //< Host memory of the levels and lists
+   };
+
+   /**
+    * @return the level for a particle with velocity v whose velocity
+    *    changed by dv over the last base step, from 0 to maxLevel. Written
+    *    without division, so a particle at rest goes to the deepest level
+    *    and one in no field stays on level 0
+    */
+   inline float stepLevel(float vx, float vy, float vz, float dvx, float dvy, float dvz, float accuracy, int maxLevel)
+   {
+      float dv2   = dvx * dvx + dvy * dvy + dvz * dvz;
+      float v2    = (vx * vx + vy * vy + vz * vz) * accuracy * accuracy;
+      float level = 0;
+      for(int l = 1; l <= maxLevel && dv2 > v2; ++l, v2 *= 4)
+      {
+         level += 1;
+      }
+      return level;
+   }
+
+   inline Compute::floatv stepLevel(Compute::floatv vx, Compute::floatv vy, Compute::floatv vz,
+                                    Compute::floatv dvx, Compute::floatv dvy, Compute::floatv dvz,
+                                    float accuracy, int maxLevel)
+   {
+      using Compute::floatv;
+
+      const floatv one(1.0f), zero(0.0f), four(4.0f);
+      floatv dv2   = dvx * dvx + dvy * dvy + dvz * dvz;
+      floatv v2    = (vx * vx + vy * vy + vz * vz) * floatv(accuracy * accuracy);
+      floatv level = zero;
+      for(int l = 1; l <= maxLevel; ++l, v2 = v2 * four)
+      {
+         level = level + Compute::select(dv2 > v2, one, zero);
+      }
+      return level;
+   }
+
+   /**
+    * Set the first levels of particles [first, last), with dv estimated as
+    * the acceleration times the base step
+    */
+   template<typename Field>
+   void assignLevels(const ParticleStore& store, size_t first, size_t last, const Field& field, float dt, BlockSteps& steps)
+   {
+      const float* px  = store.plane(ParticleStore::X);
+      const float* py  = store.plane(ParticleStore::Y);
+      const float* pz  = store.plane(ParticleStore::Z);
+      const float* pvx = store.plane(ParticleStore::VX);
+      const float* pvy = store.plane(ParticleStore::VY);
+      const float* pvz = store.plane(ParticleStore::VZ);
+      float*       levels = steps.levels();
+
+      for(size_t i = first; i < last; ++i)
+      {
+         float ax, ay, az;
+         field(px[i], py[i], pz[i], ax, ay, az);
+         levels[i] = stepLevel(pvx[i], pvy[i], pvz[i], ax * dt, ay * dt, az * dt, steps.getAccuracy(), steps.getMaxLevel());
+      }
+   }
+
+   /**
+    * Advance the level 0 particles of [first, last) one step, one particle
+    * at a time, and set their new levels. field is a float field
+    */
+   template<typename Integrator, typename Field>
+   void integrateLevelZeroScalar(ParticleStore& store, BlockSteps& steps, size_t first, size_t last,
+                                 const Field& field, const StepParams& params)
+   {
+      float* px  = store.plane(ParticleStore::X);
+      float* py  = store.plane(ParticleStore::Y);
+      float* pz  = store.plane(ParticleStore::Z);
+      float* pvx = store.plane(ParticleStore::VX);
+      float* pvy = store.plane(ParticleStore::VY);
+      float* pvz = store.plane(ParticleStore::VZ);
+      float* levels = steps.levels();
+
+      for(size_t i = first; i < last; ++i)
+      {
+         if(levels[i] > 0)
+         {
+            continue;
+         }
+
+         float x  = px[i],  y  = py[i],  z  = pz[i];
+         float vx = pvx[i], vy = pvy[i], vz = pvz[i];
+
+         Integrator::step(x, y, z, vx, vy, vz, field, params.dt);
+         levels[i] = stepLevel(vx, vy, vz, vx - pvx[i], vy - pvy[i], vz - pvz[i], steps.getAccuracy(), steps.getMaxLevel());
+
+         if(x * x + y * y + z * z > params.resetRadius2)
+         {
+            x  = store.plane(ParticleStore::X0)[i];
+            y  = store.plane(ParticleStore::Y0)[i];
+            z  = store.plane(ParticleStore::Z0)[i];
+            vx = store.plane(ParticleStore::VX0)[i];
+            vy = store.plane(ParticleStore::VY0)[i];
+            vz = store.plane(ParticleStore::VZ0)[i];
+         }
+
+         px[i]  = x;  py[i]  = y;  pz[i]  = z;
+         pvx[i] = vx; pvy[i] = vy; pvz[i] = vz;
+      }
+   }
+
+   /**
+    * Advance the level 0 particles of [first, last) one step, floatv::width
+    * particles at a time, and set their new levels. Lanes on deeper levels
+    * are computed and discarded. first and last must be multiples of
+    * ParticleStore::padding, or last may be store.paddedSize(). field is a
+    * floatv field
+    */
+   template<typename Integrator, typename Field>
+   void integrateLevelZeroSimd(ParticleStore& store, BlockSteps& steps, size_t first, size_t last,
+                               const Field& field, const StepParams& params)
+   {
+      using Compute::floatv;
+      using Compute::maskv;
+
+      float* px  = store.plane(ParticleStore::X);
+      float* py  = store.plane(ParticleStore::Y);
+      float* pz  = store.plane(ParticleStore::Z);
+      float* pvx = store.plane(ParticleStore::VX);
+      float* pvy = store.plane(ParticleStore::VY);
+      float* pvz = store.plane(ParticleStore::VZ);
+      float* levels = steps.levels();
+
+      const floatv resetRadius2(params.resetRadius2);
+      const floatv zero(0.0f);
+
+      for(size_t i = first; i < last; i += floatv::width)
+      {
+         floatv x0  = floatv::load(px + i),  y0  = floatv::load(py + i),  z0  = floatv::load(pz + i);
+         floatv vx0 = floatv::load(pvx + i), vy0 = floatv::load(pvy + i), vz0 = floatv::load(pvz + i);
+         floatv x = x0, y = y0, z = z0, vx = vx0, vy = vy0, vz = vz0;
+
+         Integrator::step(x, y, z, vx, vy, vz, field, params.dt);
+         floatv level = stepLevel(vx, vy, vz, vx - vx0, vy - vy0, vz - vz0, steps.getAccuracy(), steps.getMaxLevel());
+
+         maskv reset = (x * x + y * y + z * z) > resetRadius2;
+         if(Compute::any(reset))
+         {
+            x  = Compute::select(reset, floatv::load(store.plane(ParticleStore::X0)  + i), x);
+            y  = Compute::select(reset, floatv::load(store.plane(ParticleStore::Y0)  + i), y);
+            z  = Compute::select(reset, floatv::load(store.plane(ParticleStore::Z0)  + i), z);
+            vx = Compute::select(reset, floatv::load(store.plane(ParticleStore::VX0) + i), vx);
+            vy = Compute::select(reset, floatv::load(store.plane(ParticleStore::VY0) + i), vy);
+            vz = Compute::select(reset, floatv::load(store.plane(ParticleStore::VZ0) + i), vz);
+         }
+
+         // Lanes on deeper levels keep their state for the list kernels
+         floatv oldLevel = floatv::load(levels + i);
+         maskv  deep     = oldLevel > zero;
+         if(Compute::any(deep))
+         {
+            x     = Compute::select(deep, x0, x);
+            y     = Compute::select(deep, y0, y);
+            z     = Compute::select(deep, z0, z);
+            vx    = Compute::select(deep, vx0, vx);
+            vy    = Compute::select(deep, vy0, vy);
+            vz    = Compute::select(deep, vz0, vz);
+            level = Compute::select(deep, oldLevel, level);
+         }
+
+         x.store(px + i);   y.store(py + i);   z.store(pz + i);
+         vx.store(pvx + i); vy.store(pvy + i); vz.store(pvz + i);
+         level.store(levels + i);
+      }
+   }
+
+   /**
+    * Advance entries [first, last) of one level's list one step, one
+    * particle at a time, and set their new levels. field is a float field
+    */
+   template<typename Integrator, typename Field>
+   void integrateLevelScalar(ParticleStore& store, BlockSteps& steps, int level, size_t first, size_t last,
+                             const Field& field, const StepParams& params)
+   {
+      float* px  = store.plane(ParticleStore::X);
+      float* py  = store.plane(ParticleStore::Y);
+      float* pz  = store.plane(ParticleStore::Z);
+      float* pvx = store.plane(ParticleStore::VX);
+      float* pvy = store.plane(ParticleStore::VY);
+      float* pvz = store.plane(ParticleStore::VZ);
+
+      const uint32_t* indices  = steps.bin(level);
+      float*          levels   = steps.levels();
+      const int       subSteps = 1 << level;
+      const float     dt       = params.dt / subSteps;
+
+      for(size_t k = first; k < last; ++k)
+      {
+         size_t i  = indices[k];
+         float  x  = px[i],  y  = py[i],  z  = pz[i];
+         float  vx = pvx[i], vy = pvy[i], vz = pvz[i];
+
+         // Velocity change over the base step, not counting resets
+         float dvx = 0, dvy = 0, dvz = 0;
+         for(int s = 0; s < subSteps; ++s)
+         {
+            float ux = vx, uy = vy, uz = vz;
+            Integrator::step(x, y, z, vx, vy, vz, field, dt);
+            dvx += vx - ux;
+            dvy += vy - uy;
+            dvz += vz - uz;
+
+            if(x * x + y * y + z * z > params.resetRadius2)
+            {
+               x  = store.plane(ParticleStore::X0)[i];
+               y  = store.plane(ParticleStore::Y0)[i];
+               z  = store.plane(ParticleStore::Z0)[i];
+               vx = store.plane(ParticleStore::VX0)[i];
+               vy = store.plane(ParticleStore::VY0)[i];
+               vz = store.plane(ParticleStore::VZ0)[i];
+            }
+         }
+         levels[i] = stepLevel(vx, vy, vz, dvx, dvy, dvz, steps.getAccuracy(), steps.getMaxLevel());
+
+         px[i]  = x;  py[i]  = y;  pz[i]  = z;
+         pvx[i] = vx; pvy[i] = vy; pvz[i] = vz;
+      }
+   }
+
+   /**
+    * Advance entries [first, last) of one level's list one step,
+    * floatv::width particles at a time, and set their new levels. The
+    * particles are gathered into registers, take all of their sub-steps
+    * there and are scattered back. A short final group repeats its last
+    * particle, which computes and stores the same values twice. field is a
+    * floatv field
+    */
+   template<typename Integrator, typename Field>
+   void integrateLevelSimd(ParticleStore& store, BlockSteps& steps, int level, size_t first, size_t last,
+                           const Field& field, const StepParams& params)
+   {
+      using Compute::floatv;
+      using Compute::maskv;
+
+      const int width = floatv::width;
+
+      float* planes[6];
+      for(int p = 0; p < 6; ++p)
+      {
+         planes[p] = store.plane(ParticleStore::Plane(ParticleStore::X + p));
+      }
+
+      const uint32_t* indices  = steps.bin(level);
+      float*          levels   = steps.levels();
+      const int       subSteps = 1 << level;
+      const float     dt       = params.dt / subSteps;
+      const floatv    resetRadius2(params.resetRadius2);
+
+      alignas(64) float lanes[6][width];
+      size_t            group[width];
+
+      for(size_t k = first; k < last; k += width)
+      {
+         for(int lane = 0; lane < width; ++lane)
+         {
+            group[lane] = indices[std::min(k + lane, last - 1)];
+            for(int p = 0; p < 6; ++p)
+            {
+               lanes[p][lane] = planes[p][group[lane]];
+            }
+         }
+
+         floatv x  = floatv::load(lanes[0]), y  = floatv::load(lanes[1]), z  = floatv::load(lanes[2]);
+         floatv vx = floatv::load(lanes[3]), vy = floatv::load(lanes[4]), vz = floatv::load(lanes[5]);
+
+         // Velocity change over the base step, not counting resets
+         floatv dvx(0.0f), dvy(0.0f), dvz(0.0f);
+         for(int s = 0; s < subSteps; ++s)
+         {
+            floatv ux = vx, uy = vy, uz = vz;
+            Integrator::step(x, y, z, vx, vy, vz, field, dt);
+            dvx = dvx + (vx - ux);
+            dvy = dvy + (vy - uy);
+            dvz = dvz + (vz - uz);
+
+            maskv reset = (x * x + y * y + z * z) > resetRadius2;
+            if(Compute::any(reset))
+            {
+               floatv* state[6] = { &x, &y, &z, &vx, &vy, &vz };
+               for(int p = 0; p < 6; ++p)
+               {
+                  const float* initial = store.plane(ParticleStore::Plane(ParticleStore::X0 + p));
+                  for(int lane = 0; lane < width; ++lane)
+                  {
+                     lanes[p][lane] = initial[group[lane]];
+                  }
+                  *state[p] = Compute::select(reset, floatv::load(lanes[p]), *state[p]);
+               }
+            }
+         }
+
+         floatv newLevel = stepLevel(vx, vy, vz, dvx, dvy, dvz, steps.getAccuracy(), steps.getMaxLevel());
+
+         x.store(lanes[0]);  y.store(lanes[1]);  z.store(lanes[2]);
+         vx.store(lanes[3]); vy.store(lanes[4]); vz.store(lanes[5]);
+         alignas(64) float newLevels[width];
+         newLevel.store(newLevels);
+         for(int lane = 0; lane < width; ++lane)
+         {
+            for(int p = 0; p < 6; ++p)
+            {
+               planes[p][group[lane]] = lanes[p][lane];
+            }
+            levels[group[lane]] = newLevels[lane];
+         }
+      }
+   }
+}
+
+#endif
@@ -0,0 +1,67 @@
+//--------------------------------------------------------------------------------
+// bounds.h
+//
+// Axis aligned bounding box of the particle positions, reduced over chunks on
+// the thread pool. Used to fit the octree and the particle mesh grid.
+//--------------------------------------------------------------------------------
+#ifndef _bounds_h
+#define _bounds_h
+
+#include "particle_store.h"
+
+#include <parallel_for.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <vector>
+
+namespace Particles
+{
+   /**
+    * Bounding box of the current positions
+    *
+    * @param store
+    *    Particles, at least one
+    * @param lo, hi
+    *    Output minimum and maximum corner
+    */
+   inline void positionBounds(const ParticleStore& store, float lo[3], float hi[3])
+   {
+      const size_t chunkSize = 65536;
+      size_t size      = store.size();
+      size_t numChunks = (size + chunkSize - 1) / chunkSize;
+
+      // One partial result per chunk
+      std::vector<float> bounds(numChunks * 6);
+      Compute::parallelForChunks(0, size, chunkSize, [&](size_t first, size_t last)
+      {
+         float* b = &bounds[first / chunkSize * 6];
+         for(int axis = 0; axis < 3; ++axis)
+         {
+            const float* p = store.plane(ParticleStore::Plane(ParticleStore::X + axis));
+            float minimum = p[first];
+            float maximum = p[first];
+            for(size_t i = first; i < last; ++i)
+            {
+               minimum = std::min(minimum, p[i]);
+               maximum = std::max(maximum, p[i]);
+            }
+            b[axis]     = minimum;
+            b[axis + 3] = maximum;
+         }
+      });
+
+      for(int axis = 0; axis < 3; ++axis)
+      {
+         lo[axis] = bounds[axis];
+         hi[axis] = bounds[axis + 3];
+         for(size_t c = 1; c < numChunks; ++c)
+         {
+            lo[axis] = std::min(lo[axis], bounds[c * 6 + axis]);
+            hi[axis] = std::max(hi[axis], bounds[c * 6 + 3 + axis]);
+         }
+      }
+   }
+}
+
+#endif
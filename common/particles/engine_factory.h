@@ -0,0 +1,70 @@
+//--------------------------------------------------------------------------------
+// engine_factory.h
+//
+// Create a particle engine from the name of its integration scheme, for
+// programs that pick the scheme on the command line.
+//--------------------------------------------------------------------------------
+#ifndef _engine_factory_h
+#define _engine_factory_h
+
+#include "barnes_hut.h"
+#include "integrators.h"
+#include "kepler_engine.h"
+#include "nbody_engine.h"
+#include "particle_engine.h"
+
+#ifdef HAVE_FFTW
+#include "particle_mesh.h"
+#endif
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+namespace Particles
+{
+   /**
+    * Create an engine for an integration scheme chosen at run time. Throws
+    * std::runtime_error for an unknown name
+    *
+    * @param integrator
+    *    "rk4", "leapfrog", "yoshida4", "kepler", "barnes-hut" or, when built
+    *    with FFTW (HAVE_FFTW), "particle-mesh"
+    * @param numParticles
+    *    Number of particles
+    */
+   inline ParticleEngineBase* createParticleEngine(const std::string& integrator, size_t numParticles)
+   {
+      if(integrator == RK4::name())
+      {
+         return new ParticleEngine<RK4>(numParticles);
+      }
+      if(integrator == Leapfrog::name())
+      {
+         return new ParticleEngine<Leapfrog>(numParticles);
+      }
+      if(integrator == Yoshida4::name())
+      {
+         return new ParticleEngine<Yoshida4>(numParticles);
+      }
+      if(integrator == "kepler")
+      {
+         return new KeplerEngine(numParticles);
+      }
+      if(integrator == BarnesHut::name())
+      {
+         return new NBodyEngine<BarnesHut>(numParticles);
+      }
+#ifdef HAVE_FFTW
+      if(integrator == ParticleMesh::name())
+      {
+         return new NBodyEngine<ParticleMesh>(numParticles);
+      }
+      throw std::runtime_error("Unknown integrator " + integrator + ", expected rk4, leapfrog, yoshida4, kepler, barnes-hut or particle-mesh");
+#else
+      throw std::runtime_error("Unknown integrator " + integrator + ", expected rk4, leapfrog, yoshida4, kepler or barnes-hut");
+#endif
+   }
+}
+
+#endif
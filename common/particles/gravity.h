@@ -0,0 +1,75 @@
+//--------------------------------------------------------------------------------
+// gravity.h
+//
+// Acceleration of particles towards a single gravity well at the origin,
+// a = -GM x / |x|^3. The float version is the reference; the floatv version
+// replaces the square root and division with one reciprocal square root.
+//
+// The integrators take the force as a field policy: any type with
+// operator()(x, y, z, ax, ay, az). CentralWell is the single well at the
+// origin; wells.h has fields for several wells.
+//--------------------------------------------------------------------------------
+#ifndef _gravity_h
+#define _gravity_h
+
+#include <simd.h>
+#include <simd_math.h>
+
+#include <cmath>
+
+namespace Particles
+{
+   /**
+    * Acceleration towards the well for one particle
+    */
+   inline void gravity(float GM, float x, float y, float z, float& ax, float& ay, float& az)
+   {
+      float r2 = x * x + y * y + z * z;
+      float r  = sqrtf(r2);
+      float s  = -GM / (r2 * r);
+      ax = s * x;
+      ay = s * y;
+      az = s * z;
+   }
+
+   /**
+    * Acceleration towards the well for floatv::width particles
+    */
+   inline void gravity(Compute::floatv GM, Compute::floatv x, Compute::floatv y, Compute::floatv z,
+                       Compute::floatv& ax, Compute::floatv& ay, Compute::floatv& az)
+   {
+      Compute::floatv rinv = Compute::rsqrtApprox(x * x + y * y + z * z);
+      Compute::floatv s    = -GM * rinv * rinv * rinv;
+      ax = s * x;
+      ay = s * y;
+      az = s * z;
+   }
+
+   /**
+    * Field of the single gravity well at the origin
+    */
+   template<typename T>
+   struct CentralWell
+   {
+      /**
+       * Floating point operations per evaluation of the floatv version:
+       * 5 for r^2, 6 for the refined reciprocal square root, 3 for the
+       * scale and 3 for the components
+       */
+      static const int flops = 17;
+
+      T GM;       //< Gravitational constant times the well mass. The particle mass cancels
+
+      explicit CentralWell(float GM)
+      :  GM (GM)
+      {
+      }
+
+      void operator()(T x, T y, T z, T& ax, T& ay, T& az) const
+      {
+         gravity(GM, x, y, z, ax, ay, az);
+      }
+   };
+}
+
+#endif
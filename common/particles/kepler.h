@@ -0,0 +1,269 @@
+//--------------------------------------------------------------------------------
+// kepler.h
+//
+// Closed form propagation of a particle around a point mass, in universal
+// variables. The same equations cover elliptic, parabolic and hyperbolic
+// orbits, so escaping particles need no special case. See "Fundamentals of
+// Astrodynamics" by Bate, Mueller and White, chapter 4, or "Orbital Mechanics
+// for Engineering Students" by Curtis, section 3.7.
+//
+// Everything is evaluated in double precision: the universal anomaly equation
+// loses too many digits in float near periapsis of eccentric orbits.
+//--------------------------------------------------------------------------------
+#ifndef _kepler_h
+#define _kepler_h
+
+#include <algorithm>
+#include <cmath>
+
+namespace Particles
+{
+   namespace Kepler
+   {
+      /**
+       * Stumpff functions C(z) and S(z)
+       */
+      inline void stumpff(double z, double& C, double& S)
+      {
+         if(z > 1e-6)
+         {
+            double s = sqrt(z);
+            C = (1.0 - cos(s)) / z;
+            S = (s - sin(s)) / (s * z);
+         }
+         else if(z < -1e-6)
+         {
+            double s = sqrt(-z);
+            C = (cosh(s) - 1.0) / -z;
+            S = (sinh(s) - s) / (s * -z);
+         }
+         else
+         {
+            C = 1.0 / 2.0 - z / 24.0  + z * z / 720.0;
+            S = 1.0 / 6.0 - z / 120.0 + z * z / 5040.0;
+         }
+      }
+
+      /**
+       * The part of an orbit that does not change over time
+       */
+      struct Elements
+      {
+         double r0;        //< Distance from the well at time 0
+         double sigma0;    //< r0 . v0 / sqrt(GM)
+         double alpha;     //< 1 / semi-major axis. Negative for escaping orbits
+         double period;    //< The state repeats after this time: the orbital period, or the
+                           //  time to reach the reset radius. 0 if the particle never moves
+      };
+
+      /**
+       * Time since time 0 and distance from the well at universal anomaly chi
+       */
+      inline void timeAndRadius(const Elements& el, double sqrtGM, double chi, double& t, double& r)
+      {
+         double z = el.alpha * chi * chi;
+         double C, S;
+         stumpff(z, C, S);
+         t = (el.sigma0 * chi * chi * C + (1.0 - el.alpha * el.r0) * chi * chi * chi * S + el.r0 * chi) / sqrtGM;
+         r = chi * chi * C + el.sigma0 * chi * (1.0 - z * S) + el.r0 * (1.0 - z * C);
+      }
+
+      /**
+       * Solve Kepler's equation in universal variables for the anomaly chi
+       * reached after time t >= 0. t(chi) increases monotonically with
+       * slope r / sqrt(GM), so Newton's method is kept inside a bracket
+       */
+      inline double solveAnomaly(const Elements& el, double sqrtGM, double t)
+      {
+         if(t <= 0)
+         {
+            return 0;
+         }
+
+         // Bracket the root. Start where |alpha chi^2| = 1 and double: a
+         // larger first guess overflows cosh() on fast escaping orbits
+         double lo = 0;
+         double hi = el.alpha != 0 ? 1.0 / sqrt(fabs(el.alpha)) : sqrt(el.r0);
+         double th, rh;
+         timeAndRadius(el, sqrtGM, hi, th, rh);
+         while(th < t)
+         {
+            lo = hi;
+            hi *= 2;
+            timeAndRadius(el, sqrtGM, hi, th, rh);
+         }
+
+         double chi = 0.5 * (lo + hi);
+         for(int i = 0; i < 64; ++i)
+         {
+            double tc, rc;
+            timeAndRadius(el, sqrtGM, chi, tc, rc);
+            double error = tc - t;
+            if(fabs(error) <= 1e-14 * t)
+            {
+               break;
+            }
+
+            if(error < 0)
+            {
+               lo = chi;
+            }
+            else
+            {
+               hi = chi;
+            }
+
+            // Newton step, or bisection if it leaves the bracket
+            double next = chi - error * sqrtGM / rc;
+            chi = (next > lo && next < hi) ? next : 0.5 * (lo + hi);
+         }
+         return chi;
+      }
+
+      /**
+       * Compute the elements of a particle
+       *
+       * @param x0, v0
+       *    Position and velocity at time 0
+       * @param GM
+       *    Gravitational constant times the well mass
+       * @param resetRadius
+       *    Particles that reach this distance return to their state at time 0
+       */
+      inline Elements elements(const double x0[3], const double v0[3], double GM, double resetRadius)
+      {
+         Elements el;
+         double sqrtGM = sqrt(GM);
+         double v2     = v0[0] * v0[0] + v0[1] * v0[1] + v0[2] * v0[2];
+         el.r0     = sqrt(x0[0] * x0[0] + x0[1] * x0[1] + x0[2] * x0[2]);
+         el.sigma0 = (x0[0] * v0[0] + x0[1] * v0[1] + x0[2] * v0[2]) / sqrtGM;
+         el.alpha  = el.r0 > 0 ? 2.0 / el.r0 - v2 / GM : 0;
+         el.period = 0;
+
+         // Particles at the well or outside the reset radius are reset on
+         // every step, so they never move
+         if(el.r0 <= 0 || el.r0 > resetRadius)
+         {
+            return el;
+         }
+
+         double chiReset;
+         if(el.alpha > 0)
+         {
+            // Bound orbit. e cos(E) = 1 - r / a and e sin(E) = sigma / sqrt(a)
+            // with eccentric anomaly E, and chi = (E - E0) sqrt(a)
+            double sqrtAlpha = sqrt(el.alpha);
+            double eCosE0    = 1.0 - el.r0 * el.alpha;
+            double eSinE0    = el.sigma0 * sqrtAlpha;
+            double e         = sqrt(eCosE0 * eCosE0 + eSinE0 * eSinE0);
+            double apoapsis  = (1.0 + e) / el.alpha;
+
+            if(apoapsis <= resetRadius)
+            {
+               el.period = 2.0 * M_PI / (sqrtGM * el.alpha * sqrtAlpha);
+               return el;
+            }
+
+            // The first outbound crossing of the reset radius. r0 < resetRadius,
+            // so E0 lies in (-E_R, E_R)
+            double E0 = atan2(eSinE0, eCosE0);
+            double ER = acos(std::min(1.0, std::max(-1.0, (1.0 - resetRadius * el.alpha) / e)));
+            chiReset  = (ER - E0) / sqrtAlpha;
+         }
+         else
+         {
+            // Escaping orbit. r(chi) falls to periapsis at most once and then
+            // grows without bound, so bracketing and bisection find the
+            // single crossing
+            double lo = 0;
+            double hi = el.alpha < 0 ? 1.0 / sqrt(-el.alpha) : sqrt(resetRadius);
+            double t, r;
+            timeAndRadius(el, sqrtGM, hi, t, r);
+            while(r < resetRadius)
+            {
+               lo = hi;
+               hi *= 2;
+               timeAndRadius(el, sqrtGM, hi, t, r);
+            }
+            for(int i = 0; i < 100 && hi - lo > 1e-14 * hi; ++i)
+            {
+               double mid = 0.5 * (lo + hi);
+               timeAndRadius(el, sqrtGM, mid, t, r);
+               if(r < resetRadius)
+               {
+                  lo = mid;
+               }
+               else
+               {
+                  hi = mid;
+               }
+            }
+            chiReset = 0.5 * (lo + hi);
+         }
+
+         double r;
+         timeAndRadius(el, sqrtGM, chiReset, el.period, r);
+         return el;
+      }
+
+      /**
+       * Position and velocity of a particle at time t
+       *
+       * @param el
+       *    Elements from elements()
+       * @param x0, v0
+       *    Position and velocity at time 0
+       * @param GM
+       *    Gravitational constant times the well mass
+       * @param t
+       *    Time since time 0. Any value, including negative
+       * @param x, v
+       *    Output position and velocity
+       */
+      inline void propagate(const Elements& el, const double x0[3], const double v0[3], double GM, double t,
+                            double x[3], double v[3])
+      {
+         if(el.period <= 0)
+         {
+            for(int i = 0; i < 3; ++i)
+            {
+               x[i] = x0[i];
+               v[i] = v0[i];
+            }
+            return;
+         }
+
+         // The motion repeats with el.period, either because the orbit is
+         // closed or because the particle is reset to its initial state
+         t = fmod(t, el.period);
+         if(t < 0)
+         {
+            t += el.period;
+         }
+
+         double sqrtGM = sqrt(GM);
+         double chi    = solveAnomaly(el, sqrtGM, t);
+         double z      = el.alpha * chi * chi;
+         double C, S;
+         stumpff(z, C, S);
+
+         // Lagrange coefficients
+         double f = 1.0 - chi * chi / el.r0 * C;
+         double g = t - chi * chi * chi / sqrtGM * S;
+         for(int i = 0; i < 3; ++i)
+         {
+            x[i] = f * x0[i] + g * v0[i];
+         }
+
+         double r    = sqrt(x[0] * x[0] + x[1] * x[1] + x[2] * x[2]);
+         double fDot = sqrtGM / (r * el.r0) * (z * S - 1.0) * chi;
+         double gDot = 1.0 - chi * chi / r * C;
+         for(int i = 0; i < 3; ++i)
+         {
+            v[i] = fDot * x0[i] + gDot * v0[i];
+         }
+      }
+   }
+}
+
+#endif
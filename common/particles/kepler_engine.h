@@ -0,0 +1,217 @@
+//--------------------------------------------------------------------------------
+// kepler_engine.h
+//
+// Particle engine that evaluates every particle's orbit in closed form instead
+// of integrating it. With a single point mass and no interaction between
+// particles, each particle follows an exact conic, so the state at any time
+// costs the same to compute: time can be scrubbed forwards and backwards, and
+// there is no integration error.
+//--------------------------------------------------------------------------------
+#ifndef _kepler_engine_h
+#define _kepler_engine_h
+
+#include "kepler.h"
+#include "particle_engine.h"
+
+#include <aligned_array.h>
+#include <memory_accounting.h>
+#include <parallel_for.h>
+
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+namespace Particles
+{
+   /**
+    * The initial planes of the store are the state at time 0. The elements
+    * are computed from them on the first update(), and again whenever the
+    * well mass, the reset radius or the number of particles changes. Call
+    * updateElements() after changing the initial state of a particle
+    * directly.
+    *
+    * How to use this class:
+    * \code
+    * Particles::KeplerEngine engine(numParticles);
+    * for(size_t i = 0; i < numParticles; ++i)
+    * {
+    *    engine.getStore().set(i, 0.1f, 0, 0, vx, vy, vz);
+    * }
+    *
+    * engine.update();          // t = 0.01
+    * engine.setTime(3600.0);   // Jump an hour ahead
+    * \endcode
+    */
+   class KeplerEngine : public ParticleEngineBase
+   {
+   public:
+      /**
+       * Constructor
+       *
+       * @param numParticles
+       *    Number of particles
+       * @param wellMass
+       *    Mass of the gravity well in kg
+       * @param timeStep
+       *    Time advanced by update(), in seconds
+       */
+      explicit KeplerEngine(size_t numParticles, float wellMass = 9.5e9f, float timeStep = 0.01f)
+      :  ParticleEngineBase     (numParticles, wellMass, timeStep)
+      ,  _time                  (0)
+      ,  _elementsGM            (0)
+      ,  _elementsResetRadius   (0)
+      ,  _memory                ("KeplerEngine")
+      {
+      }
+
+      using ParticleEngineBase::update;
+
+      /**
+       * Advance the time by nSteps time steps. The orbits are evaluated
+       * once, at the new time, however many steps that is
+       */
+      virtual void update(int nSteps)
+      {
+         setTime(_time + double(nSteps) * _timeStep);
+      }
+
+      virtual const char* getIntegratorName() const
+      {
+         return "kepler";
+      }
+
+      /**
+       * Set the position and velocity of every particle to their values at
+       * time t. Particles that reach the reset radius start over from their
+       * initial state, exactly when they cross it
+       *
+       * @param t
+       *    Time in seconds since the initial state. Any value, including
+       *    negative
+       */
+      void setTime(double t)
+      {
+         double GM = 6.67e-11 * _wellMass;
+         if(_elements.size() != _store.size() || _elementsGM != GM || _elementsResetRadius != _resetRadius)
+         {
+            updateElements();
+         }
+         _time = t;
+
+         ParticleStore& store = _store;
+         const Kepler::Elements* elements = _elements.data();
+         Compute::parallelForChunks(0, store.size(), _chunkSize, [&](size_t first, size_t last)
+         {
+            float* px  = store.plane(ParticleStore::X);
+            float* py  = store.plane(ParticleStore::Y);
+            float* pz  = store.plane(ParticleStore::Z);
+            float* pvx = store.plane(ParticleStore::VX);
+            float* pvy = store.plane(ParticleStore::VY);
+            float* pvz = store.plane(ParticleStore::VZ);
+
+            for(size_t i = first; i < last; ++i)
+            {
+               double x0[3], v0[3], x[3], v[3];
+               initialState(i, x0, v0);
+               Kepler::propagate(elements[i], x0, v0, GM, t, x, v);
+
+               px[i]  = float(x[0]); py[i]  = float(x[1]); pz[i]  = float(x[2]);
+               pvx[i] = float(v[0]); pvy[i] = float(v[1]); pvz[i] = float(v[2]);
+            }
+         });
+      }
+
+      /**
+       * Only the single well at the origin has a closed form solution.
+       * Throws std::runtime_error for any other set of wells
+       */
+      virtual void setWells(const std::vector<Well>& wells)
+      {
+         if(!wells.empty())
+         {
+            throw std::runtime_error("The kepler mode supports only the single well at the origin");
+         }
+      }
+
+      /**
+       * The closed form needs no time steps. Throws std::runtime_error for
+       * any level above 0
+       */
+      virtual void setMaxLevel(int maxLevel)
+      {
+         if(maxLevel > 0)
+         {
+            throw std::runtime_error("The kepler mode does not take time steps");
+         }
+      }
+
+      /**
+       * Particles follow their orbits from the initial state. Throws
+       * std::runtime_error for any emitters
+       */
+      virtual void setEmitters(const std::vector<Emitter>& emitters)
+      {
+         if(!emitters.empty())
+         {
+            throw std::runtime_error("The kepler mode does not support emitters");
+         }
+      }
+
+      /**
+       * @return the current time in seconds since the initial state
+       */
+      double getTime() const
+      {
+         return _time;
+      }
+
+      /**
+       * Recompute the orbital elements from the initial state
+       */
+      void updateElements()
+      {
+         _elementsGM          = 6.67e-11 * _wellMass;
+         _elementsResetRadius = _resetRadius;
+         if(_elements.size() != _store.size())
+         {
+            _elements.resize(_store.size());
+            _memory.setHost(_elements.size() * sizeof(Kepler::Elements));
+         }
+
+         double GM          = _elementsGM;
+         double resetRadius = _elementsResetRadius;
+         Kepler::Elements* elements = _elements.data();
+         Compute::parallelForChunks(0, _store.size(), _chunkSize, [&](size_t first, size_t last)
+         {
+            for(size_t i = first; i < last; ++i)
+            {
+               double x0[3], v0[3];
+               initialState(i, x0, v0);
+               elements[i] = Kepler::elements(x0, v0, GM, resetRadius);
+            }
+         });
+      }
+
+   private:
+      /**
+       * Initial position and velocity of particle i in double precision
+       */
+      void initialState(size_t i, double x0[3], double v0[3]) const
+      {
+         x0[0] = _store.plane(ParticleStore::X0)[i];
+         x0[1] = _store.plane(ParticleStore::Y0)[i];
+         x0[2] = _store.plane(ParticleStore::Z0)[i];
+         v0[0] = _store.plane(ParticleStore::VX0)[i];
+         v0[1] = _store.plane(ParticleStore::VY0)[i];
+         v0[2] = _store.plane(ParticleStore::VZ0)[i];
+      }
+
+      Compute::AlignedArray<Kepler::Elements> _elements;             //< Orbit of each particle
+      double                                  _time;                 //< Seconds since the initial state
+      double                                  _elementsGM;           //< GM the elements were computed for
+      float                                   _elementsResetRadius;  //< Reset radius the elements were computed for
+      Compute::MemoryAccount                  _memory;               //< Host memory of the elements
+   };
+}
+
+#endif
@@ -0,0 +1,509 @@
+//--------------------------------------------------------------------------------
+// lifecycle.h
+//
+// Particles that are born from emitters, live for a while and die, instead of
+// being reset to their initial state. The store is allocated once for the
+// largest number of particles; the live particles are kept packed at the
+// front of it and the slots behind them form the free list, so the count
+// varies from step to step without reallocating.
+//
+// A step has three passes, each parallel over the thread pool:
+//
+//    1. Integrate and age the live particles. A particle beyond the reset
+//       radius has its remaining time zeroed with a select, so the loop has
+//       no data dependent branch
+//    2. Retire: stream-compact the indices of the particles that are out of
+//       time into a free list, scanning only the lifetimes a SIMD vector at
+//       a time
+//    3. Respawn: each emitter adds its particles for the step as one batch,
+//       into the free slots first and then behind the live particles. The
+//       random values are a function of the emitter and the running
+//       particle count (counter_rng.h), so the batch is filled in parallel.
+//       If fewer particles are born than died, live particles from the end
+//       of the range move into the remaining holes. In a steady state
+//       almost nothing moves
+//--------------------------------------------------------------------------------
+#ifndef _lifecycle_h
+#define _lifecycle_h
+
+#include "particle_kernels.h"
+#include "particle_store.h"
+
+#include <aligned_array.h>
+#include <counter_rng.h>
+#include <memory_accounting.h>
+#include <parallel_for.h>
+#include <simd.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include <stdint.h>
+
+namespace Particles
+{
+   /**
+    * Source of new particles. The particles start at a random point of the
+    * shape and move off in a random direction at the given speed
+    */
+   struct Emitter
+   {
+      enum Shape
+      {
+         POINT,      //< Every particle starts at the center
+         SPHERE,     //< Uniform in a ball of the given radius
+         DISK        //< Uniform in a disk of the given radius in the xz plane
+      };
+
+      Shape shape;
+      float x, y, z;          //< Center
+      float radius;           //< Size of the sphere or disk
+      float speed;            //< Initial speed of every particle
+      float rate;             //< Particles per second
+      float lifetime;         //< Mean lifetime in seconds
+      float lifetimeSpread;   //< Lifetimes are uniform in lifetime * (1 +- lifetimeSpread)
+
+      Emitter()
+      :  shape          (POINT)
+      ,  x              (0)
+      ,  y              (0)
+      ,  z              (0)
+      ,  radius         (0)
+      ,  speed          (1)
+      ,  rate           (1000)
+      ,  lifetime       (1)
+      ,  lifetimeSpread (0)
+      {
+      }
+   };
+
+   /**
+    * Emitters, the remaining lifetime of each particle and the number of
+    * live particles.
+    *
+    * How to use this class:
+    * \code
+    * Particles::Lifecycle lifecycle;
+    * lifecycle.setEmitters(emitters, store);
+    * while(running)
+    * {
+    *    // ... integrate particles [0, lifecycle.getNumAlive()) and age
+    *    //     them, see advanceSimd() ...
+    *    lifecycle.retire();
+    *    lifecycle.emit(store, dt);
+    * }
+    * \endcode
+    */
+   class Lifecycle
+   {
+   public:
+      /**
+       * Constructor
+       */
+      Lifecycle()
+      :  _rng       (7)
+      ,  _numAlive  (0)
+      ,  _numFree   (0)
+      ,  _memory    ("Lifecycle")
+      {
+      }
+
+      /**
+       * @return true if there are emitters, which replaces resets with
+       *    death and respawn
+       */
+      bool enabled() const
+      {
+         return !_emitters.empty();
+      }
+
+      const std::vector<Emitter>& getEmitters() const { return _emitters; }
+      size_t getNumAlive() const                      { return _numAlive; }
+
+      /**
+       * @return the remaining lifetime of every slot of the store, 0 or less
+       *    for the free slots
+       */
+      float* lifetimes()
+      {
+         return _lifetimes.data();
+      }
+
+      /**
+       * Replace the emitters and kill every particle
+       *
+       * @param emitters
+       *    The emitters. Empty turns the lifecycle off
+       * @param store
+       *    The particles, sized for the most that may be alive at once
+       */
+      void setEmitters(const std::vector<Emitter>& emitters, const ParticleStore& store)
+      {
+         _emitters = emitters;
+         _pending.assign(emitters.size(), 0.0);
+         _emitted.assign(emitters.size(), 0);
+         _numAlive = 0;
+         _numFree  = 0;
+
+         _lifetimes.resize(store.paddedSize());
+         _dead.resize(store.size());
+         _free.resize(store.size());
+         _movers.resize(store.size());
+         _memory.setHost(_lifetimes.size() * sizeof(float) + (_dead.size() + _free.size() + _movers.size()) * sizeof(uint32_t));
+      }
+
+      /**
+       * List the particles that are out of time as free slots, in index
+       * order
+       */
+      void retire()
+      {
+         using Compute::floatv;
+
+         const size_t chunkSize = 16384;
+         size_t       numAlive  = _numAlive;
+         const float* life      = _lifetimes.data();
+
+         // List the dead of each chunk in the chunk's own range of _dead
+         size_t              numChunks = (numAlive + chunkSize - 1) / chunkSize;
+         std::vector<size_t> offsets(numChunks + 1, 0);
+         uint32_t*           deadList  = _dead.data();
+         Compute::parallelForChunks(0, numAlive, chunkSize, [&](size_t first, size_t last)
+         {
+            const floatv zero(0.0f);
+            uint32_t* list    = deadList + first;
+            size_t    numDead = 0;
+            size_t    i       = first;
+            for(; i + floatv::width <= last; i += floatv::width)
+            {
+               unsigned kill = Compute::bits(zero >= floatv::load(life + i));
+               for(size_t lane = i; kill != 0; ++lane, kill >>= 1)
+               {
+                  if(kill & 1)
+                  {
+                     list[numDead++] = uint32_t(lane);
+                  }
+               }
+            }
+            for(; i < last; ++i)
+            {
+               if(life[i] <= 0)
+               {
+                  list[numDead++] = uint32_t(i);
+               }
+            }
+            offsets[first / chunkSize + 1] = numDead;
+         });
+
+         for(size_t c = 0; c < numChunks; ++c)
+         {
+            offsets[c + 1] += offsets[c];
+         }
+
+         uint32_t* freeList = _free.data();
+         Compute::ThreadPool::instance().run(numChunks, [&](size_t c)
+         {
+            std::copy(deadList + c * chunkSize, deadList + c * chunkSize + (offsets[c + 1] - offsets[c]), freeList + offsets[c]);
+         });
+         _numFree = offsets[numChunks];
+      }
+
+      /**
+       * Add each emitter's particles for a step of dt, first into the free
+       * slots, lowest index first, then behind the live particles.
+       * Particles that do not fit are dropped. Then pack the live particles
+       * at the front of the store
+       */
+      void emit(ParticleStore& store, float dt)
+      {
+         const uint32_t* freeList = _free.data();
+         float*          life     = _lifetimes.data();
+         size_t          numFree  = _numFree;
+         size_t          numAlive = _numAlive;
+         size_t          numNew   = 0;
+
+         for(size_t e = 0; e < _emitters.size(); ++e)
+         {
+            const Emitter& emitter = _emitters[e];
+
+            _pending[e] += double(emitter.rate) * dt;
+            size_t count = size_t(_pending[e]);
+            _pending[e] -= double(count);
+            count = std::min(count, store.size() - (numAlive - numFree) - numNew);
+            if(count == 0)
+            {
+               continue;
+            }
+
+            size_t   first   = numNew;
+            uint64_t emitted = _emitted[e];
+            uint32_t stream  = uint32_t(2 * e + 1);
+
+            Compute::parallelFor(first, first + count, [&](size_t begin, size_t end)
+            {
+               float* planes[6];
+               for(int p = 0; p < 6; ++p)
+               {
+                  planes[p] = store.plane(ParticleStore::Plane(ParticleStore::X + p));
+               }
+
+               for(size_t k = begin; k < end; ++k)
+               {
+                  size_t i = k < numFree ? freeList[k] : numAlive + (k - numFree);
+                  float  state[6];
+                  spawn(emitter, emitted + (k - first), stream, state, life[i]);
+                  for(int p = 0; p < 6; ++p)
+                  {
+                     planes[p][i] = state[p];
+                  }
+               }
+            }, 1024);
+
+            _emitted[e] += count;
+            numNew      += count;
+         }
+
+         if(numNew >= numFree)
+         {
+            _numAlive += numNew - numFree;
+            _numFree   = 0;
+         }
+         else
+         {
+            pack(store, numNew);
+         }
+      }
+
+   private:
+      /**
+       * Move live particles from the end of the live range into the free
+       * slots that the emitters left, so that the live range has no holes
+       *
+       * @param used
+       *    Free slots the emitters filled, the first ones of the list
+       */
+      void pack(ParticleStore& store, size_t used)
+      {
+         // The free slots below the new count are the holes, and the live
+         // particles at or above it fill them. There are as many of each
+         const uint32_t* holes    = _free.data() + used;
+         size_t          numAlive = _numAlive;
+         size_t          newAlive = numAlive - (_numFree - used);
+         size_t          numHoles = std::lower_bound(holes, holes + (_numFree - used), uint32_t(newAlive)) - holes;
+         collect(newAlive, numAlive, _movers.data());
+
+         const uint32_t* movers = _movers.data();
+         float*          life   = _lifetimes.data();
+         Compute::parallelFor(0, numHoles, [&](size_t first, size_t last)
+         {
+            float* planes[6];
+            for(int p = 0; p < 6; ++p)
+            {
+               planes[p] = store.plane(ParticleStore::Plane(ParticleStore::X + p));
+            }
+
+            for(size_t k = first; k < last; ++k)
+            {
+               size_t dst = holes[k];
+               size_t src = movers[k];
+               for(int p = 0; p < 6; ++p)
+               {
+                  planes[p][dst] = planes[p][src];
+               }
+               life[dst] = life[src];
+               life[src] = 0;
+            }
+         }, 1024);
+
+         _numAlive = newAlive;
+         _numFree  = 0;
+      }
+
+      /**
+       * Write the indices of the live particles in [first, last) to out, in
+       * increasing order, skipping aligned vectors of dead slots
+       *
+       * @return the number of indices written
+       */
+      size_t collect(size_t first, size_t last, uint32_t* out) const
+      {
+         using Compute::floatv;
+
+         const size_t chunkSize = 16384;
+         const float* life      = _lifetimes.data();
+
+         if(last <= first)
+         {
+            return 0;
+         }
+
+         auto scan = [&](size_t begin, size_t end, uint32_t* dst) -> size_t
+         {
+            const floatv zero(0.0f);
+            size_t n = 0;
+            size_t i = begin;
+            while(i < end)
+            {
+               if(i % floatv::width == 0 && i + floatv::width <= end && !Compute::any(floatv::load(life + i) > zero))
+               {
+                  i += floatv::width;
+                  continue;
+               }
+               if(life[i] > 0)
+               {
+                  if(dst)
+                  {
+                     dst[n] = uint32_t(i);
+                  }
+                  ++n;
+               }
+               ++i;
+            }
+            return n;
+         };
+
+         size_t numChunks = (last - first + chunkSize - 1) / chunkSize;
+         std::vector<size_t> offsets(numChunks + 1, 0);
+         Compute::parallelForChunks(first, last, chunkSize, [&](size_t begin, size_t end)
+         {
+            offsets[(begin - first) / chunkSize + 1] = scan(begin, end, NULL);
+         });
+         for(size_t c = 0; c < numChunks; ++c)
+         {
+            offsets[c + 1] += offsets[c];
+         }
+         Compute::parallelForChunks(first, last, chunkSize, [&](size_t begin, size_t end)
+         {
+            scan(begin, end, out + offsets[(begin - first) / chunkSize]);
+         });
+         return offsets[numChunks];
+      }
+
+      /**
+       * Initial state and lifetime of an emitter's nth particle
+       */
+      void spawn(const Emitter& emitter, uint64_t n, uint32_t stream, float state[6], float& lifetime) const
+      {
+         // u[0] and u[1] pick the direction, u[2] the lifetime and u[4] to
+         // u[6] the offset from the center
+         float u[8];
+         _rng.uniform4(n, stream, u);
+         if(emitter.shape != Emitter::POINT)
+         {
+            _rng.uniform4(n, stream + 1, u + 4);
+         }
+
+         // Random direction, as in the original initialization
+         float theta = 2 * float(M_PI) * u[0];
+         float phi   = 2 * float(M_PI) * u[1];
+         state[3] = emitter.speed * cosf(phi) * sinf(theta);
+         state[4] = emitter.speed * sinf(phi) * sinf(theta);
+         state[5] = emitter.speed * cosf(theta);
+
+         float offset[3] = { 0, 0, 0 };
+         if(emitter.shape == Emitter::SPHERE)
+         {
+            // Uniform in the ball: cube root of the radius, uniform cos(polar)
+            float r     = emitter.radius * cbrtf(u[4]);
+            float cosP  = 2 * u[5] - 1;
+            float sinP  = sqrtf(std::max(0.0f, 1 - cosP * cosP));
+            float az    = 2 * float(M_PI) * u[6];
+            offset[0] = r * sinP * cosf(az);
+            offset[1] = r * cosP;
+            offset[2] = r * sinP * sinf(az);
+         }
+         else if(emitter.shape == Emitter::DISK)
+         {
+            float r  = emitter.radius * sqrtf(u[4]);
+            float az = 2 * float(M_PI) * u[5];
+            offset[0] = r * cosf(az);
+            offset[2] = r * sinf(az);
+         }
+         state[0] = emitter.x + offset[0];
+         state[1] = emitter.y + offset[1];
+         state[2] = emitter.z + offset[2];
+
+         // u is in (0,1], so the lifetime is always positive for spreads
+         // below 1
+         lifetime = emitter.lifetime * (1 + emitter.lifetimeSpread * (2 * u[2] - 1));
+         lifetime = std::max(lifetime, 1e-6f);
+      }
+
+      Compute::Philox                  _rng;        //< Positions, directions and lifetimes of new particles
+      std::vector<Emitter>             _emitters;   //< Sources of particles
+      std::vector<double>              _pending;    //< Fraction of a particle each emitter owes
+      std::vector<uint64_t>            _emitted;    //< Particles each emitter has created, the random stream index
+      size_t                           _numAlive;   //< Live particles, packed at the front of the store
+      size_t                           _numFree;    //< Dead slots inside the live range, between retire() and emit()
+      Compute::AlignedArray<float>     _lifetimes;  //< Remaining lifetime of each slot, padded
+      Compute::AlignedArray<uint32_t>  _dead;       //< Dead particles of each retire chunk, at the chunk's offset
+      Compute::AlignedArray<uint32_t>  _free;       //< Free list: the dead slots inside the live range, in index order
+      Compute::AlignedArray<uint32_t>  _movers;     //< Live particles behind the new live range
+      Compute::MemoryAccount           _memory;     //< Host memory of the arrays
+   };
+
+   /**
+    * Advance particles [first, last) one step and age them, one particle at
+    * a time. Particles beyond sqrt(params.resetRadius2) run out of time
+    * instead of being reset, and Lifecycle::retire() removes them. field is
+    * a float field
+    */
+   template<typename Integrator, typename Field>
+   void advanceScalar(ParticleStore& store, float* lifetimes, size_t first, size_t last, const Field& field, const StepParams& params)
+   {
+      float* px  = store.plane(ParticleStore::X);
+      float* py  = store.plane(ParticleStore::Y);
+      float* pz  = store.plane(ParticleStore::Z);
+      float* pvx = store.plane(ParticleStore::VX);
+      float* pvy = store.plane(ParticleStore::VY);
+      float* pvz = store.plane(ParticleStore::VZ);
+
+      for(size_t i = first; i < last; ++i)
+      {
+         Integrator::step(px[i], py[i], pz[i], pvx[i], pvy[i], pvz[i], field, params.dt);
+         bool escaped = px[i] * px[i] + py[i] * py[i] + pz[i] * pz[i] > params.resetRadius2;
+         lifetimes[i] = escaped ? 0.0f : lifetimes[i] - params.dt;
+      }
+   }
+
+   /**
+    * Advance particles [first, last) one step and age them, floatv::width
+    * particles at a time, as advanceScalar(). first and last must be
+    * multiples of ParticleStore::padding, or last may be
+    * store.paddedSize(). field is a floatv field
+    */
+   template<typename Integrator, typename Field>
+   void advanceSimd(ParticleStore& store, float* lifetimes, size_t first, size_t last, const Field& field, const StepParams& params)
+   {
+      using Compute::floatv;
+
+      float* px  = store.plane(ParticleStore::X);
+      float* py  = store.plane(ParticleStore::Y);
+      float* pz  = store.plane(ParticleStore::Z);
+      float* pvx = store.plane(ParticleStore::VX);
+      float* pvy = store.plane(ParticleStore::VY);
+      float* pvz = store.plane(ParticleStore::VZ);
+
+      const floatv dt(params.dt);
+      const floatv resetRadius2(params.resetRadius2);
+      const floatv zero(0.0f);
+
+      for(size_t i = first; i < last; i += floatv::width)
+      {
+         floatv x  = floatv::load(px + i),  y  = floatv::load(py + i),  z  = floatv::load(pz + i);
+         floatv vx = floatv::load(pvx + i), vy = floatv::load(pvy + i), vz = floatv::load(pvz + i);
+
+         Integrator::step(x, y, z, vx, vy, vz, field, params.dt);
+
+         floatv life = floatv::load(lifetimes + i) - dt;
+         Compute::select((x * x + y * y + z * z) > resetRadius2, zero, life).store(lifetimes + i);
+
+         x.store(px + i);   y.store(py + i);   z.store(pz + i);
+         vx.store(pvx + i); vy.store(pvy + i); vz.store(pvz + i);
+      }
+   }
+}
+
+#endif
@@ -0,0 +1,260 @@
+//--------------------------------------------------------------------------------
+// nbody_engine.h
+//
+// Particle engine with mutual gravity between the particles, on top of the
+// gravity wells. The particle-particle forces come from a solver policy:
+//
+//    BarnesHut     Octree, O(N log N), accurate at every scale (barnes_hut.h)
+//    ParticleMesh  Density grid and FFT Poisson solve, O(N + M log M) for M
+//                  grid cells, resolves only scales above a grid cell
+//                  (particle_mesh.h)
+//
+// Both solvers work from one snapshot of the positions, so the step is a
+// drift-kick-drift leapfrog with one solve per step:
+//
+//    1. Drift every particle half a step
+//    2. Evaluate the mutual accelerations at the new positions
+//    3. Kick with the mutual and well accelerations, drift the second half
+//       step, and reset particles beyond the reset radius
+//
+// Multi-stage schemes such as RK4 would need a solve per stage.
+//--------------------------------------------------------------------------------
+#ifndef _nbody_engine_h
+#define _nbody_engine_h
+
+#include "barnes_hut.h"
+#include "particle_engine.h"
+
+#include <aligned_array.h>
+#include <memory_accounting.h>
+#include <parallel_for.h>
+#include <simd.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+namespace Particles
+{
+   /**
+    * The particles have equal masses that sum to the total mass. Only the
+    * SIMD kernel is implemented; the kernel setting is ignored. Solver must
+    * have name() and accelerations(store, particleGM, ax, ay, az).
+    *
+    * How to use this class:
+    * \code
+    * Particles::NBodyEngine<Particles::BarnesHut> engine(numParticles);
+    * engine.setTotalMass(1e10f);
+    * engine.getSolver().setOpeningAngle(0.7f);
+    * for(size_t i = 0; i < numParticles; ++i)
+    * {
+    *    engine.getStore().set(i, x, y, z, vx, vy, vz);
+    * }
+    *
+    * engine.update();
+    * \endcode
+    */
+   template<typename Solver>
+   class NBodyEngine : public ParticleEngineBase
+   {
+   public:
+      /**
+       * Constructor
+       *
+       * @param numParticles
+       *    Number of particles
+       * @param wellMass
+       *    Mass of the gravity well in kg
+       * @param timeStep
+       *    Time step in seconds
+       */
+      explicit NBodyEngine(size_t numParticles, float wellMass = 9.5e9f, float timeStep = 0.01f)
+      :  ParticleEngineBase     (numParticles, wellMass, timeStep)
+      ,  _totalMass             (wellMass)
+      ,  _memory                ("NBodyEngine")
+      {
+      }
+
+      using ParticleEngineBase::update;
+
+      /**
+       * Advance every particle nSteps time steps. The forces need every
+       * particle's position, so each step is a separate pass
+       */
+      virtual void update(int nSteps)
+      {
+         for(int step = 0; step < nSteps; ++step)
+         {
+            advance();
+         }
+      }
+
+      virtual const char* getIntegratorName() const
+      {
+         return Solver::name();
+      }
+
+      /**
+       * Every particle feels every other, so they all share one step.
+       * Throws std::runtime_error for any level above 0
+       */
+      virtual void setMaxLevel(int maxLevel)
+      {
+         if(maxLevel > 0)
+         {
+            throw std::runtime_error(std::string("Block time steps are not supported by ") + Solver::name());
+         }
+      }
+
+      /**
+       * The solvers work on the whole store. Throws std::runtime_error for
+       * any emitters
+       */
+      virtual void setEmitters(const std::vector<Emitter>& emitters)
+      {
+         if(!emitters.empty())
+         {
+            throw std::runtime_error(std::string("Emitters are not supported by ") + Solver::name());
+         }
+      }
+
+      float getTotalMass() const                      { return _totalMass; }
+
+      /**
+       * @param mass
+       *    Combined mass of the particles in kg, split evenly between them
+       */
+      void setTotalMass(float mass)
+      {
+         _totalMass = mass;
+      }
+
+      /**
+       * @return the mutual gravity solver, for its settings
+       */
+      Solver& getSolver()
+      {
+         return _solver;
+      }
+
+   private:
+      /**
+       * Advance every particle one time step
+       */
+      void advance()
+      {
+         using Compute::floatv;
+
+         ParticleStore& store = _store;
+         if(_acceleration[0].size() != store.paddedSize())
+         {
+            for(int axis = 0; axis < 3; ++axis)
+            {
+               _acceleration[axis].resize(store.paddedSize());
+            }
+            _memory.setHost(3 * store.paddedSize() * sizeof(float));
+         }
+
+         const floatv halfDt(0.5f * _timeStep);
+         Compute::parallelForChunks(0, store.paddedSize(), _chunkSize, [&](size_t first, size_t last)
+         {
+            for(int axis = 0; axis < 3; ++axis)
+            {
+               float*       x = store.plane(ParticleStore::Plane(ParticleStore::X + axis));
+               const float* v = store.plane(ParticleStore::Plane(ParticleStore::VX + axis));
+               for(size_t i = first; i < last; i += floatv::width)
+               {
+                  (floatv::load(x + i) + floatv::load(v + i) * halfDt).store(x + i);
+               }
+            }
+         });
+
+         float particleGM = 6.67e-11f * _totalMass / std::max<size_t>(store.size(), 1);
+         _solver.accelerations(store, particleGM, _acceleration[0].data(), _acceleration[1].data(), _acceleration[2].data());
+
+         visitField(KickDrift(*this));
+      }
+
+      /**
+       * Field visitor that runs the kick and the second drift with the
+       * well field added to the mutual accelerations
+       */
+      struct KickDrift
+      {
+         NBodyEngine& engine;
+
+         explicit KickDrift(NBodyEngine& engine)
+         :  engine (engine)
+         {
+         }
+
+         template<typename ScalarField, typename SimdField>
+         void operator()(const ScalarField&, const SimdField& field) const
+         {
+            engine.kickDrift(field);
+         }
+      };
+
+      template<typename Field>
+      void kickDrift(const Field& field)
+      {
+         using Compute::floatv;
+         using Compute::maskv;
+
+         ParticleStore& store = _store;
+         const float*   tax   = _acceleration[0].data();
+         const float*   tay   = _acceleration[1].data();
+         const float*   taz   = _acceleration[2].data();
+         const floatv   dt(_timeStep);
+         const floatv   halfDt(0.5f * _timeStep);
+         const floatv   resetRadius2(_resetRadius * _resetRadius);
+
+         Compute::parallelForChunks(0, store.paddedSize(), _chunkSize, [&](size_t first, size_t last)
+         {
+            float* px  = store.plane(ParticleStore::X);
+            float* py  = store.plane(ParticleStore::Y);
+            float* pz  = store.plane(ParticleStore::Z);
+            float* pvx = store.plane(ParticleStore::VX);
+            float* pvy = store.plane(ParticleStore::VY);
+            float* pvz = store.plane(ParticleStore::VZ);
+
+            for(size_t i = first; i < last; i += floatv::width)
+            {
+               floatv x  = floatv::load(px + i),  y  = floatv::load(py + i),  z  = floatv::load(pz + i);
+               floatv vx = floatv::load(pvx + i), vy = floatv::load(pvy + i), vz = floatv::load(pvz + i);
+
+               floatv ax, ay, az;
+               field(x, y, z, ax, ay, az);
+               vx = vx + (ax + floatv::load(tax + i)) * dt;
+               vy = vy + (ay + floatv::load(tay + i)) * dt;
+               vz = vz + (az + floatv::load(taz + i)) * dt;
+               x  = x + vx * halfDt;
+               y  = y + vy * halfDt;
+               z  = z + vz * halfDt;
+
+               maskv reset = (x * x + y * y + z * z) > resetRadius2;
+               if(Compute::any(reset))
+               {
+                  x  = Compute::select(reset, floatv::load(store.plane(ParticleStore::X0)  + i), x);
+                  y  = Compute::select(reset, floatv::load(store.plane(ParticleStore::Y0)  + i), y);
+                  z  = Compute::select(reset, floatv::load(store.plane(ParticleStore::Z0)  + i), z);
+                  vx = Compute::select(reset, floatv::load(store.plane(ParticleStore::VX0) + i), vx);
+                  vy = Compute::select(reset, floatv::load(store.plane(ParticleStore::VY0) + i), vy);
+                  vz = Compute::select(reset, floatv::load(store.plane(ParticleStore::VZ0) + i), vz);
+               }
+
+               x.store(px + i);   y.store(py + i);   z.store(pz + i);
+               vx.store(pvx + i); vy.store(pvy + i); vz.store(pvz + i);
+            }
+         });
+      }
+
+      float                         _totalMass;        //< Combined mass of the particles in kg
+      Solver                        _solver;           //< Mutual gravity
+      Compute::AlignedArray<float>  _acceleration[3];  //< Mutual acceleration of each particle, padded
+      Compute::MemoryAccount        _memory;           //< Host memory of the accelerations
+   };
+}
+
+#endif
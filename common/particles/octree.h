@@ -0,0 +1,629 @@
+//--------------------------------------------------------------------------------
+// octree.h
+//
+// Barnes-Hut octree for the mutual gravity of equal mass particles. See "A
+// hierarchical O(N log N) force-calculation algorithm" by Barnes and Hut,
+// Nature 324 (1986).
+//
+// The tree is rebuilt from scratch every step:
+//
+//    1. Bounding cube of the particles, reduced in parallel (bounds.h)
+//    2. 48 bit Morton code of every particle, 16 bits per axis, in parallel
+//    3. Parallel radix sort of (code, particle index) pairs
+//    4. Gather of the positions into sorted order. The particles of every
+//       node are now one contiguous range
+//    5. The top levels are built serially down to splitDepth; the subtrees
+//       below run as separate jobs on the thread pool and are appended
+//       afterwards
+//
+// Forces are evaluated for groups of groupVectors * floatv::width consecutive
+// sorted particles, which are close together in space. The group walks the
+// tree once: a node far enough from the group's bounding box is applied as a point
+// mass at its centre of mass, otherwise it is opened. Leaves that are opened
+// are summed directly, one source particle against the whole group per SIMD
+// instruction.
+//--------------------------------------------------------------------------------
+#ifndef _octree_h
+#define _octree_h
+
+#include "bounds.h"
+#include "particle_store.h"
+#include "wells.h"
+
+#include <aligned_array.h>
+#include <memory_accounting.h>
+#include <parallel_for.h>
+#include <radix_sort.h>
+#include <simd.h>
+#include <thread_pool.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+#include <stdint.h>
+
+namespace Particles
+{
+   /**
+    * How to use this class:
+    * \code
+    * Particles::Octree tree;
+    * tree.build(store, particleGM, 0.5f, 16);
+    * tree.accelerations(softening * softening, ax, ay, az);
+    * \endcode
+    */
+   class Octree
+   {
+   public:
+      /**
+       * Tree node. The children of a node are consecutive
+       */
+      struct Node
+      {
+         float    x, y, z;       //< Centre of mass
+         float    GM;            //< Gravitational constant times the mass of the particles
+         float    openRadius2;   //< Groups closer than sqrt(openRadius2) to the centre of mass open the node
+         uint32_t firstChild;    //< Index of the first child
+         uint32_t numChildren;   //< Number of children, 0 for a leaf
+         uint32_t first;         //< First particle, in sorted order
+         uint32_t count;         //< Number of particles
+      };
+
+      /**
+       * Deepest level of the tree, set by the bits per axis of the Morton
+       * codes. Nodes at this depth are leaves whatever their size
+       */
+      static const int maxDepth = 16;
+
+      /**
+       * Depth below which subtrees are built in parallel. Up to 8^splitDepth
+       * jobs
+       */
+      static const int splitDepth = 3;
+
+      /**
+       * SIMD vectors of particles per tree walk. Walking the tree costs
+       * more per node than the interactions it finds, so sharing a walk
+       * between more particles pays until the group's bounding box grows
+       * enough to open many more nodes
+       */
+      static const size_t groupVectors = 2;
+
+      /**
+       * Constructor
+       */
+      Octree()
+      :  _size        (0)
+      ,  _particleGM  (0)
+      ,  _invTheta2   (0)
+      ,  _leafSize    (1)
+      ,  _memory      ("Octree")
+      {
+      }
+
+      /**
+       * Rebuild the tree for the current particle positions
+       *
+       * @param store
+       *    Particles
+       * @param particleGM
+       *    Gravitational constant times the mass of one particle
+       * @param openingAngle
+       *    Barnes-Hut opening angle theta. A node is applied as a point mass
+       *    when its size over its distance is below theta. Smaller is more
+       *    accurate and slower; 0 degrades to direct summation
+       * @param leafSize
+       *    Nodes with at most this many particles are not subdivided
+       */
+      void build(const ParticleStore& store, float particleGM, float openingAngle, size_t leafSize)
+      {
+         _size       = store.size();
+         _particleGM = particleGM;
+         _invTheta2  = openingAngle > 0 ? 1.0f / (openingAngle * openingAngle) : HUGE_VALF;
+         _leafSize   = std::max<size_t>(leafSize, 1);
+         _nodes.clear();
+         if(_size == 0)
+         {
+            return;
+         }
+
+         // Pad the sorted positions to whole groups
+         size_t groupPadding = groupVectors * ParticleStore::padding;
+         resize((_size + groupPadding - 1) / groupPadding * groupPadding);
+         computeCodes(store);
+         Compute::radixSort(_codes.data(), _index.data(), _codesTmp.data(), _indexTmp.data(), _size, 3 * maxDepth);
+         gatherPositions(store);
+         buildNodes();
+      }
+
+      /**
+       * Acceleration of every particle due to all others. Call build()
+       * first
+       *
+       * @param softening2
+       *    Square of the softening length. Must be greater than 0, which
+       *    also makes the force of a particle on itself 0
+       * @param ax, ay, az
+       *    Output planes, indexed like the particle store
+       */
+      void accelerations(float softening2, float* ax, float* ay, float* az) const
+      {
+         using Compute::floatv;
+
+         const size_t width     = floatv::width;
+         const size_t groupSize = groupVectors * width;
+         const size_t chunk     = 1024;
+
+         Compute::parallelForChunks(0, _sorted[X].size(), chunk, [&](size_t first, size_t last)
+         {
+            const float* sx = _sorted[X].data();
+            const float* sy = _sorted[Y].data();
+            const float* sz = _sorted[Z].data();
+            const floatv eps2(softening2);
+            const floatv particleGM(_particleGM);
+
+            uint32_t stack[7 * maxDepth + 8];
+            float    result[3][groupVectors * ParticleStore::padding];
+
+            for(size_t group = first; group < last; group += groupSize)
+            {
+               floatv gx[groupVectors], gy[groupVectors], gz[groupVectors];
+               floatv fx[groupVectors], fy[groupVectors], fz[groupVectors];
+               for(size_t v = 0; v < groupVectors; ++v)
+               {
+                  gx[v] = floatv::load(sx + group + v * width);
+                  gy[v] = floatv::load(sy + group + v * width);
+                  gz[v] = floatv::load(sz + group + v * width);
+                  fx[v] = fy[v] = fz[v] = floatv(0.0f);
+               }
+
+               // Bounding box of the group
+               float lo[3], hi[3];
+               for(int axis = 0; axis < 3; ++axis)
+               {
+                  const float* s = _sorted[axis].data() + group;
+                  lo[axis] = hi[axis] = s[0];
+                  for(size_t lane = 1; lane < groupSize; ++lane)
+                  {
+                     lo[axis] = std::min(lo[axis], s[lane]);
+                     hi[axis] = std::max(hi[axis], s[lane]);
+                  }
+               }
+
+               int top = 0;
+               stack[top++] = 0;
+               while(top > 0)
+               {
+                  const Node& node = _nodes[stack[--top]];
+
+                  float dx = std::max(0.0f, std::max(lo[0] - node.x, node.x - hi[0]));
+                  float dy = std::max(0.0f, std::max(lo[1] - node.y, node.y - hi[1]));
+                  float dz = std::max(0.0f, std::max(lo[2] - node.z, node.z - hi[2]));
+                  if(dx * dx + dy * dy + dz * dz > node.openRadius2)
+                  {
+                     floatv nx(node.x), ny(node.y), nz(node.z), GM(node.GM);
+                     for(size_t v = 0; v < groupVectors; ++v)
+                     {
+                        addWell(nx, ny, nz, GM, eps2, gx[v], gy[v], gz[v], fx[v], fy[v], fz[v]);
+                     }
+                  }
+                  else if(node.numChildren == 0)
+                  {
+                     for(uint32_t j = node.first; j < node.first + node.count; ++j)
+                     {
+                        floatv px(sx[j]), py(sy[j]), pz(sz[j]);
+                        for(size_t v = 0; v < groupVectors; ++v)
+                        {
+                           addWell(px, py, pz, particleGM, eps2, gx[v], gy[v], gz[v], fx[v], fy[v], fz[v]);
+                        }
+                     }
+                  }
+                  else
+                  {
+                     for(uint32_t c = 0; c < node.numChildren; ++c)
+                     {
+                        stack[top++] = node.firstChild + c;
+                     }
+                  }
+               }
+
+               for(size_t v = 0; v < groupVectors; ++v)
+               {
+                  fx[v].store(result[0] + v * width);
+                  fy[v].store(result[1] + v * width);
+                  fz[v].store(result[2] + v * width);
+               }
+               size_t lanes = group < _size ? std::min(groupSize, _size - group) : 0;
+               for(size_t lane = 0; lane < lanes; ++lane)
+               {
+                  uint32_t i = _index[group + lane];
+                  ax[i] = result[0][lane];
+                  ay[i] = result[1][lane];
+                  az[i] = result[2][lane];
+               }
+            }
+         });
+      }
+
+      /**
+       * @return the nodes, root first
+       */
+      const std::vector<Node>& getNodes() const
+      {
+         return _nodes;
+      }
+
+   private:
+      enum Axis
+      {
+         X, Y, Z
+      };
+
+      /**
+       * A cube of space
+       */
+      struct Cell
+      {
+         float x, y, z;    //< Centre
+         float half;       //< Half the side length
+
+         /**
+          * @return the cell of child octant
+          */
+         Cell child(uint32_t octant) const
+         {
+            Cell cell;
+            cell.half = 0.5f * half;
+            cell.x    = x + ((octant & 4) ? cell.half : -cell.half);
+            cell.y    = y + ((octant & 2) ? cell.half : -cell.half);
+            cell.z    = z + ((octant & 1) ? cell.half : -cell.half);
+            return cell;
+         }
+      };
+
+      /**
+       * A subtree to build as a separate job
+       */
+      struct Task
+      {
+         uint32_t node;    //< Root of the subtree in _nodes
+         int      depth;   //< Depth of the root
+         Cell     cell;    //< Cell of the root
+      };
+
+      /**
+       * Resize the per particle arrays
+       */
+      void resize(size_t paddedSize)
+      {
+         if(_codes.size() != _size)
+         {
+            _codes.resize(_size);
+            _codesTmp.resize(_size);
+            _index.resize(_size);
+            _indexTmp.resize(_size);
+         }
+         for(int axis = 0; axis < 3; ++axis)
+         {
+            if(_sorted[axis].size() != paddedSize)
+            {
+               _sorted[axis].resize(paddedSize);
+            }
+         }
+      }
+
+      /**
+       * Spread the low 16 bits of v so that there are two zero bits between
+       * neighboring bits
+       */
+      static uint64_t spreadBits(uint64_t v)
+      {
+         v &= 0xFFFF;
+         v = (v | (v << 16)) & 0x0000FF0000FFULL;
+         v = (v | (v <<  8)) & 0x00F00F00F00FULL;
+         v = (v | (v <<  4)) & 0x0C30C30C30C3ULL;
+         v = (v | (v <<  2)) & 0x249249249249ULL;
+         return v;
+      }
+
+      /**
+       * @return the octant of a code at depth, the 3 bits that pick the
+       * child of a node at that depth
+       */
+      static uint32_t octant(uint64_t code, int depth)
+      {
+         return uint32_t(code >> (3 * (maxDepth - 1 - depth))) & 7;
+      }
+
+      /**
+       * Bounding cube and Morton code of every particle
+       */
+      void computeCodes(const ParticleStore& store)
+      {
+         const float* px = store.plane(ParticleStore::X);
+         const float* py = store.plane(ParticleStore::Y);
+         const float* pz = store.plane(ParticleStore::Z);
+
+         float lo[3], hi[3];
+         positionBounds(store, lo, hi);
+
+         // Grow the cube slightly so the largest coordinate quantizes below
+         // 65536
+         float extent = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]));
+         _root.half = 0.5f * extent * 1.0001f + 1e-6f;
+         _root.x    = 0.5f * (lo[0] + hi[0]);
+         _root.y    = 0.5f * (lo[1] + hi[1]);
+         _root.z    = 0.5f * (lo[2] + hi[2]);
+
+         float scale = 65536.0f / (2.0f * _root.half);
+         float ox    = _root.x - _root.half;
+         float oy    = _root.y - _root.half;
+         float oz    = _root.z - _root.half;
+
+         uint64_t* codes = _codes.data();
+         uint32_t* index = _index.data();
+         Compute::parallelForChunks(0, _size, 65536, [&](size_t first, size_t last)
+         {
+            for(size_t i = first; i < last; ++i)
+            {
+               codes[i] = (spreadBits(quantize((px[i] - ox) * scale)) << 2) |
+                          (spreadBits(quantize((py[i] - oy) * scale)) << 1) |
+                           spreadBits(quantize((pz[i] - oz) * scale));
+               index[i] = uint32_t(i);
+            }
+         });
+      }
+
+      /**
+       * Clamp a scaled coordinate to [0, 65535]. Written so that NaN maps to
+       * 0
+       */
+      static uint64_t quantize(float v)
+      {
+         return v > 0 ? uint64_t(std::min(v, 65535.0f)) : 0;
+      }
+
+      /**
+       * Copy the positions into sorted order and pad with the last particle
+       */
+      void gatherPositions(const ParticleStore& store)
+      {
+         const uint32_t* index = _index.data();
+         for(int axis = 0; axis < 3; ++axis)
+         {
+            const float* src = store.plane(ParticleStore::Plane(ParticleStore::X + axis));
+            float*       dst = _sorted[axis].data();
+            Compute::parallelForChunks(0, _size, 65536, [&](size_t first, size_t last)
+            {
+               for(size_t i = first; i < last; ++i)
+               {
+                  dst[i] = src[index[i]];
+               }
+            });
+            std::fill(dst + _size, dst + _sorted[axis].size(), dst[_size - 1]);
+         }
+      }
+
+      /**
+       * Build the top of the tree serially, the subtrees in parallel, then
+       * join them
+       */
+      void buildNodes()
+      {
+         _tasks.clear();
+         _nodes.resize(1);
+         buildNode(_nodes, 0, 0, uint32_t(_size), 0, _root, true);
+
+         if(_subtrees.size() < _tasks.size())
+         {
+            _subtrees.resize(_tasks.size());
+         }
+         Compute::ThreadPool::instance().run(_tasks.size(), [&](size_t t)
+         {
+            const Node& root = _nodes[_tasks[t].node];
+            std::vector<Node>& subtree = _subtrees[t];
+            subtree.resize(1);
+            buildNode(subtree, 0, root.first, root.first + root.count, _tasks[t].depth, _tasks[t].cell, false);
+         });
+
+         // Append each subtree below its root. Local index 0 is the root
+         // itself, so local index i > 0 moves to offset + i - 1
+         for(size_t t = 0; t < _tasks.size(); ++t)
+         {
+            std::vector<Node>& subtree = _subtrees[t];
+            uint32_t offset = uint32_t(_nodes.size());
+            for(size_t i = 0; i < subtree.size(); ++i)
+            {
+               if(subtree[i].numChildren > 0)
+               {
+                  subtree[i].firstChild += offset - 1;
+               }
+            }
+            _nodes[_tasks[t].node] = subtree[0];
+            _nodes.insert(_nodes.end(), subtree.begin() + 1, subtree.end());
+         }
+
+         finishTop(0, 0);
+
+         // The node vectors keep their capacity from one build to the next
+         size_t bytes = (_codes.size() + _codesTmp.size()) * sizeof(uint64_t) + (_index.size() + _indexTmp.size()) * sizeof(uint32_t)
+                      + 3 * _sorted[0].size() * sizeof(float) + Compute::vectorBytes(_nodes) + Compute::vectorBytes(_tasks);
+         for(size_t t = 0; t < _subtrees.size(); ++t)
+         {
+            bytes += Compute::vectorBytes(_subtrees[t]);
+         }
+         _memory.setHost(bytes);
+      }
+
+      /**
+       * Build node index of nodes for the sorted particles [first, last).
+       * With split set, nodes at splitDepth are queued as tasks instead of
+       * being subdivided
+       */
+      void buildNode(std::vector<Node>& nodes, uint32_t index, uint32_t first, uint32_t last, int depth,
+                     const Cell& cell, bool split)
+      {
+         {
+            Node& node       = nodes[index];
+            node.first       = first;
+            node.count       = last - first;
+            node.numChildren = 0;
+            node.firstChild  = 0;
+         }
+
+         if(last - first <= _leafSize || depth == maxDepth)
+         {
+            setLeafMoments(nodes[index], cell);
+            return;
+         }
+
+         if(split && depth == splitDepth)
+         {
+            Task task;
+            task.node  = index;
+            task.depth = depth;
+            task.cell  = cell;
+            _tasks.push_back(task);
+            return;
+         }
+
+         // The codes in the range share everything above this depth, so the
+         // octant at this depth is sorted too
+         const uint64_t* codes = _codes.data();
+         uint32_t bounds[9];
+         bounds[0] = first;
+         for(uint32_t o = 1; o < 8; ++o)
+         {
+            bounds[o] = uint32_t(std::partition_point(codes + bounds[o - 1], codes + last,
+               [&](uint64_t code) { return octant(code, depth) < o; }) - codes);
+         }
+         bounds[8] = last;
+
+         uint32_t numChildren = 0;
+         for(uint32_t o = 0; o < 8; ++o)
+         {
+            numChildren += bounds[o + 1] > bounds[o] ? 1 : 0;
+         }
+
+         uint32_t firstChild = uint32_t(nodes.size());
+         nodes.resize(nodes.size() + numChildren);
+         nodes[index].firstChild  = firstChild;
+         nodes[index].numChildren = numChildren;
+
+         uint32_t child = firstChild;
+         for(uint32_t o = 0; o < 8; ++o)
+         {
+            if(bounds[o + 1] > bounds[o])
+            {
+               buildNode(nodes, child++, bounds[o], bounds[o + 1], depth + 1, cell.child(o), split);
+            }
+         }
+         setInternalMoments(nodes, index, cell);
+      }
+
+      /**
+       * Redo the moments of the top levels once the subtrees are in place
+       */
+      void finishTop(uint32_t index, int depth)
+      {
+         Node& node = _nodes[index];
+         if(node.numChildren == 0 || depth >= splitDepth)
+         {
+            return;
+         }
+
+         for(uint32_t c = 0; c < node.numChildren; ++c)
+         {
+            finishTop(node.firstChild + c, depth + 1);
+         }
+         setInternalMoments(_nodes, index, cellOf(index, depth));
+      }
+
+      /**
+       * @return the cell of a node at depth, from the Morton code of its
+       * first particle
+       */
+      Cell cellOf(uint32_t index, int depth) const
+      {
+         Cell cell = _root;
+         uint64_t code = _codes[_nodes[index].first];
+         for(int d = 0; d < depth; ++d)
+         {
+            cell = cell.child(octant(code, d));
+         }
+         return cell;
+      }
+
+      /**
+       * Centre of mass of a leaf, directly from its particles
+       */
+      void setLeafMoments(Node& node, const Cell& cell) const
+      {
+         double x = 0, y = 0, z = 0;
+         for(uint32_t i = node.first; i < node.first + node.count; ++i)
+         {
+            x += _sorted[X][i];
+            y += _sorted[Y][i];
+            z += _sorted[Z][i];
+         }
+         node.x  = float(x / node.count);
+         node.y  = float(y / node.count);
+         node.z  = float(z / node.count);
+         node.GM = _particleGM * node.count;
+         setOpenRadius(node, cell);
+      }
+
+      /**
+       * Centre of mass of an internal node, from its children
+       */
+      void setInternalMoments(std::vector<Node>& nodes, uint32_t index, const Cell& cell) const
+      {
+         Node& node = nodes[index];
+         double x = 0, y = 0, z = 0;
+         for(uint32_t c = node.firstChild; c < node.firstChild + node.numChildren; ++c)
+         {
+            x += double(nodes[c].x) * nodes[c].count;
+            y += double(nodes[c].y) * nodes[c].count;
+            z += double(nodes[c].z) * nodes[c].count;
+         }
+         node.x  = float(x / node.count);
+         node.y  = float(y / node.count);
+         node.z  = float(z / node.count);
+         node.GM = _particleGM * node.count;
+         setOpenRadius(node, cell);
+      }
+
+      /**
+       * The node is opened within (b / theta) of its centre of mass, where b
+       * is the distance from the centre of mass to the furthest corner of
+       * the cell. This bounds the error even when the centre of mass sits
+       * near the edge of the cell
+       */
+      void setOpenRadius(Node& node, const Cell& cell) const
+      {
+         float bx = cell.half + fabsf(node.x - cell.x);
+         float by = cell.half + fabsf(node.y - cell.y);
+         float bz = cell.half + fabsf(node.z - cell.z);
+         node.openRadius2 = (bx * bx + by * by + bz * bz) * _invTheta2;
+      }
+
+      size_t                          _size;         //< Number of particles
+      float                           _particleGM;   //< G times the mass of one particle
+      float                           _invTheta2;    //< 1 / opening angle^2
+      size_t                          _leafSize;     //< Largest leaf that is not subdivided
+      Cell                            _root;         //< Bounding cube
+      Compute::AlignedArray<uint64_t> _codes;        //< Morton codes, sorted
+      Compute::AlignedArray<uint64_t> _codesTmp;     //< Scratch for the sort
+      Compute::AlignedArray<uint32_t> _index;        //< Particle index of each sorted position
+      Compute::AlignedArray<uint32_t> _indexTmp;     //< Scratch for the sort
+      Compute::AlignedArray<float>    _sorted[3];    //< Positions in sorted order, padded to whole groups
+      std::vector<Node>               _nodes;        //< The tree, root first
+      std::vector<Task>               _tasks;        //< Subtrees to build in parallel
+      std::vector<std::vector<Node> > _subtrees;     //< Nodes of each subtree, kept to reuse the memory
+      Compute::MemoryAccount          _memory;       //< Host memory of the arrays and the nodes
+   };
+}
+
+#endif
@@ -0,0 +1,194 @@
+//--------------------------------------------------------------------------------
+// particle_dispatch.h
+//
+// The SIMD particle kernel of ParticleEngine for the instruction set picked at
+// run time (see cpu_dispatch.h). The field is passed as plain floats, the
+// central well's GM or a WellSet, because the field policies are templates
+// over floatv, whose type differs between the instruction sets.
+//
+// Every translation unit that includes this header gets simdKernels() for its
+// own floatv, in Particles::sse2, Particles::avx2 and so on. With
+// COMPUTE_DISPATCH, particle_kernels_avx2.cpp and particle_kernels_avx512.cpp
+// compile it with AVX2 and AVX-512F and export their tables through
+// avx2::dispatchedKernels() and avx512::dispatchedKernels().
+//
+// Those two files must only include kernel headers. Inline functions that do
+// not take or return floatv, such as ParticleStore::plane(), keep one name
+// for every instruction set, and the linker may keep any of the copies; they
+// are trivial accessors, which compile to the same code at every level.
+//--------------------------------------------------------------------------------
+#ifndef _particle_dispatch_h
+#define _particle_dispatch_h
+
+#include "integrators.h"
+#include "particle_kernels.h"
+#include "particle_store.h"
+#include "wells.h"
+
+#include <cpu_dispatch.h>
+#include <simd.h>
+
+#include <cstddef>
+
+namespace Particles
+{
+   /**
+    * Field of the wells, without the value type
+    */
+   struct FieldParams
+   {
+      float          GM;      //< G times the mass of the central well, if wells is NULL
+      const WellSet* wells;   //< The wells, or NULL for the single well at the origin
+   };
+
+   /**
+    * integrateSimd() for one integrator and field
+    */
+   typedef void (*SimdKernel)(ParticleStore& store, size_t first, size_t last, const FieldParams& field, const StepParams& params);
+
+   /**
+    * integrateSimd() of each integrator, for one instruction set
+    */
+   struct SimdKernels
+   {
+      Compute::Isa isa;        //< Instruction set of the kernels
+      SimdKernel   rk4;
+      SimdKernel   leapfrog;
+      SimdKernel   yoshida4;
+   };
+
+   /**
+    * The kernel of an integrator in a SimdKernels. NULL for integrators
+    * without a dispatched kernel, which ParticleEngine runs inline instead
+    */
+   template<typename Integrator>
+   struct SimdKernelOf
+   {
+      static SimdKernel get(const SimdKernels&) { return NULL; }
+   };
+
+   template<>
+   struct SimdKernelOf<RK4>
+   {
+      static SimdKernel get(const SimdKernels& kernels) { return kernels.rk4; }
+   };
+
+   template<>
+   struct SimdKernelOf<Leapfrog>
+   {
+      static SimdKernel get(const SimdKernels& kernels) { return kernels.leapfrog; }
+   };
+
+   template<>
+   struct SimdKernelOf<Yoshida4>
+   {
+      static SimdKernel get(const SimdKernels& kernels) { return kernels.yoshida4; }
+   };
+
+#ifdef COMPUTE_DISPATCH
+   namespace avx2
+   {
+      /**
+       * @return the kernels compiled with AVX2 and FMA, in particle_kernels_avx2.cpp
+       */
+      SimdKernels dispatchedKernels();
+   }
+
+   namespace avx512
+   {
+      /**
+       * @return the kernels compiled with AVX-512F, in particle_kernels_avx512.cpp
+       */
+      SimdKernels dispatchedKernels();
+   }
+#endif
+
+
+   // Compiled for the instruction set of the including translation unit
+   namespace COMPUTE_SIMD_NAMESPACE
+   {
+      /**
+       * integrateSimd() with the floatv field of field: the central well, a
+       * kernel specialized for one to four wells, or the tiled loop, as in
+       * ParticleEngineBase::visitField()
+       */
+      template<typename Integrator>
+      void integrateField(ParticleStore& store, size_t first, size_t last, const FieldParams& field, const StepParams& params)
+      {
+         using Compute::floatv;
+
+         if(field.wells == NULL)
+         {
+            integrateSimd<Integrator>(store, first, last, CentralWell<floatv>(field.GM), params);
+            return;
+         }
+
+         const WellSet& wells = *field.wells;
+         switch(wells.size())
+         {
+            case 1:
+               integrateSimd<Integrator>(store, first, last, FixedWells<floatv, 1>(wells), params);
+               break;
+
+            case 2:
+               integrateSimd<Integrator>(store, first, last, FixedWells<floatv, 2>(wells), params);
+               break;
+
+            case 3:
+               integrateSimd<Integrator>(store, first, last, FixedWells<floatv, 3>(wells), params);
+               break;
+
+            case 4:
+               integrateSimd<Integrator>(store, first, last, FixedWells<floatv, 4>(wells), params);
+               break;
+
+            default:
+               integrateSimd<Integrator>(store, first, last, TiledWells<floatv>(wells), params);
+               break;
+         }
+      }
+
+      /**
+       * @return the kernels for the floatv of this translation unit
+       */
+      inline SimdKernels simdKernels()
+      {
+         SimdKernels kernels =
+         {
+            Compute::floatv::isa,
+            &integrateField<RK4>,
+            &integrateField<Leapfrog>,
+            &integrateField<Yoshida4>
+         };
+         return kernels;
+      }
+
+      /**
+       * @return the kernels of the instruction set CpuDispatch selected.
+       *    The program itself is compiled for the lowest level, so that one
+       *    comes from this translation unit
+       */
+      inline SimdKernels dispatchedSimdKernels()
+      {
+#ifdef COMPUTE_DISPATCH
+         switch(Compute::CpuDispatch::instance().getIsa())
+         {
+            case Compute::ISA_AVX512:
+               return avx512::dispatchedKernels();
+
+            case Compute::ISA_AVX2:
+               return avx2::dispatchedKernels();
+
+            default:
+               break;
+         }
+#endif
+         return simdKernels();
+      }
+   }
+
+   using COMPUTE_SIMD_NAMESPACE::dispatchedSimdKernels;
+
+}
+
+#endif
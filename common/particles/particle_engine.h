@@ -0,0 +1,521 @@
+//--------------------------------------------------------------------------------
+// particle_engine.h
+//
+// CPU particle system: particles orbiting one or more gravity wells,
+// integrated on a structure-of-arrays store. Shared by the iOS model and the CPU fallback of
+// the GPU comparison programs.
+//
+// The update is split into fixed size chunks that are processed on the shared
+// thread pool. A chunk of the default size touches 6 planes x 8192 floats =
+// 192 KB, which stays within a core's L2 while the integrator stages run, and
+// chunk boundaries are multiples of 16 particles so no two threads ever write
+// to the same cache line.
+//
+// By default there is a single well at the origin, as in the original
+// simulation. setWells() replaces it with any number of wells. One to four
+// wells run kernels specialized for the exact count; more run the tiled loop
+// from wells.h. Both use the SIMD kernel.
+//
+// With fixed steps the SIMD kernel of RK4, Leapfrog and Yoshida4 comes from
+// particle_dispatch.h, for the instruction set CpuDispatch picked at run time.
+//
+// setMaxLevel() turns on hierarchical block time steps (block_steps.h) for
+// ParticleEngine: particles that need it take 2, 4, ... 2^maxLevel sub-steps
+// per step, the rest one.
+//
+// setEmitters() replaces the resets with a particle lifecycle (lifecycle.h):
+// particles are born from the emitters, die when their time runs out or they
+// pass the reset radius, and only the live ones are updated and drawn.
+//--------------------------------------------------------------------------------
+#ifndef _particle_engine_h
+#define _particle_engine_h
+
+#include "block_steps.h"
+#include "integrators.h"
+#include "lifecycle.h"
+#include "particle_dispatch.h"
+#include "particle_kernels.h"
+#include "particle_store.h"
+#include "wells.h"
+
+#include <parallel_for.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <stdexcept>
+#include <vector>
+
+namespace Particles
+{
+   /**
+    * Which kernel update() runs
+    */
+   enum Kernel
+   {
+      SCALAR,
+      SIMD
+   };
+
+   /**
+    * Particle state and parameters, independent of the integration scheme.
+    * Hold engines through this class when the scheme is picked at run time
+    */
+   class ParticleEngineBase
+   {
+   public:
+      /**
+       * Constructor
+       *
+       * @param numParticles
+       *    Number of particles
+       * @param wellMass
+       *    Mass of the gravity well in kg
+       * @param timeStep
+       *    Time step in seconds
+       */
+      ParticleEngineBase(size_t numParticles, float wellMass, float timeStep)
+      :  _store        (numParticles)
+      ,  _wellMass     (wellMass)
+      ,  _timeStep     (timeStep)
+      ,  _resetRadius  (100.0f)
+      ,  _kernel       (SIMD)
+      ,  _chunkSize    (8192)
+      {
+      }
+
+      /**
+       * Destructor
+       */
+      virtual ~ParticleEngineBase()
+      {
+      }
+
+      /**
+       * Advance every particle one time step. Particles that leave the
+       * reset radius return to their initial state
+       */
+      void update()
+      {
+         update(1);
+      }
+
+      /**
+       * Advance every particle nSteps time steps. Where the engine can, each
+       * particle takes all of them before it is written back, which is
+       * faster than calling update() nSteps times when only the last state
+       * is drawn
+       *
+       * @param nSteps
+       *    Number of time steps, at least 1
+       */
+      virtual void update(int nSteps) = 0;
+
+      /**
+       * @return the name of the integration scheme
+       */
+      virtual const char* getIntegratorName() const = 0;
+
+      ParticleStore&       getStore()                 { return _store; }
+      const ParticleStore& getStore() const           { return _store; }
+      size_t               getNumParticles() const    { return _store.size(); }
+
+      /**
+       * @return the number of live particles, packed at the front of the
+       *    store. All of them unless there are emitters
+       */
+      size_t getNumAlive() const
+      {
+         return _lifecycle.enabled() ? _lifecycle.getNumAlive() : _store.size();
+      }
+
+      float getWellMass() const                       { return _wellMass; }
+      void  setWellMass(float mass)                   { _wellMass = mass; }
+      const std::vector<Well>& getWells() const       { return _wells; }
+      float getTimeStep() const                       { return _timeStep; }
+      void  setTimeStep(float dt)                     { _timeStep = dt; }
+      float getResetRadius() const                    { return _resetRadius; }
+      void  setResetRadius(float radius)              { _resetRadius = radius; }
+      Kernel getKernel() const                        { return _kernel; }
+      void  setKernel(Kernel kernel)                  { _kernel = kernel; }
+      size_t getChunkSize() const                     { return _chunkSize; }
+
+      /**
+       * @param chunkSize
+       *    Particles per scheduled chunk, rounded up to a multiple of
+       *    ParticleStore::padding
+       */
+      void setChunkSize(size_t chunkSize)
+      {
+         size_t padding = ParticleStore::padding;
+         _chunkSize = std::max(padding, (chunkSize + padding - 1) / padding * padding);
+      }
+
+      int   getMaxLevel() const                       { return _blockSteps.getMaxLevel(); }
+      float getStepAccuracy() const                   { return _blockSteps.getAccuracy(); }
+      const BlockSteps& getBlockSteps() const         { return _blockSteps; }
+
+      /**
+       * @param maxLevel
+       *    Deepest block time step level: particles close to a well take
+       *    up to 2^maxLevel sub-steps per step. 0, the default, gives every
+       *    particle the same step
+       */
+      virtual void setMaxLevel(int maxLevel)
+      {
+         if(maxLevel > 0 && _lifecycle.enabled())
+         {
+            throw std::runtime_error("Block time steps cannot be combined with emitters");
+         }
+         _blockSteps.setMaxLevel(maxLevel);
+      }
+
+      /**
+       * @param accuracy
+       *    Largest velocity change per block time step, as a fraction of
+       *    the speed. Default 0.02
+       */
+      void setStepAccuracy(float accuracy)
+      {
+         _blockSteps.setAccuracy(accuracy);
+      }
+
+      /**
+       * Replace the single well at the origin with a set of wells. The well
+       * mass setting is not used while wells are set. Particles are still
+       * reset by their distance from the origin
+       *
+       * @param wells
+       *    The wells. Empty restores the single well at the origin
+       */
+      virtual void setWells(const std::vector<Well>& wells)
+      {
+         _wells = wells;
+         _wellSet.set(wells);
+         _blockSteps.invalidate();
+      }
+
+      const std::vector<Emitter>& getEmitters() const { return _lifecycle.getEmitters(); }
+
+      /**
+       * Start a particle lifecycle: kill every particle and let the
+       * emitters create new ones, up to getNumParticles() at a time.
+       * Particles die when their lifetime is over or they pass the reset
+       * radius, instead of returning to their initial state
+       *
+       * @param emitters
+       *    The emitters. Empty restores the resets
+       */
+      virtual void setEmitters(const std::vector<Emitter>& emitters)
+      {
+         if(!emitters.empty() && _blockSteps.enabled())
+         {
+            throw std::runtime_error("Emitters cannot be combined with block time steps");
+         }
+         _lifecycle.setEmitters(emitters, _store);
+      }
+
+   protected:
+      /**
+       * @return the parameters for the next step
+       */
+      StepParams getStepParams() const
+      {
+         StepParams params;
+         params.dt           = _timeStep;
+         params.resetRadius2 = _resetRadius * _resetRadius;
+         params.steps        = 1;
+         return params;
+      }
+
+      /**
+       * @return the current wells for the dispatched kernels
+       */
+      FieldParams getFieldParams() const
+      {
+         FieldParams field;
+         field.GM    = 6.67e-11f * _wellMass;
+         field.wells = _wellSet.size() == 0 ? NULL : &_wellSet;
+         return field;
+      }
+
+      /**
+       * Call visitor(scalarField, simdField) with the float and floatv
+       * fields of the current wells: the central well, a kernel
+       * specialized for one to four wells, or the tiled loop
+       */
+      template<typename Visitor>
+      void visitField(const Visitor& visitor) const
+      {
+         using Compute::floatv;
+
+         switch(_wellSet.size())
+         {
+            case 0:
+               visitor(CentralWell<float>(6.67e-11f * _wellMass), CentralWell<floatv>(6.67e-11f * _wellMass));
+               break;
+
+            case 1:
+               visitor(FixedWells<float, 1>(_wellSet), FixedWells<floatv, 1>(_wellSet));
+               break;
+
+            case 2:
+               visitor(FixedWells<float, 2>(_wellSet), FixedWells<floatv, 2>(_wellSet));
+               break;
+
+            case 3:
+               visitor(FixedWells<float, 3>(_wellSet), FixedWells<floatv, 3>(_wellSet));
+               break;
+
+            case 4:
+               visitor(FixedWells<float, 4>(_wellSet), FixedWells<floatv, 4>(_wellSet));
+               break;
+
+            default:
+               visitor(TiledWells<float>(_wellSet), TiledWells<floatv>(_wellSet));
+               break;
+         }
+      }
+
+      ParticleStore           _store;        //< Particle state
+      float                   _wellMass;     //< Mass of the gravity well in kg
+      float                   _timeStep;     //< Time step in seconds
+      float                   _resetRadius;  //< Distance at which particles are reset
+      Kernel                  _kernel;       //< Kernel used by update()
+      size_t                  _chunkSize;    //< Particles per chunk, a multiple of ParticleStore::padding
+      std::vector<Well>       _wells;        //< Wells, or empty for the single well at the origin
+      WellSet                 _wellSet;      //< _wells with GM folded, for the kernels
+      BlockSteps              _blockSteps;   //< Block time step levels, when enabled
+      Lifecycle               _lifecycle;    //< Emitters and lifetimes, when enabled
+   };
+
+   /**
+    * Particle engine for one integration scheme, RK4, Leapfrog or Yoshida4.
+    * The scheme is inlined into the kernels.
+    *
+    * How to use this class:
+    * \code
+    * Particles::ParticleEngine<Particles::Leapfrog> engine(numParticles);
+    * for(size_t i = 0; i < numParticles; ++i)
+    * {
+    *    engine.getStore().set(i, 0.1f, 0, 0, vx, vy, vz);
+    * }
+    *
+    * engine.update();
+    * engine.getStore().interleavePositions(vertices, 0, numParticles);
+    * \endcode
+    */
+   template<typename Integrator = RK4>
+   class ParticleEngine : public ParticleEngineBase
+   {
+   public:
+      /**
+       * Constructor
+       *
+       * @param numParticles
+       *    Number of particles
+       * @param wellMass
+       *    Mass of the gravity well in kg
+       * @param timeStep
+       *    Time step in seconds
+       */
+      explicit ParticleEngine(size_t numParticles, float wellMass = 9.5e9f, float timeStep = 0.01f)
+      :  ParticleEngineBase(numParticles, wellMass, timeStep)
+      {
+      }
+
+      using ParticleEngineBase::update;
+
+      /**
+       * Advance every particle nSteps time steps. Each chunk handles the
+       * resets of its own particles, so there is no serial pass afterwards.
+       * With fixed steps every particle takes all nSteps in registers;
+       * block steps and emitters take one pass per step
+       */
+      virtual void update(int nSteps)
+      {
+         visitField(Integrate(*this, nSteps));
+      }
+
+      virtual const char* getIntegratorName() const
+      {
+         return Integrator::name();
+      }
+
+   private:
+      /**
+       * Field visitor that runs integrate()
+       */
+      struct Integrate
+      {
+         ParticleEngine& engine;
+         int             nSteps;
+
+         Integrate(ParticleEngine& engine, int nSteps)
+         :  engine (engine)
+         ,  nSteps (nSteps)
+         {
+         }
+
+         template<typename ScalarField, typename SimdField>
+         void operator()(const ScalarField& scalarField, const SimdField& simdField) const
+         {
+            engine.integrate(scalarField, simdField, nSteps);
+         }
+      };
+
+      /**
+       * Run the selected kernel over every chunk
+       *
+       * @param scalarField, simdField
+       *    The same field for float and floatv
+       * @param nSteps
+       *    Number of time steps
+       */
+      template<typename ScalarField, typename SimdField>
+      void integrate(const ScalarField& scalarField, const SimdField& simdField, int nSteps)
+      {
+         StepParams     params = getStepParams();
+         ParticleStore& store  = _store;
+
+         // The level lists and the free list change every step
+         if(_blockSteps.enabled())
+         {
+            for(int step = 0; step < nSteps; ++step)
+            {
+               integrateLevels(scalarField, simdField, params);
+            }
+            return;
+         }
+
+         if(_lifecycle.enabled())
+         {
+            for(int step = 0; step < nSteps; ++step)
+            {
+               integrateLive(scalarField, simdField, params);
+            }
+            return;
+         }
+
+         params.steps = nSteps;
+
+         // The kernel of the instruction set CpuDispatch picked, if this
+         // integrator has one
+         SimdKernel kernel = SimdKernelOf<Integrator>::get(dispatchedSimdKernels());
+
+         if(_kernel == SIMD && kernel != NULL)
+         {
+            FieldParams field = getFieldParams();
+            Compute::parallelForChunks(0, store.paddedSize(), _chunkSize, [&](size_t first, size_t last)
+            {
+               kernel(store, first, last, field, params);
+            });
+         }
+         else if(_kernel == SIMD)
+         {
+            Compute::parallelForChunks(0, store.paddedSize(), _chunkSize, [&](size_t first, size_t last)
+            {
+               integrateSimd<Integrator>(store, first, last, simdField, params);
+            });
+         }
+         else
+         {
+            Compute::parallelForChunks(0, store.size(), _chunkSize, [&](size_t first, size_t last)
+            {
+               integrateScalar<Integrator>(store, first, last, scalarField, params);
+            });
+         }
+      }
+
+      /**
+       * Advance and age the live particles, then retire the dead and let
+       * the emitters fill the free slots
+       */
+      template<typename ScalarField, typename SimdField>
+      void integrateLive(const ScalarField& scalarField, const SimdField& simdField, const StepParams& params)
+      {
+         ParticleStore& store     = _store;
+         float*         lifetimes = _lifecycle.lifetimes();
+         size_t         numAlive  = _lifecycle.getNumAlive();
+
+         if(_kernel == SIMD)
+         {
+            size_t padding = ParticleStore::padding;
+            Compute::parallelForChunks(0, (numAlive + padding - 1) / padding * padding, _chunkSize, [&](size_t first, size_t last)
+            {
+               advanceSimd<Integrator>(store, lifetimes, first, last, simdField, params);
+            });
+         }
+         else
+         {
+            Compute::parallelForChunks(0, numAlive, _chunkSize, [&](size_t first, size_t last)
+            {
+               advanceScalar<Integrator>(store, lifetimes, first, last, scalarField, params);
+            });
+         }
+
+         _lifecycle.retire();
+         _lifecycle.emit(store, params.dt);
+      }
+
+      /**
+       * Run the level 0 kernel over every chunk in store order, then the
+       * list kernel over every deeper level, then rebuild the lists from
+       * the new levels. Deeper levels do 2^level times the work per
+       * particle, so their chunks are shorter
+       */
+      template<typename ScalarField, typename SimdField>
+      void integrateLevels(const ScalarField& scalarField, const SimdField& simdField, const StepParams& params)
+      {
+         ParticleStore& store  = _store;
+         BlockSteps&    steps  = _blockSteps;
+         Kernel         kernel = _kernel;
+
+         if(!steps.valid(store.paddedSize()))
+         {
+            steps.resize(store.paddedSize());
+            Compute::parallelForChunks(0, store.paddedSize(), _chunkSize, [&](size_t first, size_t last)
+            {
+               assignLevels(store, first, last, scalarField, params.dt, steps);
+            });
+            steps.rebin(store.size());
+         }
+
+         if(kernel == SIMD)
+         {
+            Compute::parallelForChunks(0, store.paddedSize(), _chunkSize, [&](size_t first, size_t last)
+            {
+               integrateLevelZeroSimd<Integrator>(store, steps, first, last, simdField, params);
+            });
+         }
+         else
+         {
+            Compute::parallelForChunks(0, store.size(), _chunkSize, [&](size_t first, size_t last)
+            {
+               integrateLevelZeroScalar<Integrator>(store, steps, first, last, scalarField, params);
+            });
+         }
+
+         // std::max takes references, so it needs a copy of the constant
+         size_t padding = ParticleStore::padding;
+         for(int level = 1; level <= steps.getMaxLevel(); ++level)
+         {
+            size_t chunkSize = std::max(padding, _chunkSize >> level);
+            Compute::parallelForChunks(0, steps.binSize(level), chunkSize, [&](size_t first, size_t last)
+            {
+               if(kernel == SIMD)
+               {
+                  integrateLevelSimd<Integrator>(store, steps, level, first, last, simdField, params);
+               }
+               else
+               {
+                  integrateLevelScalar<Integrator>(store, steps, level, first, last, scalarField, params);
+               }
+            });
+         }
+
+         steps.rebin(store.size());
+      }
+   };
+}
+
+#endif
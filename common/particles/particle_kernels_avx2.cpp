@@ -0,0 +1,16 @@
+//--------------------------------------------------------------------------------
+// particle_kernels_avx2.cpp
+//
+// The dispatched particle kernels compiled with AVX2 and FMA (-mavx2 -mfma).
+// Include nothing here but kernel headers; see particle_dispatch.h.
+//--------------------------------------------------------------------------------
+#include "particle_dispatch.h"
+
+#if !defined(__AVX2__) || !defined(__FMA__) || defined(__AVX512F__)
+#error "particle_kernels_avx2.cpp must be compiled with -mavx2 -mfma only"
+#endif
+
+Particles::SimdKernels Particles::avx2::dispatchedKernels()
+{
+   return simdKernels();
+}
@@ -0,0 +1,16 @@
+//--------------------------------------------------------------------------------
+// particle_kernels_avx512.cpp
+//
+// The dispatched particle kernels compiled with AVX-512F (-mavx512f).
+// Include nothing here but kernel headers; see particle_dispatch.h.
+//--------------------------------------------------------------------------------
+#include "particle_dispatch.h"
+
+#if !defined(__AVX512F__)
+#error "particle_kernels_avx512.cpp must be compiled with -mavx512f only"
+#endif
+
+Particles::SimdKernels Particles::avx512::dispatchedKernels()
+{
+   return simdKernels();
+}
@@ -0,0 +1,541 @@
+//--------------------------------------------------------------------------------
+// particle_mesh.h
+//
+// Particle-mesh mutual gravity solver for NBodyEngine. See "Computer Simulation
+// Using Particles" by Hockney and Eastwood, chapters 5 and 6.
+//
+//    1. Deposit the particle masses onto an N^3 grid with cloud-in-cell
+//       weights
+//    2. Convolve the density with the Green's function of the Poisson
+//       equation using FFTW real-to-complex and complex-to-real transforms
+//    3. Differentiate the potential on the grid with central differences
+//    4. Interpolate the accelerations back to the particles with the same
+//       cloud-in-cell weights, so that a particle exerts no force on itself
+//
+// The transforms run on a (2N)^3 grid with the density in one octant and zeros
+// elsewhere. This gives isolated boundaries, as for particles in empty space,
+// instead of the periodic images a plain N^3 transform would add.
+//
+// The deposit is parallel over slabs of constant x: particles are counting
+// sorted by slab, and the even slabs are processed on the thread pool, then the
+// odd ones. A particle in slab s only writes planes s and s + 1, so slabs that
+// run at the same time never write the same cell.
+//
+// The cost is O(particles + cells log cells), independent of clustering, but
+// the force is only resolved down to a couple of grid cells.
+//--------------------------------------------------------------------------------
+#ifndef _particle_mesh_h
+#define _particle_mesh_h
+
+#include "bounds.h"
+#include "particle_store.h"
+
+#include <aligned_array.h>
+#include <memory_accounting.h>
+#include <parallel_for.h>
+#include <radix_sort.h>
+#include <thread_pool.h>
+
+#include <fftw3.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+
+#include <stdint.h>
+
+namespace Particles
+{
+   /**
+    * How to use this class:
+    * \code
+    * Particles::NBodyEngine<Particles::ParticleMesh> engine(numParticles);
+    * engine.getSolver().setGridSize(128);
+    * \endcode
+    */
+   class ParticleMesh
+   {
+   public:
+      /**
+       * Constructor
+       */
+      ParticleMesh()
+      :  _gridSize   (64)
+      ,  _boxSize    (0)
+      ,  _density    (NULL)
+      ,  _spectrum   (NULL)
+      ,  _green      (NULL)
+      ,  _forward    (NULL)
+      ,  _backward   (NULL)
+      ,  _spacing    (1)
+      ,  _memory     ("ParticleMesh")
+      {
+         _origin[0] = _origin[1] = _origin[2] = 0;
+      }
+
+      /**
+       * Destructor
+       */
+      ~ParticleMesh()
+      {
+         release();
+      }
+
+      static const char* name() { return "particle-mesh"; }
+
+      /**
+       * Compute the acceleration of every particle due to all others.
+       * Particles outside the grid neither contribute nor feel a force
+       *
+       * @param store
+       *    Particles
+       * @param particleGM
+       *    Gravitational constant times the mass of one particle
+       * @param ax, ay, az
+       *    Output planes, indexed like the particle store
+       */
+      void accelerations(const ParticleStore& store, float particleGM, float* ax, float* ay, float* az)
+      {
+         if(store.size() == 0)
+         {
+            return;
+         }
+
+         if(_density == NULL)
+         {
+            allocate();
+         }
+         fitGrid(store);
+         deposit(store);
+         solve();
+         differentiate(particleGM);
+         gather(store, ax, ay, az);
+      }
+
+      int   getGridSize() const                       { return _gridSize; }
+      float getBoxSize() const                        { return _boxSize; }
+
+      /**
+       * @param gridSize
+       *    Grid points per axis, rounded up to an even number of at least 8.
+       *    Memory grows with the cube: 64 needs about 45 MB, 128 about 360 MB
+       */
+      void setGridSize(int gridSize)
+      {
+         gridSize = std::max(8, gridSize + (gridSize & 1));
+         if(gridSize != _gridSize)
+         {
+            release();
+            _gridSize = gridSize;
+         }
+      }
+
+      /**
+       * @param boxSize
+       *    Side of a fixed grid cube centred on the origin. 0 fits the grid
+       *    to the particles every step
+       */
+      void setBoxSize(float boxSize)
+      {
+         _boxSize = std::max(0.0f, boxSize);
+      }
+
+   private:
+      // Not copyable
+      ParticleMesh(const ParticleMesh&);
+      ParticleMesh& operator=(const ParticleMesh&);
+
+      /**
+       * Position of a particle on the grid: the cell with corner (i, j, k)
+       * and the fractional offsets inside it
+       */
+      struct Cell
+      {
+         size_t i, j, k;
+         float  fx, fy, fz;
+      };
+
+      /**
+       * @return the side of the padded transform grid
+       */
+      size_t paddedSize() const
+      {
+         return 2 * size_t(_gridSize);
+      }
+
+      /**
+       * Allocate the grids, plan the transforms and transform the Green's
+       * function
+       */
+      void allocate()
+      {
+         size_t M       = paddedSize();
+         size_t complex = M * M * (M / 2 + 1);
+
+         _density  = (double*) fftw_malloc(sizeof(double) * M * M * M);
+         _spectrum = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * complex);
+         _green    = (double*) fftw_malloc(sizeof(double) * complex);
+         _forward  = fftw_plan_dft_r2c_3d(int(M), int(M), int(M), _density, _spectrum, FFTW_ESTIMATE);
+         _backward = fftw_plan_dft_c2r_3d(int(M), int(M), int(M), _spectrum, _density, FFTW_ESTIMATE);
+
+         size_t N = size_t(_gridSize);
+         for(int axis = 0; axis < 3; ++axis)
+         {
+            _field[axis].resize(N * N * N);
+         }
+         updateMemory();
+
+         // Potential of a unit mass in grid units, -1 / r, with -1 at r = 0.
+         // The cloud-in-cell weights already smooth the force below a cell.
+         // Distances wrap around the padded grid, which places the negative
+         // offsets in the upper half of each axis
+         for(size_t i = 0; i < M; ++i)
+         {
+            double di = double(std::min(i, M - i));
+            for(size_t j = 0; j < M; ++j)
+            {
+               double dj = double(std::min(j, M - j));
+               for(size_t k = 0; k < M; ++k)
+               {
+                  double dk = double(std::min(k, M - k));
+                  double r2 = di * di + dj * dj + dk * dk;
+                  _density[(i * M + j) * M + k] = r2 > 0 ? -1.0 / sqrt(r2) : -1.0;
+               }
+            }
+         }
+
+         // The Green's function is even, so its transform is real. Fold in
+         // the 1 / M^3 that FFTW leaves out of the inverse transform
+         fftw_execute(_forward);
+         double scale = 1.0 / (double(M) * M * M);
+         for(size_t c = 0; c < complex; ++c)
+         {
+            _green[c] = _spectrum[c][0] * scale;
+         }
+      }
+
+      /**
+       * Free the grids and plans
+       */
+      void release()
+      {
+         if(_forward != NULL)
+         {
+            fftw_destroy_plan(_forward);
+            fftw_destroy_plan(_backward);
+         }
+         fftw_free(_density);
+         fftw_free(_spectrum);
+         fftw_free(_green);
+         _density  = NULL;
+         _spectrum = NULL;
+         _green    = NULL;
+         _forward  = NULL;
+         _backward = NULL;
+         updateMemory();
+      }
+
+      /**
+       * Report the grids and the sort arrays to the memory account
+       */
+      void updateMemory()
+      {
+         size_t M       = paddedSize();
+         size_t complex = M * M * (M / 2 + 1);
+         size_t bytes   = 3 * _field[0].size() * sizeof(float)
+                        + (_slab.size() + _slabTmp.size()) * sizeof(uint64_t) + (_order.size() + _orderTmp.size()) * sizeof(uint32_t);
+         if(_density != NULL)
+         {
+            bytes += M * M * M * sizeof(double) + complex * (sizeof(fftw_complex) + sizeof(double));
+         }
+         _memory.setHost(bytes);
+      }
+
+      /**
+       * Place the grid. Grid point (i, j, k) sits at _origin + _spacing *
+       * (i, j, k)
+       */
+      void fitGrid(const ParticleStore& store)
+      {
+         float N = float(_gridSize);
+         if(_boxSize > 0)
+         {
+            _spacing = _boxSize / (N - 1);
+            for(int axis = 0; axis < 3; ++axis)
+            {
+               _origin[axis] = -0.5f * _boxSize;
+            }
+            return;
+         }
+
+         // Centre the particles with a cell of margin on every side, so that
+         // the differences next to the particles stay central
+         float lo[3], hi[3];
+         positionBounds(store, lo, hi);
+         float extent = std::max(hi[0] - lo[0], std::max(hi[1] - lo[1], hi[2] - lo[2]));
+         _spacing = std::max(extent, 1e-6f) / (N - 3);
+         for(int axis = 0; axis < 3; ++axis)
+         {
+            _origin[axis] = 0.5f * (lo[axis] + hi[axis]) - 0.5f * (N - 1) * _spacing;
+         }
+      }
+
+      /**
+       * Locate a particle on the grid
+       *
+       * @return false if the particle is outside the grid
+       */
+      bool locate(float x, float y, float z, Cell& cell) const
+      {
+         float invSpacing = 1.0f / _spacing;
+         float limit      = float(_gridSize - 1);
+         float u          = (x - _origin[0]) * invSpacing;
+         float v          = (y - _origin[1]) * invSpacing;
+         float w          = (z - _origin[2]) * invSpacing;
+
+         // Written so that NaN fails the test
+         if(!(u >= 0 && u < limit && v >= 0 && v < limit && w >= 0 && w < limit))
+         {
+            return false;
+         }
+
+         cell.i  = size_t(u);
+         cell.j  = size_t(v);
+         cell.k  = size_t(w);
+         cell.fx = u - float(cell.i);
+         cell.fy = v - float(cell.j);
+         cell.fz = w - float(cell.k);
+         return true;
+      }
+
+      /**
+       * Cloud-in-cell deposit of the particle masses, in units of one
+       * particle mass, into the first octant of the padded grid
+       */
+      void deposit(const ParticleStore& store)
+      {
+         size_t n = store.size();
+         size_t N = size_t(_gridSize);
+         size_t M = paddedSize();
+
+         Compute::parallelForChunks(0, M, 1, [&](size_t first, size_t last)
+         {
+            memset(_density + first * M * M, 0, (last - first) * M * M * sizeof(double));
+         });
+
+         // Counting sort by slab. Particles outside the grid get slab N - 1,
+         // which is never deposited
+         if(_slab.size() != n)
+         {
+            _slab.resize(n);
+            _slabTmp.resize(n);
+            _order.resize(n);
+            _orderTmp.resize(n);
+            updateMemory();
+         }
+
+         const float* px = store.plane(ParticleStore::X);
+         const float* py = store.plane(ParticleStore::Y);
+         const float* pz = store.plane(ParticleStore::Z);
+         Compute::parallelForChunks(0, n, 65536, [&](size_t first, size_t last)
+         {
+            for(size_t p = first; p < last; ++p)
+            {
+               Cell cell;
+               _slab[p]  = locate(px[p], py[p], pz[p], cell) ? cell.i : N - 1;
+               _order[p] = uint32_t(p);
+            }
+         });
+
+         int slabBits = 1;
+         while((size_t(1) << slabBits) < N)
+         {
+            ++slabBits;
+         }
+         Compute::radixSort(_slab.data(), _order.data(), _slabTmp.data(), _orderTmp.data(), n, slabBits);
+
+         std::vector<size_t> slabStart(N);
+         for(size_t s = 0; s < N; ++s)
+         {
+            slabStart[s] = std::lower_bound(_slab.data(), _slab.data() + n, uint64_t(s)) - _slab.data();
+         }
+
+         for(size_t parity = 0; parity < 2; ++parity)
+         {
+            size_t numSlabs = (N - 1 - parity + 1) / 2;
+            Compute::ThreadPool::instance().run(numSlabs, [&](size_t chunk)
+            {
+               size_t s = parity + 2 * chunk;
+               for(size_t q = slabStart[s]; q < slabStart[s + 1]; ++q)
+               {
+                  uint32_t p = _order[q];
+                  Cell cell;
+                  if(!locate(px[p], py[p], pz[p], cell))
+                  {
+                     continue;
+                  }
+
+                  double wx[2] = { 1.0 - cell.fx, cell.fx };
+                  double wy[2] = { 1.0 - cell.fy, cell.fy };
+                  double wz[2] = { 1.0 - cell.fz, cell.fz };
+                  for(size_t a = 0; a < 2; ++a)
+                  {
+                     for(size_t b = 0; b < 2; ++b)
+                     {
+                        double* row = _density + ((cell.i + a) * M + cell.j + b) * M + cell.k;
+                        row[0] += wx[a] * wy[b] * wz[0];
+                        row[1] += wx[a] * wy[b] * wz[1];
+                     }
+                  }
+               }
+            });
+         }
+      }
+
+      /**
+       * Replace the density with the potential in grid units
+       */
+      void solve()
+      {
+         size_t M     = paddedSize();
+         size_t plane = M * (M / 2 + 1);
+
+         fftw_execute(_forward);
+         Compute::parallelForChunks(0, M, 1, [&](size_t first, size_t last)
+         {
+            for(size_t c = first * plane; c < last * plane; ++c)
+            {
+               _spectrum[c][0] *= _green[c];
+               _spectrum[c][1] *= _green[c];
+            }
+         });
+         fftw_execute(_backward);
+      }
+
+      /**
+       * Acceleration on the N^3 grid, a = -grad(potential), with central
+       * differences inside and one-sided differences on the faces
+       */
+      void differentiate(float particleGM)
+      {
+         size_t N = size_t(_gridSize);
+         size_t M = paddedSize();
+
+         // The potential is in units of particleGM / _spacing, and each
+         // difference divides by another _spacing
+         double scale = -double(particleGM) / (double(_spacing) * _spacing);
+
+         Compute::parallelForChunks(0, N, 1, [&](size_t first, size_t last)
+         {
+            float* fx = _field[0].data();
+            float* fy = _field[1].data();
+            float* fz = _field[2].data();
+            for(size_t i = first; i < last; ++i)
+            {
+               for(size_t j = 0; j < N; ++j)
+               {
+                  for(size_t k = 0; k < N; ++k)
+                  {
+                     size_t g     = (i * N + j) * N + k;
+                     size_t index = (i * M + j) * M + k;
+                     fx[g] = float(scale * difference(i, index, M * M, N));
+                     fy[g] = float(scale * difference(j, index, M, N));
+                     fz[g] = float(scale * difference(k, index, 1, N));
+                  }
+               }
+            }
+         });
+      }
+
+      /**
+       * Derivative of the potential along one axis, in grid units
+       *
+       * @param position
+       *    Index along the axis
+       * @param index
+       *    Index of the point in the padded grid
+       * @param stride
+       *    Distance between neighbors along the axis
+       * @param N
+       *    Grid points per axis
+       */
+      double difference(size_t position, size_t index, size_t stride, size_t N) const
+      {
+         if(position == 0)
+         {
+            return _density[index + stride] - _density[index];
+         }
+         if(position == N - 1)
+         {
+            return _density[index] - _density[index - stride];
+         }
+         return 0.5 * (_density[index + stride] - _density[index - stride]);
+      }
+
+      /**
+       * Cloud-in-cell interpolation of the grid accelerations
+       */
+      void gather(const ParticleStore& store, float* ax, float* ay, float* az) const
+      {
+         size_t N = size_t(_gridSize);
+
+         Compute::parallelForChunks(0, store.size(), 8192, [&](size_t first, size_t last)
+         {
+            const float* px = store.plane(ParticleStore::X);
+            const float* py = store.plane(ParticleStore::Y);
+            const float* pz = store.plane(ParticleStore::Z);
+            for(size_t p = first; p < last; ++p)
+            {
+               Cell cell;
+               if(!locate(px[p], py[p], pz[p], cell))
+               {
+                  ax[p] = ay[p] = az[p] = 0;
+                  continue;
+               }
+
+               float wx[2] = { 1.0f - cell.fx, cell.fx };
+               float wy[2] = { 1.0f - cell.fy, cell.fy };
+               float wz[2] = { 1.0f - cell.fz, cell.fz };
+               float a[3]  = { 0, 0, 0 };
+               for(size_t i = 0; i < 2; ++i)
+               {
+                  for(size_t j = 0; j < 2; ++j)
+                  {
+                     for(size_t k = 0; k < 2; ++k)
+                     {
+                        size_t g = ((cell.i + i) * N + cell.j + j) * N + cell.k + k;
+                        float  w = wx[i] * wy[j] * wz[k];
+                        a[0] += w * _field[0][g];
+                        a[1] += w * _field[1][g];
+                        a[2] += w * _field[2][g];
+                     }
+                  }
+               }
+               ax[p] = a[0];
+               ay[p] = a[1];
+               az[p] = a[2];
+            }
+         });
+      }
+
+      int                             _gridSize;     //< Grid points per axis, N
+      float                           _boxSize;      //< Side of a fixed grid cube, or 0 to fit the particles
+      double*                         _density;      //< (2N)^3 density, then potential
+      fftw_complex*                   _spectrum;     //< Transform of the density
+      double*                         _green;        //< Transform of the Green's function, scaled by 1 / (2N)^3
+      fftw_plan                       _forward;      //< _density to _spectrum
+      fftw_plan                       _backward;     //< _spectrum to _density
+      float                           _origin[3];    //< Position of grid point (0, 0, 0)
+      float                           _spacing;      //< Distance between grid points
+      Compute::AlignedArray<float>    _field[3];     //< Acceleration on the N^3 grid, one plane per axis
+      Compute::AlignedArray<uint64_t> _slab;         //< Slab of each particle, then sorted
+      Compute::AlignedArray<uint64_t> _slabTmp;      //< Scratch for the sort
+      Compute::AlignedArray<uint32_t> _order;        //< Particle indices sorted by slab
+      Compute::AlignedArray<uint32_t> _orderTmp;     //< Scratch for the sort
+      Compute::MemoryAccount          _memory;       //< Host memory of the grids and the sort arrays
+   };
+}
+
+#endif
@@ -0,0 +1,165 @@
+//--------------------------------------------------------------------------------
+// particle_store.h
+//
+// Structure-of-arrays particle storage. Each component of position and
+// velocity lives in its own 64 byte aligned plane, so a SIMD kernel loads the
+// x coordinates of 8 (AVX2) or 16 (AVX-512) particles with one instruction
+// instead of gathering them out of vec4s.
+//--------------------------------------------------------------------------------
+#ifndef _particle_store_h
+#define _particle_store_h
+
+#include <aligned_array.h>
+#include <memory_accounting.h>
+
+#include <cstddef>
+
+namespace Particles
+{
+   /**
+    * Current and initial position and velocity of every particle, one plane
+    * per component. The planes are padded to a multiple of padding so that
+    * kernels never need a scalar tail loop. The padding lanes mirror the last
+    * particle, so they always hold a valid state.
+    *
+    * How to use this class:
+    * \code
+    * Particles::ParticleStore store(numParticles);
+    * for(size_t i = 0; i < numParticles; ++i)
+    * {
+    *    store.set(i, 0.1f, 0, 0, vx, vy, vz);
+    * }
+    *
+    * float* x = store.plane(Particles::ParticleStore::X);
+    * \endcode
+    */
+   class ParticleStore
+   {
+   public:
+      /**
+       * Planes. X0 through VZ0 hold the initial state that a particle is
+       * reset to
+       */
+      enum Plane
+      {
+         X, Y, Z, VX, VY, VZ,
+         X0, Y0, Z0, VX0, VY0, VZ0,
+         NUM_PLANES
+      };
+
+      /**
+       * Plane lengths are a multiple of this. 16 covers the widest floatv
+       * (AVX-512)
+       */
+      static const size_t padding = 16;
+
+      /**
+       * Constructor
+       *
+       * @param size
+       *    Number of particles
+       */
+      explicit ParticleStore(size_t size = 0)
+      :  _size        (0)
+      ,  _paddedSize  (0)
+      ,  _memory      ("ParticleStore")
+      {
+         resize(size);
+      }
+
+      /**
+       * Reallocate the planes. Every particle, including the padding, is
+       * zeroed and must be initialized with set()
+       *
+       * @param size
+       *    Number of particles
+       */
+      void resize(size_t size)
+      {
+         _size       = size;
+         _paddedSize = (size + padding - 1) / padding * padding;
+         for(int p = 0; p < NUM_PLANES; ++p)
+         {
+            _planes[p].resize(_paddedSize);
+         }
+         _memory.setHost(NUM_PLANES * _paddedSize * sizeof(float));
+      }
+
+      /**
+       * Set the current and initial state of particle i
+       */
+      void set(size_t i, float x, float y, float z, float vx, float vy, float vz)
+      {
+         const float values[6] = { x, y, z, vx, vy, vz };
+
+         // The last particle also fills the padding lanes
+         size_t last = (i + 1 == _size) ? _paddedSize : i + 1;
+         for(int p = 0; p < 6; ++p)
+         {
+            for(size_t j = i; j < last; ++j)
+            {
+               _planes[p][j]     = values[p];
+               _planes[p + 6][j] = values[p];
+            }
+         }
+      }
+
+      /**
+       * Write the positions of particles [first, last) as (x, y, z, 1), the
+       * layout of the vertex buffers that the renderers draw
+       *
+       * @param xyzw
+       *    4 * (last - first) output floats
+       */
+      void interleavePositions(float* xyzw, size_t first, size_t last) const
+      {
+         const float* x = plane(X);
+         const float* y = plane(Y);
+         const float* z = plane(Z);
+         for(size_t i = first; i < last; ++i, xyzw += 4)
+         {
+            xyzw[0] = x[i];
+            xyzw[1] = y[i];
+            xyzw[2] = z[i];
+            xyzw[3] = 1.0f;
+         }
+      }
+
+      /**
+       * @return the number of particles
+       */
+      size_t size() const
+      {
+         return _size;
+      }
+
+      /**
+       * @return the plane length, size() rounded up to a multiple of padding
+       */
+      size_t paddedSize() const
+      {
+         return _paddedSize;
+      }
+
+      /**
+       * @return the first element of a plane
+       */
+      float* plane(Plane p)
+      {
+         return _planes[p].data();
+      }
+
+      const float* plane(Plane p) const
+      {
+         return _planes[p].data();
+      }
+
+   private:
+      Compute::AlignedArray<float> _planes[NUM_PLANES];  //< One array per component
+      size_t                  _size;         //< Number of particles
+      size_t                  _paddedSize;   //< Length of each plane
+      Compute::MemoryAccount  _memory;       //< Host memory of the planes
+   };
+}
+
+#endif
@@ -0,0 +1,234 @@
+//--------------------------------------------------------------------------------
+// wells.h
+//
+// Several gravity wells at arbitrary positions, each with its own mass and
+// softening length. The softened acceleration towards one well is
+//
+//    a = GM d / (|d|^2 + eps^2)^(3/2),  d = well - x
+//
+// The gravitational constant and the well mass are folded into GM once, when
+// the wells are set, not in the inner loop. Two field policies are provided
+// for the integrators:
+//
+//    FixedWells<T, N>  N known at compile time. The loop over wells unrolls
+//                      completely and every well parameter stays in a
+//                      register for the whole chunk
+//    TiledWells<T>     Any number of wells, read from a structure-of-arrays
+//                      copy padded to a multiple of tileSize. The loop runs
+//                      a tile at a time with no remainder
+//--------------------------------------------------------------------------------
+#ifndef _wells_h
+#define _wells_h
+
+#include <aligned_array.h>
+#include <simd.h>
+#include <simd_math.h>
+
+#include <cmath>
+#include <cstddef>
+#include <vector>
+
+namespace Particles
+{
+   /**
+    * One gravity well
+    */
+   struct Well
+   {
+      float x, y, z;    //< Position
+      float mass;       //< Mass in kg
+      float softening;  //< Softening length. Limits the force near the well, 0 for a point mass
+
+      Well(float x = 0, float y = 0, float z = 0, float mass = 9.5e9f, float softening = 0)
+      :  x         (x)
+      ,  y         (y)
+      ,  z         (z)
+      ,  mass      (mass)
+      ,  softening (softening)
+      {
+      }
+   };
+
+   /**
+    * 1 / sqrt(x): exact for float, the refined estimate for floatv
+    */
+   inline float inverseSqrt(float x)
+   {
+      return 1.0f / sqrtf(x);
+   }
+
+   inline Compute::floatv inverseSqrt(Compute::floatv x)
+   {
+      return Compute::rsqrtApprox(x);
+   }
+
+   /**
+    * Add the acceleration towards one well to (ax, ay, az)
+    */
+   template<typename T>
+   inline void addWell(T wx, T wy, T wz, T GM, T softening2, T x, T y, T z, T& ax, T& ay, T& az)
+   {
+      T dx   = wx - x;
+      T dy   = wy - y;
+      T dz   = wz - z;
+      T rinv = inverseSqrt(dx * dx + dy * dy + dz * dz + softening2);
+      T s    = GM * rinv * rinv * rinv;
+      ax = ax + s * dx;
+      ay = ay + s * dy;
+      az = az + s * dz;
+   }
+
+   /**
+    * Wells in structure-of-arrays form, with GM and the squared softening
+    * precomputed. Padded with massless wells to a multiple of tileSize
+    */
+   class WellSet
+   {
+   public:
+      /**
+       * Planes
+       */
+      enum Plane
+      {
+         X, Y, Z, GM, SOFTENING2,
+         NUM_PLANES
+      };
+
+      /**
+       * Number of wells per tile of TiledWells
+       */
+      static const size_t tileSize = 4;
+
+      /**
+       * Constructor
+       */
+      WellSet()
+      :  _size (0)
+      {
+      }
+
+      /**
+       * Replace the wells
+       */
+      void set(const std::vector<Well>& wells)
+      {
+         _size = wells.size();
+         size_t padded = (_size + tileSize - 1) / tileSize * tileSize;
+         for(int p = 0; p < NUM_PLANES; ++p)
+         {
+            _planes[p].resize(padded);
+         }
+
+         for(size_t i = 0; i < padded; ++i)
+         {
+            // Padding wells have no mass. A softening of 1 keeps them from
+            // producing 0 * inf for a particle at the origin
+            Well well = i < _size ? wells[i] : Well(0, 0, 0, 0, 1);
+            _planes[X][i]          = well.x;
+            _planes[Y][i]          = well.y;
+            _planes[Z][i]          = well.z;
+            _planes[GM][i]         = 6.67e-11f * well.mass;
+            _planes[SOFTENING2][i] = well.softening * well.softening;
+         }
+      }
+
+      /**
+       * @return the number of wells, not counting padding
+       */
+      size_t size() const
+      {
+         return _size;
+      }
+
+      /**
+       * @return the number of wells including padding
+       */
+      size_t paddedSize() const
+      {
+         return _planes[X].size();
+      }
+
+      const float* plane(Plane p) const
+      {
+         return _planes[p].data();
+      }
+
+   private:
+      Compute::AlignedArray<float> _planes[NUM_PLANES];   //< Well parameters, one plane each
+      size_t                       _size;                 //< Number of wells, not counting padding
+   };
+
+   /**
+    * Field of a number of wells fixed at compile time. Each parameter is
+    * broadcast once when the field is built
+    */
+   template<typename T, size_t N>
+   struct FixedWells
+   {
+      T x[N], y[N], z[N], GM[N], softening2[N];
+
+      /**
+       * @param wells
+       *    Must hold exactly N wells
+       */
+      explicit FixedWells(const WellSet& wells)
+      {
+         for(size_t i = 0; i < N; ++i)
+         {
+            x[i]          = T(wells.plane(WellSet::X)[i]);
+            y[i]          = T(wells.plane(WellSet::Y)[i]);
+            z[i]          = T(wells.plane(WellSet::Z)[i]);
+            GM[i]         = T(wells.plane(WellSet::GM)[i]);
+            softening2[i] = T(wells.plane(WellSet::SOFTENING2)[i]);
+         }
+      }
+
+      void operator()(T px, T py, T pz, T& ax, T& ay, T& az) const
+      {
+         ax = ay = az = T(0.0f);
+         for(size_t i = 0; i < N; ++i)
+         {
+            addWell(x[i], y[i], z[i], GM[i], softening2[i], px, py, pz, ax, ay, az);
+         }
+      }
+   };
+
+   /**
+    * Field of any number of wells. The parameters are read from the well
+    * set and broadcast as the loop goes, tileSize wells per iteration
+    */
+   template<typename T>
+   struct TiledWells
+   {
+      const float* x;
+      const float* y;
+      const float* z;
+      const float* GM;
+      const float* softening2;
+      size_t       count;      //< Number of wells including padding
+
+      explicit TiledWells(const WellSet& wells)
+      :  x           (wells.plane(WellSet::X))
+      ,  y           (wells.plane(WellSet::Y))
+      ,  z           (wells.plane(WellSet::Z))
+      ,  GM          (wells.plane(WellSet::GM))
+      ,  softening2  (wells.plane(WellSet::SOFTENING2))
+      ,  count       (wells.paddedSize())
+      {
+      }
+
+      void operator()(T px, T py, T pz, T& ax, T& ay, T& az) const
+      {
+         ax = ay = az = T(0.0f);
+         for(size_t i = 0; i < count; i += WellSet::tileSize)
+         {
+            for(size_t j = i; j < i + WellSet::tileSize; ++j)
+            {
+               addWell(T(x[j]), T(y[j]), T(z[j]), T(GM[j]), T(softening2[j]), px, py, pz, ax, ay, az);
+            }
+         }
+      }
+   };
+}
+
+#endif
@@ -16,6 +16,13 @@
 #include <opengl.h>
 #include <shader.h>
 #include <trackball.h>
+#include <context.h>
+#include <phase_timer.h>
+#include <trace.h>
+#include <memory_accounting.h>
+#include <gl_memory.h>
+#include <counter_rng.h>
+#include <parallel_for.h>
 
 using std::vector;
 using std::string;
@@ -43,12 +50,15 @@ unsigned int            _srcCompute;         //< Source compute texture
 unsigned int            _dstCompute;         //< Destination compute texture
 
 bool                    _running = true;     //< true if the program should continue running
+unique_ptr<GL::Context> _context;            //< Window or headless OpenGL context
 
 // Particle data
 vector<vec4>            _positions;
 vector<vec4>            _velocities;
 size_t                  _particleWidth;      //< Width of the particle data texture
 size_t                  _particleHeight;     //< Height of the particle data texture
+Compute::Philox         _rng(1);             //< Random initial velocities, keyed by particle index
+Compute::MemoryAccount  _memory("Particles"); //< Host copies, textures and buffer of the particles
 
 // Track the framerate
 unsigned long           _numFrames;          //< Number of frames drawn
@@ -78,7 +88,7 @@ void terminate(int exitCode)
    glDeleteVertexArrays(1, &_computeVAO);
    glDeleteBuffers(1, &_computePosBuf);
    glDeleteBuffers(1, &_computeTexCoordBuf);
-   glfwTerminate();
+   _context.reset();
    exit(exitCode);
 }
 
@@ -272,8 +282,10 @@ void initParticle(int i)
    // same and determined by the variable r, but the directions are random
    
    // Define the velocity in terms of polar coordinates
-   float theta = 2 * M_PI * rand() / RAND_MAX;
-   float phi = 2 * M_PI * rand() * RAND_MAX;
+   float u[4];
+   _rng.uniform4(i, 0, u);
+   float theta = 2 * M_PI * u[0];
+   float phi = 2 * M_PI * u[1];
    float r = 3.51f;
    
    // Translate from polar to cartesian
@@ -308,8 +320,10 @@ void initParticle(int i)
    // same and determined by the variable r, but the directions are random
    
    // Define the velocity in terms of polar coordinates
-   float theta = 2 * M_PI * rand() / RAND_MAX;
-   float phi = 2 * M_PI * rand() * RAND_MAX;
+   float u[4];
+   _rng.uniform4(i, 0, u);
+   float theta = 2 * M_PI * u[0];
+   float phi = 2 * M_PI * u[1];
    float r = 3.51f;
    
    // Translate from polar to cartesian
@@ -341,10 +355,15 @@ void initParticles(size_t numParticles)
    _positions.resize(_particleHeight * _particleWidth);
    _velocities.resize(_particleHeight * _particleWidth);
 
-   for(size_t i = 0; i < _particleWidth * _particleHeight; ++i)
+   // Each particle's random values depend only on its index, so the
+   // particles can be initialized on any number of threads
+   Compute::parallelFor(0, _particleWidth * _particleHeight, [](size_t first, size_t last)
    {
-      initParticle(i);
-   }
+      for(size_t i = first; i < last; ++i)
+      {
+         initParticle(i);
+      }
+   });
    
    createFBO();
    
@@ -358,6 +377,15 @@ void initParticles(size_t numParticles)
    glVertexAttribPointer(_renderProg->getAttribLocation("pos"), 4, GL_FLOAT, GL_FALSE, 0, NULL);
    glEnableVertexAttribArray(_renderProg->getAttribLocation("pos"));
    glBindVertexArray(0);
+
+   // Both ping pong textures of each kind, and the host copies they were
+   // uploaded from
+   size_t deviceBytes = GL::bufferBytes(_pBO);
+   for(size_t id = 0; id < _posTexID.size(); ++id)
+   {
+      deviceBytes += GL::textureBytes(_posTexID[id]) + GL::textureBytes(_velTexID[id]);
+   }
+   _memory.set(Compute::vectorBytes(_positions) + Compute::vectorBytes(_velocities), deviceBytes);
 }
 
 /**
@@ -430,7 +458,7 @@ void init(size_t numParticles)
    glEnable(GL_BLEND);
    glBlendFunc(GL_ONE, GL_ONE);
    int width, height;
-   glfwGetWindowSize(&width, &height);
+   _context->getSize(width, height);
 }
 
 /**
@@ -489,7 +517,7 @@ void GLFWCALL mouseMove(int x, int y)
    if(_tracking)
    {
       int width, height;
-      glfwGetWindowSize(&width, &height);
+      _context->getSize(width, height);
       _trackball->motion(x, height - y);
    }
 }
@@ -535,6 +563,11 @@ void GLFWCALL keypress(int key, int state)
          case 'r':
             reloadShaders();
             break;
+
+         case 'M':
+         case 'm':
+            Compute::MemoryRegistry::instance().report(std::cout);
+            break;
             
       }
    }
@@ -554,38 +587,44 @@ int GLFWCALL close(void)
  */
 void updateParticles()
 {
-   glDisable(GL_BLEND);
-   // Set the viewport to be the size of the destination texture
-   glViewport(0, 0, _particleWidth, _particleHeight);
+   {
+      GL::ScopedPhase timed("updateParticles");
+      glDisable(GL_BLEND);
+      // Set the viewport to be the size of the destination texture
+      glViewport(0, 0, _particleWidth, _particleHeight);
    
-   // Bind the framebuffer object
-   glBindFramebuffer(GL_FRAMEBUFFER, _fboID[_dstCompute]);
+      // Bind the framebuffer object
+      glBindFramebuffer(GL_FRAMEBUFFER, _fboID[_dstCompute]);
 
-   _updateProg->bind();
+      _updateProg->bind();
    
-   // Bind the source particle attribute textures
-   glActiveTexture(GL_TEXTURE0);
-   glBindTexture(GL_TEXTURE_2D, _posTexID[_srcCompute]);
-   _updateProg->setUniform("inPos", 0);
+      // Bind the source particle attribute textures
+      glActiveTexture(GL_TEXTURE0);
+      glBindTexture(GL_TEXTURE_2D, _posTexID[_srcCompute]);
+      _updateProg->setUniform("inPos", 0);
    
-   glActiveTexture(GL_TEXTURE1);
-   glBindTexture(GL_TEXTURE_2D, _velTexID[_srcCompute]);
-   _updateProg->setUniform("inVel", 1);
+      glActiveTexture(GL_TEXTURE1);
+      glBindTexture(GL_TEXTURE_2D, _velTexID[_srcCompute]);
+      _updateProg->setUniform("inVel", 1);
    
-   // Draw the quad that covers the entire FBO
-   glBindVertexArray(_computeVAO);
-   glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-
-   // Copy the positions from the FBO's back end buffer that hold the
-   // particle positions into the vertex buffer object used to draw
-   // the particles. It is hoped that a copy will not actually happen,
-   // but instead that the driver will merely change a pointer.
-   glReadBuffer(GL_COLOR_ATTACHMENT0);
-   glBindBuffer(GL_PIXEL_PACK_BUFFER, _pBO);
-   // Set the reading buffer for this FBO
-   glReadPixels(0, 0, _particleWidth, _particleHeight, GL_RGBA, GL_FLOAT, NULL);
-   glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
-   GL_ERR_CHECK();
+      // Draw the quad that covers the entire FBO
+      glBindVertexArray(_computeVAO);
+      glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+   }
+
+   {
+      GL::ScopedPhase timed("PBO copy");
+      // Copy the positions from the FBO's back end buffer that hold the
+      // particle positions into the vertex buffer object used to draw
+      // the particles. It is hoped that a copy will not actually happen,
+      // but instead that the driver will merely change a pointer.
+      glReadBuffer(GL_COLOR_ATTACHMENT0);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, _pBO);
+      // Set the reading buffer for this FBO
+      glReadPixels(0, 0, _particleWidth, _particleHeight, GL_RGBA, GL_FLOAT, NULL);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+      GL_ERR_CHECK();
+   }
 
    // Reset the VAO, shader and framebuffer object state back to
    // the default
@@ -595,7 +634,7 @@ void updateParticles()
    
    // Reset the viewport size
    int width, height;
-   glfwGetWindowSize(&width, &height);
+   _context->getSize(width, height);
    glViewport(0, 0, width, height);
    GL_ERR_CHECK();
    
@@ -611,6 +650,7 @@ void updateParticles()
  */
 void drawParticles()
 {
+   GL::ScopedPhase timed("drawParticles");
    glEnable(GL_BLEND);
    // Clear the color and depth buffers
    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
@@ -621,7 +661,7 @@ void drawParticles()
    // Get the width and height of the window
    int width;
    int height;
-   glfwGetWindowSize(&width, &height);
+   _context->getSize(width, height);
    
    // Clear the color and depth buffers
    GL_ERR_CHECK();
@@ -681,7 +721,7 @@ int update(double time)
 void framerate(unsigned long frameCount)
 {
    gettimeofday(&_endTime, NULL);
-   double elapsed = _endTime.tv_sec - _startTime.tv_sec;
+   double elapsed = (_endTime.tv_sec - _startTime.tv_sec) + 1e-6 * (_endTime.tv_usec - _startTime.tv_usec);
    std::cout << "Frames per second: " << frameCount / elapsed << std::endl;
 }
 
@@ -700,93 +740,118 @@ int main(int argc, char* argv[])
    _zoom = 700;
    _tracking = false;
    
-   _trackball = unique_ptr<Trackball>(new Trackball(width, height));
+   bool phases = false;
+   bool memory = false;
+   string traceFile;
+   bool headless = false;
+   unsigned long maxFrames = 0;
+   for(int i = 1; i < argc; ++i)
+   {
+      string arg(argv[i]);
+      if(arg == "--phases")
+      {
+         phases = true;
+      }
+      else if(arg == "--memory")
+      {
+         memory = true;
+      }
+      else if(arg == "--headless")
+      {
+         headless = true;
+      }
+      else if(arg == "--frames" && i + 1 < argc && atol(argv[i + 1]) > 0)
+      {
+         maxFrames = atol(argv[++i]);
+      }
+      else if(arg == "--trace" && i + 1 < argc)
+      {
+         traceFile = argv[++i];
+      }
+      else
+      {
+         std::cerr << "Usage: " << argv[0] << " [--phases] [--memory] [--headless] [--frames n] [--trace file]" << std::endl;
+         return -1;
+      }
+   }
+
+   // Without a window there is no way to quit, so stop after a fixed
+   // number of frames
+   if(headless && maxFrames == 0)
+   {
+      maxFrames = 1000;
+   }
 
-   // Initialize GLFW
-   glfwInit();
+   _trackball = unique_ptr<Trackball>(new Trackball(width, height));
 
-   // Request an OpenGL core profile context, without backwards compatibility
-   glfwOpenWindowHint(GLFW_OPENGL_VERSION_MAJOR,  3);
-   glfwOpenWindowHint(GLFW_OPENGL_VERSION_MINOR,  2);
-   glfwOpenWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-   glfwOpenWindowHint(GLFW_OPENGL_PROFILE,        GLFW_OPENGL_CORE_PROFILE);
-   // Open a window and create its OpenGL context
-   if(!glfwOpenWindow(width, height, 0, 0, 0, 8, 32, 0, GLFW_WINDOW ))
+   // Open a window, or with --headless an offscreen pbuffer, and create
+   // its OpenGL context
+   try
+   {
+      _context = unique_ptr<GL::Context>(GL::Context::create(headless ? GL::Context::HEADLESS : GL::Context::WINDOW, width, height));
+   }
+   catch(std::runtime_error err)
    {
-      std::cerr << "Failed to open GLFW window" << std::endl;
-      glfwTerminate();
+      std::cerr << "Failed to create an OpenGL context: " << err.what() << std::endl;
       return -1;
    }
    resize(width, height);
 
-   glfwSwapInterval(0);
-   glfwSetWindowSizeCallback(resize);
-   glfwSetKeyCallback(keypress);
-   glfwSetWindowCloseCallback(close);
-   glfwSetMouseButtonCallback(mouseButton);
-   glfwSetMouseWheelCallback(mouseWheel);
-   glfwSetMousePosCallback(mouseMove);
+   _context->setSwapInterval(0);
+   if(!_context->isHeadless())
+   {
+      glfwSetWindowSizeCallback(resize);
+      glfwSetKeyCallback(keypress);
+      glfwSetWindowCloseCallback(close);
+      glfwSetMouseButtonCallback(mouseButton);
+      glfwSetMouseWheelCallback(mouseWheel);
+      glfwSetMousePosCallback(mouseMove);
+   }
    
    std::cout << "GL Version: " << glGetString(GL_VERSION) << std::endl;
+   std::cout << "Context: " << _context->describe() << std::endl;
 
-#if 0
-   vector<float> numParticles =
+   if(phases)
    {
-      250000,
-      500000,
-      750000,
-      1000000,
-      2000000,
-      3000000,
-      4000000,
-      5000000,
-      6000000,
-      7000000,
-      8000000,
-      9000000,
-      10000000,
-      11000000,
-      12000000,
-      13000000,
-      14000000,
-      15000000,
-   };
-   
-   for(auto num : numParticles)
+      GL::PhaseTimer::instance().enable();
+   }
+
+   // Record a timeline of the frames. It is written on exit, and on
+   // SIGUSR1 while the program runs
+   if(!traceFile.empty())
    {
-      init(num);
-      _numFrames = 0;
-      gettimeofday(&_startTime, NULL);
-      
-      // Main loop. Run until ESC key is pressed or the window is closed
-      while(_running && _numFrames < 1000)
-      {
-         update(glfwGetTime());
-         glfwSwapBuffers();
-      }
-      std::cout << "num: " << num << std::endl;
-      framerate(_numFrames);
-      if(!_running)
-      {
-         break;
-      }
+      Compute::Tracer::instance().enable(traceFile);
+      Compute::Tracer::instance().installSignalHandler(SIGUSR1);
    }
-   
-#else
+
    size_t num = 1000000;
    init(num);
+
+   // Batch runs are where particle counts are chosen, so they always
+   // report the memory the particles took
+   if(memory || headless)
+   {
+      Compute::MemoryRegistry::instance().report(std::cout);
+   }
    _numFrames = 0;
    gettimeofday(&_startTime, NULL);
    
-   // Main loop. Run until ESC key is pressed or the window is closed
-   while(_running)
+   // Main loop. Run until ESC key is pressed, the window is closed or
+   // maxFrames frames have been drawn
+   while(_running && (maxFrames == 0 || _numFrames < maxFrames))
    {
-      update(glfwGetTime());
-      glfwSwapBuffers();
+      Compute::Tracer::instance().poll();
+      update(_context->getTime());
+
+      GL::ScopedPhase timed("swap", false);
+      _context->swapBuffers();
    }
    std::cout << "num: " << num << std::endl;
    framerate(_numFrames);
-#endif
+   if(phases)
+   {
+      GL::PhaseTimer::instance().report(std::cout);
+   }
    
    terminate(EXIT_SUCCESS);
 }
@@ -0,0 +1,752 @@
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+#include <string>
+#include <memory>
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include <GL/glfw.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>  // rotation, translation, scale, etc
+
+#include <opengl.h>
+#include <shader.h>
+#include <trackball.h>
+#include <phase_timer.h>
+#include <trace.h>
+#include <memory_accounting.h>
+#include <gl_memory.h>
+#include <context.h>
+#include <counter_rng.h>
+#include <cpu_dispatch.h>
+#include <parallel_for.h>
+#include <engine_factory.h>
+
+#include "scaling.h"
+
+using std::vector;
+using std::string;
+using std::unique_ptr;
+using namespace glm;
+
+string                  _renderVertFile;     //< File name for the PS vertex shader
+string                  _renderFragFile;     //< File name for the PS fragment shader
+unique_ptr<GL::Program> _renderProg;         //< Pointer to the PS rendering program
+GLuint                  _pVAO;               //< Vertex array object for the positions
+GLuint                  _pBO;                //< Buffer object for the positions
+Compute::MemoryAccount  _pBOMemory("Render buffer"); //< GPU memory of _pBO
+
+bool                    _running = true;     //< true if the program should continue running
+unique_ptr<GL::Context> _context;            //< Window or headless OpenGL context
+
+// Particle data
+unique_ptr<Particles::ParticleEngineBase> _engine; //< Particle state and update kernels
+Compute::Philox         _rng(1);             //< Random initial velocities, keyed by particle index
+int                     _stepsPerFrame = 1;  //< Time steps taken between drawn frames
+
+// Track the framerate
+unsigned long           _numFrames;          //< Number of frames drawn
+double                  _aliveSum = 0;       //< Live particle count summed over the updated frames
+timeval                 _startTime;          //< Start time of program
+timeval                 _endTime;            //< End time of program
+
+// User interaction
+unique_ptr<Trackball>   _trackball;
+// This keeps the user from zooming really far in or out and then having to spend
+// time to undo their actions. Zooming is clamped to a max and min value by
+// checking the delta of the mouse wheel each time it changes.
+float                   _mouseWheelPrev;     //< Previous mouse wheel position;
+float                   _zoom;               //< Current mouse wheel zoom in/out factor
+float                   _zoomMax;            //< Max allowed mouse wheel zoom
+float                   _zoomMin;            //< Min allowed mouse wheel zoom
+bool                    _tracking;
+
+/**
+ * Clean up and exit
+ *
+ * @param exitCode      The exit code, eg, EXIT_SUCCESS or EXIT_FAILURE
+ */
+void terminate(int exitCode)
+{
+   glDeleteVertexArrays(1, &_pVAO);
+   glDeleteBuffers(1, &_pBO);
+   _context.reset();
+   exit(exitCode);
+}
+
+/**
+ * Reload the shaders. If unsuccessful, print the errors to stderr and
+ * leave the previous shader program in place
+ */
+void reloadShaders(void)
+{
+   try
+   {
+      _renderProg = unique_ptr<GL::Program>(new GL::Program(_renderVertFile, _renderFragFile));
+   }
+   catch (std::runtime_error exception)
+   {
+      std::cerr << exception.what() << std::endl;
+   }
+}
+
+/**
+ * Initialize a single particle
+ *
+ * @param i
+ *    The index of the particle to initialize
+ */
+void initParticle(int i)
+{
+   // Determine the initial velocity. The magnitude of all velocities is the
+   // same and determined by the variable r, but the directions are random
+
+   // Define the velocity in terms of polar coordinates
+   float u[4];
+   _rng.uniform4(i, 0, u);
+   float theta = 2 * M_PI * u[0];
+   float phi = 2 * M_PI * u[1];
+   float r = 3.51f;
+
+   // Translate from polar to cartesian
+   float sin_theta = sin(theta);
+   float cos_theta = cos(theta);
+   float sin_phi   = sin(phi);
+   float cos_phi   = cos(phi);
+   float x = r * cos_phi * sin_theta;
+   float y = r * sin_phi * sin_theta;
+   float z = r * cos_theta;
+
+   // All particles start from a position directly above the gravity well
+   _engine->getStore().set(i, 0, 0.1f, 0, x, y, z);
+}
+
+/**
+ * Initialize particles. The engine has already been created
+ */
+void initParticles()
+{
+   size_t numParticles = _engine->getNumParticles();
+
+   // Each particle's random values depend only on its index, so the
+   // particles can be initialized on any number of threads
+   Compute::parallelFor(0, numParticles, [](size_t first, size_t last)
+   {
+      for(size_t i = first; i < last; ++i)
+      {
+         initParticle(i);
+      }
+   });
+
+   // The positions are rewritten every frame
+   glGenVertexArrays(1, &_pVAO);
+   glBindVertexArray(_pVAO);
+   glGenBuffers(1, &_pBO);
+   glBindBuffer(GL_ARRAY_BUFFER, _pBO);
+   glBufferData(GL_ARRAY_BUFFER, sizeof(vec4) * numParticles, NULL, GL_STREAM_DRAW);
+   glVertexAttribPointer(_renderProg->getAttribLocation("pos"), 4, GL_FLOAT, GL_FALSE, 0, NULL);
+   glEnableVertexAttribArray(_renderProg->getAttribLocation("pos"));
+   glBindVertexArray(0);
+   _pBOMemory.setDevice(GL::bufferBytes(_pBO));
+}
+
+/**
+ * Initialize vertex array objects, vertex buffer objects,
+ * clear color and depth clear value
+ */
+void init()
+{
+   // Set the location of the shader files
+   _renderVertFile = std::string(SOURCE_DIR) + "/render_vert.c";
+   _renderFragFile = std::string(SOURCE_DIR) + "/render_frag.c";
+
+   // Load the shaders
+   reloadShaders();
+
+   // Verify that the shaders loaded. If they did not load,
+   // then the program can't continue and must terminate
+   if(_renderProg == nullptr)
+   {
+      terminate(EXIT_FAILURE);
+   }
+
+   // Initial particle system and vertex buffer
+   initParticles();
+
+   glEnable(GL_BLEND);
+   glBlendFunc(GL_ONE, GL_ONE);
+}
+
+/**
+ * Window resize callback
+ *
+ * @param width   the width of the window
+ * @param height  the height of the window
+ */
+void GLFWCALL resize(int width, int height)
+{
+   // Set the affine transform of (x,y) from normalized device coordinates to
+   // window coordinates. In this case, (-1,1) -> (0, width) and (-1,1) -> (0, height)
+   glViewport(0, 0, width, height);
+
+   _trackball->reshape(width, height);
+}
+
+/**
+ *  Mouse click callback
+ *
+ *  @param button that was clicked
+ *  @param button state
+ */
+void GLFWCALL mouseButton(int button, int action)
+{
+   if(button == GLFW_MOUSE_BUTTON_1)
+   {
+      _tracking = action == GLFW_PRESS;
+   }
+
+   if(_tracking)
+   {
+      int x, y;
+      glfwGetMousePos(&x, &y);
+      _trackball->start(x,y);
+   }
+   else
+   {
+      _trackball->stop();
+   }
+}
+
+/**
+ * Mouse movement callback
+ */
+void GLFWCALL mouseMove(int x, int y)
+{
+   if(_tracking)
+   {
+      int width, height;
+      _context->getSize(width, height);
+      _trackball->motion(x, height - y);
+   }
+}
+
+/**
+ * Handle changes in the mouse wheel position
+ */
+void GLFWCALL mouseWheel(int mouseWheelCur)
+{
+   // Find the change in the mouse wheel position
+   float delta = _mouseWheelPrev - mouseWheelCur;
+
+   // Update the zoom based on the delta
+   _zoom += delta;
+
+   // Keep the zoom amount in the range (_zoomMin,_zoomMax);
+   if(_zoom > _zoomMax) {
+      _zoom = _zoomMax;
+   }
+
+   if(_zoom < _zoomMin) {
+      _zoom = _zoomMin;
+   }
+
+   // The new "previous" mouse wheel position
+   _mouseWheelPrev = mouseWheelCur;
+}
+
+/**
+ * Keypress callback
+ */
+void GLFWCALL keypress(int key, int state)
+{
+   if(state == GLFW_PRESS)
+   {
+      switch(key)
+      {
+         case GLFW_KEY_ESC:
+            _running = false;
+            break;
+
+         case 'R':
+         case 'r':
+            reloadShaders();
+            break;
+
+         case 'M':
+         case 'm':
+            Compute::MemoryRegistry::instance().report(std::cout);
+            break;
+
+         case GLFW_KEY_LEFT:
+         case GLFW_KEY_RIGHT:
+            // Scrub time in the analytic mode
+            if(Particles::KeplerEngine* kepler = dynamic_cast<Particles::KeplerEngine*>(_engine.get()))
+            {
+               kepler->setTime(kepler->getTime() + (key == GLFW_KEY_LEFT ? -1.0 : 1.0));
+            }
+            break;
+
+      }
+   }
+}
+
+/**
+ * Window close callback
+ */
+int GLFWCALL close(void)
+{
+   _running = false;
+   return GL_TRUE;
+}
+
+/**
+ * Update particle positions on the CPU and copy them into the vertex buffer
+ */
+void updateParticles()
+{
+   {
+      GL::ScopedPhase timed("ParticleEngine::update", false, _engine->getNumAlive() * _stepsPerFrame);
+      _aliveSum += _engine->getNumAlive();
+      _engine->update(_stepsPerFrame);
+   }
+
+   // Orphan the previous contents so the driver does not wait for the last
+   // frame's draw to finish, then write the positions straight into the
+   // mapped buffer
+   GL::ScopedPhase timed("upload", false);
+   size_t numParticles = _engine->getNumAlive();
+   glBindBuffer(GL_ARRAY_BUFFER, _pBO);
+   float* xyzw = static_cast<float*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, sizeof(vec4) * numParticles,
+                                                      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+   if(xyzw == NULL)
+   {
+      throw std::runtime_error("Unable to map the particle vertex buffer");
+   }
+   _engine->getStore().interleavePositions(xyzw, 0, numParticles);
+   glUnmapBuffer(GL_ARRAY_BUFFER);
+   glBindBuffer(GL_ARRAY_BUFFER, 0);
+   GL_ERR_CHECK();
+}
+
+/**
+ * Draw particle system
+ */
+void drawParticles()
+{
+   GL::ScopedPhase timed("drawParticles");
+   // Clear the color and depth buffers
+   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+   glBindVertexArray(_pVAO);
+   _renderProg->bind();
+
+   glPointSize(1.0f);
+   // Get the width and height of the window
+   int width;
+   int height;
+   _context->getSize(width, height);
+
+   GL_ERR_CHECK();
+
+   // Projection matrix
+   glm::mat4 projection = glm::perspective(45.0f,                         // 45 degree field of view
+                                           float(width) / float(height),  // Ratio
+                                           0.1f,                          // Near clip
+                                           4000.0f);                      // Far clip
+   // Camera matrix
+   glm::mat4 view       = glm::lookAt(glm::vec3(0,0,_zoom * 1e-2), // Camera position is at (0,0,2), in world space
+                                      glm::vec3(0,0,0), // and looks at the origin
+                                      glm::vec3(0,1,0)  // Head is up (set to 0,-1,0 to look upside-down)
+                                      );
+
+   glm::mat4 translate = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, 0.0f, -2.0f));
+
+   // Model matrix
+   glm::mat4 model = _trackball->getTransform();
+
+   // Create  model, view, projection matrix
+   glm::mat4 mv        = view * translate * model;
+
+   _renderProg->setUniform("mv", mv);
+   _renderProg->setUniform("proj", projection);
+   glDrawArrays(GL_POINTS, 0, _engine->getNumAlive());
+
+   _renderProg->release();
+   glBindVertexArray(0);
+   GL_ERR_CHECK();
+}
+
+/**
+ * Main loop
+ * @param time    time elapsed in seconds since the start of the program
+ */
+int update(double time)
+{
+   try
+   {
+      updateParticles();
+      drawParticles();
+      _numFrames++;
+   }
+   catch (std::runtime_error exception)
+   {
+      std::cerr << exception.what() << std::endl;
+   }
+   return GL_TRUE;
+}
+
+/**
+ * Calculate and display the frame rate and particle throughput for the
+ * entire run of the program
+ */
+void framerate(unsigned long frameCount)
+{
+   gettimeofday(&_endTime, NULL);
+   double elapsed = (_endTime.tv_sec - _startTime.tv_sec) + 1e-6 * (_endTime.tv_usec - _startTime.tv_usec);
+   std::cout << "Frames per second: " << frameCount / elapsed << std::endl;
+
+   // The live count changes as particles are born and die, so use its
+   // mean over the frames rather than the capacity
+   double meanAlive = frameCount > 0 ? _aliveSum / frameCount : 0;
+   std::cout << "Particle updates per second: " << frameCount * double(_stepsPerFrame) * meanAlive / elapsed << std::endl;
+}
+
+/**
+ * Wells evenly spaced on a ring around the origin in the xz plane, sharing
+ * the mass of the single well
+ *
+ * @param count
+ *    Number of wells
+ * @param totalMass
+ *    Combined mass of the wells in kg
+ */
+vector<Particles::Well> ringOfWells(int count, float totalMass)
+{
+   const float radius    = 0.5f;
+   const float softening = 0.01f;
+
+   vector<Particles::Well> wells;
+   for(int i = 0; i < count; ++i)
+   {
+      float angle = 2.0f * float(M_PI) * i / count;
+      wells.push_back(Particles::Well(radius * cosf(angle), 0, radius * sinf(angle), totalMass / count, softening));
+   }
+   return wells;
+}
+
+/**
+ * One emitter where the initial burst starts, directly above the gravity
+ * well, with the same speed. It emits at the rate that keeps about count
+ * particles alive
+ *
+ * @param count
+ *    Number of particles the store holds
+ * @param lifetime
+ *    Mean lifetime in seconds
+ */
+vector<Particles::Emitter> pointEmitter(size_t count, float lifetime)
+{
+   Particles::Emitter emitter;
+   emitter.y              = 0.1f;
+   emitter.speed          = 3.51f;
+   emitter.lifetime       = lifetime;
+   emitter.lifetimeSpread = 0.25f;
+   emitter.rate           = count / lifetime;
+   return vector<Particles::Emitter>(1, emitter);
+}
+
+/**
+ * Print the command line options
+ */
+void usage(const char* program)
+{
+   std::cerr << "Usage: " << program << " [--integrator name] [--scalar] [--threads n] [--wells n] [--levels n] [--lifetime s] [--steps k] [--phases] [--counters] [--memory] [--headless] [--frames n] [--trace file] [--isa level] [--scaling] [--scaling-report] [number of particles]" << std::endl
+             << "   --integrator  rk4 (default), leapfrog, yoshida4, kepler, barnes-hut or particle-mesh" << std::endl
+             << "   --scalar      Update the particles one at a time instead of with SIMD" << std::endl
+             << "   --threads n   Update the particles on n threads. Default: all hardware threads" << std::endl
+             << "   --wells n     Split the gravity well into n wells on a ring" << std::endl
+             << "   --levels n    Let particles near a well take up to 2^n sub-steps per step" << std::endl
+             << "   --lifetime s  Emit particles continuously and let them live for about s seconds" << std::endl
+             << "   --steps k     Take k time steps per drawn frame, keeping each particle in registers" << std::endl
+             << "   --phases      Print the time spent in each phase of the frame at exit" << std::endl
+             << "   --counters    --phases with cycles, instructions and cache and branch misses per phase" << std::endl
+             << "   --memory      Print the host and GPU memory of the engine and buffers after setup" << std::endl
+             << "   --headless    Render to an offscreen EGL pbuffer instead of a window" << std::endl
+             << "   --frames n    Exit after n frames. Default with --headless: 1000" << std::endl
+             << "   --trace file  Write a Chrome trace of the frames to file at exit, and on SIGUSR1" << std::endl
+             << "   --isa level   Run the SIMD kernels at one of: " << Compute::CpuDispatch::availableNames() << ". Default: the widest" << std::endl
+             << "   --scaling     Print the frame rate for 1 to 64 threads and 1M to 50M particles, then exit" << std::endl
+             << "   --scaling-report  Print strong and weak scaling of the update and a roofline of the host, then exit" << std::endl;
+}
+
+/**
+ * Program entry point
+ */
+int main(int argc, char* argv[])
+{
+   int width = 1280; // Initial window width
+   int height = 720; // Initial window height
+   _running = true;
+   _numFrames = 0;
+   _zoomMax = 6000;
+   _zoomMin = 1;
+   _zoom = 700;
+   _tracking = false;
+
+   size_t num = 1000000;
+   int numWells = 0;
+   int maxLevel = 0;
+   float lifetime = 0;
+   bool scaling = false;
+   bool scalingReport = false;
+   bool phases = false;
+   bool counters = false;
+   bool memory = false;
+   string traceFile;
+   bool headless = false;
+   unsigned long maxFrames = 0;
+   string integrator = Particles::RK4::name();
+   Particles::Kernel kernel = Particles::SIMD;
+   for(int i = 1; i < argc; ++i)
+   {
+      if(strcmp(argv[i], "--scalar") == 0)
+      {
+         kernel = Particles::SCALAR;
+      }
+      else if(strcmp(argv[i], "--integrator") == 0 && i + 1 < argc)
+      {
+         integrator = argv[++i];
+      }
+      else if(strcmp(argv[i], "--threads") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+      {
+         Compute::ThreadPool::instance().setNumThreads(atoi(argv[++i]));
+      }
+      else if(strcmp(argv[i], "--wells") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+      {
+         numWells = atoi(argv[++i]);
+      }
+      else if(strcmp(argv[i], "--levels") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+      {
+         maxLevel = atoi(argv[++i]);
+      }
+      else if(strcmp(argv[i], "--lifetime") == 0 && i + 1 < argc && atof(argv[i + 1]) > 0)
+      {
+         lifetime = float(atof(argv[++i]));
+      }
+      else if(strcmp(argv[i], "--steps") == 0 && i + 1 < argc && atoi(argv[i + 1]) > 0)
+      {
+         _stepsPerFrame = atoi(argv[++i]);
+      }
+      else if(strcmp(argv[i], "--phases") == 0)
+      {
+         phases = true;
+      }
+      else if(strcmp(argv[i], "--counters") == 0)
+      {
+         phases   = true;
+         counters = true;
+      }
+      else if(strcmp(argv[i], "--memory") == 0)
+      {
+         memory = true;
+      }
+      else if(strcmp(argv[i], "--headless") == 0)
+      {
+         headless = true;
+      }
+      else if(strcmp(argv[i], "--frames") == 0 && i + 1 < argc && atol(argv[i + 1]) > 0)
+      {
+         maxFrames = atol(argv[++i]);
+      }
+      else if(strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+      {
+         traceFile = argv[++i];
+      }
+      else if(strcmp(argv[i], "--isa") == 0 && i + 1 < argc)
+      {
+         Compute::Isa isa;
+         if(!Compute::parseIsa(argv[++i], isa))
+         {
+            usage(argv[0]);
+            return -1;
+         }
+         try
+         {
+            Compute::CpuDispatch::instance().setIsa(isa);
+         }
+         catch (std::runtime_error exception)
+         {
+            std::cerr << exception.what() << std::endl;
+            return -1;
+         }
+      }
+      else if(strcmp(argv[i], "--scaling") == 0)
+      {
+         scaling = true;
+      }
+      else if(strcmp(argv[i], "--scaling-report") == 0)
+      {
+         scalingReport = true;
+      }
+      else if(atol(argv[i]) > 0)
+      {
+         num = atol(argv[i]);
+      }
+      else
+      {
+         usage(argv[0]);
+         return -1;
+      }
+   }
+
+   if(scaling)
+   {
+      vector<unsigned int> threads = { 1, 2, 4, 8, 16, 32, 64 };
+      vector<size_t>       counts  = { 1000000, 5000000, 10000000, 15000000, 25000000, 50000000 };
+      try
+      {
+         runScalingSweep(std::cout, integrator, threads, counts, 20);
+      }
+      catch (std::runtime_error exception)
+      {
+         std::cerr << exception.what() << std::endl;
+         return -1;
+      }
+      return 0;
+   }
+
+   if(scalingReport)
+   {
+      // Powers of two up to the number of hardware threads, and that number
+      vector<unsigned int> threads;
+      unsigned int         maxThreads = Compute::defaultThreadCount();
+      for(unsigned int t = 1; t < maxThreads; t *= 2)
+      {
+         threads.push_back(t);
+      }
+      threads.push_back(maxThreads);
+      try
+      {
+         runScalingReport(std::cout, integrator, num, threads, 20);
+      }
+      catch (std::runtime_error exception)
+      {
+         std::cerr << exception.what() << std::endl;
+         return -1;
+      }
+      return 0;
+   }
+
+   try
+   {
+      _engine = unique_ptr<Particles::ParticleEngineBase>(Particles::createParticleEngine(integrator, num));
+      _engine->setKernel(kernel);
+      if(numWells > 0)
+      {
+         _engine->setWells(ringOfWells(numWells, _engine->getWellMass()));
+      }
+      _engine->setMaxLevel(maxLevel);
+      if(lifetime > 0)
+      {
+         _engine->setEmitters(pointEmitter(num, lifetime));
+      }
+   }
+   catch (std::runtime_error exception)
+   {
+      std::cerr << exception.what() << std::endl;
+      usage(argv[0]);
+      return -1;
+   }
+
+   _trackball = unique_ptr<Trackball>(new Trackball(width, height));
+
+   // Without a window there is no way to quit, so stop after a fixed
+   // number of frames
+   if(headless && maxFrames == 0)
+   {
+      maxFrames = 1000;
+   }
+
+   // Open a window, or with --headless an offscreen pbuffer, and create
+   // its OpenGL context
+   try
+   {
+      _context = unique_ptr<GL::Context>(GL::Context::create(headless ? GL::Context::HEADLESS : GL::Context::WINDOW, width, height));
+   }
+   catch (std::runtime_error exception)
+   {
+      std::cerr << "Failed to create an OpenGL context: " << exception.what() << std::endl;
+      return -1;
+   }
+   resize(width, height);
+
+   _context->setSwapInterval(0);
+   if(!_context->isHeadless())
+   {
+      glfwSetWindowSizeCallback(resize);
+      glfwSetKeyCallback(keypress);
+      glfwSetWindowCloseCallback(close);
+      glfwSetMouseButtonCallback(mouseButton);
+      glfwSetMouseWheelCallback(mouseWheel);
+      glfwSetMousePosCallback(mouseMove);
+   }
+
+   std::cout << "GL Version: " << glGetString(GL_VERSION) << std::endl;
+   std::cout << "Context: " << _context->describe() << std::endl;
+   std::cout << "SIMD width: " << Compute::isaWidth(Compute::CpuDispatch::instance().getIsa())
+             << " (" << Compute::CpuDispatch::instance().describe() << ")" << std::endl;
+   std::cout << "Threads: " << Compute::ThreadPool::instance().getNumThreads() << std::endl;
+   std::cout << "Integrator: " << integrator << std::endl;
+
+   if(phases)
+   {
+      GL::PhaseTimer::instance().enable();
+      if(counters)
+      {
+         std::cout << "Performance counters: " << GL::PhaseTimer::instance().enableCounters() << std::endl;
+      }
+   }
+
+   // Record a timeline of the frames. It is written on exit, and on
+   // SIGUSR1 while the program runs
+   if(!traceFile.empty())
+   {
+      Compute::Tracer::instance().enable(traceFile);
+      Compute::Tracer::instance().installSignalHandler(SIGUSR1);
+   }
+
+   init();
+
+   // Batch runs are where particle counts are chosen, so they always
+   // report the memory the particles took
+   if(memory || headless)
+   {
+      Compute::MemoryRegistry::instance().report(std::cout);
+   }
+
+   _numFrames = 0;
+   _aliveSum  = 0;
+   gettimeofday(&_startTime, NULL);
+
+   // Main loop. Run until ESC key is pressed, the window is closed or
+   // maxFrames frames have been drawn
+   while(_running && (maxFrames == 0 || _numFrames < maxFrames))
+   {
+      Compute::Tracer::instance().poll();
+      update(_context->getTime());
+
+      GL::ScopedPhase timed("swap", false);
+      _context->swapBuffers();
+   }
+   std::cout << "num: " << num << std::endl;
+   framerate(_numFrames);
+   if(phases)
+   {
+      GL::PhaseTimer::instance().report(std::cout);
+   }
+
+   terminate(EXIT_SUCCESS);
+}
@@ -0,0 +1,297 @@
+//--------------------------------------------------------------------------------
+// scaling.cpp
+//
+// Thread scaling sweep of the CPU particle update, run without a window, and
+// a strong and weak scaling and roofline report for sizing hardware.
+//--------------------------------------------------------------------------------
+#include "scaling.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <memory>
+#include <sstream>
+
+#include <counter_rng.h>
+#include <cpu_dispatch.h>
+#include <parallel_for.h>
+#include <roofline.h>
+#include <engine_factory.h>
+
+/*
+ * Bytes of memory traffic per particle and pass of the fixed step kernels:
+ * position and velocity, 6 floats, loaded and stored once
+ */
+static const int bytesPerPass = 2 * 6 * sizeof(float);
+
+/*
+ * Operations of the reset test after every step: r^2 and the comparison
+ */
+static const int resetFlops = 6;
+
+/*
+ * Smallest number of particles for the roofline. The positions and
+ * velocities then take 192 MB, as much as the triad arrays, so neither
+ * fits in the cache
+ */
+static const size_t rooflineParticles = 8 << 20;
+
+/*
+ * Same initial state as the interactive program: every particle starts
+ * above the well with a random direction
+ */
+static void initParticles(Particles::ParticleEngineBase& engine)
+{
+   Compute::Philox rng(1);
+   Particles::ParticleStore& store = engine.getStore();
+
+   Compute::parallelFor(0, engine.getNumParticles(), [&](size_t first, size_t last)
+   {
+      for(size_t i = first; i < last; ++i)
+      {
+         float u[4];
+         rng.uniform4(i, 0, u);
+         float theta = 2 * M_PI * u[0];
+         float phi   = 2 * M_PI * u[1];
+         float r     = 3.51f;
+         store.set(i, 0, 0.1f, 0,
+                   r * cosf(phi) * sinf(theta),
+                   r * sinf(phi) * sinf(theta),
+                   r * cosf(theta));
+      }
+   });
+}
+
+/*
+ * Time the particle update over a grid of thread counts and particle counts
+ */
+void runScalingSweep(std::ostream& out, const std::string& integrator,
+                     const std::vector<unsigned int>& threads,
+                     const std::vector<size_t>& counts, int steps)
+{
+   Compute::ThreadPool& pool = Compute::ThreadPool::instance();
+   unsigned int defaultThreads = pool.getNumThreads();
+
+   out << "% Frames per second of the CPU update, " << integrator << ", SIMD width "
+       << Compute::isaWidth(Compute::CpuDispatch::instance().getIsa()) << ", " << Compute::defaultThreadCount() << " hardware threads" << std::endl;
+   out << "Particles";
+   for(size_t t = 0; t < threads.size(); ++t)
+   {
+      out << "\t& " << threads[t] << (threads[t] == 1 ? " thread" : " threads");
+   }
+   out << " \\\\" << std::endl << "\\hline" << std::endl;
+
+   for(size_t c = 0; c < counts.size(); ++c)
+   {
+      std::unique_ptr<Particles::ParticleEngineBase> engine(Particles::createParticleEngine(integrator, counts[c]));
+      initParticles(*engine);
+
+      out << counts[c] / 1e6;
+      for(size_t t = 0; t < threads.size(); ++t)
+      {
+         pool.setNumThreads(threads[t]);
+         engine->update();
+
+         std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+         for(int s = 0; s < steps; ++s)
+         {
+            engine->update();
+         }
+         std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+         out << "\t& " << std::setprecision(3) << steps / elapsed.count() << std::flush;
+      }
+      out << " \\\\" << std::endl;
+   }
+
+   pool.setNumThreads(defaultThreads);
+}
+
+/*
+ * Floating point operations per particle and step of the SIMD kernel with
+ * the central well, or 0 for integrators without a fixed count
+ */
+template<typename Integrator>
+static int flopsPerStep()
+{
+   return Integrator::flops + Integrator::forceEvaluations * Particles::CentralWell<Compute::floatv>::flops + resetFlops;
+}
+
+static int flopsPerStep(const std::string& integrator)
+{
+   if(integrator == Particles::RK4::name())
+   {
+      return flopsPerStep<Particles::RK4>();
+   }
+   if(integrator == Particles::Leapfrog::name())
+   {
+      return flopsPerStep<Particles::Leapfrog>();
+   }
+   if(integrator == Particles::Yoshida4::name())
+   {
+      return flopsPerStep<Particles::Yoshida4>();
+   }
+   return 0;
+}
+
+/*
+ * Seconds per time step of engine->update(stepsPerPass), averaged over
+ * passes after one warm-up pass
+ */
+static double secondsPerStep(Particles::ParticleEngineBase& engine, int stepsPerPass, int passes)
+{
+   engine.update(stepsPerPass);
+
+   std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+   for(int p = 0; p < passes; ++p)
+   {
+      engine.update(stepsPerPass);
+   }
+   std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+   return elapsed.count() / (double(passes) * stepsPerPass);
+}
+
+/*
+ * Format a rate in units of 1e9, or "-" if it is not known
+ */
+static std::string giga(double rate)
+{
+   if(rate <= 0)
+   {
+      return "-";
+   }
+   std::ostringstream str;
+   str << std::fixed << std::setprecision(1) << rate * 1e-9;
+   return str.str();
+}
+
+/*
+ * Strong and weak scaling of one integrator, then the roofline of all the
+ * fixed step integrators
+ */
+void runScalingReport(std::ostream& out, const std::string& integrator, size_t numParticles,
+                      const std::vector<unsigned int>& threads, int steps)
+{
+   using std::setw;
+
+   Compute::ThreadPool& pool = Compute::ThreadPool::instance();
+   unsigned int defaultThreads = pool.getNumThreads();
+   unsigned int maxThreads     = *std::max_element(threads.begin(), threads.end());
+   int          flops          = flopsPerStep(integrator);
+
+   out << "Host: " << Compute::defaultThreadCount() << " hardware threads, SIMD width "
+       << Compute::isaWidth(Compute::CpuDispatch::instance().getIsa()) << " (" << Compute::CpuDispatch::instance().describe() << ")" << std::endl;
+   if(flops > 0)
+   {
+      out << integrator << ": " << flops << " flops and " << bytesPerPass << " bytes per particle and step" << std::endl;
+   }
+
+   // Strong scaling: the same problem on more threads
+   out << std::endl << "Strong scaling, " << integrator << ", " << numParticles << " particles" << std::endl;
+   out << setw(8) << "Threads" << setw(12) << "ms/step" << setw(10) << "Speedup" << setw(12) << "Efficiency"
+       << setw(10) << "GFLOP/s" << setw(8) << "GB/s" << setw(12) << "Triad GB/s" << std::endl;
+   {
+      std::unique_ptr<Particles::ParticleEngineBase> engine(Particles::createParticleEngine(integrator, numParticles));
+      initParticles(*engine);
+
+      double oneThread = 0;
+      for(size_t t = 0; t < threads.size(); ++t)
+      {
+         pool.setNumThreads(threads[t]);
+         double seconds = secondsPerStep(*engine, 1, steps);
+         double triad   = Compute::measureTriadBandwidth();
+         if(t == 0)
+         {
+            oneThread = seconds * threads[0];
+         }
+
+         double speedup = oneThread / seconds;
+         out << setw(8) << threads[t] << std::fixed << std::setprecision(2)
+             << setw(12) << seconds * 1e3
+             << setw(10) << speedup
+             << setw(11) << 100 * speedup / threads[t] << "%"
+             << setw(10) << giga(double(flops) * numParticles / seconds)
+             << setw(8) << giga(flops > 0 ? double(bytesPerPass) * numParticles / seconds : 0)
+             << setw(12) << giga(triad) << std::endl;
+      }
+   }
+
+   // Weak scaling: the same problem per thread, ending at the strong
+   // scaling size
+   size_t perThread = std::max<size_t>(1, numParticles / maxThreads);
+   out << std::endl << "Weak scaling, " << integrator << ", " << perThread << " particles per thread" << std::endl;
+   out << setw(8) << "Threads" << setw(12) << "Particles" << setw(12) << "ms/step" << setw(12) << "Efficiency"
+       << setw(10) << "GFLOP/s" << setw(8) << "GB/s" << std::endl;
+   {
+      double oneThread = 0;
+      for(size_t t = 0; t < threads.size(); ++t)
+      {
+         size_t count = perThread * threads[t];
+         std::unique_ptr<Particles::ParticleEngineBase> engine(Particles::createParticleEngine(integrator, count));
+         initParticles(*engine);
+
+         pool.setNumThreads(threads[t]);
+         double seconds = secondsPerStep(*engine, 1, steps);
+         if(t == 0)
+         {
+            oneThread = seconds;
+         }
+
+         out << setw(8) << threads[t] << setw(12) << count << std::fixed << std::setprecision(2)
+             << setw(12) << seconds * 1e3
+             << setw(11) << 100 * oneThread / seconds << "%"
+             << setw(10) << giga(double(flops) * count / seconds)
+             << setw(8) << giga(flops > 0 ? double(bytesPerPass) * count / seconds : 0) << std::endl;
+      }
+   }
+
+   // Roofline of the whole machine. More steps per pass divide the memory
+   // traffic per step, which moves a kernel to the right
+   numParticles = std::max(numParticles, rooflineParticles);
+   pool.setNumThreads(maxThreads);
+   double triad     = Compute::measureTriadBandwidth();
+   double update    = Compute::measureUpdateBandwidth();
+   double bandwidth = std::max(triad, update);
+   double peak      = Compute::measurePeakFlops();
+   double ridge     = peak / bandwidth;
+   out << std::endl << "Roofline, " << maxThreads << (maxThreads == 1 ? " thread" : " threads") << ", " << numParticles << " particles" << std::endl
+       << "   Bandwidth " << giga(bandwidth) << " GB/s (triad " << giga(triad) << ", in-place update " << giga(update)
+       << "), peak " << giga(peak) << " GFLOP/s, ridge point " << std::setprecision(2) << ridge << " flop/byte" << std::endl;
+
+   // The peak is measured with the floatv the program was compiled for,
+   // which is narrower than the dispatched kernels with CPU_DISPATCH
+   if(Compute::CpuDispatch::instance().getIsa() != Compute::floatv::isa)
+   {
+      out << "   The peak is measured at " << Compute::isaName(Compute::Isa(Compute::floatv::isa)) << ", the kernels run at "
+          << Compute::isaName(Compute::CpuDispatch::instance().getIsa()) << "; configure with NATIVE_ARCH for a matching roof" << std::endl;
+   }
+   out << setw(10) << "Kernel" << setw(12) << "Steps/pass" << setw(11) << "Flop/byte" << setw(10) << "GFLOP/s"
+       << setw(14) << "Roof GFLOP/s" << setw(10) << "Of roof" << setw(9) << "Bound" << std::endl;
+
+   const char* integrators[] = { Particles::RK4::name(), Particles::Leapfrog::name(), Particles::Yoshida4::name() };
+   const int   stepsPerPass[] = { 1, 16 };
+   for(size_t i = 0; i < sizeof(integrators) / sizeof(integrators[0]); ++i)
+   {
+      std::unique_ptr<Particles::ParticleEngineBase> engine(Particles::createParticleEngine(integrators[i], numParticles));
+      initParticles(*engine);
+      int kernelFlops = flopsPerStep(integrators[i]);
+
+      for(size_t k = 0; k < sizeof(stepsPerPass) / sizeof(stepsPerPass[0]); ++k)
+      {
+         double seconds   = secondsPerStep(*engine, stepsPerPass[k], std::max(1, steps / stepsPerPass[k]));
+         double intensity = double(kernelFlops) * stepsPerPass[k] / bytesPerPass;
+         double achieved  = double(kernelFlops) * numParticles / seconds;
+         double roof      = Compute::attainableFlops(intensity, peak, bandwidth);
+
+         out << setw(10) << integrators[i] << setw(12) << stepsPerPass[k] << std::fixed << std::setprecision(2)
+             << setw(11) << intensity
+             << setw(10) << giga(achieved)
+             << setw(14) << giga(roof)
+             << setw(9) << 100 * achieved / roof << "%"
+             << setw(9) << (intensity < ridge ? "memory" : "compute") << std::endl;
+      }
+   }
+
+   pool.setNumThreads(defaultThreads);
+}
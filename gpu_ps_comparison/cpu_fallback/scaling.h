@@ -0,0 +1,69 @@
+//--------------------------------------------------------------------------------
+// scaling.h
+//
+// Thread scaling sweep of the CPU particle update, run without a window, and
+// a strong and weak scaling and roofline report for sizing hardware.
+//--------------------------------------------------------------------------------
+#ifndef _scaling_h
+#define _scaling_h
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/**
+ * Time the particle update for every combination of thread count and number
+ * of particles and print frames (steps) per second as LaTeX table rows, in
+ * the same units as the GPU table in doc/comparison.tex
+ *
+ * @param out
+ *    Stream for the table
+ * @param integrator
+ *    Integration scheme, see Particles::createParticleEngine()
+ * @param threads
+ *    Thread counts to test, one column each
+ * @param counts
+ *    Numbers of particles to test, one row each
+ * @param steps
+ *    Timed steps per measurement, after one warm-up step
+ */
+void runScalingSweep(std::ostream& out, const std::string& integrator,
+                     const std::vector<unsigned int>& threads,
+                     const std::vector<size_t>& counts, int steps);
+
+/**
+ * Print a plain text report of how the particle update scales and what
+ * limits it:
+ *
+ *    Strong scaling  numParticles particles on each thread count: time per
+ *                    step, speedup and efficiency against one thread, the
+ *                    flop rate and memory traffic reached, and the STREAM
+ *                    triad bandwidth of the same threads for comparison
+ *    Weak scaling    numParticles / max(threads) particles per thread, so
+ *                    the largest run matches the strong scaling size
+ *    Roofline        bandwidth (the higher of the STREAM triad and an
+ *                    in-place update) and peak multiply-add rate of all
+ *                    threads, and every fixed step integrator at 1 and 16
+ *                    steps per pass placed against them, with at least 8M
+ *                    particles so that the state does not fit in the cache
+ *
+ * Flop rates are only given for integrators with a known operation count
+ * per step (rk4, leapfrog and yoshida4 with the central well)
+ *
+ * @param out
+ *    Stream for the report
+ * @param integrator
+ *    Integration scheme for the scaling tables, see
+ *    Particles::createParticleEngine()
+ * @param numParticles
+ *    Strong scaling size, also used for the roofline
+ * @param threads
+ *    Thread counts to test, in increasing order
+ * @param steps
+ *    Timed passes per measurement, after one warm-up pass
+ */
+void runScalingReport(std::ostream& out, const std::string& integrator, size_t numParticles,
+                      const std::vector<unsigned int>& threads, int steps);
+
+#endif
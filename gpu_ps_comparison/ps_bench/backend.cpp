@@ -0,0 +1,144 @@
+//--------------------------------------------------------------------------------
+// backend.cpp
+//
+// Backend registry, the shared initial state and the CPU backends.
+//--------------------------------------------------------------------------------
+#include "backend.h"
+
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+
+#include <counter_rng.h>
+#include <parallel_for.h>
+#include <particle_engine.h>
+
+namespace
+{
+   /**
+    * The CPU fallback's update: the structure-of-arrays RK4 kernel, then the
+    * positions interleaved as xyzw the way they are written into the vertex
+    * buffer
+    */
+   class CpuBackend : public Backend
+   {
+   public:
+      /**
+       * Constructor
+       *
+       * @param kernel
+       *    Scalar or SIMD kernel
+       * @param numThreads
+       *    Worker threads to update on
+       */
+      CpuBackend(Particles::Kernel kernel, unsigned int numThreads)
+      :  _kernel     (kernel)
+      ,  _numThreads (numThreads)
+      {
+      }
+
+      virtual size_t init(size_t numParticles)
+      {
+         Compute::ThreadPool::instance().setNumThreads(_numThreads);
+
+         _engine = std::unique_ptr<Particles::ParticleEngine<> >(new Particles::ParticleEngine<>(numParticles));
+         _engine->setKernel(_kernel);
+         _xyzw.assign(4 * numParticles, 0.0f);
+
+         Particles::ParticleStore& store = _engine->getStore();
+         Compute::parallelFor(0, numParticles, [&](size_t first, size_t last)
+         {
+            for(size_t i = first; i < last; ++i)
+            {
+               float pos[4], vel[4];
+               initialState(i, pos, vel);
+               store.set(i, pos[0], pos[1], pos[2], vel[0], vel[1], vel[2]);
+            }
+         });
+         return numParticles;
+      }
+
+      virtual void step()
+      {
+         _engine->update();
+         _engine->getStore().interleavePositions(&_xyzw[0], 0, _engine->getNumParticles());
+      }
+
+      virtual void finish()
+      {
+      }
+
+      virtual void positions(std::vector<float>& xyzw)
+      {
+         xyzw.resize(4 * _engine->getNumParticles());
+         _engine->getStore().interleavePositions(&xyzw[0], 0, _engine->getNumParticles());
+      }
+
+   private:
+      Particles::Kernel                                 _kernel;       //< Kernel used by the engine
+      unsigned int                                      _numThreads;   //< Threads in the pool while this backend runs
+      std::unique_ptr<Particles::ParticleEngine<> >     _engine;       //< Particle state
+      std::vector<float>                                _xyzw;         //< Stand-in for the mapped vertex buffer
+   };
+}
+
+std::vector<std::string> backendNames()
+{
+   std::vector<std::string> names;
+   names.push_back("copy-to-pbo");
+   names.push_back("transform-feedback");
+   names.push_back("vertex-texture-fetch");
+   names.push_back("cpu-scalar");
+   names.push_back("cpu-simd");
+   names.push_back("cpu-threaded");
+   return names;
+}
+
+bool isGLBackend(const std::string& name)
+{
+   return name == "copy-to-pbo" || name == "transform-feedback" || name == "vertex-texture-fetch";
+}
+
+Backend* createBackend(const std::string& name, unsigned int numThreads)
+{
+   if(isGLBackend(name))
+   {
+      return createGLBackend(name);
+   }
+   if(name == "cpu-scalar")
+   {
+      return new CpuBackend(Particles::SCALAR, 1);
+   }
+   if(name == "cpu-simd")
+   {
+      return new CpuBackend(Particles::SIMD, 1);
+   }
+   if(name == "cpu-threaded")
+   {
+      return new CpuBackend(Particles::SIMD, numThreads > 0 ? numThreads : Compute::defaultThreadCount());
+   }
+   throw std::runtime_error("Unknown backend: " + name);
+}
+
+void initialState(size_t i, float pos[4], float vel[4])
+{
+   static const Compute::Philox rng(1);
+
+   // Define the velocity in terms of polar coordinates
+   float u[4];
+   rng.uniform4(i, 0, u);
+   float theta = 2 * M_PI * u[0];
+   float phi   = 2 * M_PI * u[1];
+   float r     = 3.51f;
+
+   vel[0] = r * cosf(phi) * sinf(theta);
+   vel[1] = r * sinf(phi) * sinf(theta);
+   vel[2] = r * cosf(theta);
+   vel[3] = 0;
+
+   // All particles start from a position directly above the gravity well
+   pos[0] = 0;
+   pos[1] = 0.1f;
+   pos[2] = 0;
+   pos[3] = 1;
+}
@@ -0,0 +1,97 @@
+//--------------------------------------------------------------------------------
+// backend.h
+//
+// Particle update methods timed by ps_bench: the three OpenGL methods of the
+// comparison and the CPU fallback. Every backend starts from the same
+// initial state as the interactive programs and advances the particles one
+// RK4 step per call to step().
+//--------------------------------------------------------------------------------
+#ifndef _backend_h
+#define _backend_h
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+/**
+ * One way of updating the particles
+ */
+class Backend
+{
+public:
+   /**
+    * Destructor. Releases the particle data and any GL objects
+    */
+   virtual ~Backend()
+   {
+   }
+
+   /**
+    * Create the particles in their initial state
+    *
+    * @param numParticles
+    *    Requested number of particles
+    * @return the number of particles created. The texture based methods
+    *    round down to a square
+    */
+   virtual size_t init(size_t numParticles) = 0;
+
+   /**
+    * Advance every particle one time step and make the new positions
+    * available for drawing. May return before the work is done
+    */
+   virtual void step() = 0;
+
+   /**
+    * Wait until the work of every step() so far is done
+    */
+   virtual void finish() = 0;
+
+   /**
+    * Read back the current positions, for --validate
+    *
+    * @param xyzw
+    *    Gets xyzw of every particle, in the order of initialState()
+    */
+   virtual void positions(std::vector<float>& xyzw) = 0;
+};
+
+/**
+ * @return the names of every backend, in the order they are run by default
+ */
+std::vector<std::string> backendNames();
+
+/**
+ * @return true if the backend needs a current OpenGL 3.2 context
+ */
+bool isGLBackend(const std::string& name);
+
+/**
+ * Create a backend. GL backends need a current context
+ *
+ * @param name
+ *    One of backendNames()
+ * @param numThreads
+ *    Worker threads for cpu-threaded. 0 uses the thread pool's setting
+ * @return a new backend, owned by the caller. Throws std::runtime_error for
+ *    unknown names
+ */
+Backend* createBackend(const std::string& name, unsigned int numThreads);
+
+/**
+ * Create one of the OpenGL backends, see gl_backends.cpp
+ *
+ * @return a new backend, or NULL if name is not a GL backend
+ */
+Backend* createGLBackend(const std::string& name);
+
+/**
+ * Initial state of particle i, as in the interactive programs: directly
+ * above the well, moving at 3.51 m/s in a random direction
+ *
+ * @param pos, vel
+ *    xyzw of the position (w = 1) and the velocity (w = 0)
+ */
+void initialState(size_t i, float pos[4], float vel[4]);
+
+#endif
@@ -0,0 +1,287 @@
+//--------------------------------------------------------------------------------
+// gate.cpp
+//
+// Baseline files and the bootstrap comparison of the regression gate.
+//
+// A baseline file is plain text:
+//
+//    ps_bench baseline 1
+//    machine <machineName()>
+//    run <backend> <particles> <median ns of each repetition ...>
+//--------------------------------------------------------------------------------
+#include "gate.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <stdexcept>
+
+#include <unistd.h>
+
+#include <counter_rng.h>
+#include <cpu_dispatch.h>
+#include <thread_pool.h>
+
+/*
+ * @return the host name, or "localhost" if it is not known
+ */
+static std::string hostName()
+{
+   char name[256] = { 0 };
+   if(gethostname(name, sizeof(name) - 1) != 0 || name[0] == 0)
+   {
+      return "localhost";
+   }
+   return name;
+}
+
+/*
+ * @return the CPU model from /proc/cpuinfo, or "unknown CPU"
+ */
+static std::string cpuModel()
+{
+   std::ifstream in("/proc/cpuinfo");
+   std::string   line;
+   while(std::getline(in, line))
+   {
+      if(line.compare(0, 10, "model name") == 0 && line.find(':') != std::string::npos)
+      {
+         return line.substr(line.find_first_not_of(" \t", line.find(':') + 1));
+      }
+   }
+   return "unknown CPU";
+}
+
+/*
+ * Mean of values
+ */
+static double mean(const std::vector<double>& values)
+{
+   double sum = 0;
+   for(size_t i = 0; i < values.size(); ++i)
+   {
+      sum += values[i];
+   }
+   return values.empty() ? 0 : sum / values.size();
+}
+
+/*
+ * Mean of values.size() values drawn with replacement. Draw d of resample
+ * r uses counter (r, d) of stream, so the intervals are reproducible
+ */
+static double resampledMean(const std::vector<double>& values, const Compute::Philox& rng, uint32_t stream, uint64_t r)
+{
+   double sum = 0;
+   for(size_t d = 0; d < values.size(); ++d)
+   {
+      uint32_t bits[4];
+      rng.random4((r << 20) | d, stream, bits);
+      sum += values[bits[0] % values.size()];
+   }
+   return sum / values.size();
+}
+
+std::string machineName()
+{
+   std::ostringstream name;
+   name << hostName() << ", " << cpuModel() << ", " << Compute::defaultThreadCount() << " threads, SIMD width "
+        << Compute::isaWidth(Compute::CpuDispatch::instance().getIsa());
+   return name.str();
+}
+
+std::string baselineFile(const std::string& dir)
+{
+   // Keep the name usable as a file name whatever the host is called
+   std::string host = hostName();
+   for(size_t i = 0; i < host.size(); ++i)
+   {
+      if(!isalnum(static_cast<unsigned char>(host[i])) && host[i] != '-' && host[i] != '.')
+      {
+         host[i] = '_';
+      }
+   }
+   return dir + "/" + host + ".baseline";
+}
+
+void writeBaseline(std::ostream& out, const std::string& machine, const std::vector<Run>& runs)
+{
+   // Repetitions of the same backend and count go on one line, in the
+   // order the backends and counts first ran
+   std::vector<Baseline::Key>                    order;
+   std::map<Baseline::Key, std::vector<double> > medians;
+   for(size_t r = 0; r < runs.size(); ++r)
+   {
+      Baseline::Key key(runs[r].backend, runs[r].particles);
+      if(medians.find(key) == medians.end())
+      {
+         order.push_back(key);
+      }
+      medians[key].push_back(summarize(runs[r].stepNs).p50);
+   }
+
+   out << "ps_bench baseline 1" << std::endl;
+   out << "machine " << machine << std::endl;
+   out << std::fixed << std::setprecision(1);
+   for(size_t k = 0; k < order.size(); ++k)
+   {
+      const std::vector<double>& m = medians[order[k]];
+      out << "run " << order[k].first << " " << order[k].second;
+      for(size_t i = 0; i < m.size(); ++i)
+      {
+         out << " " << m[i];
+      }
+      out << std::endl;
+   }
+   out.unsetf(std::ios::floatfield);
+}
+
+Baseline readBaseline(const std::string& filename)
+{
+   std::ifstream in(filename.c_str());
+   if(!in)
+   {
+      throw std::runtime_error("Unable to read baseline " + filename);
+   }
+
+   std::string line;
+   if(!std::getline(in, line) || line != "ps_bench baseline 1")
+   {
+      throw std::runtime_error(filename + " is not a ps_bench baseline");
+   }
+
+   Baseline baseline;
+   while(std::getline(in, line))
+   {
+      if(line.compare(0, 8, "machine ") == 0)
+      {
+         baseline.machine = line.substr(8);
+      }
+      else if(line.compare(0, 4, "run ") == 0)
+      {
+         std::istringstream fields(line.substr(4));
+         Baseline::Key       key;
+         double              median;
+         if(!(fields >> key.first >> key.second))
+         {
+            throw std::runtime_error("Bad run in baseline " + filename + ": " + line);
+         }
+         std::vector<double>& medians = baseline.medians[key];
+         while(fields >> median)
+         {
+            medians.push_back(median);
+         }
+         if(medians.empty())
+         {
+            throw std::runtime_error("Run without times in baseline " + filename + ": " + line);
+         }
+      }
+   }
+   return baseline;
+}
+
+std::vector<Comparison> compare(const Baseline& baseline, const std::vector<Run>& runs,
+                                double confidence, double tolerance, int resamples)
+{
+   std::vector<Baseline::Key>                    order;
+   std::map<Baseline::Key, std::vector<double> > current;
+   for(size_t r = 0; r < runs.size(); ++r)
+   {
+      Baseline::Key key(runs[r].backend, runs[r].particles);
+      if(current.find(key) == current.end())
+      {
+         order.push_back(key);
+      }
+      current[key].push_back(summarize(runs[r].stepNs).p50);
+   }
+
+   Compute::Philox         rng(1);
+   std::vector<Comparison> comparisons;
+   for(size_t k = 0; k < order.size(); ++k)
+   {
+      const std::vector<double>& now = current[order[k]];
+
+      Comparison c;
+      c.backend   = order[k].first;
+      c.particles = order[k].second;
+      c.currentNs = mean(now);
+
+      std::map<Baseline::Key, std::vector<double> >::const_iterator base = baseline.medians.find(order[k]);
+      if(base == baseline.medians.end())
+      {
+         c.baselineNs = 0;
+         c.ratio      = 0;
+         c.low        = 0;
+         c.high       = 0;
+         c.verdict    = Comparison::NEW;
+         comparisons.push_back(c);
+         continue;
+      }
+
+      const std::vector<double>& before = base->second;
+      c.baselineNs = mean(before);
+      c.ratio      = c.currentNs / c.baselineNs;
+
+      std::vector<double> ratios(resamples);
+      for(int r = 0; r < resamples; ++r)
+      {
+         ratios[r] = resampledMean(now, rng, 2 * uint32_t(k), r) / resampledMean(before, rng, 2 * uint32_t(k) + 1, r);
+      }
+      std::sort(ratios.begin(), ratios.end());
+      double alpha = 1 - confidence;
+      size_t lowIndex  = size_t(floor(0.5 * alpha * (resamples - 1)));
+      size_t highIndex = size_t(ceil((1 - 0.5 * alpha) * (resamples - 1)));
+      c.low  = ratios[lowIndex];
+      c.high = ratios[highIndex];
+
+      if(c.low > 1 + tolerance)
+      {
+         c.verdict = Comparison::SLOWER;
+      }
+      else if(c.high < 1 - tolerance)
+      {
+         c.verdict = Comparison::FASTER;
+      }
+      else
+      {
+         c.verdict = Comparison::UNCHANGED;
+      }
+      comparisons.push_back(c);
+   }
+   return comparisons;
+}
+
+void writeComparison(std::ostream& out, const std::vector<Comparison>& comparisons, double confidence)
+{
+   const char* verdicts[] = { "unchanged", "faster", "SLOWER", "new" };
+
+   out << "Step time against the baseline, " << confidence * 100 << "% confidence interval of the change" << std::endl;
+   out << std::left << std::setw(22) << "backend" << std::right << std::setw(10) << "particles"
+       << std::setw(14) << "baseline ms" << std::setw(12) << "current ms" << std::setw(10) << "change"
+       << std::setw(22) << "interval" << "  " << "verdict" << std::endl;
+   out << std::fixed;
+   for(size_t i = 0; i < comparisons.size(); ++i)
+   {
+      const Comparison& c = comparisons[i];
+      out << std::left << std::setw(22) << c.backend << std::right << std::setw(10) << c.particles;
+      if(c.verdict == Comparison::NEW)
+      {
+         out << std::setw(14) << "-" << std::setw(12) << std::setprecision(3) << c.currentNs * 1e-6
+             << std::setw(10) << "-" << std::setw(22) << "-";
+      }
+      else
+      {
+         std::ostringstream interval;
+         interval << std::fixed << std::setprecision(1) << std::showpos
+                  << "[" << (c.low - 1) * 100 << "%, " << (c.high - 1) * 100 << "%]";
+         std::ostringstream change;
+         change << std::fixed << std::setprecision(1) << std::showpos << (c.ratio - 1) * 100 << "%";
+         out << std::setw(14) << std::setprecision(3) << c.baselineNs * 1e-6 << std::setw(12) << c.currentNs * 1e-6
+             << std::setw(10) << change.str() << std::setw(22) << interval.str();
+      }
+      out << "  " << verdicts[c.verdict] << std::endl;
+   }
+   out.unsetf(std::ios::floatfield);
+}
@@ -0,0 +1,103 @@
+//--------------------------------------------------------------------------------
+// gate.h
+//
+// Regression gate: stores the step times of a set of ps_bench runs as the
+// baseline of a machine, and later compares new runs against it. Each run is
+// repeated, the comparison bootstraps a confidence interval for the change in
+// step time, and only a change whose whole interval lies beyond the tolerance
+// counts, so noise alone does not fail the gate.
+//--------------------------------------------------------------------------------
+#ifndef _gate_h
+#define _gate_h
+
+#include <cstddef>
+#include <map>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "report.h"
+
+/**
+ * Median step time of every repetition of every backend and count, as
+ * stored in a baseline file
+ */
+struct Baseline
+{
+   typedef std::pair<std::string, size_t> Key;   //< Backend and particle count
+
+   std::string                          machine;   //< machineName() where it was recorded
+   std::map<Key, std::vector<double> >  medians;   //< Median step time in ns of each repetition
+};
+
+/**
+ * Result of comparing one backend and count against the baseline
+ */
+struct Comparison
+{
+   enum Verdict
+   {
+      UNCHANGED,   //< The interval reaches into the tolerance
+      FASTER,      //< Faster by more than the tolerance
+      SLOWER,      //< Slower by more than the tolerance
+      NEW          //< Not in the baseline
+   };
+
+   std::string backend;      //< Backend name
+   size_t      particles;    //< Particles updated
+   double      baselineNs;   //< Mean of the baseline's repetition medians
+   double      currentNs;    //< Mean of the current repetition medians
+   double      ratio;        //< currentNs / baselineNs
+   double      low;          //< Lower end of the confidence interval of the ratio
+   double      high;         //< Upper end of the confidence interval of the ratio
+   Verdict     verdict;
+};
+
+/**
+ * @return a description of this machine: host name, CPU model, hardware
+ *    threads and the SIMD width the CPU kernels run at. Baselines only
+ *    apply to the machine they were recorded on, and to the same --isa
+ */
+std::string machineName();
+
+/**
+ * @return a file name for the baseline of this machine in directory dir
+ */
+std::string baselineFile(const std::string& dir);
+
+/**
+ * Write the median step time of every run as a baseline
+ */
+void writeBaseline(std::ostream& out, const std::string& machine, const std::vector<Run>& runs);
+
+/**
+ * Read a baseline written by writeBaseline(). Throws std::runtime_error if
+ * the file cannot be read or is not a baseline
+ */
+Baseline readBaseline(const std::string& filename);
+
+/**
+ * Compare runs against a baseline. For every backend and count the
+ * repetition medians of both sides are resampled with replacement, and the
+ * ratio of their means over all resamples gives a percentile confidence
+ * interval
+ *
+ * @param confidence
+ *    Confidence level of the interval, e.g. 0.95
+ * @param tolerance
+ *    Relative change that is accepted, e.g. 0.05. A run is SLOWER if the
+ *    lower end of the interval is above 1 + tolerance, and FASTER if the
+ *    upper end is below 1 - tolerance
+ * @param resamples
+ *    Number of bootstrap resamples
+ */
+std::vector<Comparison> compare(const Baseline& baseline, const std::vector<Run>& runs,
+                                double confidence, double tolerance, int resamples);
+
+/**
+ * Write a table of the comparisons
+ */
+void writeComparison(std::ostream& out, const std::vector<Comparison>& comparisons, double confidence);
+
+#endif
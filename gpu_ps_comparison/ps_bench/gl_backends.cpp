@@ -0,0 +1,432 @@
+//--------------------------------------------------------------------------------
+// gl_backends.cpp
+//
+// The three OpenGL update methods of the comparison, with the shaders of the
+// interactive programs:
+//
+//    copy-to-pbo           RK4 in a fragment shader into a pair of float
+//                          textures, then glReadPixels into the vertex buffer
+//    vertex-texture-fetch  The same update; the render shader reads the
+//                          positions from the texture, so there is no copy
+//    transform-feedback    RK4 in a vertex shader, written straight into the
+//                          next pair of vertex buffers
+//
+// Only the update is timed. Drawing the points costs the same for every
+// method apart from the vertex texture fetch.
+//--------------------------------------------------------------------------------
+#include "backend.h"
+
+#include <cmath>
+#include <memory>
+#include <stdexcept>
+
+#include <opengl.h>
+#include <shader.h>
+#include <gl_memory.h>
+#include <memory_accounting.h>
+
+namespace
+{
+   /**
+    * Update in a fragment shader. The state is a pair of RGBA float
+    * textures, position and velocity, ping-ponged between two FBOs
+    */
+   class TextureBackend : public Backend
+   {
+   public:
+      /**
+       * Constructor
+       *
+       * @param shaderDir
+       *    Directory with the program's update_vert.c and update_frag.c
+       */
+      explicit TextureBackend(const std::string& shaderDir)
+      :  _side        (0)
+      ,  _shaderDir   (shaderDir)
+      ,  _src         (0)
+      ,  _quadVAO     (0)
+      ,  _quadBuf     (0)
+      ,  _memory      ("TextureBackend")
+      {
+         for(int i = 0; i < 2; ++i)
+         {
+            _posTex[i] = _velTex[i] = _fbo[i] = 0;
+         }
+      }
+
+      virtual ~TextureBackend()
+      {
+         release();
+      }
+
+      virtual size_t init(size_t numParticles)
+      {
+         release();
+
+         _updateProg = std::unique_ptr<GL::Program>(new GL::Program(_shaderDir + "/update_vert.c", _shaderDir + "/update_frag.c"));
+
+         // The particles fill a square texture
+         _side = size_t(sqrt(double(numParticles)));
+         size_t count = _side * _side;
+         std::vector<float> pos(4 * count), vel(4 * count);
+         for(size_t i = 0; i < count; ++i)
+         {
+            initialState(i, &pos[4 * i], &vel[4 * i]);
+         }
+
+         glGenTextures(2, _posTex);
+         glGenTextures(2, _velTex);
+         glGenFramebuffers(2, _fbo);
+         for(int id = 0; id < 2; ++id)
+         {
+            createTexture(_posTex[id], id == 0 ? &pos[0] : NULL);
+            createTexture(_velTex[id], id == 0 ? &vel[0] : NULL);
+
+            glBindFramebuffer(GL_FRAMEBUFFER, _fbo[id]);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, _posTex[id], 0);
+            glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, _velTex[id], 0);
+            GLenum drawBuffers[2] = { GL_COLOR_ATTACHMENT0, GL_COLOR_ATTACHMENT1 };
+            glDrawBuffers(2, drawBuffers);
+            glReadBuffer(GL_COLOR_ATTACHMENT0);
+            if(glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+            {
+               throw std::runtime_error("Particle framebuffer is incomplete");
+            }
+         }
+         glBindFramebuffer(GL_FRAMEBUFFER, 0);
+         glBindTexture(GL_TEXTURE_2D, 0);
+
+         // Quad that covers the whole state texture: positions, then texcoords
+         const float quad[24] =
+         {
+            -1, -1, 0, 1,   -1,  1, 0, 1,   1, -1, 0, 1,   1,  1, 0, 1,
+             0,  0,         0,  1,          1,  0,         1,  1
+         };
+         glGenVertexArrays(1, &_quadVAO);
+         glGenBuffers(1, &_quadBuf);
+         glBindVertexArray(_quadVAO);
+         glBindBuffer(GL_ARRAY_BUFFER, _quadBuf);
+         glBufferData(GL_ARRAY_BUFFER, sizeof(quad), quad, GL_STATIC_DRAW);
+         glVertexAttribPointer(_updateProg->getAttribLocation("pos"), 4, GL_FLOAT, GL_FALSE, 0, NULL);
+         glEnableVertexAttribArray(_updateProg->getAttribLocation("pos"));
+         glVertexAttribPointer(_updateProg->getAttribLocation("texcoord"), 2, GL_FLOAT, GL_FALSE, 0, (GLvoid*)(16 * sizeof(float)));
+         glEnableVertexAttribArray(_updateProg->getAttribLocation("texcoord"));
+         glBindVertexArray(0);
+         glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+         _memory.setDevice(GL::textureBytes(_posTex[0]) + GL::textureBytes(_posTex[1]) +
+                           GL::textureBytes(_velTex[0]) + GL::textureBytes(_velTex[1]) + GL::bufferBytes(_quadBuf));
+
+         _src = 0;
+         initOutput(count);
+         GL_ERR_CHECK();
+         return count;
+      }
+
+      virtual void step()
+      {
+         unsigned int dst = _src ^ 1;
+
+         glDisable(GL_BLEND);
+         glViewport(0, 0, GLsizei(_side), GLsizei(_side));
+         glBindFramebuffer(GL_FRAMEBUFFER, _fbo[dst]);
+         _updateProg->bind();
+
+         glActiveTexture(GL_TEXTURE0);
+         glBindTexture(GL_TEXTURE_2D, _posTex[_src]);
+         _updateProg->setUniform("inPos", 0);
+         glActiveTexture(GL_TEXTURE1);
+         glBindTexture(GL_TEXTURE_2D, _velTex[_src]);
+         _updateProg->setUniform("inVel", 1);
+
+         glBindVertexArray(_quadVAO);
+         glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+         glBindVertexArray(0);
+
+         output();
+
+         _updateProg->release();
+         glBindFramebuffer(GL_FRAMEBUFFER, 0);
+         GL_ERR_CHECK();
+
+         _src = dst;
+      }
+
+      virtual void finish()
+      {
+         glFinish();
+      }
+
+      virtual void positions(std::vector<float>& xyzw)
+      {
+         xyzw.resize(4 * _side * _side);
+         glBindFramebuffer(GL_FRAMEBUFFER, _fbo[_src]);
+         glReadBuffer(GL_COLOR_ATTACHMENT0);
+         glReadPixels(0, 0, GLsizei(_side), GLsizei(_side), GL_RGBA, GL_FLOAT, &xyzw[0]);
+         glBindFramebuffer(GL_FRAMEBUFFER, 0);
+         GL_ERR_CHECK();
+      }
+
+   protected:
+      /**
+       * Set up whatever output() needs
+       */
+      virtual void initOutput(size_t count)
+      {
+      }
+
+      /**
+       * Make the new positions available for drawing. The destination FBO
+       * is still bound
+       */
+      virtual void output()
+      {
+      }
+
+      /**
+       * Delete the output objects
+       */
+      virtual void releaseOutput()
+      {
+      }
+
+      size_t _side;   //< Width and height of the state textures
+
+   private:
+      /**
+       * Create a _side x _side float texture
+       */
+      void createTexture(GLuint id, const float* data)
+      {
+         glBindTexture(GL_TEXTURE_2D, id);
+         glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, GLsizei(_side), GLsizei(_side), 0, GL_RGBA, GL_FLOAT, data);
+         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+         glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+      }
+
+      /**
+       * Delete the GL objects of the last init()
+       */
+      void release()
+      {
+         if(_quadVAO == 0)
+         {
+            return;
+         }
+         releaseOutput();
+         glDeleteTextures(2, _posTex);
+         glDeleteTextures(2, _velTex);
+         glDeleteFramebuffers(2, _fbo);
+         glDeleteVertexArrays(1, &_quadVAO);
+         glDeleteBuffers(1, &_quadBuf);
+         _quadVAO = 0;
+         _memory.setDevice(0);
+      }
+
+      std::string                   _shaderDir;    //< Location of the update shaders
+      std::unique_ptr<GL::Program>  _updateProg;   //< RK4 fragment program
+      unsigned int                  _src;          //< Index of the current state
+      GLuint                        _posTex[2];    //< Position textures
+      GLuint                        _velTex[2];    //< Velocity textures
+      GLuint                        _fbo[2];       //< Framebuffers that write to each pair
+      GLuint                        _quadVAO;      //< Full screen quad
+      GLuint                        _quadBuf;      //< Quad positions and texture coordinates
+      Compute::MemoryAccount        _memory;       //< GPU memory of the textures and the quad
+   };
+
+   /**
+    * TextureBackend plus a copy of the positions into a vertex buffer
+    */
+   class CopyToPboBackend : public TextureBackend
+   {
+   public:
+      CopyToPboBackend()
+      :  TextureBackend (GPU_PS_DIR "/copy_to_pbo")
+      ,  _pbo           (0)
+      ,  _memory        ("CopyToPboBackend")
+      {
+      }
+
+      virtual ~CopyToPboBackend()
+      {
+         releaseOutput();
+      }
+
+   protected:
+      virtual void initOutput(size_t count)
+      {
+         glGenBuffers(1, &_pbo);
+         glBindBuffer(GL_ARRAY_BUFFER, _pbo);
+         glBufferData(GL_ARRAY_BUFFER, 4 * sizeof(float) * count, NULL, GL_STATIC_DRAW);
+         glBindBuffer(GL_ARRAY_BUFFER, 0);
+         _memory.setDevice(GL::bufferBytes(_pbo));
+      }
+
+      virtual void output()
+      {
+         glReadBuffer(GL_COLOR_ATTACHMENT0);
+         glBindBuffer(GL_PIXEL_PACK_BUFFER, _pbo);
+         glReadPixels(0, 0, GLsizei(_side), GLsizei(_side), GL_RGBA, GL_FLOAT, NULL);
+         glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+      }
+
+      virtual void releaseOutput()
+      {
+         if(_pbo != 0)
+         {
+            glDeleteBuffers(1, &_pbo);
+            _pbo = 0;
+         }
+         _memory.setDevice(0);
+      }
+
+   private:
+      GLuint                  _pbo;      //< Vertex buffer the positions are copied into
+      Compute::MemoryAccount  _memory;   //< GPU memory of _pbo
+   };
+
+   /**
+    * Update in a vertex shader with the outputs captured by transform
+    * feedback into the other pair of vertex buffers
+    */
+   class TransformFeedbackBackend : public Backend
+   {
+   public:
+      TransformFeedbackBackend()
+      :  _count  (0)
+      ,  _src    (0)
+      ,  _memory ("TransformFeedbackBackend")
+      {
+         for(int i = 0; i < 2; ++i)
+         {
+            _vao[i] = _posBuf[i] = _velBuf[i] = 0;
+         }
+      }
+
+      virtual ~TransformFeedbackBackend()
+      {
+         release();
+      }
+
+      virtual size_t init(size_t numParticles)
+      {
+         release();
+
+         std::vector<std::string> varyings;
+         varyings.push_back("newVel");
+         varyings.push_back("newPos");
+         _updateProg = std::unique_ptr<GL::Program>(new GL::Program(GPU_PS_DIR "/transform_feedback/update_vert.c", varyings, GL_SEPARATE_ATTRIBS));
+
+         _count = numParticles;
+         std::vector<float> pos(4 * _count), vel(4 * _count);
+         for(size_t i = 0; i < _count; ++i)
+         {
+            initialState(i, &pos[4 * i], &vel[4 * i]);
+         }
+
+         glGenVertexArrays(2, _vao);
+         glGenBuffers(2, _posBuf);
+         glGenBuffers(2, _velBuf);
+         for(int buf = 0; buf < 2; ++buf)
+         {
+            glBindVertexArray(_vao[buf]);
+
+            glBindBuffer(GL_ARRAY_BUFFER, _posBuf[buf]);
+            glBufferData(GL_ARRAY_BUFFER, sizeof(float) * pos.size(), &pos[0], GL_STREAM_COPY);
+            glVertexAttribPointer(_updateProg->getAttribLocation("pos"), 4, GL_FLOAT, GL_FALSE, 0, NULL);
+            glEnableVertexAttribArray(_updateProg->getAttribLocation("pos"));
+
+            glBindBuffer(GL_ARRAY_BUFFER, _velBuf[buf]);
+            glBufferData(GL_ARRAY_BUFFER, sizeof(float) * vel.size(), &vel[0], GL_STREAM_COPY);
+            glVertexAttribPointer(_updateProg->getAttribLocation("vel"), 4, GL_FLOAT, GL_FALSE, 0, NULL);
+            glEnableVertexAttribArray(_updateProg->getAttribLocation("vel"));
+         }
+         glBindVertexArray(0);
+         glBindBuffer(GL_ARRAY_BUFFER, 0);
+         _memory.setDevice(GL::bufferBytes(_posBuf[0]) + GL::bufferBytes(_posBuf[1]) +
+                           GL::bufferBytes(_velBuf[0]) + GL::bufferBytes(_velBuf[1]));
+
+         _src = 0;
+         GL_ERR_CHECK();
+         return _count;
+      }
+
+      virtual void step()
+      {
+         unsigned int dst = _src ^ 1;
+
+         _updateProg->bind();
+         glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, _updateProg->getVaryingLocation("newPos"), _posBuf[dst]);
+         glBindBufferBase(GL_TRANSFORM_FEEDBACK_BUFFER, _updateProg->getVaryingLocation("newVel"), _velBuf[dst]);
+         glEnable(GL_RASTERIZER_DISCARD);
+         glBeginTransformFeedback(GL_POINTS);
+         glBindVertexArray(_vao[_src]);
+         glDrawArrays(GL_POINTS, 0, GLsizei(_count));
+         glBindVertexArray(0);
+         glEndTransformFeedback();
+         glDisable(GL_RASTERIZER_DISCARD);
+         _updateProg->release();
+         GL_ERR_CHECK();
+
+         _src = dst;
+      }
+
+      virtual void finish()
+      {
+         glFinish();
+      }
+
+      virtual void positions(std::vector<float>& xyzw)
+      {
+         xyzw.resize(4 * _count);
+         glBindBuffer(GL_ARRAY_BUFFER, _posBuf[_src]);
+         glGetBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(float) * xyzw.size(), &xyzw[0]);
+         glBindBuffer(GL_ARRAY_BUFFER, 0);
+         GL_ERR_CHECK();
+      }
+
+   private:
+      /**
+       * Delete the GL objects of the last init()
+       */
+      void release()
+      {
+         if(_vao[0] == 0)
+         {
+            return;
+         }
+         glDeleteVertexArrays(2, _vao);
+         glDeleteBuffers(2, _posBuf);
+         glDeleteBuffers(2, _velBuf);
+         _vao[0] = 0;
+         _memory.setDevice(0);
+      }
+
+      std::unique_ptr<GL::Program>  _updateProg;   //< RK4 vertex program with transform feedback
+      size_t                        _count;        //< Number of particles
+      unsigned int                  _src;          //< Index of the current state
+      GLuint                        _vao[2];       //< Vertex arrays that read each pair of buffers
+      GLuint                        _posBuf[2];    //< Position buffers
+      GLuint                        _velBuf[2];    //< Velocity buffers
+      Compute::MemoryAccount        _memory;       //< GPU memory of the buffers
+   };
+}
+
+Backend* createGLBackend(const std::string& name)
+{
+   if(name == "copy-to-pbo")
+   {
+      return new CopyToPboBackend();
+   }
+   if(name == "vertex-texture-fetch")
+   {
+      return new TextureBackend(GPU_PS_DIR "/vertex_texture_fetch");
+   }
+   if(name == "transform-feedback")
+   {
+      return new TransformFeedbackBackend();
+   }
+   return NULL;
+}
@@ -0,0 +1,514 @@
+//--------------------------------------------------------------------------------
+// main.cpp
+//
+// ps_bench: times the particle update of every method in the comparison, at
+// a list of particle counts, and writes the per-step times and their
+// percentiles as JSON or CSV. Each step is timed on its own with a steady
+// clock; the GL backends call glFinish() inside the timed region, so a step
+// is the full GPU time of the update and not just its submission. Hardware
+// performance counters can be read around the timed steps as well.
+//
+// With --save-baseline and --gate the runs are repeated and stored as the
+// baseline of the machine, or compared against it; see gate.h. With
+// --validate nothing is timed: the positions of every backend are checked
+// against the shared RK4 kernel instead; see validate.h.
+//--------------------------------------------------------------------------------
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <context.h>
+#include <cpu_dispatch.h>
+#include <memory_accounting.h>
+#include <opengl.h>
+#include <perf_counters.h>
+#include <thread_pool.h>
+
+#include "backend.h"
+#include "gate.h"
+#include "report.h"
+#include "validate.h"
+
+using std::string;
+using std::vector;
+
+/**
+ * Split a comma separated list
+ */
+vector<string> splitList(const string& list)
+{
+   vector<string> items;
+   std::stringstream in(list);
+   string item;
+   while(std::getline(in, item, ','))
+   {
+      if(!item.empty())
+      {
+         items.push_back(item);
+      }
+   }
+   return items;
+}
+
+/**
+ * Parse a particle count, with an optional k or M suffix
+ *
+ * @return the count, or 0 if str is not a positive count
+ */
+size_t parseCount(const string& str)
+{
+   char*  end   = NULL;
+   double value = strtod(str.c_str(), &end);
+   if(*end == 'k' || *end == 'K')
+   {
+      value *= 1e3;
+      ++end;
+   }
+   else if(*end == 'm' || *end == 'M')
+   {
+      value *= 1e6;
+      ++end;
+   }
+   return *end == 0 && value >= 1 ? size_t(value) : 0;
+}
+
+/**
+ * Time one backend at one particle count
+ *
+ * @param backend
+ *    The backend, not yet initialized
+ * @param numParticles
+ *    Requested number of particles
+ * @param steps, warmup
+ *    Timed and untimed steps
+ * @param counters
+ *    true to count hardware events over the timed steps
+ * @param run
+ *    Gets the results
+ */
+void timeBackend(Backend& backend, size_t numParticles, int steps, int warmup, bool counters, Run& run)
+{
+   typedef std::chrono::steady_clock Clock;
+
+   run.particles = backend.init(numParticles);
+   run.warmup    = warmup;
+
+   // The backend's state is all allocated by now, and only one backend
+   // exists at a time, so the totals are the memory of this run
+   Compute::MemoryUsage memory = Compute::MemoryRegistry::instance().total();
+   run.hostBytes   = memory.hostBytes;
+   run.deviceBytes = memory.deviceBytes;
+   run.stepNs.clear();
+   run.stepNs.reserve(steps);
+
+   for(int s = 0; s < warmup; ++s)
+   {
+      backend.step();
+   }
+   backend.finish();
+
+   // Opened after init(), so that the threads the backend started are
+   // counted. The counters are read only around all steps together: a read
+   // takes a system call per thread, which would distort short steps
+   std::unique_ptr<Compute::PerfCounters> perf(counters ? new Compute::PerfCounters : NULL);
+   Compute::PerfCounts                    before;
+   if(perf)
+   {
+      before = perf->read();
+   }
+
+   for(int s = 0; s < steps; ++s)
+   {
+      Clock::time_point start = Clock::now();
+      backend.step();
+      backend.finish();
+      Clock::time_point end = Clock::now();
+      run.stepNs.push_back(double(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+   }
+
+   if(perf)
+   {
+      run.counts = perf->read() - before;
+   }
+}
+
+/**
+ * Print the command line options
+ */
+void usage(const char* program)
+{
+   vector<string> names = backendNames();
+   std::cerr << "Usage: " << program << " [--backend list] [--counts list] [--steps n] [--warmup n] [--threads n] [--format json|csv] [--samples] [--counters] [--output file] [--window]"
+             << " [--repeat n] [--save-baseline dir] [--gate dir] [--tolerance percent] [--confidence percent]"
+             << " [--validate steps] [--validate-tolerance e] [--isa level]" << std::endl
+             << "   --backend list   Comma separated backends. Default: all of" << std::endl
+             << "                    ";
+   for(size_t i = 0; i < names.size(); ++i)
+   {
+      std::cerr << (i == 0 ? "" : ", ") << names[i];
+   }
+   std::cerr << std::endl
+             << "   --counts list    Comma separated particle counts, k and M suffixes allowed. Default: 250k to 15M" << std::endl
+             << "   --steps n        Timed steps per count. Default: 1000" << std::endl
+             << "   --warmup n       Untimed steps before them. Default: 10" << std::endl
+             << "   --threads n      Threads for cpu-threaded. Default: all hardware threads" << std::endl
+             << "   --format f       json (default) or csv" << std::endl
+             << "   --samples        Write every step time, not just the summary" << std::endl
+             << "   --counters       Count cycles, instructions, cache and branch misses and DRAM traffic" << std::endl
+             << "   --output file    Write to file instead of standard output" << std::endl
+             << "   --window         Run the GL backends in a window. Default: headless when built with EGL" << std::endl
+             << "   --repeat n       Run every backend and count n times. Default: 1, or 5 with --save-baseline or --gate" << std::endl
+             << "   --save-baseline dir  Store the median step times as the baseline of this machine in dir" << std::endl
+             << "   --gate dir       Compare against the baseline of this machine in dir; exit with 2 if a run got slower" << std::endl
+             << "   --tolerance p    Change in step time the gate accepts, in percent. Default: 5" << std::endl
+             << "   --confidence p   Confidence level of the gate's intervals, in percent. Default: 95" << std::endl
+             << "   --validate n     Time nothing; compare the positions after n steps with the shared RK4 kernel, exit with 3 if a backend differs" << std::endl
+             << "   --validate-tolerance e  Relative position error that --validate accepts. Default: 1e-3" << std::endl
+             << "   --isa level      Run the CPU kernels at one of: " << Compute::CpuDispatch::availableNames() << ". Default: the widest" << std::endl;
+}
+
+/**
+ * Program entry point
+ */
+int main(int argc, char* argv[])
+{
+   vector<string> backends = backendNames();
+   vector<size_t> counts   = { 250000, 500000, 750000, 1000000, 2000000, 3000000, 4000000, 5000000, 6000000,
+                               7000000, 8000000, 9000000, 10000000, 11000000, 12000000, 13000000, 14000000, 15000000 };
+   int            steps      = 1000;
+   int            warmup     = 10;
+   unsigned int   numThreads = 0;
+   string         format     = "json";
+   string         output;
+   bool           samples    = false;
+   bool           counters   = false;
+   bool           window     = !GL::Context::headlessSupported();
+   int            repeat     = 0;
+   string         saveDir;
+   string         gateDir;
+   double         tolerance  = 0.05;
+   double         confidence = 0.95;
+   int            validateSteps     = 0;
+   double         validateTolerance = 1e-3;
+
+   for(int i = 1; i < argc; ++i)
+   {
+      bool hasValue = i + 1 < argc;
+      if(strcmp(argv[i], "--backend") == 0 && hasValue)
+      {
+         backends = splitList(argv[++i]);
+      }
+      else if(strcmp(argv[i], "--counts") == 0 && hasValue)
+      {
+         vector<string> items = splitList(argv[++i]);
+         counts.clear();
+         for(size_t c = 0; c < items.size(); ++c)
+         {
+            size_t count = parseCount(items[c]);
+            if(count == 0)
+            {
+               usage(argv[0]);
+               return -1;
+            }
+            counts.push_back(count);
+         }
+      }
+      else if(strcmp(argv[i], "--steps") == 0 && hasValue && atoi(argv[i + 1]) > 0)
+      {
+         steps = atoi(argv[++i]);
+      }
+      else if(strcmp(argv[i], "--warmup") == 0 && hasValue && atoi(argv[i + 1]) >= 0)
+      {
+         warmup = atoi(argv[++i]);
+      }
+      else if(strcmp(argv[i], "--threads") == 0 && hasValue && atoi(argv[i + 1]) > 0)
+      {
+         numThreads = atoi(argv[++i]);
+      }
+      else if(strcmp(argv[i], "--format") == 0 && hasValue && (strcmp(argv[i + 1], "json") == 0 || strcmp(argv[i + 1], "csv") == 0))
+      {
+         format = argv[++i];
+      }
+      else if(strcmp(argv[i], "--samples") == 0)
+      {
+         samples = true;
+      }
+      else if(strcmp(argv[i], "--counters") == 0)
+      {
+         counters = true;
+      }
+      else if(strcmp(argv[i], "--output") == 0 && hasValue)
+      {
+         output = argv[++i];
+      }
+      else if(strcmp(argv[i], "--window") == 0)
+      {
+         window = true;
+      }
+      else if(strcmp(argv[i], "--repeat") == 0 && hasValue && atoi(argv[i + 1]) > 0)
+      {
+         repeat = atoi(argv[++i]);
+      }
+      else if(strcmp(argv[i], "--save-baseline") == 0 && hasValue)
+      {
+         saveDir = argv[++i];
+      }
+      else if(strcmp(argv[i], "--gate") == 0 && hasValue)
+      {
+         gateDir = argv[++i];
+      }
+      else if(strcmp(argv[i], "--tolerance") == 0 && hasValue && atof(argv[i + 1]) >= 0)
+      {
+         tolerance = atof(argv[++i]) / 100;
+      }
+      else if(strcmp(argv[i], "--confidence") == 0 && hasValue && atof(argv[i + 1]) > 0 && atof(argv[i + 1]) < 100)
+      {
+         confidence = atof(argv[++i]) / 100;
+      }
+      else if(strcmp(argv[i], "--validate") == 0 && hasValue && atoi(argv[i + 1]) > 0)
+      {
+         validateSteps = atoi(argv[++i]);
+      }
+      else if(strcmp(argv[i], "--validate-tolerance") == 0 && hasValue && atof(argv[i + 1]) > 0)
+      {
+         validateTolerance = atof(argv[++i]);
+      }
+      else if(strcmp(argv[i], "--isa") == 0 && hasValue)
+      {
+         Compute::Isa isa;
+         if(!Compute::parseIsa(argv[++i], isa))
+         {
+            usage(argv[0]);
+            return -1;
+         }
+         try
+         {
+            Compute::CpuDispatch::instance().setIsa(isa);
+         }
+         catch(const std::runtime_error& err)
+         {
+            std::cerr << err.what() << std::endl;
+            return -1;
+         }
+      }
+      else
+      {
+         usage(argv[0]);
+         return -1;
+      }
+   }
+
+   // A baseline needs several runs of each backend and count, so that the
+   // spread between runs is known
+   if(repeat == 0)
+   {
+      repeat = saveDir.empty() && gateDir.empty() ? 1 : 5;
+   }
+
+   // Read the baseline before anything runs, so that a missing baseline or
+   // one from another machine fails at once
+   Baseline baseline;
+   if(!gateDir.empty())
+   {
+      try
+      {
+         baseline = readBaseline(baselineFile(gateDir));
+      }
+      catch(const std::runtime_error& err)
+      {
+         std::cerr << err.what() << std::endl;
+         return -1;
+      }
+      if(baseline.machine != machineName())
+      {
+         std::cerr << "The baseline was recorded on " << baseline.machine << ", not on " << machineName() << std::endl;
+         return -1;
+      }
+   }
+
+   // Check the names before anything runs
+   vector<string> known = backendNames();
+   bool           needGL = false;
+   for(size_t b = 0; b < backends.size(); ++b)
+   {
+      if(std::find(known.begin(), known.end(), backends[b]) == known.end())
+      {
+         std::cerr << "Unknown backend: " << backends[b] << std::endl;
+         usage(argv[0]);
+         return -1;
+      }
+      needGL = needGL || isGLBackend(backends[b]);
+   }
+
+   Metadata metadata;
+   metadata.push_back(std::make_pair(string("machine"), machineName()));
+   metadata.push_back(std::make_pair(string("repeat"), std::to_string(repeat)));
+   metadata.push_back(std::make_pair(string("simd_width"), std::to_string(Compute::isaWidth(Compute::CpuDispatch::instance().getIsa()))));
+   metadata.push_back(std::make_pair(string("isa"), Compute::CpuDispatch::instance().describe()));
+   metadata.push_back(std::make_pair(string("hardware_threads"), std::to_string(Compute::defaultThreadCount())));
+   if(counters)
+   {
+      Compute::PerfCounters probe;
+      metadata.push_back(std::make_pair(string("perf_counters"), probe.status()));
+      std::cerr << "Performance counters: " << probe.status() << std::endl;
+   }
+   std::unique_ptr<GL::Context> context;
+   if(needGL)
+   {
+      // Nothing is drawn, so a small surface will do
+      try
+      {
+         context.reset(GL::Context::create(window ? GL::Context::WINDOW : GL::Context::HEADLESS, 64, 64));
+      }
+      catch(const std::runtime_error& err)
+      {
+         std::cerr << "Failed to create an OpenGL 3.2 context: " << err.what() << std::endl;
+         return -1;
+      }
+      context->setSwapInterval(0);
+      metadata.push_back(std::make_pair(string("gl_context"),  context->describe()));
+      metadata.push_back(std::make_pair(string("gl_version"),  string(reinterpret_cast<const char*>(glGetString(GL_VERSION)))));
+      metadata.push_back(std::make_pair(string("gl_renderer"), string(reinterpret_cast<const char*>(glGetString(GL_RENDERER)))));
+   }
+
+   // Compare every backend at every count with the native kernel. This
+   // replaces the timing: the reference run would distort it
+   if(validateSteps > 0)
+   {
+      vector<Validation> validations;
+      bool               failed = false;
+      for(size_t b = 0; b < backends.size(); ++b)
+      {
+         try
+         {
+            std::unique_ptr<Backend> backend(createBackend(backends[b], numThreads));
+            for(size_t c = 0; c < counts.size(); ++c)
+            {
+               validations.push_back(validate(*backend, backends[b], counts[c], validateSteps, validateTolerance));
+            }
+         }
+         catch(const std::runtime_error& err)
+         {
+            std::cerr << backends[b] << ": " << err.what() << std::endl;
+            failed = true;
+         }
+      }
+      writeValidation(std::cerr, validations, validateTolerance);
+
+      // The collision kernel of lb_waves has no backend; check its native
+      // build on its own
+      CollisionValidation collision = validateCollision(100000, validateTolerance);
+      writeCollisionValidation(std::cerr, collision, validateTolerance);
+
+      bool differs = !collision.passed;
+      for(size_t v = 0; v < validations.size(); ++v)
+      {
+         differs = differs || !validations[v].passed;
+      }
+      return differs ? 3 : (failed ? 1 : 0);
+   }
+
+   // Run every backend at every count. A backend that fails is reported
+   // and skipped, and the exit code says so. Repetitions go round all
+   // backends in turn, so that a slow drift of the machine, e.g. its
+   // temperature, affects every backend alike
+   vector<Run>    runs;
+   vector<string> failedBackends;
+   for(int r = 0; r < repeat; ++r)
+   {
+      for(size_t b = 0; b < backends.size(); ++b)
+      {
+         if(std::find(failedBackends.begin(), failedBackends.end(), backends[b]) != failedBackends.end())
+         {
+            continue;
+         }
+         try
+         {
+            std::unique_ptr<Backend> backend(createBackend(backends[b], numThreads));
+            for(size_t c = 0; c < counts.size(); ++c)
+            {
+               Run run;
+               run.backend = backends[b];
+               timeBackend(*backend, counts[c], steps, warmup, counters, run);
+               runs.push_back(run);
+
+               Summary s = summarize(run.stepNs);
+               if(repeat > 1)
+               {
+                  std::cerr << "[" << r + 1 << "/" << repeat << "] ";
+               }
+               std::cerr << run.backend << " " << run.particles << ": median " << s.p50 * 1e-6 << " ms, p99 " << s.p99 * 1e-6 << " ms"
+                         << ", " << run.hostBytes * 1e-6 << " MB host, " << run.deviceBytes * 1e-6 << " MB device";
+               if(run.counts.ipc() > 0)
+               {
+                  std::cerr << ", IPC " << run.counts.ipc();
+               }
+               std::cerr << std::endl;
+            }
+         }
+         catch(const std::runtime_error& err)
+         {
+            std::cerr << backends[b] << ": " << err.what() << std::endl;
+            failedBackends.push_back(backends[b]);
+         }
+      }
+   }
+   bool failed = !failedBackends.empty();
+
+   std::ofstream file;
+   if(!output.empty())
+   {
+      file.open(output.c_str());
+      if(!file)
+      {
+         std::cerr << "Unable to open " << output << std::endl;
+         return -1;
+      }
+   }
+   std::ostream& out = output.empty() ? std::cout : file;
+   if(format == "csv")
+   {
+      writeCsv(out, runs, samples);
+   }
+   else
+   {
+      writeJson(out, metadata, runs, samples);
+   }
+
+   if(!saveDir.empty())
+   {
+      string        filename = baselineFile(saveDir);
+      std::ofstream baselineOut(filename.c_str());
+      if(!baselineOut)
+      {
+         std::cerr << "Unable to write baseline " << filename << std::endl;
+         return -1;
+      }
+      writeBaseline(baselineOut, machineName(), runs);
+      std::cerr << "Baseline written to " << filename << std::endl;
+   }
+
+   // A run is a regression only if it is slower than the tolerance over
+   // the whole confidence interval
+   bool regressed = false;
+   if(!gateDir.empty())
+   {
+      vector<Comparison> comparisons = compare(baseline, runs, confidence, tolerance, 10000);
+      writeComparison(std::cerr, comparisons, confidence);
+      for(size_t c = 0; c < comparisons.size(); ++c)
+      {
+         regressed = regressed || comparisons[c].verdict == Comparison::SLOWER;
+      }
+      std::cerr << (regressed ? "Gate failed: slower than the baseline" : "Gate passed") << std::endl;
+   }
+
+   return regressed ? 2 : (failed ? 1 : 0);
+}
@@ -0,0 +1,240 @@
+//--------------------------------------------------------------------------------
+// report.cpp
+//
+// Summary statistics and JSON / CSV output of ps_bench runs.
+//--------------------------------------------------------------------------------
+#include "report.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+/*
+ * Value at quantile q of sorted samples, interpolating between the two
+ * closest ranks
+ */
+static double percentile(const std::vector<double>& sorted, double q)
+{
+   double pos   = q * (sorted.size() - 1);
+   size_t below = size_t(pos);
+   size_t above = std::min(below + 1, sorted.size() - 1);
+   return sorted[below] + (pos - below) * (sorted[above] - sorted[below]);
+}
+
+Summary summarize(const std::vector<double>& stepNs)
+{
+   Summary s = { 0, 0, 0, 0, 0, 0, 0 };
+   if(stepNs.empty())
+   {
+      return s;
+   }
+
+   std::vector<double> sorted(stepNs);
+   std::sort(sorted.begin(), sorted.end());
+
+   double sum = 0;
+   for(size_t i = 0; i < sorted.size(); ++i)
+   {
+      sum += sorted[i];
+   }
+   s.mean = sum / sorted.size();
+
+   double sq = 0;
+   for(size_t i = 0; i < sorted.size(); ++i)
+   {
+      sq += (sorted[i] - s.mean) * (sorted[i] - s.mean);
+   }
+   s.stddev = sorted.size() > 1 ? sqrt(sq / (sorted.size() - 1)) : 0;
+
+   s.min = sorted.front();
+   s.p50 = percentile(sorted, 0.5);
+   s.p90 = percentile(sorted, 0.9);
+   s.p99 = percentile(sorted, 0.99);
+   s.max = sorted.back();
+   return s;
+}
+
+/*
+ * Name and value of every hardware count of a run that ps_bench reports:
+ * cycles and instructions per step, instructions per cycle, and the misses
+ * and DRAM traffic per particle update
+ */
+static std::vector<std::pair<std::string, double> > counterValues(const Run& run)
+{
+   std::vector<std::pair<std::string, double> > values;
+   const Compute::PerfCounts& c = run.counts;
+   double steps     = double(run.stepNs.size());
+   double particles = double(run.particles) * steps;
+   if(steps == 0 || particles == 0)
+   {
+      return values;
+   }
+
+   if(c.valid[Compute::PerfCounts::CYCLES])
+   {
+      values.push_back(std::make_pair(std::string("cycles_per_step"), c.value[Compute::PerfCounts::CYCLES] / steps));
+   }
+   if(c.valid[Compute::PerfCounts::INSTRUCTIONS])
+   {
+      values.push_back(std::make_pair(std::string("instructions_per_step"), c.value[Compute::PerfCounts::INSTRUCTIONS] / steps));
+   }
+   if(c.ipc() > 0)
+   {
+      values.push_back(std::make_pair(std::string("ipc"), c.ipc()));
+   }
+   if(c.valid[Compute::PerfCounts::LLC_MISSES])
+   {
+      values.push_back(std::make_pair(std::string("llc_misses_per_particle"), c.value[Compute::PerfCounts::LLC_MISSES] / particles));
+   }
+   if(c.valid[Compute::PerfCounts::BRANCH_MISSES])
+   {
+      values.push_back(std::make_pair(std::string("branch_misses_per_particle"), c.value[Compute::PerfCounts::BRANCH_MISSES] / particles));
+   }
+   if(c.valid[Compute::PerfCounts::DRAM_BYTES])
+   {
+      values.push_back(std::make_pair(std::string("dram_bytes_per_particle"), c.value[Compute::PerfCounts::DRAM_BYTES] / particles));
+   }
+   return values;
+}
+
+/*
+ * str as a JSON string literal
+ */
+static std::string quote(const std::string& str)
+{
+   std::string out = "\"";
+   for(size_t i = 0; i < str.size(); ++i)
+   {
+      char c = str[i];
+      if(c == '"' || c == '\\')
+      {
+         out += '\\';
+         out += c;
+      }
+      else if(c == '\n')
+      {
+         out += "\\n";
+      }
+      else if(static_cast<unsigned char>(c) >= 0x20)
+      {
+         out += c;
+      }
+   }
+   return out + "\"";
+}
+
+void writeJson(std::ostream& out, const Metadata& metadata, const std::vector<Run>& runs, bool samples)
+{
+   out << std::fixed << std::setprecision(1);
+   out << "{" << std::endl;
+   for(size_t m = 0; m < metadata.size(); ++m)
+   {
+      out << "  " << quote(metadata[m].first) << ": " << quote(metadata[m].second) << "," << std::endl;
+   }
+
+   out << "  \"runs\": [";
+   for(size_t r = 0; r < runs.size(); ++r)
+   {
+      const Run& run = runs[r];
+      Summary    s   = summarize(run.stepNs);
+
+      out << (r == 0 ? "" : ",") << std::endl
+          << "    {" << std::endl
+          << "      \"backend\": " << quote(run.backend) << "," << std::endl
+          << "      \"particles\": " << run.particles << "," << std::endl
+          << "      \"warmup\": " << run.warmup << "," << std::endl
+          << "      \"steps\": " << run.stepNs.size() << "," << std::endl
+          << "      \"mean_ns\": " << s.mean << "," << std::endl
+          << "      \"stddev_ns\": " << s.stddev << "," << std::endl
+          << "      \"min_ns\": " << s.min << "," << std::endl
+          << "      \"p50_ns\": " << s.p50 << "," << std::endl
+          << "      \"p90_ns\": " << s.p90 << "," << std::endl
+          << "      \"p99_ns\": " << s.p99 << "," << std::endl
+          << "      \"max_ns\": " << s.max << "," << std::endl
+          << "      \"updates_per_second\": " << (s.mean > 0 ? run.particles * 1e9 / s.mean : 0.0) << "," << std::endl
+          << "      \"host_bytes\": " << run.hostBytes << "," << std::endl
+          << "      \"device_bytes\": " << run.deviceBytes;
+
+      // Ratios need more than one decimal
+      std::vector<std::pair<std::string, double> > counters = counterValues(run);
+      out << std::setprecision(4);
+      for(size_t v = 0; v < counters.size(); ++v)
+      {
+         out << "," << std::endl << "      " << quote(counters[v].first) << ": " << counters[v].second;
+      }
+      out << std::setprecision(1);
+      if(samples)
+      {
+         out << "," << std::endl << "      \"step_ns\": [";
+         for(size_t i = 0; i < run.stepNs.size(); ++i)
+         {
+            out << (i == 0 ? "" : ", ") << run.stepNs[i];
+         }
+         out << "]";
+      }
+      out << std::endl << "    }";
+   }
+   out << std::endl << "  ]" << std::endl << "}" << std::endl;
+}
+
+void writeCsv(std::ostream& out, const std::vector<Run>& runs, bool samples)
+{
+   out << std::fixed << std::setprecision(1);
+   if(samples)
+   {
+      out << "backend,particles,step,ns" << std::endl;
+      for(size_t r = 0; r < runs.size(); ++r)
+      {
+         for(size_t i = 0; i < runs[r].stepNs.size(); ++i)
+         {
+            out << runs[r].backend << "," << runs[r].particles << "," << i << "," << runs[r].stepNs[i] << std::endl;
+         }
+      }
+      return;
+   }
+
+   // The counter columns are the same for every row, so that a run
+   // without counts gets empty cells rather than shifted ones
+   std::vector<std::string> columns;
+   for(size_t r = 0; r < runs.size(); ++r)
+   {
+      std::vector<std::pair<std::string, double> > counters = counterValues(runs[r]);
+      for(size_t v = 0; v < counters.size(); ++v)
+      {
+         if(std::find(columns.begin(), columns.end(), counters[v].first) == columns.end())
+         {
+            columns.push_back(counters[v].first);
+         }
+      }
+   }
+
+   out << "backend,particles,warmup,steps,mean_ns,stddev_ns,min_ns,p50_ns,p90_ns,p99_ns,max_ns,updates_per_second,host_bytes,device_bytes";
+   for(size_t c = 0; c < columns.size(); ++c)
+   {
+      out << "," << columns[c];
+   }
+   out << std::endl;
+   for(size_t r = 0; r < runs.size(); ++r)
+   {
+      const Run& run = runs[r];
+      Summary    s   = summarize(run.stepNs);
+      out << run.backend << "," << run.particles << "," << run.warmup << "," << run.stepNs.size() << ","
+          << s.mean << "," << s.stddev << "," << s.min << "," << s.p50 << "," << s.p90 << "," << s.p99 << "," << s.max << ","
+          << (s.mean > 0 ? run.particles * 1e9 / s.mean : 0.0) << "," << run.hostBytes << "," << run.deviceBytes;
+
+      std::vector<std::pair<std::string, double> > counters = counterValues(run);
+      out << std::setprecision(4);
+      for(size_t c = 0; c < columns.size(); ++c)
+      {
+         out << ",";
+         for(size_t v = 0; v < counters.size(); ++v)
+         {
+            if(counters[v].first == columns[c])
+            {
+               out << counters[v].second;
+            }
+         }
+      }
+      out << std::setprecision(1) << std::endl;
+   }
+}
@@ -0,0 +1,73 @@
+//--------------------------------------------------------------------------------
+// report.h
+//
+// Per-step timings of ps_bench runs, their summary statistics and the JSON
+// and CSV output.
+//--------------------------------------------------------------------------------
+#ifndef _report_h
+#define _report_h
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <perf_counters.h>
+
+/**
+ * Timings of one backend at one particle count
+ */
+struct Run
+{
+   std::string          backend;     //< Backend name
+   size_t               particles;   //< Particles actually updated
+   int                  warmup;      //< Untimed steps before the timed ones
+   std::vector<double>  stepNs;      //< Wall time of every timed step in nanoseconds
+   Compute::PerfCounts  counts;      //< Hardware events of all timed steps together, if counted
+   size_t               hostBytes;   //< Host memory of every account after init()
+   size_t               deviceBytes; //< GPU memory of every account after init()
+};
+
+/**
+ * Summary statistics of a run's step times, in nanoseconds
+ */
+struct Summary
+{
+   double mean;
+   double stddev;
+   double min;
+   double p50;
+   double p90;
+   double p99;
+   double max;
+};
+
+/**
+ * @param stepNs
+ *    Step times. Percentiles interpolate linearly between the closest ranks
+ * @return the statistics, all 0 if there are no samples
+ */
+Summary summarize(const std::vector<double>& stepNs);
+
+/**
+ * Name and value pairs that describe the machine and the settings
+ */
+typedef std::vector<std::pair<std::string, std::string> > Metadata;
+
+/**
+ * Write the runs as one JSON object: the metadata, then a "runs" array with
+ * the summary of each run, its hardware counts per step and per particle if
+ * they were counted and, if samples is set, every step time
+ */
+void writeJson(std::ostream& out, const Metadata& metadata, const std::vector<Run>& runs, bool samples);
+
+/**
+ * Write the runs as CSV with a header row: one row per run with the
+ * summary, or if samples is set one row per timed step. If any run has
+ * hardware counts the summary rows get their columns, empty for events
+ * that were not counted
+ */
+void writeCsv(std::ostream& out, const std::vector<Run>& runs, bool samples);
+
+#endif
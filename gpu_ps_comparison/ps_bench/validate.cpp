@@ -0,0 +1,163 @@
+//--------------------------------------------------------------------------------
+// validate.cpp
+//
+// Native run of the shared RK4 kernel and the comparison of the backends
+// against it, and the check of the shared lattice Boltzmann collision.
+//--------------------------------------------------------------------------------
+#include "validate.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+
+#include <counter_rng.h>
+#include <lb_collision.h>
+#include <parallel_for.h>
+#include <rk4_gravity.h>
+
+/**
+ * Time step of the update shaders, see integrate() in their main()
+ */
+static const float timeStep = 0.01f;
+
+Validation validate(Backend& backend, const std::string& name, size_t numParticles, int steps, double tolerance)
+{
+   Validation v;
+   v.backend   = name;
+   v.particles = backend.init(numParticles);
+   v.steps     = steps;
+
+   for(int s = 0; s < steps; ++s)
+   {
+      backend.step();
+   }
+   backend.finish();
+   std::vector<float> xyzw;
+   backend.positions(xyzw);
+
+   // The reference: the kernel of the shaders, one particle at a time
+   std::vector<double> errors(v.particles);
+   Compute::parallelFor(0, v.particles, [&](size_t first, size_t last)
+   {
+      for(size_t i = first; i < last; ++i)
+      {
+         float pos[4], vel[4];
+         initialState(i, pos, vel);
+
+         Kernels::State state;
+         state.x = Kernels::vec3(pos[0], pos[1], pos[2]);
+         state.v = Kernels::vec3(vel[0], vel[1], vel[2]);
+         for(int s = 0; s < steps; ++s)
+         {
+            state = Kernels::integrate(state, 0, timeStep);
+         }
+
+         const float* p    = &xyzw[4 * i];
+         Kernels::vec3 diff = Kernels::vec3(p[0], p[1], p[2]) - state.x;
+         double error = Kernels::length(diff) / std::max(double(Kernels::length(state.x)), 1e-6);
+
+         // A particle that left the float range compares as NaN; count it
+         // as an outlier
+         errors[i] = error == error ? error : HUGE_VAL;
+      }
+   });
+
+   v.outliers = 0;
+   for(size_t i = 0; i < errors.size(); ++i)
+   {
+      v.outliers += errors[i] > tolerance ? 1 : 0;
+   }
+   std::sort(errors.begin(), errors.end());
+   v.maxError = errors.empty() ? 0 : errors.back();
+   v.p99Error = errors.empty() ? 0 : errors[size_t(0.99 * (errors.size() - 1))];
+   v.passed   = v.outliers <= v.particles / 100;
+   return v;
+}
+
+void writeValidation(std::ostream& out, const std::vector<Validation>& validations, double tolerance)
+{
+   out << "Positions against the native RK4 kernel, relative error, tolerance " << tolerance << std::endl;
+   out << std::left << std::setw(22) << "backend" << std::right << std::setw(10) << "particles"
+       << std::setw(8) << "steps" << std::setw(12) << "p99" << std::setw(12) << "max"
+       << std::setw(10) << "outliers" << "  " << "result" << std::endl;
+   out << std::scientific << std::setprecision(2);
+   for(size_t i = 0; i < validations.size(); ++i)
+   {
+      const Validation& v = validations[i];
+      out << std::left << std::setw(22) << v.backend << std::right << std::setw(10) << v.particles
+          << std::setw(8) << v.steps << std::setw(12) << v.p99Error << std::setw(12) << v.maxError
+          << std::setw(10) << v.outliers << "  " << (v.passed ? "agrees" : "DIFFERS") << std::endl;
+   }
+   out.unsetf(std::ios::floatfield);
+}
+
+CollisionValidation validateCollision(size_t sites, double tolerance)
+{
+   CollisionValidation v;
+   v.sites    = sites;
+   v.maxError = 0;
+
+   // The lattice of lb_waves: 128 sites across 40 m, 128 steps per second
+   const float lambda   = 40.0f / 128.0f;
+   const float timeStep = 1.0f / 128.0f;
+
+   Compute::Philox rng(2);
+   for(size_t i = 0; i < sites; ++i)
+   {
+      float u[4], w[4];
+      rng.uniform4(i, 0, u);
+      rng.uniform4(i, 1, w);
+
+      // Wave numbers from long swells to the shortest waves of the lattice,
+      // and mass flows of either sign
+      float waveNumber = 0.1f + 10.0f * w[0];
+      float f[5]       = { 2 * u[0] - 1, 2 * u[1] - 1, 2 * u[2] - 1, 2 * u[3] - 1, 2 * w[1] - 1 };
+
+      float K = Kernels::collisionK(lambda, timeStep, waveNumber);
+      double v2    = double(lambda) / timeStep * (double(lambda) / timeStep);
+      double Kref  = 9.81 / (v2 * waveNumber);
+      v.maxError   = std::max(v.maxError, std::fabs(K - Kref) / Kref);
+
+      // Rows of the collision matrix for f_0, for f_1 and f_2, and for f_3
+      // and f_4, in terms of the kernel's own K so the rows are compared alone
+      double k = K;
+      double omega[3][5] =
+      {
+         { -4 * k, 2 + 4 * k, 2 + 4 * k, 2 + 4 * k, 2 + 4 * k },
+         { k,      k - 1,     k - 1,     k,         k         },
+         { k,      k,         k,         k - 1,     k - 1     }
+      };
+
+      Kernels::vec4 mf0(f[0], f[1], f[2], f[3]);
+      Kernels::vec4 mf1(f[4], waveNumber, 0.0f, 0.0f);
+      float dots[3] =
+      {
+         Kernels::dotOmegaMass0(K, mf0, mf1),
+         Kernels::dotOmegaMass1(K, mf0, mf1),
+         Kernels::dotOmegaMass2(K, mf0, mf1)
+      };
+
+      for(int row = 0; row < 3; ++row)
+      {
+         double dot = 0, scale = 0;
+         for(int j = 0; j < 5; ++j)
+         {
+            dot   += omega[row][j] * f[j];
+            scale += std::fabs(omega[row][j] * f[j]);
+         }
+         v.maxError = std::max(v.maxError, std::fabs(dots[row] - dot) / std::max(scale, 1e-30));
+      }
+   }
+
+   v.passed = v.maxError <= tolerance;
+   return v;
+}
+
+void writeCollisionValidation(std::ostream& out, const CollisionValidation& validation, double tolerance)
+{
+   out << "Lattice Boltzmann collision against the double precision matrix, tolerance " << tolerance << std::endl;
+   out << std::scientific << std::setprecision(2);
+   out << std::left << std::setw(22) << "lb-collision" << std::right << std::setw(10) << validation.sites
+       << std::setw(12) << validation.maxError << "  " << (validation.passed ? "agrees" : "DIFFERS") << std::endl;
+   out.unsetf(std::ios::floatfield);
+}
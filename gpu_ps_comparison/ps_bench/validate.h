@@ -0,0 +1,92 @@
+//--------------------------------------------------------------------------------
+// validate.h
+//
+// Checks the positions of a backend against the shared RK4 kernel of
+// common/kernels/rk4_gravity.h, compiled natively. The GL backends run the
+// same kernel as GLSL, so they should agree to rounding; the CPU engines
+// have their own SIMD form of the step, which this checks as well.
+//
+// The lattice Boltzmann collision of lb_waves (common/kernels/lb_collision.h)
+// is compiled natively here too and checked against the collision matrix in
+// double precision, so that the shared header keeps building as C++.
+//--------------------------------------------------------------------------------
+#ifndef _validate_h
+#define _validate_h
+
+#include <cstddef>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "backend.h"
+
+/**
+ * Result of validating one backend at one particle count
+ */
+struct Validation
+{
+   std::string backend;     //< Backend name
+   size_t      particles;   //< Particles compared
+   int         steps;       //< Steps taken before the comparison
+   double      maxError;    //< Largest position error relative to the reference
+   double      p99Error;    //< 99th percentile of the relative position errors
+   size_t      outliers;    //< Particles with an error above the tolerance
+   bool        passed;      //< No more than 1% outliers
+};
+
+/**
+ * Result of checking the lattice Boltzmann collision kernels
+ */
+struct CollisionValidation
+{
+   size_t      sites;       //< Random sites compared
+   double      maxError;    //< Largest error relative to the size of the terms
+   bool        passed;      //< maxError is within the tolerance
+};
+
+/**
+ * Step a backend and compare its positions with the native kernel. The
+ * error of a particle is the distance to the reference position divided
+ * by the reference's distance from the well, so particles far out are not
+ * held to tighter bounds than the float format gives them
+ *
+ * @param backend
+ *    The backend, not yet initialized
+ * @param name
+ *    Name of the backend, for the result
+ * @param numParticles
+ *    Requested number of particles
+ * @param steps
+ *    Steps of backend and reference before the comparison
+ * @param tolerance
+ *    Largest relative error that counts as agreeing. A particle that
+ *    passes close to the well amplifies rounding differences without
+ *    bound, so up to 1% of the particles may exceed it
+ */
+Validation validate(Backend& backend, const std::string& name, size_t numParticles, int steps, double tolerance);
+
+/**
+ * Write a table of the validations
+ */
+void writeValidation(std::ostream& out, const std::vector<Validation>& validations, double tolerance);
+
+/**
+ * Compare collisionK() and dotOmegaMass0() to dotOmegaMass2(), compiled
+ * natively, with the collision matrix evaluated in double precision at
+ * random sites. The error of a product is its difference from the
+ * reference divided by the sum of the magnitudes of its terms, so
+ * cancellation is not held against the float kernels
+ *
+ * @param sites
+ *    Number of random sites
+ * @param tolerance
+ *    Largest error that counts as agreeing
+ */
+CollisionValidation validateCollision(size_t sites, double tolerance);
+
+/**
+ * Write the result of validateCollision()
+ */
+void writeCollisionValidation(std::ostream& out, const CollisionValidation& validation, double tolerance);
+
+#endif
@@ -11,6 +11,13 @@
 
 #include "opengl.h"
 #include "shader.h"
+#include "counter_rng.h"
+#include "parallel_for.h"
+#include "phase_timer.h"
+#include "trace.h"
+#include "memory_accounting.h"
+#include "gl_memory.h"
+#include "context.h"
 
 #include <vector>
 #include <string>
@@ -29,6 +36,7 @@ string         _renderVertFile;
 string         _renderFragFile;
 
 bool           _running = true;
+auto_ptr<GL::Context> _context;   //< Window or headless OpenGL context
 
 vector<GLuint> _pVao;            //< Vertex array object for the positions
 vector<GLuint> _pVbo;            //< buffer object for the the positions;
@@ -48,6 +56,8 @@ GLuint         _query;           //< Handle to a query object
 
 vector<vec4>   _positions;
 vector<vec4>   _velocities;
+Compute::Philox _rng(1);         //< Random initial velocities, keyed by particle index
+Compute::MemoryAccount _memory("Particles"); //< Host copies and buffers of the particles
 
 int            _width;
 int            _height;
@@ -79,7 +89,7 @@ bool           _dirty;
  */
 void terminate(int exitCode)
 {
-   glfwTerminate();
+   _context.reset();
 
    exit(exitCode);
 }
@@ -122,8 +132,10 @@ void initParticle(int i)
    // same and determined by the variable r, but the directions are random
 
    // Define the velocity in terms of polar coordinates
-   float theta = 2 * M_PI * rand() / RAND_MAX;
-   float phi = 2 * M_PI * rand() * RAND_MAX;
+   float u[4];
+   _rng.uniform4(i, 0, u);
+   float theta = 2 * M_PI * u[0];
+   float phi = 2 * M_PI * u[1];
    float r = 3.51f;
    
    // Translate from polar to cartesian
@@ -150,10 +162,15 @@ void initParticles(int numParticles)
    _velocities.resize(numParticles);
    _positions.resize(numParticles);
    
-   for(size_t i = 0; i < numParticles; ++i)
+   // Each particle's random values depend only on its index, so the
+   // particles can be initialized on any number of threads
+   Compute::parallelFor(0, numParticles, [](size_t first, size_t last)
    {
-      initParticle(i);
-   }
+      for(size_t i = first; i < last; ++i)
+      {
+         initParticle(i);
+      }
+   });
 }
 
 /**
@@ -203,6 +220,14 @@ void init(int numParticles)
       glEnable(GL_BLEND);
       glBlendFunc(GL_ONE, GL_ONE);
 
+      // Both ping pong buffers of each kind, and the host copies they
+      // were uploaded from
+      size_t deviceBytes = 0;
+      for(size_t buf = 0; buf < _pVbo.size(); ++buf)
+      {
+         deviceBytes += GL::bufferBytes(_pVbo[buf]) + GL::bufferBytes(_vVbo[buf]);
+      }
+      _memory.set(Compute::vectorBytes(_positions) + Compute::vectorBytes(_velocities), deviceBytes);
    }
    catch (std::runtime_error exception)
    {
@@ -228,6 +253,11 @@ void GLFWCALL keypress(int key, int state)
          case 'r':
             reloadShaders();
             break;
+
+         case 'M':
+         case 'm':
+            Compute::MemoryRegistry::instance().report(std::cout);
+            break;
             
       }
    }
@@ -359,6 +389,8 @@ void drawPoints()
 
 void transformFeedback()
 {
+   GL::ScopedPhase timed("transformFeedback");
+
    // Update happens in a vertex shader. There are two outputs from the vertex shader:
    // position and velocity
    try
@@ -385,6 +417,7 @@ void transformFeedback()
 
 void draw(double time)
 {
+   GL::ScopedPhase timed("draw");
    try
    {
       glPointSize(1.0f);
@@ -392,7 +425,7 @@ void draw(double time)
       // Get the width and height of the window
       int width;
       int height;
-      glfwGetWindowSize(&width, &height);
+      _context->getSize(width, height);
 
       // Clear the color and depth buffers
       GL_ERR_CHECK();
@@ -449,7 +482,7 @@ int update(double time)
 void framerate(unsigned long frameCount)
 {
    gettimeofday(&_endTime, NULL);
-   double elapsed = _endTime.tv_sec - _startTime.tv_sec;
+   double elapsed = (_endTime.tv_sec - _startTime.tv_sec) + 1e-6 * (_endTime.tv_usec - _startTime.tv_usec);
    std::cout << "Frames per second: " << frameCount / elapsed << std::endl;
 }
 
@@ -484,95 +517,117 @@ int main(int argc, char* argv[])
    _zoomMin = 1;
    _zoom = 700;
 
-   // Initialize GLFW
-   glfwInit();
-
-   // Request an OpenGL core profile context, without backwards compatibility
-   glfwOpenWindowHint(GLFW_OPENGL_VERSION_MAJOR,  3);
-   glfwOpenWindowHint(GLFW_OPENGL_VERSION_MINOR,  2);
-   glfwOpenWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-   glfwOpenWindowHint(GLFW_OPENGL_PROFILE,        GLFW_OPENGL_CORE_PROFILE);
-   glfwOpenWindowHint(GLFW_FSAA_SAMPLES, 8);
-   //   glfwSwapInterval(0);
-   // Open a window and create its OpenGL context
-   if(!glfwOpenWindow(_width, _height, 0, 0, 0, 8, 32, 0, GLFW_WINDOW))
+   bool phases = false;
+   bool memory = false;
+   string traceFile;
+   bool headless = false;
+   unsigned long maxFrames = 0;
+   for(int i = 1; i < argc; ++i)
    {
-      std::cerr << "Failed to open GLFW window" << std::endl;
-      glfwTerminate();
+      string arg(argv[i]);
+      if(arg == "--phases")
+      {
+         phases = true;
+      }
+      else if(arg == "--memory")
+      {
+         memory = true;
+      }
+      else if(arg == "--headless")
+      {
+         headless = true;
+      }
+      else if(arg == "--frames" && i + 1 < argc && atol(argv[i + 1]) > 0)
+      {
+         maxFrames = atol(argv[++i]);
+      }
+      else if(arg == "--trace" && i + 1 < argc)
+      {
+         traceFile = argv[++i];
+      }
+      else
+      {
+         std::cerr << "Usage: " << argv[0] << " [--phases] [--memory] [--headless] [--frames n] [--trace file]" << std::endl;
+         return -1;
+      }
+   }
+
+   // Without a window there is no way to quit, so stop after a fixed
+   // number of frames
+   if(headless && maxFrames == 0)
+   {
+      maxFrames = 1000;
+   }
+
+   // Open a window, or with --headless an offscreen pbuffer, and create
+   // its OpenGL context
+   try
+   {
+      _context = auto_ptr<GL::Context>(GL::Context::create(headless ? GL::Context::HEADLESS : GL::Context::WINDOW, _width, _height, 8));
+   }
+   catch(std::runtime_error err)
+   {
+      std::cerr << "Failed to create an OpenGL context: " << err.what() << std::endl;
       return -1;
    }
 
    resize(_width, _height);
 
-   glfwSwapInterval(0);
+   _context->setSwapInterval(0);
 
-   glfwSetWindowSizeCallback(resize);
-   glfwSetKeyCallback(keypress);
-   glfwSetWindowCloseCallback(close);
-   glfwSetMouseButtonCallback(mouseButton);
-   glfwSetMousePosCallback(mouseMove);
-   glfwSetMouseWheelCallback(mouseWheel);
+   if(!_context->isHeadless())
+   {
+      glfwSetWindowSizeCallback(resize);
+      glfwSetKeyCallback(keypress);
+      glfwSetWindowCloseCallback(close);
+      glfwSetMouseButtonCallback(mouseButton);
+      glfwSetMousePosCallback(mouseMove);
+      glfwSetMouseWheelCallback(mouseWheel);
+   }
    
    std::cout << "GL Version: " << glGetString(GL_VERSION) << std::endl;
+   std::cout << "Context: " << _context->describe() << std::endl;
 
-   
-#if 0
-   // This section used to test FPS with varying numbers of particles
-   vector<float> numParticles =
+   if(phases)
    {
-      250000,
-      500000,
-      750000,
-      1000000,
-      2000000,
-      3000000,
-      4000000,
-      5000000,
-      6000000,
-      7000000,
-      8000000,
-      9000000,
-      10000000,
-      11000000,
-      12000000,
-      13000000,
-      14000000,
-      15000000,
-   };
-   
-   for(auto num : numParticles)
+      GL::PhaseTimer::instance().enable();
+   }
+
+   // Record a timeline of the frames. It is written on exit, and on
+   // SIGUSR1 while the program runs
+   if(!traceFile.empty())
    {
-      init(num);
-      _numFrames = 0;
-      gettimeofday(&_startTime, NULL);
-      
-      // Main loop. Run until ESC key is pressed or the window is closed
-      while(_running && _numFrames < 1000)
-      {
-         update(glfwGetTime());
-         glfwSwapBuffers();
-      }
-      std::cout << "num: " << num << std::endl;
-      framerate(_numFrames);
-      if(!_running)
-      {
-         break;
-      }
+      Compute::Tracer::instance().enable(traceFile);
+      Compute::Tracer::instance().installSignalHandler(SIGUSR1);
    }
-#else
+   
 
    init(250000);
 
+   // Batch runs are where particle counts are chosen, so they always
+   // report the memory the particles took
+   if(memory || headless)
+   {
+      Compute::MemoryRegistry::instance().report(std::cout);
+   }
+
    gettimeofday(&_startTime, NULL);
 
-   // Main loop. Run until ESC key is pressed or the window is closed
-   while(_running)
+   // Main loop. Run until ESC key is pressed, the window is closed or
+   // maxFrames frames have been drawn
+   while(_running && (maxFrames == 0 || _numFrames < maxFrames))
    {
-      update(glfwGetTime());
-      glfwSwapBuffers();
+      Compute::Tracer::instance().poll();
+      update(_context->getTime());
+
+      GL::ScopedPhase timed("swap", false);
+      _context->swapBuffers();
    }
    framerate(_numFrames);
+   if(phases)
+   {
+      GL::PhaseTimer::instance().report(std::cout);
+   }
 
    terminate(EXIT_SUCCESS);
-#endif
 }
@@ -8,87 +8,9 @@
 
 #include "ParticleSystemModel.h"
 
-using glm::vec3;
-using glm::vec4;
-
-//----------------------------------------------------------------------
-// Calculate the magnitude of the gravitational force between
-// two masses.
-//
-// Input:  m1 - mass in Kg
-//         m2 - mass in Kg
-//         r  - distance in meters
-//
-// Return: magnitude of attractive force in Newtons
-// floating point ops: 2
-//----------------------------------------------------------------------
-float gravity(float m1, float m2, float r)
-{
-   float G = 6.67e-11f; // Nm^2/kg^2
-   return G * m1 * m2 / (r * r);
-}
-
-//----------------------------------------------------------------------
-// Calculate the acceleration vector
-//
-// Input:  p0 - position in space (m)
-//         v0 - velocity (m / s^2)
-//         t  - time (s)
-//
-// m1 - singularity mass
-// m2 - particle mass
-// Output: acceleration vector (m/s)
-// floating point ops: 6
-//----------------------------------------------------------------------
-vec3 acceleration(State state, float t, float m1, float m2)
-{
-   float g = gravity(m1, m2, glm::length(state.x));
-   vec3 force = -g * glm::normalize(state.x);
-   
-   // Acceleration vector. F = ma => a = F/m
-   return force / m2;
-}
-
-//----------------------------------------------------------------------
-// RK4 functions
-// floating point ops: 6
-//----------------------------------------------------------------------
-Derivative evaluate(State initial, float t, float m1, float m2)
-{
-   Derivative OUT;
-   OUT.dx = initial.v;
-   OUT.dv = acceleration(initial, t, m1, m2);
-   return OUT;
-}
+#include <parallel_for.h>
 
-// floating point ops: 11
-Derivative evaluate(State initial, float t, float dt, Derivative d, float m1, float m2)
-{
-   State state;
-   state.x = initial.x + d.dx * dt;
-   state.v = initial.v + d.dv * dt;
-   
-   Derivative OUT;
-   OUT.dx = state.v;
-   OUT.dv = acceleration(state, t+dt, m1, m2);
-   
-   return OUT;
-}
-
-// 6 + 11 + 11 + 11 + 10 + 4 = 53
-void integrate(State& state, float t, float dt, float m1, float m2)
-{
-   Derivative a = evaluate(state, t, m1, m2);
-   Derivative b = evaluate(state, t, dt*0.5f, a, m1, m2);
-   Derivative c = evaluate(state, t, dt*0.5f, b, m1, m2);
-   Derivative d = evaluate(state, t, dt, c, m1, m2);
-   
-   vec3 dxdt = 0.166666667f * (a.dx + 2.0f*(b.dx + c.dx) + d.dx);
-   vec3 dvdt = 0.166666667f * (a.dv + 2.0f*(b.dv + c.dv) + d.dv);
-   
-   state.x = state.x + dxdt*dt;
-   state.v = state.v + dvdt*dt;
-}
+using glm::vec4;
 
 /**
  * Constructor
@@ -97,8 +19,9 @@ void integrate(State& state, float t, float dt, float m1, float m2)
  * clear color and depth clear value
  */
 ParticleSystemModel::ParticleSystemModel(unsigned int numParticles)
-:  _numParticles  (numParticles)
-,  _singularityMass  (9.5e9)
+:  _engine           (numParticles, 9.5e9f)
+,  _rng              (1)
+,  _numParticles     (numParticles)
 ,  _particleMass     (1e5)
 {
    // Initial particle system, textures and FBOs
@@ -124,8 +47,10 @@ void ParticleSystemModel::initParticle(int i)
    // same and determined by the variable r, but the directions are random
    
    // Define the velocity in terms of polar coordinates
-   float theta = 2 * M_PI * rand() / RAND_MAX;
-   float phi = 2 * M_PI * rand() * RAND_MAX;
+   float u[4];
+   _rng.uniform4(i, 0, u);
+   float theta = 2 * M_PI * u[0];
+   float phi = 2 * M_PI * u[1];
    float r = 3.51f;
    
    // Translate from polar to cartesian
@@ -137,12 +62,10 @@ void ParticleSystemModel::initParticle(int i)
    float y = r * sin_phi * sin_theta;
    float z = r * cos_theta;
    
-   _velocities.at(i) = vec4(x,y,z,0);
-   _initialVelocities.at(i) = _velocities.at(i);
    float height = 0.1;
    
+   _engine.getStore().set(i, height, 0, 0, x, y, z);
    _positions.at(i)  = vec4(height, 0, 0, 1.0f);
-   _initialPositions.at(i) = _positions.at(i);
 }
 
 /*
@@ -150,15 +73,18 @@ void ParticleSystemModel::initParticle(int i)
  */
 void ParticleSystemModel::initParticles(unsigned int numParticles)
 {
+   _engine.getStore().resize(numParticles);
    _positions.resize(numParticles);
-   _velocities.resize(numParticles);
-   _initialPositions.resize(numParticles);
-   _initialVelocities.resize(numParticles);
    
-   for(size_t i = 0; i < _numParticles; ++i)
+   // Each particle's velocity depends only on its index, so the particles
+   // can be initialized in parallel
+   Compute::parallelFor(0, _numParticles, [this](size_t first, size_t last)
    {
-      initParticle(i);
-   }
+      for(size_t i = first; i < last; ++i)
+      {
+         initParticle(i);
+      }
+   });
 }
 
 /*
@@ -166,25 +92,10 @@ void ParticleSystemModel::initParticles(unsigned int numParticles)
  */
 void ParticleSystemModel::update()
 {
-   // Time step
-   static float t = 0.01;
+   // RK4 step on the structure-of-arrays store. Particles that get too far
+   // away are reset to their initial position and velocity by the kernel
+   _engine.update();
    
-   // Update each particle
-   for(int i = 0; i < _numParticles; i++)
-   {
-      // Get the new position using RK4 (4th order Runge-Kutta method)
-      State state;
-      state.x = vec3(_positions[i].x, _positions[i].y, _positions[i].z);
-      state.v = vec3(_velocities[i].x, _velocities[i].y, _velocities[i].z);
-      integrate(state, 0, t, _singularityMass, _particleMass);
-      _positions[i] = vec4(state.x, 1);
-      _velocities[i] = vec4(state.v, 0);
-      
-      // If a particle gets too far away, reset the position and velocity
-      if(glm::length(vec3(_positions[i].x, _positions[i].y, _positions[i].z)) > 100.0f)
-      {
-         _positions[i] = _initialPositions[i];
-         _velocities[i] = _initialVelocities[i];
-      }
-   }
+   // The view draws interleaved vec4 positions
+   _engine.getStore().interleavePositions(&_positions[0].x, 0, _numParticles);
 }
\ No newline at end of file
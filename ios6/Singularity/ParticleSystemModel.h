@@ -13,22 +13,9 @@
 
 #include <glm/glm.hpp>
 #include <vector>
-   
-/**
- * Structures for passing around position and velocity state
- * and derivatives for use with RK4
- */
-struct Derivative
-{
-   glm::vec3 dx;
-   glm::vec3 dv;
-};
 
-struct State
-{
-   glm::vec3 x;
-   glm::vec3 v;
-};
+#include <counter_rng.h>
+#include <particle_engine.h>
 
 class ParticleSystemModel
 {
@@ -93,12 +80,12 @@ public:
    
    float getSingularityMass() const
    {
-      return _singularityMass;
+      return _engine.getWellMass();
    }
    
    void setSingularityMass(float mass)
    {
-      _singularityMass = mass;
+      _engine.setWellMass(mass);
    }
    
    float getParticleMass() const
@@ -115,14 +102,12 @@ public:
 private:
    
    // Particle data
-   std::vector<glm::vec4>        _positions;
-   std::vector<glm::vec4>        _velocities;
-   std::vector<glm::vec4>        _initialPositions;
-   std::vector<glm::vec4>        _initialVelocities;
+   Particles::ParticleEngine<>   _engine;             //< Particle state and the RK4 kernels
+   std::vector<glm::vec4>        _positions;          //< Positions in the layout drawn by the view
+   Compute::Philox               _rng;                //< Random initial velocities, keyed by particle index
    
    unsigned int                  _numParticles;       //< Number of particles
    
-   float                         _singularityMass;    //< The mass of the singularity
-   float                         _particleMass;       //< the mass of the particles
+   float                         _particleMass;       //< the mass of the particles. Cancels out of the motion
 };
 #endif /* defined(__Singularity__ParticleSystemModel__) */
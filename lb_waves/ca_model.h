@@ -0,0 +1,46 @@
+//--------------------------------------------------------------------------------
+// ca_model.h
+//
+// Interface shared by the wave models. The view (CAViewGLSL) and the normals
+// computation (CAModelNormals) only need a texture of lattice positions and the
+// lattice size, so any model that produces those can drive them.
+//--------------------------------------------------------------------------------
+#ifndef _ca_model_h
+#define _ca_model_h
+
+#include <glm/glm.hpp>
+
+#include "opengl.h"
+
+/**
+ * Abstract wave model. The current positions are stored in an RGBA float
+ * texture of size getLatticeSize(), one (x, height, z, 1) texel per lattice
+ * point
+ */
+class CAModel
+{
+public:
+   /**
+    * Destructor
+    */
+   virtual ~CAModel()
+   {
+   }
+
+   /**
+    * Update the model to the next time step
+    */
+   virtual void update() = 0;
+
+   /**
+    * Get the current position texture ID
+    */
+   virtual const GLuint getCurPositionID() const = 0;
+
+   /**
+    * @return the lattice size
+    */
+   virtual const glm::ivec2 getLatticeSize() const = 0;
+};
+
+#endif
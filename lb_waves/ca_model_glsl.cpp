@@ -14,6 +14,9 @@
 
 #include "ca_model_glsl.h"
 
+#include <gl_memory.h>
+#include <phase_timer.h>
+
 using glm::vec2;
 using glm::vec4;
 using std::vector;
@@ -45,6 +48,7 @@ CAModelGLSL::CAModelGLSL(const glm::ivec2& size, const glm::vec2& min, const glm
 , _physicalSize(physicalSize)
 , _timeStep    (timeStep)
 , _ocean       (Ocean(size.x, 0.00005f, vec2(0.0f,32.0f), 64))
+, _memory      ("CAModelGLSL")
 
 {
    // Initial state
@@ -317,6 +321,14 @@ void CAModelGLSL::uploadInitialConditions()
       glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
    }
 
+   // The host copies stay alive next to the source and destination textures
+   size_t deviceBytes = 0;
+   for(unsigned int id = 0; id < _posTexID.size(); ++id)
+   {
+      deviceBytes += GL::textureBytes(_posTexID[id]) + GL::textureBytes(_massFlowTexID0[id]) + GL::textureBytes(_massFlowTexID1[id]);
+   }
+   _memory.set(Compute::vectorBytes(_positions) + Compute::vectorBytes(_massFlow0) + Compute::vectorBytes(_massFlow1),
+               deviceBytes);
 }
 
 /*
@@ -471,6 +483,9 @@ void CAModelGLSL::initComputeQuad()
  */
 void CAModelGLSL::update()
 {
+   // The counters only see the CPU side: the driver, or all of the work
+   // under a software renderer such as llvmpipe
+   GL::ScopedPhase timed("CAModelGLSL::update", true, size_t(_size.x) * _size.y);
    try
    {
       GL_ERR_CHECK();
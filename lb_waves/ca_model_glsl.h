@@ -19,11 +19,13 @@
 
 #include "shader.h"
 #include "ocean.h"
+#include "ca_model.h"
+#include "memory_accounting.h"
 
 /**
  * The cellular automata model for the waves
  */
-class CAModelGLSL
+class CAModelGLSL : public CAModel
 {
 public:
    /**
@@ -47,17 +49,17 @@ public:
    /**
     * Destructor
     */
-   ~CAModelGLSL();
+   virtual ~CAModelGLSL();
    
    /**
     * Update the model to the next time step
     */
-   void update();
+   virtual void update();
    
    /**
     * Get the current position texture ID
     */
-   const GLuint getCurPositionID() const
+   virtual const GLuint getCurPositionID() const
    {
       return _posTexID[_dst];
    }
@@ -65,7 +67,7 @@ public:
    /**
     * @return the lattice size
     */
-   const glm::ivec2 getLatticeSize() const
+   virtual const glm::ivec2 getLatticeSize() const
    {
       return _size;
    }
@@ -139,5 +141,6 @@ private:
    float                         _lambda;             //< spacing between lattice points, in meters
    glm::vec2                     _v;                  //< _lambda / _timeStep
    Ocean                         _ocean;              //< Initial conditions
+   Compute::MemoryAccount        _memory;             //< Host copies and GPU textures of the lattice
 };
 #endif
@@ -16,6 +16,9 @@
 
 #include "ca_model_normals.h"
 
+#include <gl_memory.h>
+#include <phase_timer.h>
+
 using glm::ivec2;
 using glm::vec2;
 using glm::vec4;
@@ -24,9 +27,10 @@ using std::vector;
 /**
  * Constructor.
  */
-CAModelNormals::CAModelNormals(const CAModelGLSL* model, GL::Program* computeProg)
+CAModelNormals::CAModelNormals(const CAModel* model, GL::Program* computeProg)
 : _model       (model)
 , _computeProg (computeProg)
+, _memory      ("CAModelNormals")
 {
    
    _posAttr = _computeProg->getAttribLocation("pos");
@@ -207,6 +211,8 @@ void CAModelNormals::createFBO()
       glBindTexture(GL_TEXTURE_2D, 0);
       glBindFramebuffer(GL_FRAMEBUFFER, 0);
       GL_ERR_CHECK();
+
+      _memory.setDevice(GL::textureBytes(_normTexID));
    }
    catch (std::runtime_error exception)
    {
@@ -220,9 +226,10 @@ void CAModelNormals::createFBO()
  */
 void CAModelNormals::update()
 {
+   const ivec2 size = _model->getLatticeSize();
+   GL::ScopedPhase timed("CAModelNormals::update", true, size_t(size.x) * size.y);
    glDisable(GL_BLEND);
    glDisable(GL_DEPTH_TEST);
-   const ivec2 size = _model->getLatticeSize();
    
    _computeProg->bind();
    
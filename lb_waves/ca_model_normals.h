@@ -15,9 +15,10 @@
 #define _ca_model_normals_h
 
 #include <glm/glm.hpp>
-#include "ca_model_glsl.h"
+#include "ca_model.h"
 #include "opengl.h"
 #include "shader.h"
+#include "memory_accounting.h"
 #include <string>
 
 /**
@@ -30,7 +31,7 @@ public:
    /**
     * Constructor. 
     */
-   CAModelNormals(const CAModelGLSL* model, GL::Program* computeProg);
+   CAModelNormals(const CAModel* model, GL::Program* computeProg);
    
    /**
     * Update the model to the next time step
@@ -82,7 +83,7 @@ protected:
    void fboStatus();
 
 private:
-   const CAModelGLSL*            _model;              //< Pointer to the model
+   const CAModel*                _model;              //< Pointer to the model
    GL::Program*                  _computeProg;        //< Computation shader
    GLuint                        _normTexID;          //< Texture IDs for the normal textures
    GLuint                        _fboID;              //< Frame buffer object handles
@@ -92,5 +93,6 @@ private:
    GLuint                        _tcAttr;             //< Location of texture coordinate attribute
    float                         _deltaS;             //< Distance in S to the next texel
    float                         _deltaT;             //< Distance in T to the next texel
+   Compute::MemoryAccount        _memory;             //< GPU memory of the normal texture
 };
 #endif
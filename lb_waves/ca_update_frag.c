@@ -29,31 +29,9 @@ uniform float timeStep;
 
 out vec4 calc[3];
 
-// Gravitational constant
-const float g = 9.81;
-
-/**
- * Dots row omega_i with the mass flow.
- */
-float dotOmegaMass0(float k, const vec4 mf0, const vec4 mf1)
-{
-   float b = -4 * k;
-   float c =  2 - b;
-   return b * mf0.x + c * mf0.y + c * mf0.z + c * mf0.w + c * mf1.x;
-}
-
-float dotOmegaMass1(float k, const vec4 mf0, const vec4 mf1)
-{
-   float a = k - 1;
-   return k * mf0.x + a * mf0.y + a * mf0.z + k * mf0.w + k * mf1.x;
-}
-
-float dotOmegaMass2(float k, const vec4 mf0, const vec4 mf1)
-{
-   float a = k - 1;
-   return k * mf0.x + k * mf0.y + k * mf0.z + a * mf0.w + a * mf1.x;
-}
-
+// Collision: collisionK() and dotOmegaMass0() to dotOmegaMass2(). Shared
+// with the C++ code, see common/kernels
+#include "../common/kernels/lb_collision.h"
 
 void main(void)
 {
@@ -80,12 +58,9 @@ void main(void)
 
    calc[0].y = clamp(calc[0].y, -25, 25);
 
-   // Velocity is lattice site spacing (meters) divided by length of time step (seconds)
-   float v = lambda / timeStep;
-
    // Choose K for this site.
    // Remember that calc[2].y is the wave number
-   float K = g / (v * v * calc[2].y);
+   float K = collisionK(lambda, timeStep, calc[2].y);
 
    // The 4 texture map indices used for indexing
    // into the mass flow textures
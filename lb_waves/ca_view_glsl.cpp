@@ -9,10 +9,13 @@
 // Jeff Bowles <jbowles@riskybacon.com>
 //--------------------------------------------------------------------------------
 #include "ca_view_glsl.h"
-#include "ca_model_glsl.h"
+#include "ca_model.h"
 #include "ca_model_normals.h"
 #include <iostream>
 
+#include <gl_memory.h>
+#include <phase_timer.h>
+
 using glm::ivec2;
 using glm::vec2;
 using std::vector;
@@ -22,7 +25,7 @@ using std::vector;
  *
  * Initialize vertex array objects, vertex buffer objects,
  */
-CAViewGLSL::CAViewGLSL(GLuint posAttr, GLuint posTexUnit, GLuint normTexUnit, CAModelGLSL* model, CAModelNormals* normals)
+CAViewGLSL::CAViewGLSL(GLuint posAttr, GLuint posTexUnit, GLuint normTexUnit, CAModel* model, CAModelNormals* normals)
 : _posAttr     (posAttr)
 , _posTexUnit  (posTexUnit)
 , _normTexUnit (normTexUnit)
@@ -31,6 +34,7 @@ CAViewGLSL::CAViewGLSL(GLuint posAttr, GLuint posTexUnit, GLuint normTexUnit, CA
 , _pVao        (0)
 , _posBuf      (0)
 , _idxBuf      (0)
+, _memory      ("CAViewGLSL")
 {
    const ivec2 size = _model->getLatticeSize();
    
@@ -98,6 +102,9 @@ CAViewGLSL::CAViewGLSL(GLuint posAttr, GLuint posTexUnit, GLuint normTexUnit, CA
    glVertexAttribPointer(_posAttr, 2, GL_FLOAT, GL_FALSE, 0, NULL);
    glEnableVertexAttribArray(_posAttr);
    glBindVertexArray(0);
+
+   _memory.set(Compute::vectorBytes(_indices) + Compute::vectorBytes(_positions),
+               GL::bufferBytes(_idxBuf) + GL::bufferBytes(_posBuf));
 }
 
 /*
@@ -115,6 +122,7 @@ CAViewGLSL::~CAViewGLSL()
  */
 void CAViewGLSL::draw()
 {
+   GL::ScopedPhase timed("CAViewGLSL::draw");
    // Multi-texturing - there are two textures bound. These textures
    // contain the positions and the normals
    glActiveTexture(_posTexUnit);
@@ -11,10 +11,11 @@
 #ifndef _ca_view_glsl_h
 #define _ca_view_glsl_h
 
-class CAModelGLSL;
+class CAModel;
 class CAModelNormals;
 
 #include "opengl.h"
+#include "memory_accounting.h"
 #include <glm/glm.hpp>
 #include <vector>
 
@@ -22,7 +23,7 @@ class CAModelNormals;
  * The OpenGL representation of the cellular automata model
  * This particular view uses vertex texture fetch to get the positions
  * of the vertices. The texture map with the positions is calculated
- * in CAModelGLSL
+ * in a CAModel such as CAModelGLSL or OceanModelFFT
  */
 class CAViewGLSL
 {
@@ -30,7 +31,7 @@ public:
    /**
     * Constructor
     */
-   CAViewGLSL(GLuint posAttr, GLuint posTexUnit, GLuint normTexUnit, CAModelGLSL* model, CAModelNormals* normals);
+   CAViewGLSL(GLuint posAttr, GLuint posTexUnit, GLuint normTexUnit, CAModel* model, CAModelNormals* normals);
    
    /**
     * Destructor
@@ -51,13 +52,14 @@ private:
    GLuint                     _posAttr;            //< Location of the position attribute
    GLuint                     _posTexUnit;         //< Texture unit for the positions
    GLuint                     _normTexUnit;        //< Texture unit for the normals
-   CAModelGLSL*               _model;              //< Data model
+   CAModel*                   _model;              //< Data model
    CAModelNormals*            _normals;            //< Normals for the mesh
    GLuint                     _pVao;               //< Vertex array object for the positions
    GLuint                     _posBuf;             //< Buffer object for the positions
    GLuint                     _idxBuf;             //< Buffer object for the vertex indices
    std::vector<GLuint>        _indices;            //< Set of indices - the order to draw the positions
    std::vector<glm::vec2>     _positions;          //< Set of texture map positions
+   Compute::MemoryAccount     _memory;             //< Host and GPU copies of the mesh
 
    
 };
@@ -14,13 +14,21 @@
 #include <GL/glfw.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <memory>
 #include <string>
 
 #include "scene.h"
 
+#include <phase_timer.h>
+#include <trace.h>
+#include <memory_accounting.h>
+#include <cpu_dispatch.h>
+#include <context.h>
+
 bool           _running;                  //< true if the program is running, false if it is time to terminate
 
 Scene*         _scene;
+std::unique_ptr<GL::Context> _context;    //< Window or headless OpenGL context
 
 // Size of window
 int            _winWidth;
@@ -48,7 +56,7 @@ timeval        _endTime;
  */
 void terminate(int exitCode)
 {
-   glfwTerminate();
+   _context.reset();
    exit(exitCode);
 }
 
@@ -57,6 +65,7 @@ void terminate(int exitCode)
 //----------------------------------------------------------------------
 void saveFrame(void)
 {
+   Compute::ScopedTrace trace("saveFrame");
    char filename[1024];
    FILE* f;
    int size, n;
@@ -150,6 +159,11 @@ void GLFWCALL keypress(int key, int state)
          case 'c':
             _scene->resetCameraToInitialState();
             break;
+
+         case 'M':
+         case 'm':
+            Compute::MemoryRegistry::instance().report(std::cout);
+            break;
             
          case GLFW_KEY_SPACE:
             _paused = !_paused;
@@ -224,11 +238,13 @@ int update(double time)
       {
          _scene->draw();
          _dirty = false;
-         glfwSwapBuffers();
+
+         GL::ScopedPhase timed("swap", false);
+         _context->swapBuffers();
       }
       else
       {
-         glfwWaitEvents();
+         _context->waitEvents();
       }
    }
    catch (std::runtime_error exception)
@@ -279,17 +295,129 @@ void GLFWCALL mouseWheel(int mouseWheelCur)
 void framerate(void)
 {
    gettimeofday(&_endTime, NULL);
-   double elapsed = _endTime.tv_sec - _startTime.tv_sec;
+   double elapsed = (_endTime.tv_sec - _startTime.tv_sec) + (_endTime.tv_usec - _startTime.tv_usec) * 1e-6;
    std::cout << "Frame per second: " << _frame / elapsed << std::endl;
 }
 
 /**
  * Program entry point
+ *
+ * Options:
+ *    --spectral           Use the FFT ocean instead of the Lattice-Boltzmann model
+ *    --loop-cache <file>  Play the spectral ocean back from a loop cache file
+ *    --cascades <n>       Sum n spectral oceans of decreasing size
+ *    --cascade-length <m> Size in meters of the largest cascade
+ *    --spectrum-accuracy  Print the accuracy of the SIMD spectrum evaluation and exit
+ *    --phases             Print the time spent in each phase of the frame at exit
+ *    --counters           --phases with hardware performance counters per phase
+ *    --memory             Print the host and GPU memory of each subsystem after setup.
+ *                         Always on with --headless
+ *    --headless           Render to an offscreen EGL pbuffer instead of a window
+ *    --frames <n>         Exit after n frames. Default with --headless: 1000
+ *    --trace <file>       Write a Chrome trace of the frames to file at exit, and on SIGUSR1
  */
 int main(int argc, char* argv[])
 {
    int _winWidth = 1280;
    int _winHeight = 720;
+
+   Scene::Dynamics dynamics = Scene::LATTICE_BOLTZMANN;
+   std::string loopCache;
+   float loopCacheFps = 10.0f;
+   int cascades = 0;
+   float cascadeLength = 2048.0f;
+   bool phases = false;
+   bool counters = false;
+   bool memory = false;
+   std::string traceFile;
+   bool headless = false;
+   bool spectrumAccuracy = false;
+   int maxFrames = 0;
+   for(int i = 1; i < argc; ++i)
+   {
+      std::string arg(argv[i]);
+      if(arg == "--spectral")
+      {
+         dynamics = Scene::SPECTRAL;
+      }
+      else if(arg == "--loop-cache" && i + 1 < argc)
+      {
+         loopCache = argv[++i];
+      }
+      else if(arg == "--loop-cache-fps" && i + 1 < argc && atof(argv[i + 1]) > 0)
+      {
+         loopCacheFps = float(atof(argv[++i]));
+      }
+      else if(arg == "--cascades" && i + 1 < argc && atoi(argv[i + 1]) > 0)
+      {
+         cascades = atoi(argv[++i]);
+      }
+      else if(arg == "--cascade-length" && i + 1 < argc && atof(argv[i + 1]) > 0)
+      {
+         cascadeLength = float(atof(argv[++i]));
+      }
+      else if(arg == "--phases")
+      {
+         phases = true;
+      }
+      else if(arg == "--counters")
+      {
+         phases   = true;
+         counters = true;
+      }
+      else if(arg == "--memory")
+      {
+         memory = true;
+      }
+      else if(arg == "--headless")
+      {
+         headless = true;
+      }
+      else if(arg == "--frames" && i + 1 < argc && atoi(argv[i + 1]) > 0)
+      {
+         maxFrames = atoi(argv[++i]);
+      }
+      else if(arg == "--trace" && i + 1 < argc)
+      {
+         traceFile = argv[++i];
+      }
+      else if(arg == "--spectrum-accuracy")
+      {
+         spectrumAccuracy = true;
+      }
+      else if(arg == "--isa" && i + 1 < argc)
+      {
+         // Force the instruction set of the CPU spectrum kernels
+         Compute::Isa isa;
+         if(!Compute::parseIsa(argv[++i], isa))
+         {
+            std::cerr << "Unknown instruction set " << argv[i] << ", expected one of: " << Compute::CpuDispatch::availableNames() << std::endl;
+            return -1;
+         }
+         try
+         {
+            Compute::CpuDispatch::instance().setIsa(isa);
+         }
+         catch (std::runtime_error exception)
+         {
+            std::cerr << exception.what() << std::endl;
+            return -1;
+         }
+      }
+      else
+      {
+         std::cerr << "Usage: " << argv[0] << " [--spectral] [--loop-cache <file>] [--loop-cache-fps <fps>] [--cascades <n>] [--cascade-length <m>] [--spectrum-accuracy] [--isa <level>] [--phases] [--counters] [--memory] [--headless] [--frames <n>] [--trace <file>]" << std::endl;
+         std::cerr << "Levels for --isa: " << Compute::CpuDispatch::availableNames() << std::endl;
+         return -1;
+      }
+   }
+
+   if(spectrumAccuracy)
+   {
+      Ocean ocean(128, 0.00005f, glm::vec2(0.0f,32.0f), 64);
+      ocean.printSpectrumAccuracy(std::cout);
+      return 0;
+   }
    
    _frame = 0;
    _running = true;
@@ -297,50 +425,101 @@ int main(int argc, char* argv[])
    _paused = false;
    _dirty = true;
    
-   // Initialize GLFW
-   glfwInit();
-
-   // Request an OpenGL core profile context, without backwards compatibility
-   glfwOpenWindowHint(GLFW_OPENGL_VERSION_MAJOR,  3);
-   glfwOpenWindowHint(GLFW_OPENGL_VERSION_MINOR,  2);
-   glfwOpenWindowHint(GLFW_OPENGL_FORWARD_COMPAT, GL_TRUE);
-   glfwOpenWindowHint(GLFW_OPENGL_PROFILE,        GLFW_OPENGL_CORE_PROFILE);
-   glfwOpenWindowHint(GLFW_FSAA_SAMPLES,          8);
-
-   // Open a window and create its OpenGL context
-   if(!glfwOpenWindow(_winWidth, _winHeight, 0, 0, 0, 0, 32, 0, GLFW_WINDOW ))
+   // Without a window there is no way to quit, so stop after a fixed
+   // number of frames
+   if(headless && maxFrames == 0)
+   {
+      maxFrames = 1000;
+   }
+
+   // Open a window, or with --headless an offscreen pbuffer, and create
+   // its OpenGL context
+   try
    {
-      std::cerr << "Failed to open GLFW window" << std::endl;
-      glfwTerminate();
+      _context.reset(GL::Context::create(headless ? GL::Context::HEADLESS : GL::Context::WINDOW, _winWidth, _winHeight, 8));
+   }
+   catch (std::runtime_error exception)
+   {
+      std::cerr << "Failed to create an OpenGL context: " << exception.what() << std::endl;
       return -1;
    }
 
-   _scene = new Scene(std::string(SOURCE_DIR), _winWidth, _winHeight);
+   if(phases)
+   {
+      GL::PhaseTimer::instance().enable();
+      if(counters)
+      {
+         std::cout << "Performance counters: " << GL::PhaseTimer::instance().enableCounters() << std::endl;
+      }
+   }
+
+   // Record a timeline of the frames. It is written on exit, and on
+   // SIGUSR1 while the program runs
+   if(!traceFile.empty())
+   {
+      Compute::Tracer::instance().enable(traceFile);
+      Compute::Tracer::instance().installSignalHandler(SIGUSR1);
+   }
+
+   _scene = new Scene(std::string(SOURCE_DIR), _winWidth, _winHeight, dynamics);
+   if(cascades > 0)
+   {
+      try
+      {
+         _scene->useCascades(cascades, cascadeLength);
+      }
+      catch (std::runtime_error exception)
+      {
+         std::cerr << exception.what() << std::endl;
+         return -1;
+      }
+   }
+   if(!loopCache.empty())
+   {
+      _scene->useLoopCache(loopCache, loopCacheFps);
+   }
 
    // Uncomment this line to test frame rate
-   //glfwSwapInterval(0);
-   glfwSetWindowSizeCallback(resize);
-   glfwSetKeyCallback(keypress);
-   glfwSetWindowCloseCallback(close);
-   glfwSetMouseButtonCallback(mouseButton);
-   glfwSetMouseWheelCallback(mouseWheel);
-   glfwSetMousePosCallback(mouseMove);
+   //_context->setSwapInterval(0);
+   if(!_context->isHeadless())
+   {
+      glfwSetWindowSizeCallback(resize);
+      glfwSetKeyCallback(keypress);
+      glfwSetWindowCloseCallback(close);
+      glfwSetMouseButtonCallback(mouseButton);
+      glfwSetMouseWheelCallback(mouseWheel);
+      glfwSetMousePosCallback(mouseMove);
+      _mouseWheelPrev = glfwGetMouseWheel();
+   }
 
    std::cout << "GL Version: " << glGetString(GL_VERSION) << std::endl;
+   std::cout << "Context: " << _context->describe() << std::endl;
+   std::cout << "CPU kernels: " << Compute::CpuDispatch::instance().describe() << std::endl;
 
-   _mouseWheelPrev = glfwGetMouseWheel();
+   // Batch runs are where lattice sizes are chosen, so they always report
+   // the memory the scene took
+   if(memory || headless)
+   {
+      Compute::MemoryRegistry::instance().report(std::cout);
+   }
 
    // Get the starting time
    gettimeofday(&_startTime, NULL);
 
-   // Main loop. Run until ESC key is pressed or the window is closed
-   while(_running)
+   // Main loop. Run until ESC key is pressed, the window is closed or
+   // maxFrames frames have been drawn
+   while(_running && (maxFrames == 0 || _frame < maxFrames))
    {
-      update(glfwGetTime());
+      Compute::Tracer::instance().poll();
+      update(_context->getTime());
       //      saveFrame();
       _frame++;
    }
    framerate();
+   if(phases)
+   {
+      GL::PhaseTimer::instance().report(std::cout);
+   }
    
    
    terminate(EXIT_SUCCESS);
@@ -11,6 +11,13 @@
 //--------------------------------------------------------------------------------
 
 #include "ocean.h"
+#include "ocean_loop_cache.h"
+#include "parallel_for.h"
+#include "spectrum_rows.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cmath>
 
 using glm::vec2;
 using glm::vec3;
@@ -20,27 +27,12 @@ using glm::normalize;
 using glm::length;
 
 /*
- * @return random value in range [0,1], uniformly distributed
- */
-float uniformRandomVariable()
-{
-   return (float)rand()/RAND_MAX;
-}
-
-/*
- * @return a random complex number, normal distribution
+ * @return the counter used to generate the random values at lattice position (n', m').
+ *         Negative positions are used for hTilde_0(-n', -m') and map to distinct counters
  */
-complex_type gaussianRandomVariable()
+static uint64_t latticeCounter(int n_prime, int m_prime)
 {
-   float x1, x2, w;
-   do
-   {
-      x1 = 2.f * uniformRandomVariable() - 1.f;
-      x2 = 2.f * uniformRandomVariable() - 1.f;
-      w = x1 * x1 + x2 * x2;
-   } while ( w >= 1.f );
-   w = sqrt((-2.f * log(w)) / w);
-   return complex_type(x1 * w, x2 * w);
+   return uint64_t(uint32_t(n_prime)) | (uint64_t(uint32_t(m_prime)) << 32);
 }
 
 /*
@@ -54,21 +46,126 @@ complex_type gaussianRandomVariable()
  *    Wind direction
  * @param length
  *    Size of the simulation in meters (length x length area)
+ * @param seed
+ *    Seed for the random amplitudes
+ * @param plan
+ *    Shared in-place FFT plan, or NULL to create one
+ * @param kMin, kMax
+ *    Band limits in radians per meter
  */
-Ocean::Ocean(const int N, const float A, const glm::vec2 w, const float length)
+Ocean::Ocean(const int N, const float A, const glm::vec2 w, const float length, const uint64_t seed, fftw_plan plan,
+             const float kMin, const float kMax)
 : _g        (9.81)
+, _T        (200.0f)
 , _N        (N)
 , _Nplus1   (N+1)
 , _A        (A)
 , _w        (w)
+, _kMin     (kMin)
+, _kMax     (kMax)
 , _length   (length)
+, _rng      (seed)
+, _hTildePlan(plan)
+, _ownsPlan (plan == NULL)
+, _loopCache(NULL)
+, _memory   ("Ocean")
 {
    _pos.resize(_Nplus1 * _Nplus1);
 
+   computeAmplitudes();
+
+   // Arrays from fftw_malloc have the alignment a shared plan expects
    _hTilde       = (complex_type*) fftw_malloc(sizeof(complex_type) * _N * _N);
-   _hTildePlan   = fftw_plan_dft_2d(N, N, reinterpret_cast<fftw_complex*>(_hTilde),
-                                          reinterpret_cast<fftw_complex*>(_hTilde),
-                                          FFTW_FORWARD, FFTW_ESTIMATE);
+   if(_ownsPlan)
+   {
+      _hTildePlan = fftw_plan_dft_2d(N, N, reinterpret_cast<fftw_complex*>(_hTilde),
+                                           reinterpret_cast<fftw_complex*>(_hTilde),
+                                           FFTW_FORWARD, FFTW_ESTIMATE);
+   }
+
+   _memory.setHost(Compute::vectorBytes(_hTilde0) + Compute::vectorBytes(_hTilde0mkConj) + Compute::vectorBytes(_omega)
+                   + sizeof(complex_type) * _N * _N + Compute::vectorBytes(_pos));
+}
+
+/*
+ * Compute _hTilde0, _hTilde0mkConj and _omega from the spectrum
+ */
+void Ocean::computeAmplitudes()
+{
+   // The initial amplitudes do not change over time, so compute them once.
+   // Each row is independent and the random values depend only on the lattice
+   // position, so the result is the same for any number of threads
+   _hTilde0.resize(_N * _N);
+   _hTilde0mkConj.resize(_N * _N);
+   _omega.resize(_N * _N);
+   Compute::parallelFor(0, _N, [this](size_t first, size_t last)
+   {
+      // Uniform values for +k in [0, N) and for -k in [N, 2N)
+      std::vector<float> u1(2 * _N);
+      std::vector<float> u2(2 * _N);
+      std::vector<float> z0(2 * _N);
+      std::vector<float> z1(2 * _N);
+      std::vector<float> p(2 * _N);
+
+      for(int m_prime = int(first); m_prime < int(last); m_prime++)
+      {
+         float u[4];
+         for(int n_prime = 0; n_prime < _N; n_prime++)
+         {
+            _rng.uniform4(latticeCounter(n_prime, m_prime), 0, u);
+            u1[n_prime] = u[0];
+            u2[n_prime] = u[1];
+
+            _rng.uniform4(latticeCounter(-n_prime, -m_prime), 0, u);
+            u1[_N + n_prime] = u[0];
+            u2[_N + n_prime] = u[1];
+         }
+
+         // Gaussian random variables and the spectrum for the whole row at once
+         Compute::boxMuller(2 * _N, &u1[0], &u2[0], &z0[0], &z1[0]);
+         phillipsRow(m_prime, &p[0]);
+         phillipsRow(m_prime, &p[_N], true);
+
+         // The angular frequencies do not depend on time either
+         dispersionRow(m_prime, &_omega[m_prime * _N]);
+
+         for(int n_prime = 0; n_prime < _N; n_prime++)
+         {
+            int index = m_prime * _N + n_prime;
+            complex_type r0(z0[n_prime], z1[n_prime]);
+            complex_type r1(z0[_N + n_prime], z1[_N + n_prime]);
+            _hTilde0[index]       = r0 * sqrt(p[n_prime] / 2.0f);
+            _hTilde0mkConj[index] = std::conj(r1 * sqrt(p[_N + n_prime] / 2.0f));
+         }
+      }
+   }, 16);
+}
+
+/*
+ * Change the spectrum parameters and recompute the initial amplitudes
+ */
+void Ocean::setSpectrum(float A, const glm::vec2& w)
+{
+   // The cached frames belong to the old spectrum
+   delete _loopCache;
+   _loopCache = NULL;
+
+   _A = A;
+   _w = w;
+   computeAmplitudes();
+}
+
+/*
+ * Limit the spectrum to kMin <= |k| < kMax and recompute the initial amplitudes
+ */
+void Ocean::setBand(float kMin, float kMax)
+{
+   delete _loopCache;
+   _loopCache = NULL;
+
+   _kMin = kMin;
+   _kMax = kMax;
+   computeAmplitudes();
 }
 
 /*
@@ -76,8 +173,12 @@ Ocean::Ocean(const int N, const float A, const glm::vec2 w, const float length)
  */
 Ocean::~Ocean()
 {
+   delete _loopCache;
    fftw_free(_hTilde);
-   fftw_destroy_plan(_hTildePlan);
+   if(_ownsPlan)
+   {
+      fftw_destroy_plan(_hTildePlan);
+   }
 }
 
 
@@ -86,9 +187,8 @@ Ocean::~Ocean()
  */
 float Ocean::dispersion(int n_prime, int m_prime) const
 {
-   // Calculate w0, eqn 34
-   float T = 200.0f; // Repeat after 200 iterations
-	float w_0 = 2.0f * M_PI / T;
+   // Calculate w0, eqn 34. The surface repeats after _T seconds
+	float w_0 = 2.0f * M_PI / _T;
    
    // Create wavevector
 	float kx = M_PI * (2 * n_prime - _N) / _length;
@@ -123,6 +223,9 @@ float Ocean::phillips(int n_prime, int m_prime) const
 
    // If wavevector is very small, no need to calculate, just return zero
    if (k_length < 0.000001) return 0.0;
+
+   // Outside of this ocean's band
+   if (k_length < _kMin || k_length >= _kMax) return 0.0;
    
    // Precaculate k^2 and k^4
 	float k_length2 = k_length  * k_length;
@@ -145,6 +248,112 @@ float Ocean::phillips(int n_prime, int m_prime) const
 	return _A * (exp(-1.0f / (k_length2 * L2)) / k_length4) * k_dot_w2 * exp(-k_length2 * l2);
 }
 
+/*
+ * Phillips spectrum for a whole row of the lattice
+ */
+void Ocean::phillipsRow(int m_prime, float* out, bool negate) const
+{
+   vec2  w        = normalize(_w);
+   float w_length = glm::length(_w);
+   float L        = w_length * w_length / _g;
+	float damping  = 0.001;
+
+   Spectrum::PhillipsParams params;
+   params.lattice.N      = _N;
+   params.lattice.length = _length;
+   params.wx             = w.x;
+   params.wz             = w.y;
+   params.L2             = L * L;
+   params.l2             = params.L2 * damping * damping;
+   params.A              = _A;
+   params.kMin2          = _kMin * _kMin;
+   params.kMax2          = _kMax * _kMax;
+
+   Spectrum::dispatchedSpectrumKernels().phillips(params, m_prime, out, negate);
+}
+
+/*
+ * Dispersion relation for a whole row of the lattice
+ */
+void Ocean::dispersionRow(int m_prime, float* out) const
+{
+   Spectrum::DispersionParams params;
+   params.lattice.N      = _N;
+   params.lattice.length = _length;
+   params.g              = _g;
+	params.w_0            = 2.0f * M_PI / _T;
+
+   Spectrum::dispatchedSpectrumKernels().dispersion(params, m_prime, out);
+}
+
+/*
+ * Compare the SIMD row evaluators with the scalar versions
+ */
+void Ocean::printSpectrumAccuracy(std::ostream& out) const
+{
+   std::vector<float> row(_N);
+
+   // The spectrum spans many orders of magnitude and the far tail underflows
+   // differently in libm and expApprox(), so relative errors are only taken
+   // for values above 1e-6 of the peak
+   double peak = 0;
+   for(int m_prime = -_N + 1; m_prime < _N; m_prime++)
+   {
+      for(int n_prime = -_N + 1; n_prime < _N; n_prime++)
+      {
+         peak = std::max(peak, double(phillips(n_prime, m_prime)));
+      }
+   }
+
+   double phillipsRel = 0;
+   double phillipsAbs = 0;
+   for(int negate = 0; negate < 2; negate++)
+   {
+      for(int m_prime = 0; m_prime < _N; m_prime++)
+      {
+         phillipsRow(m_prime, &row[0], negate != 0);
+         for(int n_prime = 0; n_prime < _N; n_prime++)
+         {
+            double ref = negate ? phillips(-n_prime, -m_prime) : phillips(n_prime, m_prime);
+            double err = fabs(row[n_prime] - ref);
+            phillipsAbs = std::max(phillipsAbs, err / peak);
+            if(ref > 1e-6 * peak)
+            {
+               phillipsRel = std::max(phillipsRel, err / ref);
+            }
+         }
+      }
+   }
+
+   // Eqn 35 rounds down to a multiple of w_0, so a tiny error can move a
+   // frequency to the neighboring multiple. The result is still periodic
+   double dispersionRel = 0;
+   int    stepsChanged  = 0;
+   for(int m_prime = 0; m_prime < _N; m_prime++)
+   {
+      dispersionRow(m_prime, &row[0]);
+      for(int n_prime = 0; n_prime < _N; n_prime++)
+      {
+         double ref = dispersion(n_prime, m_prime);
+         if(row[n_prime] != float(ref))
+         {
+            stepsChanged++;
+         }
+         if(ref > 0)
+         {
+            dispersionRel = std::max(dispersionRel, fabs(row[n_prime] - ref) / ref);
+         }
+      }
+   }
+
+   Compute::Isa isa = Spectrum::dispatchedSpectrumKernels().isa;
+   out << "Spectrum accuracy, N = " << _N << ", " << Compute::isaWidth(isa) << " lanes (" << Compute::isaName(isa) << ")" << std::endl
+       << "   phillips:   max relative error " << phillipsRel
+       << ", max error / peak " << phillipsAbs << std::endl
+       << "   dispersion: max relative error " << dispersionRel
+       << ", " << stepsChanged << " of " << _N * _N << " frequencies moved to a neighboring multiple of w_0" << std::endl;
+}
+
 /*
  * Initial height amplitude at time 0. Equation 42
  *
@@ -153,7 +362,9 @@ float Ocean::phillips(int n_prime, int m_prime) const
  */
 complex_type Ocean::hTilde_0(int n, int m) const
 {
-	complex_type r = gaussianRandomVariable();
+   float g[4];
+   _rng.gaussian4(latticeCounter(n, m), 0, g);
+	complex_type r(g[0], g[1]);
 	return r * sqrt(phillips(n, m) / 2.0f);
 }
 
@@ -168,12 +379,13 @@ complex_type Ocean::hTilde_0(int n, int m) const
  */
 complex_type Ocean::hTilde(float t, int n_prime, int m_prime) const
 {
-   // Calculate htilde0 and it's conjugate
-	complex_type htilde0       =           hTilde_0( n_prime,  m_prime);
-	complex_type htilde0mkconj = std::conj(hTilde_0(-n_prime, -m_prime));
+   // Look up htilde0 and it's conjugate
+   int index = m_prime * _N + n_prime;
+	complex_type htilde0       = _hTilde0[index];
+	complex_type htilde0mkconj = _hTilde0mkConj[index];
    
    
-	float omega_t = dispersion(n_prime, m_prime) * t;
+	float omega_t = _omega[index] * t;
    
 	float cosOmegaT = cos(omega_t);
 	float sinOmegaT = sin(omega_t);
@@ -189,19 +401,36 @@ complex_type Ocean::hTilde(float t, int n_prime, int m_prime) const
  */
 void Ocean::evaluateWavesFFT(float t)
 {
+   // One period of heights has already been computed
+   if(_loopCache != NULL)
+   {
+      _loopCache->interpolateHeights(t, &_cacheHeights[0]);
+      setHeights(&_cacheHeights[0]);
+      return;
+   }
+
    // Fill _hTilde with height amplitude values
    int index = 0;
-   for (int m_prime = 0; m_prime < _N; m_prime++)
    {
-		for (int n_prime = 0; n_prime < _N; n_prime++, index++)
+      Compute::ScopedTrace trace("Ocean hTilde");
+      for (int m_prime = 0; m_prime < _N; m_prime++)
       {
-         _hTilde[index] = hTilde(t, n_prime, m_prime);
+         for (int n_prime = 0; n_prime < _N; n_prime++, index++)
+         {
+            _hTilde[index] = hTilde(t, n_prime, m_prime);
+         }
       }
-	}
+   }
 
    // Execute the FFT and get the height field
-   fftw_execute(_hTildePlan);
-   
+   // The plan may be shared with other oceans, so execute it on this ocean's array
+   {
+      Compute::ScopedTrace trace("Ocean FFT");
+      fftw_execute_dft(_hTildePlan, reinterpret_cast<fftw_complex*>(_hTilde),
+                                    reinterpret_cast<fftw_complex*>(_hTilde));
+   }
+
+   Compute::ScopedTrace trace("Ocean positions");
 	int sign;
 	int index1;
 	float signs[] = { 1.0f, -1.0f };
@@ -236,3 +465,38 @@ void Ocean::evaluateWavesFFT(float t)
 		}
 	}
 }
+
+/*
+ * Copy an N x N height field into the lattice positions
+ */
+void Ocean::setHeights(const float* heights)
+{
+   for(int m_prime = 0; m_prime < _N; m_prime++)
+   {
+      for(int n_prime = 0; n_prime < _N; n_prime++)
+      {
+         _pos[m_prime * _Nplus1 + n_prime].y = heights[m_prime * _N + n_prime];
+      }
+      // for tiling
+      _pos[m_prime * _Nplus1 + _N].y = heights[m_prime * _N];
+   }
+   for(int n_prime = 0; n_prime < _Nplus1; n_prime++)
+   {
+      _pos[_N * _Nplus1 + n_prime].y = _pos[n_prime].y;
+   }
+}
+
+/*
+ * Serve evaluateWavesFFT() from a precomputed loop cache
+ */
+void Ocean::useLoopCache(const std::string& filename, float framesPerSecond)
+{
+   delete _loopCache;
+   _loopCache = NULL;
+
+   // The cache is built by evaluating the FFT, so it must not be
+   // attached until it is complete
+   OceanLoopCache* cache = new OceanLoopCache(*this, filename, framesPerSecond);
+   _cacheHeights.resize(size_t(_N) * _N);
+   _loopCache = cache;
+}
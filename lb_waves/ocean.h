@@ -15,12 +15,21 @@
 #define _ocean_h
 
 #include <glm/glm.hpp>
+#include <cmath>
 #include <complex>
 #include <fftw3.h>
 #include <vector>
+#include <string>
+#include <ostream>
+#include <stdint.h>
+
+#include "counter_rng.h"
+#include "memory_accounting.h"
 
 typedef std::complex<double> complex_type;
 
+class OceanLoopCache;
+
 /**
  * Initial ocean-like conditions
  * @param N
@@ -31,6 +40,13 @@ typedef std::complex<double> complex_type;
  *    Wind direction
  * @param length
  *    Size of the simulation in meters (length x length area)
+ * @param seed
+ *    Seed for the random amplitudes. The same seed always produces the same ocean
+ * @param plan
+ *    In-place N x N FFT plan to use instead of creating one. The plan is not
+ *    destroyed with the ocean, so several oceans of the same size can share it
+ * @param kMin, kMax
+ *    Band limits in radians per meter, see setBand()
  */
 class Ocean
 {
@@ -40,7 +56,8 @@ public:
    /**
     * Constructor
     */
-	Ocean(const int N, const float A, const glm::vec2 w, const float length);
+	Ocean(const int N, const float A, const glm::vec2 w, const float length, const uint64_t seed = 1, fftw_plan plan = NULL,
+         const float kMin = 0, const float kMax = INFINITY);
    
    /**
     * Destructor
@@ -56,9 +73,63 @@ public:
     * Phillips wave spectrum, equation 40 with modification specified in equation 41
     */
    float phillips(int n_prime, int m_prime) const;
+
+   /**
+    * Phillips spectrum for a whole row of the lattice, evaluated with SIMD
+    * instructions and approximate exp()
+    *
+    * @param m_prime
+    *    Row of the lattice
+    * @param out
+    *    N values. out[n'] = phillips(n', m'), or phillips(-n', -m') if negate is true
+    * @param negate
+    *    true to evaluate at the negated wavevectors
+    */
+   void phillipsRow(int m_prime, float* out, bool negate = false) const;
+
+   /**
+    * Dispersion relation for a whole row of the lattice, evaluated with SIMD
+    * instructions and approximate sqrt()
+    *
+    * @param m_prime
+    *    Row of the lattice
+    * @param out
+    *    N values. out[n'] = dispersion(n', m')
+    */
+   void dispersionRow(int m_prime, float* out) const;
+
+   /**
+    * Change the spectrum parameters and recompute the initial amplitudes.
+    * Used for parameter sweeps. The random variables do not change, so
+    * the same seed produces the same phases. Any loop cache is discarded
+    *
+    * @param A
+    *    Amplitude scaling factor
+    * @param w
+    *    Wind direction
+    */
+   void setSpectrum(float A, const glm::vec2& w);
+
+   /**
+    * Limit the spectrum to wavenumbers kMin <= |k| < kMax and recompute the
+    * initial amplitudes. Used by OceanCascade to give each cascade its own
+    * band
+    *
+    * @param kMin, kMax
+    *    Band limits in radians per meter
+    */
+   void setBand(float kMin, float kMax);
+
+   /**
+    * Compare phillipsRow() and dispersionRow() with phillips() and
+    * dispersion() over the whole lattice and print the errors
+    */
+   void printSpectrumAccuracy(std::ostream& out) const;
    
    /**
-    * Initial height amplitude at time 0. Equation 42.
+    * Initial height amplitude at time 0. Equation 42. The gaussian random
+    * variable is keyed by (n', m'), so this always returns the same value
+    * for the same seed and position
     *
     * @param n,m
     *    Position n,m on the lattice
@@ -77,10 +148,36 @@ public:
    complex_type hTilde(float t, int n_prime, int m_prime) const;
    
    /**
-    * Take the FFT of hTilde at time t, turn the result into positions
+    * Take the FFT of hTilde at time t, turn the result into positions.
+    * If a loop cache is in use, the heights are copied from the cache
+    * and no FFT is performed
     */
 	void evaluateWavesFFT(float t);
 
+   /**
+    * Serve evaluateWavesFFT() from a precomputed loop cache. The dispersion
+    * relation is quantized to multiples of 2 pi / T, so the surface repeats
+    * exactly every T seconds and one period of frames covers all time.
+    * The cache file is created if it does not exist or does not match this
+    * ocean. evaluateWavesFFT() then blends the two frames around the
+    * requested time, so the frame rate of the cache is independent of the
+    * time step of the caller.
+    *
+    * @param filename
+    *    Path to the cache file
+    * @param framesPerSecond
+    *    Number of frames to store per second of simulated time
+    */
+   void useLoopCache(const std::string& filename, float framesPerSecond);
+
+   /**
+    * @return the loop cache, or NULL if the FFT is evaluated every frame
+    */
+   const OceanLoopCache* getLoopCache() const
+   {
+      return _loopCache;
+   }
+
    /**
     * @return the positions of the vertices in the lattice
     */
@@ -89,21 +186,71 @@ public:
       return _pos;
    }
 
+   /**
+    * @return the number of cells across one dimension of the lattice
+    */
+   int getSize() const
+   {
+      return _N;
+   }
+
+   /**
+    * @return the size of the simulation in meters
+    */
+   float getLength() const
+   {
+      return _length;
+   }
+
+   /**
+    * @return the time in seconds after which the surface repeats
+    */
+   float getPeriod() const
+   {
+      return _T;
+   }
+
 private:
+   /**
+    * Compute _hTilde0 and _hTilde0mkConj from the spectrum, and _omega
+    * from the dispersion relation
+    */
+   void computeAmplitudes();
+
+   /**
+    * Copy an N x N height field into the lattice positions, including the
+    * extra row and column used for tiling
+    */
+   void setHeights(const float* heights);
    
 	float                   _g;            //< Gravitational constant
+   float                   _T;            //< Period of the surface in seconds
 	int                     _N;            //< Dimension of the lattice. Try and make it a power of 2
    int                     _Nplus1;       //< N + 1
 	float                   _A;            //< Phillips spectrum "scaling constant" parameter. Changes the heights of waves
    glm::vec2               _w;            //< Wind directionameter
+   float                   _kMin;         //< Smallest wavenumber in the spectrum
+   float                   _kMax;         //< Wavenumbers at or above this are removed from the spectrum
 
 	float                   _length;			//< Size of simulation in meters (_length x _length area)
 
+   Compute::Philox         _rng;          //< Counter-based generator for the gaussian random variables
+
+   std::vector<complex_type> _hTilde0;       //< hTilde_0(n', m') for each lattice position
+   std::vector<complex_type> _hTilde0mkConj; //< conj(hTilde_0(-n', -m')) for each lattice position
+   std::vector<float>        _omega;         //< Angular frequency of each lattice position, from dispersionRow()
+
    // For FFT
    complex_type*           _hTilde;
    fftw_plan               _hTildePlan;
+   bool                    _ownsPlan;     //< true if _hTildePlan was created by this ocean
 
    std::vector<glm::vec4>  _pos;          //< Lattice positions
+
+   OceanLoopCache*         _loopCache;    //< Precomputed period of heights, NULL if not used
+   std::vector<float>      _cacheHeights; //< Heights interpolated from the loop cache
+
+   Compute::MemoryAccount  _memory;       //< Host memory of the amplitudes, FFT buffer and positions
 };
 
 #endif
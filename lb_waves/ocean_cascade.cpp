@@ -0,0 +1,149 @@
+//--------------------------------------------------------------------------------
+// ocean_cascade.cpp
+//
+// Several Ocean patches of different sizes with non-overlapping wavenumber
+// bands, summed together.
+//--------------------------------------------------------------------------------
+#include "ocean_cascade.h"
+#include "parallel_for.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <sstream>
+#include <stdexcept>
+
+using glm::vec2;
+using glm::vec4;
+
+/*
+ * Constructor
+ */
+OceanCascade::OceanCascade(int N, float A, const glm::vec2& w, const std::vector<float>& lengths, uint64_t seed)
+: _N     (N)
+, _plan  (NULL)
+{
+   if(lengths.empty())
+   {
+      throw std::runtime_error("OceanCascade needs at least one length");
+   }
+
+   std::vector<float> sorted(lengths);
+   std::sort(sorted.begin(), sorted.end(), std::greater<float>());
+
+   // Band limits. Cascade i covers cuts[i] <= |k| < cuts[i + 1]. The cut between
+   // two cascades lies between the fundamental wavenumber of the smaller one and
+   // the Nyquist wavenumber of the larger one, so each band is resolved by its
+   // cascade
+   std::vector<float> cuts(sorted.size() + 1);
+   cuts.front() = 0;
+   cuts.back()  = INFINITY;
+   for(size_t i = 1; i < sorted.size(); ++i)
+   {
+      float nyquist     = M_PI * _N / sorted[i - 1];
+      float fundamental = 2.0f * M_PI / sorted[i];
+      if(fundamental >= nyquist)
+      {
+         std::stringstream err;
+         err << "OceanCascade: lengths " << sorted[i - 1] << " and " << sorted[i]
+             << " are too far apart for N = " << _N << ", the spectrum would have a gap";
+         throw std::runtime_error(err.str());
+      }
+      cuts[i] = sqrtf(fundamental * nyquist);
+   }
+
+   // FFTW_ESTIMATE does not touch the array, and every cascade's array comes
+   // from fftw_malloc with the same alignment, so the plan can be made once
+   fftw_complex* scratch = (fftw_complex*) fftw_malloc(sizeof(fftw_complex) * _N * _N);
+   _plan = fftw_plan_dft_2d(_N, _N, scratch, scratch, FFTW_FORWARD, FFTW_ESTIMATE);
+   fftw_free(scratch);
+
+   for(size_t i = 0; i < sorted.size(); ++i)
+   {
+      // The band goes to the constructor so the amplitudes are computed once
+      _cascades.push_back(new Ocean(_N, A, w, sorted[i], seed + i, _plan, cuts[i], cuts[i + 1]));
+   }
+}
+
+/*
+ * Destructor
+ */
+OceanCascade::~OceanCascade()
+{
+   for(size_t i = 0; i < _cascades.size(); ++i)
+   {
+      delete _cascades[i];
+   }
+   fftw_destroy_plan(_plan);
+}
+
+/*
+ * Evaluate every cascade at time t
+ */
+void OceanCascade::evaluateWavesFFT(float t)
+{
+   // Executing a plan on new arrays is thread safe, so the cascades can run
+   // side by side
+   Compute::parallelFor(0, _cascades.size(), [this, t](size_t first, size_t last)
+   {
+      for(size_t i = first; i < last; ++i)
+      {
+         _cascades[i]->evaluateWavesFFT(t);
+      }
+   }, 1);
+}
+
+/*
+ * Sum of the cascade heights at a position
+ */
+float OceanCascade::getHeight(float x, float z) const
+{
+   int   Nplus1 = _N + 1;
+   float height = 0;
+
+   for(size_t i = 0; i < _cascades.size(); ++i)
+   {
+      const Ocean&             ocean    = *_cascades[i];
+      const std::vector<vec4>& vertices = ocean.getVertices();
+
+      // Lattice coordinates, wrapped into [0, N). The extra tiling row and
+      // column mean that cell + 1 never needs to wrap
+      float u = x / ocean.getLength() * _N;
+      float v = z / ocean.getLength() * _N;
+      u -= floorf(u / _N) * _N;
+      v -= floorf(v / _N) * _N;
+
+      int   n  = std::min(int(u), _N - 1);
+      int   m  = std::min(int(v), _N - 1);
+      float fu = u - n;
+      float fv = v - m;
+
+      float h00 = vertices[m       * Nplus1 + n    ].y;
+      float h10 = vertices[m       * Nplus1 + n + 1].y;
+      float h01 = vertices[(m + 1) * Nplus1 + n    ].y;
+      float h11 = vertices[(m + 1) * Nplus1 + n + 1].y;
+
+      height += (1 - fv) * ((1 - fu) * h00 + fu * h10)
+              +      fv  * ((1 - fu) * h01 + fu * h11);
+   }
+
+   return height;
+}
+
+/*
+ * Sample the summed heights on an n x n grid
+ */
+void OceanCascade::sampleHeights(int n, float length, float* heights) const
+{
+   float step = length / n;
+   Compute::parallelFor(0, n, [=](size_t first, size_t last)
+   {
+      for(int row = int(first); row < int(last); ++row)
+      {
+         for(int col = 0; col < n; ++col)
+         {
+            heights[row * n + col] = getHeight(col * step, row * step);
+         }
+      }
+   }, 16);
+}
@@ -0,0 +1,109 @@
+//--------------------------------------------------------------------------------
+// ocean_cascade.h
+//
+// Several Ocean patches of different sizes summed together. One patch large
+// enough to cover kilometers at fine detail needs an enormous N, and a single
+// small patch tiles visibly. Instead, each cascade covers its own band of
+// wavenumbers: the largest patch carries the long swells and smaller patches
+// add the short waves. Every cascade uses the same N, so they share one FFT
+// plan, and the cascades are evaluated in parallel.
+//--------------------------------------------------------------------------------
+#ifndef _ocean_cascade_h
+#define _ocean_cascade_h
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <fftw3.h>
+#include <stdint.h>
+
+#include "ocean.h"
+
+/**
+ * A set of Ocean cascades with non-overlapping wavenumber bands
+ *
+ * How to use this class:
+ * \code
+ * std::vector<float> lengths = { 2048, 256, 32 };
+ * OceanCascade cascade(128, 0.00005f, glm::vec2(0, 32), lengths);
+ *
+ * cascade.evaluateWavesFFT(t);
+ * float h = cascade.getHeight(x, z);
+ * \endcode
+ */
+class OceanCascade
+{
+public:
+   /**
+    * Constructor. Throws std::runtime_error if the lengths leave a gap in
+    * the spectrum
+    *
+    * @param N
+    *    The number of cells across one dimension of every cascade
+    * @param A
+    *    Amplitude scaling factor
+    * @param w
+    *    Wind direction
+    * @param lengths
+    *    Size in meters of each cascade, any order
+    * @param seed
+    *    Seed for the random amplitudes. Cascade i uses seed + i
+    */
+   OceanCascade(int N, float A, const glm::vec2& w, const std::vector<float>& lengths, uint64_t seed = 1);
+
+   /**
+    * Destructor
+    */
+   ~OceanCascade();
+
+   /**
+    * Evaluate every cascade at time t
+    *
+    * @param t
+    *    Time in seconds
+    */
+   void evaluateWavesFFT(float t);
+
+   /**
+    * Sum of the cascade heights at a position, bilinearly interpolated
+    * within each cascade. Valid after evaluateWavesFFT()
+    *
+    * @param x, z
+    *    Position in meters. Any value, every cascade tiles
+    */
+   float getHeight(float x, float z) const;
+
+   /**
+    * Sample the summed heights on an n x n grid
+    *
+    * @param n
+    *    Number of samples across one dimension
+    * @param length
+    *    Size of the grid in meters
+    * @param heights
+    *    n x n output heights
+    */
+   void sampleHeights(int n, float length, float* heights) const;
+
+   /**
+    * @return the number of cascades
+    */
+   size_t getNumCascades() const
+   {
+      return _cascades.size();
+   }
+
+   /**
+    * @return cascade i, ordered from the largest length to the smallest
+    */
+   const Ocean& getCascade(size_t i) const
+   {
+      return *_cascades[i];
+   }
+
+private:
+   int                     _N;            //< Lattice size of every cascade
+   fftw_plan               _plan;         //< In-place N x N FFT plan shared by the cascades
+   std::vector<Ocean*>     _cascades;     //< Cascades, largest length first
+};
+
+#endif
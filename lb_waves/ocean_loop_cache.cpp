@@ -0,0 +1,243 @@
+//--------------------------------------------------------------------------------
+// ocean_loop_cache.cpp
+//
+// One full period of ocean height frames, stored in a memory-mapped file.
+//--------------------------------------------------------------------------------
+#include "ocean_loop_cache.h"
+#include "ocean.h"
+
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using glm::vec4;
+
+/*
+ * Constructor. Maps an existing cache file if it matches the ocean,
+ * otherwise evaluates one period of the ocean and writes the file.
+ */
+OceanLoopCache::OceanLoopCache(Ocean& ocean, const std::string& filename, float framesPerSecond)
+: _filename    (filename)
+, _N           (ocean.getSize())
+, _period      (ocean.getPeriod())
+, _fd          (-1)
+, _map         (NULL)
+, _memory      ("OceanLoopCache")
+{
+   // A whole number of frames per period keeps the loop seamless
+   _numFrames = int(floorf(_period * framesPerSecond + 0.5f));
+   if(_numFrames < 1)
+   {
+      _numFrames = 1;
+   }
+   _frameTime = _period / _numFrames;
+
+   _frameFloats = size_t(_N) * _N;
+   _fileSize    = sizeof(Header) + sizeof(float) * _frameFloats * _numFrames;
+
+   if(!mapExisting(ocean))
+   {
+      build(ocean);
+   }
+
+   // Pages of the file are read in as the frames are played, so this is
+   // the most the cache can take up
+   _memory.setHost(_fileSize);
+}
+
+/*
+ * Destructor. Unmaps the file
+ */
+OceanLoopCache::~OceanLoopCache()
+{
+   if(_map != NULL)
+   {
+      munmap(_map, _fileSize);
+   }
+   if(_fd >= 0)
+   {
+      close(_fd);
+   }
+}
+
+/*
+ * @return N x N heights for the frame at time t
+ */
+const float* OceanLoopCache::getHeights(float t) const
+{
+   return frame(frameIndex(t));
+}
+
+/*
+ * Heights at time t, blended between the two frames around it
+ */
+void OceanLoopCache::interpolateHeights(float t, float* out) const
+{
+   int          i = frameIndex(t);
+   const float* a = frame(i);
+   const float* b = frame((i + 1) % _numFrames);
+
+   // Fraction of the way from frame i to the next one
+   float s = t / _frameTime;
+   float f = s - floorf(s);
+
+   size_t count = size_t(_N) * _N;
+   for(size_t j = 0; j < count; ++j)
+   {
+      out[j] = a[j] + f * (b[j] - a[j]);
+   }
+}
+
+/*
+ * @return a pointer to the start of frame i
+ */
+const float* OceanLoopCache::frame(int i) const
+{
+   const char* frames = static_cast<const char*>(_map) + sizeof(Header);
+   return reinterpret_cast<const float*>(frames) + _frameFloats * i;
+}
+
+/*
+ * @return the frame index for time t
+ */
+int OceanLoopCache::frameIndex(float t) const
+{
+   int i = int(floorf(t / _frameTime)) % _numFrames;
+   return i < 0 ? i + _numFrames : i;
+}
+
+/*
+ * Fill in the header expected for this cache
+ */
+OceanLoopCache::Header OceanLoopCache::expectedHeader() const
+{
+   Header header;
+   memset(&header, 0, sizeof(header));
+   strncpy(header.magic, "OCNLOOP", sizeof(header.magic));
+   header.version   = 2;
+   header.N         = _N;
+   header.numFrames = _numFrames;
+   header.period    = _period;
+   header.frameTime = _frameTime;
+   return header;
+}
+
+/*
+ * Map an existing cache file
+ */
+bool OceanLoopCache::mapExisting(Ocean& ocean)
+{
+   int fd = open(_filename.c_str(), O_RDONLY);
+   if(fd < 0)
+   {
+      return false;
+   }
+
+   struct stat info;
+   if(fstat(fd, &info) != 0 || size_t(info.st_size) != _fileSize)
+   {
+      close(fd);
+      return false;
+   }
+
+   void* map = mmap(NULL, _fileSize, PROT_READ, MAP_SHARED, fd, 0);
+   if(map == MAP_FAILED)
+   {
+      close(fd);
+      return false;
+   }
+
+   Header expected = expectedHeader();
+   if(memcmp(map, &expected, sizeof(Header)) != 0)
+   {
+      munmap(map, _fileSize);
+      close(fd);
+      return false;
+   }
+
+   _fd  = fd;
+   _map = map;
+
+   // The header does not capture the spectrum parameters or the seed, so
+   // compare the first frame against a freshly evaluated one
+   std::vector<float> first(_frameFloats);
+   ocean.evaluateWavesFFT(0.0f);
+   storeFrame(ocean, &first[0]);
+   if(memcmp(frame(0), &first[0], sizeof(float) * _frameFloats) != 0)
+   {
+      munmap(_map, _fileSize);
+      close(_fd);
+      _map = NULL;
+      _fd  = -1;
+      return false;
+   }
+
+   // Playback walks through the frames in order
+   madvise(_map, _fileSize, MADV_SEQUENTIAL);
+   return true;
+}
+
+/*
+ * Evaluate one period of the ocean and write it to the cache file
+ */
+void OceanLoopCache::build(Ocean& ocean)
+{
+   _fd = open(_filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+   if(_fd < 0)
+   {
+      throw std::runtime_error("Unable to create ocean loop cache " + _filename);
+   }
+
+   if(ftruncate(_fd, _fileSize) == 0)
+   {
+      _map = mmap(NULL, _fileSize, PROT_READ | PROT_WRITE, MAP_SHARED, _fd, 0);
+   }
+
+   if(_map == NULL || _map == MAP_FAILED)
+   {
+      close(_fd);
+      throw std::runtime_error("Unable to map ocean loop cache " + _filename);
+   }
+
+   std::cout << "Building ocean loop cache " << _filename << ": "
+             << _numFrames << " frames, " << _fileSize / (1024 * 1024) << " MB" << std::endl;
+
+   float* frames = reinterpret_cast<float*>(static_cast<char*>(_map) + sizeof(Header));
+   for(int i = 0; i < _numFrames; ++i)
+   {
+      ocean.evaluateWavesFFT(i * _frameTime);
+      storeFrame(ocean, frames + _frameFloats * i);
+   }
+
+   // Write the header last so that an interrupted build is never mistaken
+   // for a complete cache
+   Header header = expectedHeader();
+   memcpy(_map, &header, sizeof(Header));
+   msync(_map, _fileSize, MS_SYNC);
+   madvise(_map, _fileSize, MADV_SEQUENTIAL);
+}
+
+/*
+ * Copy the heights of the ocean's current state into dst
+ */
+void OceanLoopCache::storeFrame(const Ocean& ocean, float* dst) const
+{
+   const std::vector<vec4>& vertices = ocean.getVertices();
+   int Nplus1 = _N + 1;
+
+   for(int m = 0; m < _N; ++m)
+   {
+      for(int n = 0; n < _N; ++n)
+      {
+         dst[m * _N + n] = vertices[m * Nplus1 + n].y;
+      }
+   }
+}
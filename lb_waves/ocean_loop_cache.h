@@ -0,0 +1,149 @@
+//--------------------------------------------------------------------------------
+// ocean_loop_cache.h
+//
+// One full period of ocean height frames, stored in a memory-mapped file. Ocean::dispersion() quantizes the angular frequencies to
+// multiples of 2 pi / T, so the FFT ocean repeats exactly every T seconds. After
+// the cache has been built, every frame is a lookup into the mapped file instead
+// of an FFT.
+//--------------------------------------------------------------------------------
+#ifndef _ocean_loop_cache_h
+#define _ocean_loop_cache_h
+
+#include <string>
+#include <stdint.h>
+
+#include "memory_accounting.h"
+
+class Ocean;
+
+/**
+ * Memory-mapped cache of one period of an Ocean
+ *
+ * File layout: a Header followed by numFrames frames. Each frame is N x N
+ * heights. Slopes are not stored; they are central differences of the
+ * heights and CAModelNormals computes them from the position texture.
+ */
+class OceanLoopCache
+{
+public:
+   /**
+    * Constructor. Maps an existing cache file if it matches the ocean,
+    * otherwise evaluates one period of the ocean and writes the file.
+    * Throws std::runtime_error if the file can't be created or mapped.
+    *
+    * @param ocean
+    *    The ocean to cache. Used only during construction
+    * @param filename
+    *    Path to the cache file
+    * @param framesPerSecond
+    *    Frame rate. Rounded so that a whole number of frames fits in one period
+    */
+   OceanLoopCache(Ocean& ocean, const std::string& filename, float framesPerSecond);
+
+   /**
+    * Destructor. Unmaps the file
+    */
+   ~OceanLoopCache();
+
+   /**
+    * @param t
+    *    Time in seconds. Any value, the cache wraps around every period
+    * @return N x N heights for the frame at time t
+    */
+   const float* getHeights(float t) const;
+
+   /**
+    * Heights at time t, blended linearly between the two frames around it,
+    * so that a cache with fewer frames per second than the display still
+    * plays back smoothly
+    *
+    * @param t
+    *    Time in seconds. Any value, the cache wraps around every period
+    * @param out
+    *    Gets N x N heights
+    */
+   void interpolateHeights(float t, float* out) const;
+
+   /**
+    * @return the number of frames in one period
+    */
+   int getNumFrames() const
+   {
+      return _numFrames;
+   }
+
+   /**
+    * @return the time in seconds between frames
+    */
+   float getFrameTime() const
+   {
+      return _frameTime;
+   }
+
+   /**
+    * @return the size of the mapped file in bytes
+    */
+   size_t getFileSize() const
+   {
+      return _fileSize;
+   }
+
+private:
+   /**
+    * Header at the start of the cache file
+    */
+   struct Header
+   {
+      char     magic[8];      //< "OCNLOOP"
+      uint32_t version;       //< File format version
+      int32_t  N;             //< Lattice size
+      int32_t  numFrames;     //< Frames in one period
+      float    period;        //< Period in seconds
+      float    frameTime;     //< Time between frames in seconds
+   };
+
+   /**
+    * Map an existing cache file
+    *
+    * @return true if the file exists and matches the ocean
+    */
+   bool mapExisting(Ocean& ocean);
+
+   /**
+    * Evaluate one period of the ocean and write it to the cache file
+    */
+   void build(Ocean& ocean);
+
+   /**
+    * Copy the heights of the ocean's current state into dst
+    */
+   void storeFrame(const Ocean& ocean, float* dst) const;
+
+   /**
+    * @return a pointer to the start of frame i
+    */
+   const float* frame(int i) const;
+
+   /**
+    * @return the frame index for time t
+    */
+   int frameIndex(float t) const;
+
+   /**
+    * Fill in the header expected for this cache
+    */
+   Header expectedHeader() const;
+
+   std::string       _filename;     //< Path to the cache file
+   int               _N;            //< Lattice size
+   int               _numFrames;    //< Frames in one period
+   float             _period;       //< Period of the ocean in seconds
+   float             _frameTime;    //< Time between frames in seconds
+   size_t            _frameFloats;  //< Number of floats in one frame
+   size_t            _fileSize;     //< Size of the cache file in bytes
+   int               _fd;           //< File descriptor of the cache file
+   void*             _map;          //< Start of the mapped file
+   Compute::MemoryAccount _memory;  //< The mapped file, counted as host memory
+};
+
+#endif
@@ -0,0 +1,167 @@
+//--------------------------------------------------------------------------------
+// ocean_model_fft.cpp
+//
+// Spectral wave model. Instead of stepping the Lattice-Boltzmann automaton, the
+// surface is evaluated directly from the Phillips spectrum with an FFT every
+// frame.
+//--------------------------------------------------------------------------------
+#include <iostream>
+#include <stdexcept>
+
+#include "ocean_model_fft.h"
+
+#include <gl_memory.h>
+#include <phase_timer.h>
+
+using glm::vec2;
+using glm::vec4;
+
+/*
+ * Constructor. Evaluates the surface at time 0
+ */
+OceanModelFFT::OceanModelFFT(const glm::ivec2& size, const glm::vec2& min, const glm::vec2& max, float physicalSize, float timeStep)
+: _size        (size)
+, _min         (min)
+, _max         (max)
+, _physicalSize(physicalSize)
+, _timeStep    (timeStep)
+, _time        (0)
+, _posTexID    (0)
+, _ocean       (NULL)
+, _cascade     (NULL)
+, _memory      ("OceanModelFFT")
+{
+   if(_size.x != _size.y)
+   {
+      throw std::runtime_error("OceanModelFFT requires a square lattice");
+   }
+
+   // Same spectrum as the CAModelGLSL initial conditions
+   _ocean = new Ocean(size.x, 0.00005f, vec2(0.0f,32.0f), physicalSize);
+
+   // The x and z coordinates never change, only the heights
+   vec2 step((_max.x - _min.x) / (_size.x - 1.0f), (_max.y - _min.y) / (_size.y - 1.0f));
+   _positions.resize(_size.x * _size.y);
+   for(int y = 0; y < _size.y; ++y)
+   {
+      for(int x = 0; x < _size.x; ++x)
+      {
+         _positions[y * _size.x + x] = vec4(_min.x + x * step.x, 0, _min.y + y * step.y, 1);
+      }
+   }
+
+   glGenTextures(1, &_posTexID);
+   glBindTexture(GL_TEXTURE_2D, _posTexID);
+   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, _size.x, _size.y, 0, GL_RGBA, GL_FLOAT, NULL);
+   glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+   glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+   glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+   glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+   glBindTexture(GL_TEXTURE_2D, 0);
+   GL_ERR_CHECK();
+
+   _memory.set(Compute::vectorBytes(_positions), GL::textureBytes(_posTexID));
+
+   evaluate();
+}
+
+/*
+ * Destructor
+ */
+OceanModelFFT::~OceanModelFFT()
+{
+   glDeleteTextures(1, &_posTexID);
+   delete _ocean;
+   delete _cascade;
+}
+
+/*
+ * Advance the time by one time step and evaluate the surface
+ */
+void OceanModelFFT::update()
+{
+   _time += _timeStep;
+   evaluate();
+}
+
+/*
+ * Restart the surface at time 0
+ */
+void OceanModelFFT::reset()
+{
+   _time = 0;
+   evaluate();
+}
+
+/*
+ * Play the surface back from a loop cache
+ */
+void OceanModelFFT::useLoopCache(const std::string& filename, float framesPerSecond)
+{
+   if(_cascade != NULL)
+   {
+      std::cerr << "The loop cache is not used with cascades" << std::endl;
+      return;
+   }
+   _ocean->useLoopCache(filename, framesPerSecond);
+   evaluate();
+}
+
+/*
+ * Replace the single ocean with a set of cascades
+ */
+void OceanModelFFT::useCascades(const std::vector<float>& lengths)
+{
+   OceanCascade* cascade = new OceanCascade(_size.x, 0.00005f, vec2(0.0f,32.0f), lengths);
+   delete _cascade;
+   _cascade = cascade;
+
+   _heights.resize(_size.x * _size.y);
+   _memory.set(Compute::vectorBytes(_positions) + Compute::vectorBytes(_heights), GL::textureBytes(_posTexID));
+
+   evaluate();
+}
+
+/*
+ * Evaluate the surface at the current time and upload it to the
+ * position texture
+ */
+void OceanModelFFT::evaluate()
+{
+   if(_cascade != NULL)
+   {
+      {
+         GL::ScopedPhase timed("OceanCascade::evaluateWavesFFT", false, _cascade->getNumCascades() * _size.x * _size.y);
+         _cascade->evaluateWavesFFT(_time);
+      }
+
+      GL::ScopedPhase timed("OceanCascade::sampleHeights", false, size_t(_size.x) * _size.y);
+      _cascade->sampleHeights(_size.x, _physicalSize, &_heights[0]);
+      for(size_t i = 0; i < _heights.size(); ++i)
+      {
+         _positions[i].y = _heights[i];
+      }
+   }
+   else
+   {
+      GL::ScopedPhase timed("OceanModelFFT::evaluate", false, size_t(_size.x) * _size.y);
+      _ocean->evaluateWavesFFT(_time);
+
+      // The ocean stores an extra row and column for tiling
+      const std::vector<vec4>& vertices = _ocean->getVertices();
+      int Nplus1 = _size.x + 1;
+      for(int y = 0; y < _size.y; ++y)
+      {
+         for(int x = 0; x < _size.x; ++x)
+         {
+            _positions[y * _size.x + x].y = vertices[y * Nplus1 + x].y;
+         }
+      }
+   }
+
+   GL::ScopedPhase timed("OceanModelFFT upload");
+   glBindTexture(GL_TEXTURE_2D, _posTexID);
+   glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, _size.x, _size.y, GL_RGBA, GL_FLOAT, &_positions[0]);
+   glBindTexture(GL_TEXTURE_2D, 0);
+   GL_ERR_CHECK();
+}
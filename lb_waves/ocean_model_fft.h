@@ -0,0 +1,129 @@
+//--------------------------------------------------------------------------------
+// ocean_model_fft.h
+//
+// Spectral wave model. Instead of stepping the Lattice-Boltzmann automaton, the
+// surface is evaluated directly from the Phillips spectrum with an FFT every
+// frame (see Ocean::evaluateWavesFFT). There are no obstacles or boundaries, but
+// the cost per frame is one N x N FFT and a texture upload, which is much cheaper
+// than the LB update at large N.
+//--------------------------------------------------------------------------------
+#ifndef _ocean_model_fft_h
+#define _ocean_model_fft_h
+
+#include <glm/glm.hpp>
+#include <string>
+#include <vector>
+
+#include "shader.h"
+#include "ca_model.h"
+#include "ocean.h"
+#include "ocean_cascade.h"
+#include "memory_accounting.h"
+
+/**
+ * Spectral ocean model. Has the same interface as CAModelGLSL so that
+ * CAViewGLSL and CAModelNormals can draw it
+ */
+class OceanModelFFT : public CAModel
+{
+public:
+   /**
+    * Constructor. Evaluates the surface at time 0
+    *
+    * @param   size
+    *    The lattice size. size.x must equal size.y
+    * @param   min
+    *    The (x,y) position at lattice position (0,0)
+    * @param   max
+    *    The (x,y) position at lattice position (size.x, size.y)
+    * @param   physicalSize
+    *    The physical dimensions in meters for on side of the simulation
+    * @param   timeStep
+    *    The amount of time to step the simulation in seconds
+    */
+   OceanModelFFT(const glm::ivec2& size, const glm::vec2& min, const glm::vec2& max, float physicalSize, float timeStep);
+
+   /**
+    * Destructor
+    */
+   virtual ~OceanModelFFT();
+
+   /**
+    * Advance the time by one time step and evaluate the surface
+    */
+   virtual void update();
+
+   /**
+    * Get the current position texture ID
+    */
+   virtual const GLuint getCurPositionID() const
+   {
+      return _posTexID;
+   }
+
+   /**
+    * @return the lattice size
+    */
+   virtual const glm::ivec2 getLatticeSize() const
+   {
+      return _size;
+   }
+
+   /**
+    * Restart the surface at time 0
+    */
+   void reset();
+
+   /**
+    * Play the surface back from a loop cache instead of running the FFT
+    * every frame. Frames are looked up by the model's time, so the cache
+    * rate does not have to match the time step
+    *
+    * @param filename
+    *    Path to the cache file. Created if it does not exist
+    * @param framesPerSecond
+    *    Frames stored per second of simulated time
+    */
+   void useLoopCache(const std::string& filename, float framesPerSecond);
+
+   /**
+    * Replace the single ocean with a set of cascades. The surface is the
+    * sum of the cascades sampled over the physical size of the model, so
+    * cascades larger than the model add long swells. Throws
+    * std::runtime_error if the lengths leave a gap in the spectrum
+    *
+    * @param lengths
+    *    Size in meters of each cascade
+    */
+   void useCascades(const std::vector<float>& lengths);
+
+   /**
+    * @return the ocean that generates the surface
+    */
+   const Ocean& getOcean() const
+   {
+      return *_ocean;
+   }
+
+private:
+   /**
+    * Evaluate the surface at the current time and upload it to the
+    * position texture
+    */
+   void evaluate();
+
+   glm::ivec2                    _size;               //< Lattice size
+   glm::vec2                     _min;                //< The (x,y) position at lattice position (0,0)
+   glm::vec2                     _max;                //< The (x,y) position at lattice position (_size.x, _size.y)
+   float                         _physicalSize;       //< Size of the surface in meters
+   float                         _timeStep;           //< Amount of time to step the simulation in seconds
+   float                         _time;               //< Current simulation time in seconds
+   GLuint                        _posTexID;           //< Texture ID for the position texture
+   std::vector<glm::vec4>        _positions;          //< Positions of the lattice points
+   Ocean*                        _ocean;              //< Spectrum and FFT
+   OceanCascade*                 _cascade;            //< Cascades used instead of _ocean, NULL if not used
+   std::vector<float>            _heights;            //< Summed cascade heights, one per lattice point
+   Compute::MemoryAccount        _memory;             //< Host positions and the position texture
+};
+
+#endif
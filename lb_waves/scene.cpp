@@ -18,6 +18,8 @@
 #include "scene.h"
 #include <unistd.h>
 
+#include <phase_timer.h>
+
 // Bring often used glm symbols into namespace
 using glm::ivec2;
 using glm::vec2;
@@ -33,8 +35,10 @@ using glm::mat4;
  *    Width in pixels for the scene
  * @param height
  *    Height in pixels for the scene
+ * @param dynamics
+ *    Wave model to use
  */
-Scene::Scene(const std::string& resourcePath, int width, int height)
+Scene::Scene(const std::string& resourcePath, int width, int height, Dynamics dynamics)
 :  _resourcePath     (resourcePath)
 ,  _width            (width)
 ,  _height           (height)
@@ -47,7 +51,10 @@ Scene::Scene(const std::string& resourcePath, int width, int height)
 ,  _caViewProg       (NULL)
 ,  _caUpdateProg     (NULL)
 ,  _normalsProg      (NULL)
+,  _dynamics         (dynamics)
 ,  _caModel          (NULL)
+,  _lbModel          (NULL)
+,  _fftModel         (NULL)
 ,  _caView           (NULL)
 ,  _caModelNormals   (NULL)
 ,  _zoomMax          (1000)
@@ -127,9 +134,9 @@ void Scene::loadShaders()
       _caUpdateProg = newProg;
       
       // Tell the CA model about the new compute program
-      if(_caModel != NULL)
+      if(_lbModel != NULL)
       {
-         _caModel->setProgram(_caUpdateProg);
+         _lbModel->setProgram(_caUpdateProg);
       }
    }
    catch(const std::runtime_error& err)
@@ -152,7 +159,16 @@ void Scene::addObjects()
       //      _caModel        = new CAModelGLSL(ivec2(256, 256), vec2(-20, -20), vec2(20,20), 2048, 1.0f / 10.0f, _caUpdateProg);
       // Works:
       //o+_caModel        = new CAModelGLSL(ivec2(64, 64), vec2(-20, -20), vec2(20,20), 64, 1.0f / 64.0f, _caUpdateProg);
-      _caModel        = new CAModelGLSL(ivec2(128, 128), vec2(-20, -20), vec2(20,20), 64, 1.0f / 128.0f, _caUpdateProg);
+      if(_dynamics == SPECTRAL)
+      {
+         _fftModel    = new OceanModelFFT(ivec2(128, 128), vec2(-20, -20), vec2(20,20), 64, 1.0f / 128.0f);
+         _caModel     = _fftModel;
+      }
+      else
+      {
+         _lbModel     = new CAModelGLSL(ivec2(128, 128), vec2(-20, -20), vec2(20,20), 64, 1.0f / 128.0f, _caUpdateProg);
+         _caModel     = _lbModel;
+      }
       //      _caModel        = new CAModelGLSL(ivec2(256, 256), vec2(-20, -20), vec2(20,20), 128, 1.0f / 128.0f, _caUpdateProg);
 
       _caModelNormals = new CAModelNormals(_caModel, _normalsProg);
@@ -264,8 +280,16 @@ void Scene::resize(unsigned int width, unsigned int height)
  */
 void Scene::resetToInitialConditionsGaussian()
 {
-   _caModel->initialStateGaussian();
-   _caModel->uploadInitialConditions();
+   if(_lbModel == NULL)
+   {
+      // The spectral model has a single initial condition
+      _fftModel->reset();
+   }
+   else
+   {
+      _lbModel->initialStateGaussian();
+      _lbModel->uploadInitialConditions();
+   }
    _caModelNormals->update();
 }
 
@@ -274,8 +298,16 @@ void Scene::resetToInitialConditionsGaussian()
  */
 void Scene::resetToInitialConditionsPhillips()
 {
-   _caModel->initialStatePhillips();
-   _caModel->uploadInitialConditions();
+   if(_lbModel == NULL)
+   {
+      // The spectral model has a single initial condition
+      _fftModel->reset();
+   }
+   else
+   {
+      _lbModel->initialStatePhillips();
+      _lbModel->uploadInitialConditions();
+   }
    _caModelNormals->update();
 }
 
@@ -284,8 +316,16 @@ void Scene::resetToInitialConditionsPhillips()
  */
 void Scene::resetToInitialConditionsGaussianAndPhillips()
 {
-   _caModel->initialStateGaussianAndPhillips();
-   _caModel->uploadInitialConditions();
+   if(_lbModel == NULL)
+   {
+      // The spectral model has a single initial condition
+      _fftModel->reset();
+   }
+   else
+   {
+      _lbModel->initialStateGaussianAndPhillips();
+      _lbModel->uploadInitialConditions();
+   }
    _caModelNormals->update();
 }
 
@@ -302,12 +342,47 @@ void Scene::resetCameraToInitialState()
    _modelTrans = mat4();
 }
 
+/*
+ * Play the spectral model back from a loop cache
+ */
+void Scene::useLoopCache(const std::string& filename, float framesPerSecond)
+{
+   if(_fftModel == NULL)
+   {
+      std::cerr << "The loop cache is only used with the spectral model" << std::endl;
+      return;
+   }
+   _fftModel->useLoopCache(filename, framesPerSecond);
+}
+
+/*
+ * Build the spectral model's surface from several ocean cascades
+ */
+void Scene::useCascades(int count, float length)
+{
+   if(_fftModel == NULL)
+   {
+      std::cerr << "Cascades are only used with the spectral model" << std::endl;
+      return;
+   }
+
+   std::vector<float> lengths;
+   for(int i = 0; i < count; ++i)
+   {
+      lengths.push_back(length);
+      length /= 8.0f;
+   }
+   _fftModel->useCascades(lengths);
+}
+
 /*
  * Update the models in the scene. This does not draw the scene
  * but updates positions, models, etc.
  */
 void Scene::update()
 {
+   // CPU time only: the models time their GL work themselves
+   GL::ScopedPhase timed("Scene::update", false);
    _caModelNormals->update();
    _caModel->update();
 }
@@ -25,6 +25,7 @@
 #include "ca_view_glsl.h"
 #include "ca_model_glsl.h"
 #include "ca_model_normals.h"
+#include "ocean_model_fft.h"
 
 /**
  * Top level scene object. This handles drawing and updating the scene.
@@ -33,6 +34,15 @@
 class Scene
 {
 public:
+   /**
+    * Wave dynamics used by the scene
+    */
+   enum Dynamics
+   {
+      LATTICE_BOLTZMANN,      //< CAModelGLSL: LB automaton on the GPU
+      SPECTRAL                //< OceanModelFFT: Phillips spectrum evaluated with an FFT every frame
+   };
+
    /**
     * Constructor
     * @param resourcePath
@@ -41,8 +51,10 @@ public:
     *    Width in pixels for the scene
     * @param height
     *    Height in pixels for the scene
+    * @param dynamics
+    *    Wave model to use
     */
-   Scene(const std::string& resourcePath, int width, int height);
+   Scene(const std::string& resourcePath, int width, int height, Dynamics dynamics = LATTICE_BOLTZMANN);
 
    /**
     * Destructor
@@ -117,6 +129,29 @@ public:
     * Reset the camera to the initial position
     */
    void resetCameraToInitialState();
+
+   /**
+    * Play the spectral model back from a loop cache. Has no effect
+    * with the LB model
+    *
+    * @param filename
+    *    Path to the cache file. Created if it does not exist
+    * @param framesPerSecond
+    *    Frames stored per second of simulated time
+    */
+   void useLoopCache(const std::string& filename, float framesPerSecond);
+
+   /**
+    * Build the spectral model's surface from several ocean cascades. Has
+    * no effect with the LB model
+    *
+    * @param count
+    *    Number of cascades
+    * @param length
+    *    Size in meters of the largest cascade. Each further cascade is
+    *    eight times smaller
+    */
+   void useCascades(int count, float length);
    
 private:
    std::string       _resourcePath;    //< Path to the resources
@@ -141,7 +176,10 @@ private:
    GL::Program*      _caUpdateProg;    //< Shader program used to calculate the heights in the mesh at each time step
    GL::Program*      _normalsProg;     //< Shader program used to calculate normals at each position on the mesh
    
-   CAModelGLSL*      _caModel;
+   Dynamics          _dynamics;        //< Wave model selected at startup
+   CAModel*          _caModel;         //< The wave model, either _lbModel or _fftModel
+   CAModelGLSL*      _lbModel;         //< LB model, NULL if the spectral model is used
+   OceanModelFFT*    _fftModel;        //< Spectral model, NULL if the LB model is used
    CAViewGLSL*       _caView;
    CAModelNormals*   _caModelNormals;
    
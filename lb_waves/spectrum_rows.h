@@ -0,0 +1,212 @@
+//--------------------------------------------------------------------------------
+// spectrum_rows.h
+//
+// SIMD rows of the Phillips spectrum and the dispersion relation, used by
+// Ocean::phillipsRow() and Ocean::dispersionRow(). The parameters are plain
+// floats so that the rows can be compiled for several instruction sets and
+// picked at run time, like the particle kernels (see particle_dispatch.h).
+//
+// Every translation unit that includes this header gets spectrumKernels()
+// for its own floatv. With COMPUTE_DISPATCH, spectrum_rows_avx2.cpp and
+// spectrum_rows_avx512.cpp compile it with AVX2 and AVX-512F.
+//--------------------------------------------------------------------------------
+#ifndef _spectrum_rows_h
+#define _spectrum_rows_h
+
+#include <cpu_dispatch.h>
+#include <simd.h>
+#include <simd_math.h>
+
+#include <algorithm>
+#include <cmath>
+
+namespace Spectrum
+{
+   /**
+    * Lattice of an ocean, for both rows
+    */
+   struct Lattice
+   {
+      int   N;        //< Dimension of the lattice
+      float length;   //< Size of the ocean in meters
+   };
+
+   /**
+    * Parameters of the Phillips spectrum, eqn 40 and 41
+    */
+   struct PhillipsParams
+   {
+      Lattice lattice;
+      float   wx, wz;   //< Normalized wind direction
+      float   L2;       //< Square of the largest wave from the wind
+      float   l2;       //< Square of the damped small wave length
+      float   A;        //< Amplitude scaling factor
+      float   kMin2;    //< Square of the lower band limit
+      float   kMax2;    //< Square of the upper band limit
+   };
+
+   /**
+    * Parameters of the dispersion relation, eqn 33 and 35
+    */
+   struct DispersionParams
+   {
+      Lattice lattice;
+      float   g;         //< Gravitational constant
+      float   w_0;       //< Base frequency, 2 pi / repeat period
+   };
+
+   /**
+    * The rows for one instruction set
+    */
+   struct SpectrumKernels
+   {
+      Compute::Isa isa;   //< Instruction set of the kernels
+      void (*phillips)(const PhillipsParams& params, int m_prime, float* out, bool negate);
+      void (*dispersion)(const DispersionParams& params, int m_prime, float* out);
+   };
+
+#ifdef COMPUTE_DISPATCH
+   namespace avx2
+   {
+      /**
+       * @return the rows compiled with AVX2 and FMA, in spectrum_rows_avx2.cpp
+       */
+      SpectrumKernels dispatchedKernels();
+   }
+
+   namespace avx512
+   {
+      /**
+       * @return the rows compiled with AVX-512F, in spectrum_rows_avx512.cpp
+       */
+      SpectrumKernels dispatchedKernels();
+   }
+#endif
+
+   // Compiled for the instruction set of the including translation unit
+   namespace COMPUTE_SIMD_NAMESPACE
+   {
+      /**
+       * Evaluate body(kx, kz) for width consecutive wavevectors at a time
+       * across row m' and store the results in out
+       */
+      template<typename Function>
+      void evaluateRow(const Lattice& lattice, int m_prime, bool negate, float* out, Function body)
+      {
+         using Compute::floatv;
+
+         const int N = lattice.N;
+
+         // k = pi (2 n' - N) / length, with n' -> -n' and m' -> -m' when negated
+         float          sign  = negate ? -1.0f : 1.0f;
+         float          scale = M_PI / lattice.length;
+         const floatv   kz    = scale * (2.0f * sign * m_prime - N);
+
+         int n_prime = 0;
+         for(; n_prime + floatv::width <= N; n_prime += floatv::width)
+         {
+            floatv kx = scale * (2.0f * sign * floatv::ramp(n_prime) - float(N));
+            body(kx, kz).store(&out[n_prime]);
+         }
+
+         // Partial register at the end of the row
+         if(n_prime < N)
+         {
+            float  tmp[floatv::width];
+            floatv kx = scale * (2.0f * sign * floatv::ramp(n_prime) - float(N));
+            body(kx, kz).store(tmp);
+            std::copy(tmp, tmp + (N - n_prime), &out[n_prime]);
+         }
+      }
+
+      /**
+       * Phillips spectrum for a whole row of the lattice
+       */
+      inline void phillipsRow(const PhillipsParams& params, int m_prime, float* out, bool negate)
+      {
+         using Compute::floatv;
+
+         const PhillipsParams p = params;
+         evaluateRow(p.lattice, m_prime, negate, out, [=](floatv kx, floatv kz)
+         {
+            floatv k_length2 = kx * kx + kz * kz;
+
+            // Wavevectors that are very small or outside of this ocean's band give
+            // zero. Replace them with 1 to keep the divisions below finite
+            Compute::maskv zero = (k_length2 < 1e-12f) | (k_length2 < p.kMin2) | (k_length2 >= p.kMax2);
+            k_length2        = Compute::select(zero, floatv(1.0f), k_length2);
+
+            // (k_hat . w_hat)^2 without normalizing k: (k . w_hat)^2 / |k|^2
+            floatv k_dot_w   = kx * p.wx + kz * p.wz;
+            floatv k_dot_w2  = k_dot_w * k_dot_w / k_length2;
+
+            // Both exponentials of eqn 40 and 41 folded into one exp() call
+            floatv e = Compute::expApprox(-1.0f / (k_length2 * p.L2) - k_length2 * p.l2);
+            floatv value = p.A * e / (k_length2 * k_length2) * k_dot_w2;
+
+            return Compute::select(zero, floatv(0.0f), value);
+         });
+      }
+
+      /**
+       * Dispersion relation for a whole row of the lattice
+       */
+      inline void dispersionRow(const DispersionParams& params, int m_prime, float* out)
+      {
+         using Compute::floatv;
+
+         float w_0     = params.w_0;
+         float g       = params.g;
+         float length2 = params.lattice.length * params.lattice.length;
+
+         evaluateRow(params.lattice, m_prime, false, out, [=](floatv kx, floatv kz)
+         {
+            floatv k_length2 = kx * kx + kz * kz;
+            floatv k_length  = Compute::sqrtApprox(k_length2);
+
+            // Equation 33 and 35
+            floatv eqn33 = Compute::sqrtApprox(g * k_length * (1.0f + k_length2 * length2));
+            return Compute::floor(eqn33 / w_0) * w_0;
+         });
+      }
+
+      /**
+       * @return the rows for the floatv of this translation unit
+       */
+      inline SpectrumKernels spectrumKernels()
+      {
+         SpectrumKernels kernels =
+         {
+            Compute::floatv::isa,
+            &phillipsRow,
+            &dispersionRow
+         };
+         return kernels;
+      }
+
+      /**
+       * @return the rows of the instruction set CpuDispatch selected
+       */
+      inline SpectrumKernels dispatchedSpectrumKernels()
+      {
+#ifdef COMPUTE_DISPATCH
+         switch(Compute::CpuDispatch::instance().getIsa())
+         {
+            case Compute::ISA_AVX512:
+               return avx512::dispatchedKernels();
+
+            case Compute::ISA_AVX2:
+               return avx2::dispatchedKernels();
+
+            default:
+               break;
+         }
+#endif
+         return spectrumKernels();
+      }
+   }
+
+   using COMPUTE_SIMD_NAMESPACE::dispatchedSpectrumKernels;
+}
+
+#endif
@@ -0,0 +1,17 @@
+//--------------------------------------------------------------------------------
+// spectrum_rows_avx2.cpp
+//
+// The dispatched spectrum rows compiled with AVX2 and FMA (-mavx2 -mfma).
+// Include nothing here but kernel headers; see
+// common/particles/particle_dispatch.h.
+//--------------------------------------------------------------------------------
+#include "spectrum_rows.h"
+
+#if !defined(__AVX2__) || !defined(__FMA__) || defined(__AVX512F__)
+#error "spectrum_rows_avx2.cpp must be compiled with -mavx2 -mfma only"
+#endif
+
+Spectrum::SpectrumKernels Spectrum::avx2::dispatchedKernels()
+{
+   return spectrumKernels();
+}
@@ -0,0 +1,17 @@
+//--------------------------------------------------------------------------------
+// spectrum_rows_avx512.cpp
+//
+// The dispatched spectrum rows compiled with AVX-512F (-mavx512f).
+// Include nothing here but kernel headers; see
+// common/particles/particle_dispatch.h.
+//--------------------------------------------------------------------------------
+#include "spectrum_rows.h"
+
+#if !defined(__AVX512F__)
+#error "spectrum_rows_avx512.cpp must be compiled with -mavx512f only"
+#endif
+
+Spectrum::SpectrumKernels Spectrum::avx512::dispatchedKernels()
+{
+   return spectrumKernels();
+}